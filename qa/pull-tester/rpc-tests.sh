@@ -76,6 +76,8 @@ testScripts=(
     'p2p_txexpiry_dos.py'
     'p2p_txexpiringsoon.py'
     'p2p_node_bloom.py'
+    'sendheaders.py'
+    'assumeutxo.py'
     'regtest_signrawtransaction.py'
     'finalsaplingroot.py'
     'shorter_block_times.py'
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Vectorium developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+from test_framework.mininode import NodeConn, NodeConnCB, NetworkThread, \
+    CBlockHeader, msg_headers, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import initialize_chain_clean, start_node, \
+    stop_node, connect_nodes, sync_blocks, p2p_port, hex_str_to_bytes, \
+    assert_equal
+
+from io import BytesIO
+import os
+import time
+
+'''
+A UTXO set snapshot from dumptxoutset, loaded on a fresh node with
+loadtxoutset, lets it follow the chain from the snapshot block on. The
+blocks below are downloaded and validated in the background, after which
+the node serves them like any other.
+'''
+
+BASE_HEIGHT = 110
+NODE_NETWORK = 1
+
+
+class HeadersNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+
+class AssumeutxoTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        # The nodes are connected once node1 has loaded the snapshot
+        self.nodes = [start_node(0, self.options.tmpdir, ['-debug=net'])]
+        self.is_network_split = True
+
+    def node1_args(self):
+        return ['-debug=net', '-disablewallet', '-assumeutxo=%d:%s:%s' % (
+            BASE_HEIGHT, self.snapshot['base_hash'], self.snapshot['txoutset_hash'])]
+
+    def send_headers(self, node, blockhashes):
+        test_node = HeadersNode()
+        conn = NodeConn('127.0.0.1', p2p_port(1), node, test_node)
+        test_node.add_connection(conn)
+        NetworkThread().start()
+        test_node.wait_for_verack()
+        for i in range(0, len(blockhashes), 100):
+            headers = msg_headers()
+            for blockhash in blockhashes[i:i + 100]:
+                header = CBlockHeader()
+                header.deserialize(BytesIO(hex_str_to_bytes(self.nodes[0].getblockheader(blockhash, False))))
+                headers.headers.append(header)
+            test_node.send_message(headers)
+        for i in range(200):
+            try:
+                node.getblockheader(blockhashes[-1])
+                break
+            except Exception:
+                time.sleep(0.1)
+        conn.disconnect_node()
+
+    def run_test(self):
+        blockhashes = self.nodes[0].generate(BASE_HEIGHT)
+        self.snapshot = self.nodes[0].dumptxoutset('utxo.dat')
+        assert_equal(self.snapshot['base_height'], BASE_HEIGHT)
+        assert_equal(self.snapshot['base_hash'], blockhashes[-1])
+        self.nodes[0].generate(10)
+
+        # node1 only knows the headers up to the snapshot block
+        self.nodes.append(start_node(1, self.options.tmpdir, self.node1_args()))
+        self.send_headers(self.nodes[1], blockhashes)
+
+        result = self.nodes[1].loadtxoutset(os.path.join(self.options.tmpdir, 'node0', 'regtest', 'utxo.dat'))
+        assert_equal(result['tip_hash'], self.snapshot['base_hash'])
+        assert_equal(result['base_height'], BASE_HEIGHT)
+        info = self.nodes[1].getblockchaininfo()
+        assert_equal(info['blocks'], BASE_HEIGHT)
+        assert_equal(info['snapshot']['baseheight'], BASE_HEIGHT)
+        assert_equal(int(self.nodes[1].getnetworkinfo()['localservices'], 16) & NODE_NETWORK, 0)
+
+        # The snapshot survives a restart
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, self.node1_args())
+        assert_equal(self.nodes[1].getblockcount(), BASE_HEIGHT)
+        assert_equal(self.nodes[1].getblockchaininfo()['snapshot']['baseheight'], BASE_HEIGHT)
+
+        # Syncing goes on past the snapshot block, and fetches the blocks
+        # below it on the side
+        connect_nodes(self.nodes[1], 0)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].getblockcount(), BASE_HEIGHT + 10)
+
+        for i in range(600):
+            if 'snapshot' not in self.nodes[1].getblockchaininfo():
+                break
+            time.sleep(0.1)
+        assert('snapshot' not in self.nodes[1].getblockchaininfo())
+        assert_equal(int(self.nodes[1].getnetworkinfo()['localservices'], 16) & NODE_NETWORK, NODE_NETWORK)
+        assert_equal(self.nodes[1].getblock(blockhashes[0])['height'], 1)
+        assert_equal(self.nodes[1].gettxoutsetinfo(), self.nodes[0].gettxoutsetinfo())
+
+        # Once validated, the chain below the snapshot block is like any
+        # other, and survives a restart too
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, self.node1_args())
+        assert('snapshot' not in self.nodes[1].getblockchaininfo())
+        assert_equal(self.nodes[1].getblockcount(), BASE_HEIGHT + 10)
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -9,12 +9,15 @@
 #
 
 import decimal
+import time
 
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import (
     initialize_chain,
     assert_equal,
     start_nodes,
+    stop_nodes,
+    wait_bitcoinds,
     connect_nodes_bi,
 )
 
@@ -23,6 +26,7 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - getblockchaininfo
 
     """
 
@@ -48,6 +52,43 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
 
+        # The parallel scans count the same
+        res_none = node.gettxoutsetinfo('none')
+        assert_equal(res_none['txouts'], res['txouts'])
+        assert_equal(res_none['bytes_serialized'], res['bytes_serialized'])
+        assert('hash_serialized' not in res_none)
+
+        # The MuHash kept up to date across a block matches a fresh scan
+        res_muhash = node.gettxoutsetinfo('muhash')
+        assert_equal(res_muhash['transactions'], res['transactions'])
+        assert_equal(res_muhash['total_amount'], res['total_amount'])
+        node.generate(1)
+        res_muhash = node.gettxoutsetinfo('muhash')
+        assert_equal(res_muhash['height'], 201)
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        assert_equal(self.nodes[0].gettxoutsetinfo('muhash'), res_muhash)
+        assert_equal(self.nodes[0].gettxoutsetinfo()['txouts'], res_muhash['txouts'])
+
+        # The wallet notifications catch up with the tip, and validation
+        # never had to wait for them on this short chain
+        self.nodes[0].generate(2)
+        self.sync_all()
+        for i in range(60):
+            info = self.nodes[0].getblockchaininfo()
+            if info['notifications']['height'] == info['blocks']:
+                break
+            time.sleep(1)
+        notifications = info['notifications']
+        assert_equal(info['blocks'], 203)
+        assert_equal(notifications['height'], 203)
+        assert_equal(notifications['lag'], 0)
+        assert(notifications['lastbatch'] >= 0)
+        assert(notifications['lastbatchtime'] >= 0)
+        assert_equal(notifications['waittime'], 0)
+
 
 if __name__ == '__main__':
     BlockchainTest().main()
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Vectorium developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+from test_framework.mininode import NodeConn, NodeConnCB, NetworkThread, \
+    CBlockLocator, msg_getheaders, msg_sendheaders, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import initialize_chain_clean, start_nodes, \
+    p2p_port, assert_equal
+
+import time
+
+'''
+Block announcements with headers (BIP 130). A peer that sent "sendheaders"
+is told about new blocks with a headers message once the headers connect to
+what it already has; any other peer gets an inv.
+'''
+
+SENDHEADERS_VERSION = 170014
+
+
+class TestNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.sendheaders_received = False
+        self.block_invs = []
+        self.headers = []
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    def on_sendheaders(self, conn, message):
+        self.sendheaders_received = True
+
+    def on_inv(self, conn, message):
+        self.block_invs.extend(i.hash for i in message.inv if i.type == 2)
+
+    def on_headers(self, conn, message):
+        for header in message.headers:
+            header.calc_sha256()
+            self.headers.append(header.sha256)
+
+    def on_close(self, conn):
+        pass
+
+    # Wait until the peer has been told about the block with hash blockhash
+    def wait_for_announcement(self, blockhash, timeout=30):
+        for i in range(timeout * 20):
+            with mininode_lock:
+                if blockhash in self.block_invs or blockhash in self.headers:
+                    return
+            time.sleep(0.05)
+        raise AssertionError("block %064x was not announced" % blockhash)
+
+    def clear_announcements(self):
+        with mininode_lock:
+            self.block_invs = []
+            self.headers = []
+
+
+class SendHeadersTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, extra_args=[['-debug=net']])
+
+    def run_test(self):
+        # Leave initial block download, which getheaders is not answered in
+        self.nodes[0].generate(1)
+
+        inv_node = TestNode()
+        headers_node = TestNode()
+        connections = []
+        connections.append(NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], inv_node,
+                                    protocol_version=SENDHEADERS_VERSION))
+        connections.append(NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], headers_node,
+                                    protocol_version=SENDHEADERS_VERSION))
+        inv_node.add_connection(connections[0])
+        headers_node.add_connection(connections[1])
+
+        NetworkThread().start()
+
+        inv_node.wait_for_verack()
+        headers_node.wait_for_verack()
+
+        # The node asks both peers for headers announcements
+        time.sleep(1)
+        with mininode_lock:
+            assert(inv_node.sendheaders_received)
+            assert(headers_node.sendheaders_received)
+
+        # Only headers_node asks for them in turn, and tells the node where
+        # it is by syncing headers to the tip
+        headers_node.send_message(msg_sendheaders())
+        getheaders = msg_getheaders()
+        getheaders.locator = CBlockLocator()
+        getheaders.locator.vHave = [int(self.nodes[0].getbestblockhash(), 16)]
+        headers_node.send_message(getheaders)
+        time.sleep(1)
+
+        for i in range(3):
+            inv_node.clear_announcements()
+            headers_node.clear_announcements()
+            blockhash = int(self.nodes[0].generate(1)[0], 16)
+
+            inv_node.wait_for_announcement(blockhash)
+            headers_node.wait_for_announcement(blockhash)
+            with mininode_lock:
+                assert_equal(inv_node.block_invs, [blockhash])
+                assert_equal(inv_node.headers, [])
+                assert_equal(headers_node.headers, [blockhash])
+                assert_equal(headers_node.block_invs, [])
+
+        [ c.disconnect_node() for c in connections ]
+
+if __name__ == '__main__':
+    SendHeadersTest().main()
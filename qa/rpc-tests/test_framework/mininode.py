@@ -1426,6 +1426,22 @@ class msg_filterclear(object):
         return "msg_filterclear()"
 
 
+class msg_sendheaders(object):
+    command = b"sendheaders"
+
+    def __init__(self):
+        pass
+
+    def deserialize(self, f):
+        pass
+
+    def serialize(self):
+        return b""
+
+    def __repr__(self):
+        return "msg_sendheaders()"
+
+
 # This is what a callback should look like for NodeConn
 # Reimplement the on_* functions to provide handling for events
 class NodeConnCB(object):
@@ -1452,7 +1468,8 @@ class NodeConnCB(object):
             b"headers": self.on_headers,
             b"getheaders": self.on_getheaders,
             b"reject": self.on_reject,
-            b"mempool": self.on_mempool
+            b"mempool": self.on_mempool,
+            b"sendheaders": self.on_sendheaders
         }
 
     def deliver(self, conn, message):
@@ -1499,6 +1516,7 @@ class NodeConnCB(object):
     def on_close(self, conn): pass
     def on_mempool(self, conn): pass
     def on_pong(self, conn, message): pass
+    def on_sendheaders(self, conn, message): pass
 
 
 # The actual NodeConn class
@@ -1521,7 +1539,8 @@ class NodeConn(asyncore.dispatcher):
         b"headers": msg_headers,
         b"getheaders": msg_getheaders,
         b"reject": msg_reject,
-        b"mempool": msg_mempool
+        b"mempool": msg_mempool,
+        b"sendheaders": msg_sendheaders
     }
     MAGIC_BYTES = {
         "mainnet": b"\x24\xe9\x27\x64",   # mainnet
@@ -1642,8 +1661,7 @@ class NodeConn(asyncore.dispatcher):
                 t.deserialize(f)
                 self.got_message(t)
             else:
-                self.show_debug_msg("Unknown command: '" + command + "' " +
-                                        repr(msg))
+                self.show_debug_msg("Unknown command: %r %r" % (command, msg))
 
     def send_message(self, message, pushbuf=False):
         if self.state != b"connected" and not pushbuf:
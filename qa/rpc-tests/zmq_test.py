@@ -24,7 +24,8 @@ class ZMQTest(BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
         return start_nodes(4, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubhashblockhwm=5000'],
             [],
             [],
             []
@@ -90,6 +91,22 @@ class ZMQTest(BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # Every message was queued and sent, none dropped
+        notifications = self.nodes[0].getzmqnotifications()
+        assert_equal(sorted(x['type'] for x in notifications), ['pubhashblock', 'pubhashtx'])
+        for x in notifications:
+            assert_equal(x['address'], 'tcp://127.0.0.1:%i' % self.port)
+            assert_equal(x['dropped'], 0)
+            assert_equal(x['failed'], 0)
+            assert(x['peakqueued'] >= 1)
+            if x['type'] == 'pubhashblock':
+                assert_equal(x['hwm'], 5000)
+                assert_equal(x['sent'] + x['queued'], n + 1)
+            else:
+                assert_equal(x['hwm'], 1000)
+                assert(x['sent'] + x['queued'] >= n + 2)
+        assert_equal(self.nodes[1].getzmqnotifications(), [])
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
@@ -8,6 +8,9 @@
 #include "serialize.h"
 #include "streams.h"
 
+#include <algorithm>
+#include <limits>
+
 int CAddrInfo::GetTriedBucket(const uint256& nKey) const
 {
     uint64_t hash1 = (CHashWriter(SER_GETHASH, 0) << nKey << GetKey()).GetHash().GetCheapHash();
@@ -71,29 +74,150 @@ double CAddrInfo::GetChance(int64_t nNow) const
     return fChance;
 }
 
+namespace {
+
+uint64_t HashNetAddr(uint64_t k0, uint64_t k1, const CNetAddr& addr)
+{
+    uint64_t a = 0, b = 0;
+    for (int i = 0; i < 8; i++) {
+        a = (a << 8) | addr.GetByte(i);
+        b = (b << 8) | addr.GetByte(i + 8);
+    }
+    return CSipHasher(k0, k1).Write(a).Write(b).Finalize();
+}
+
+//! Put nId (or -1) at nSlot of a flattened bucket table, keeping the list of occupied slots up to date.
+void SetSlot(int* pvv, int* pvvUsedPos, std::vector<int>& vUsed, int nSlot, int nId)
+{
+    if ((pvv[nSlot] == -1) != (nId == -1)) {
+        if (nId != -1) {
+            pvvUsedPos[nSlot] = vUsed.size();
+            vUsed.push_back(nSlot);
+        } else {
+            int nUsedPos = pvvUsedPos[nSlot];
+            vUsed[nUsedPos] = vUsed.back();
+            pvvUsedPos[vUsed.back()] = nUsedPos;
+            vUsed.pop_back();
+        }
+    }
+    pvv[nSlot] = nId;
+}
+
+} // namespace
+
+void CAddrMan::Clear_()
+{
+    std::vector<CAddrInfo>().swap(vInfo);
+    std::vector<int>().swap(vFreeIds);
+    std::vector<int>().swap(vAddrIndex);
+    std::vector<int>().swap(vRandom);
+    std::vector<int>().swap(vTriedUsed);
+    std::vector<int>().swap(vNewUsed);
+    nKey = GetRandHash();
+    nIndexK0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nIndexK1 = GetRand(std::numeric_limits<uint64_t>::max());
+    for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
+            vvNew[bucket][entry] = -1;
+        }
+    }
+    for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+        for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
+            vvTried[bucket][entry] = -1;
+        }
+    }
+
+    nTried = 0;
+    nNew = 0;
+}
+
+size_t CAddrMan::IndexSlot(const CNetAddr& addr) const
+{
+    size_t nMask = vAddrIndex.size() - 1;
+    size_t nSlot = HashNetAddr(nIndexK0, nIndexK1, addr) & nMask;
+    while (vAddrIndex[nSlot] != -1 && static_cast<const CNetAddr&>(vInfo[vAddrIndex[nSlot]]) != addr)
+        nSlot = (nSlot + 1) & nMask;
+    return nSlot;
+}
+
+void CAddrMan::IndexInsert(int nId)
+{
+    // Keep the table at most half full, so that probe sequences stay short
+    if (2 * (vRandom.size() + 1) > vAddrIndex.size()) {
+        std::vector<int> vOld;
+        vOld.swap(vAddrIndex);
+        vAddrIndex.assign(std::max<size_t>(16, 2 * vOld.size()), -1);
+        for (size_t i = 0; i < vOld.size(); i++) {
+            if (vOld[i] != -1)
+                vAddrIndex[IndexSlot(vInfo[vOld[i]])] = vOld[i];
+        }
+    }
+    size_t nSlot = IndexSlot(vInfo[nId]);
+    // a duplicate of an indexed address (from a corrupt peers.dat) is not indexed
+    if (vAddrIndex[nSlot] == -1)
+        vAddrIndex[nSlot] = nId;
+}
+
+void CAddrMan::IndexErase(int nId)
+{
+    if (vAddrIndex.empty())
+        return;
+    size_t nMask = vAddrIndex.size() - 1;
+    size_t nHole = IndexSlot(vInfo[nId]);
+    if (vAddrIndex[nHole] != nId)
+        return;
+
+    // Move later entries of the probe sequence back into the hole, unless
+    // that would put them before the slot they hash to.
+    for (size_t nNext = (nHole + 1) & nMask; vAddrIndex[nNext] != -1; nNext = (nNext + 1) & nMask) {
+        size_t nHome = HashNetAddr(nIndexK0, nIndexK1, vInfo[vAddrIndex[nNext]]) & nMask;
+        if (((nNext - nHome) & nMask) >= ((nNext - nHole) & nMask)) {
+            vAddrIndex[nHole] = vAddrIndex[nNext];
+            nHole = nNext;
+        }
+    }
+    vAddrIndex[nHole] = -1;
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    SetSlot(&vvTried[0][0], &vvTriedUsedPos[0][0], vTriedUsed, nKBucket * ADDRMAN_BUCKET_SIZE + nKBucketPos, nId);
+}
+
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    SetSlot(&vvNew[0][0], &vvNewUsedPos[0][0], vNewUsed, nUBucket * ADDRMAN_BUCKET_SIZE + nUBucketPos, nId);
+}
+
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
-    if (it == mapAddr.end())
+    if (vAddrIndex.empty())
+        return NULL;
+    int nId = vAddrIndex[IndexSlot(addr)];
+    if (nId == -1)
         return NULL;
     if (pnId)
-        *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-    if (it2 != mapInfo.end())
-        return &(*it2).second;
-    return NULL;
+        *pnId = nId;
+    return &vInfo[nId];
 }
 
 CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, int* pnId)
 {
-    int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
-    mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    int nId;
+    if (vFreeIds.empty()) {
+        nId = vInfo.size();
+        vInfo.push_back(CAddrInfo(addr, addrSource));
+    } else {
+        nId = vFreeIds.back();
+        vFreeIds.pop_back();
+        vInfo[nId] = CAddrInfo(addr, addrSource);
+    }
+    IndexInsert(nId);
+    vInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
     if (pnId)
         *pnId = nId;
-    return &mapInfo[nId];
+    return &vInfo[nId];
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
@@ -106,11 +230,8 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
-
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    vInfo[nId1].nRandomPos = nRndPos2;
+    vInfo[nId2].nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
@@ -118,15 +239,16 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
 
 void CAddrMan::Delete(int nId)
 {
-    assert(mapInfo.count(nId) != 0);
-    CAddrInfo& info = mapInfo[nId];
+    assert(nId >= 0 && (size_t)nId < vInfo.size() && vInfo[nId].nRandomPos != -1);
+    CAddrInfo& info = vInfo[nId];
     assert(!info.fInTried);
     assert(info.nRefCount == 0);
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
-    mapAddr.erase(info);
-    mapInfo.erase(nId);
+    IndexErase(nId);
+    info = CAddrInfo();
+    vFreeIds.push_back(nId);
     nNew--;
 }
 
@@ -135,10 +257,10 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
     // if there is an entry in the specified bucket, delete it.
     if (vvNew[nUBucket][nUBucketPos] != -1) {
         int nIdDelete = vvNew[nUBucket][nUBucketPos];
-        CAddrInfo& infoDelete = mapInfo[nIdDelete];
+        CAddrInfo& infoDelete = vInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
-        vvNew[nUBucket][nUBucketPos] = -1;
+        SetNew(nUBucket, nUBucketPos, -1);
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
         }
@@ -151,7 +273,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
         int pos = info.GetBucketPosition(nKey, true, bucket);
         if (vvNew[bucket][pos] == nId) {
-            vvNew[bucket][pos] = -1;
+            SetNew(bucket, pos, -1);
             info.nRefCount--;
         }
     }
@@ -167,12 +289,11 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     if (vvTried[nKBucket][nKBucketPos] != -1) {
         // find an item to evict
         int nIdEvict = vvTried[nKBucket][nKBucketPos];
-        assert(mapInfo.count(nIdEvict) == 1);
-        CAddrInfo& infoOld = mapInfo[nIdEvict];
+        CAddrInfo& infoOld = vInfo[nIdEvict];
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
-        vvTried[nKBucket][nKBucketPos] = -1;
+        SetTried(nKBucket, nKBucketPos, -1);
         nTried--;
 
         // find which new bucket it belongs to
@@ -183,12 +304,12 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
-        vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        SetNew(nUBucket, nUBucketPos, nIdEvict);
         nNew++;
     }
     assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
 }
@@ -291,7 +412,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
-            CAddrInfo& infoExisting = mapInfo[vvNew[nUBucket][nUBucketPos]];
+            CAddrInfo& infoExisting = vInfo[vvNew[nUBucket][nUBucketPos]];
             if (infoExisting.IsTerrible() || (infoExisting.nRefCount > 1 && pinfo->nRefCount == 0)) {
                 // Overwrite the existing new table entry.
                 fInsert = true;
@@ -300,7 +421,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         if (fInsert) {
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
-            vvNew[nUBucket][nUBucketPos] = nId;
+            SetNew(nUBucket, nUBucketPos, nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -334,67 +455,30 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
     if (size() == 0)
         return CAddrInfo();
 
-    // Track number of attempts to find a table entry, before giving up to avoid infinite loop
-    const int kMaxRetries = 200000;         // magic number so unit tests can pass
-    const int kRetriesBetweenSleep = 1000;
-    const int kRetrySleepInterval = 100;    // milliseconds
-
     if (newOnly && nNew == 0)
         return CAddrInfo();
 
     // Use a 50% chance for choosing between tried and new table entries.
-    if (!newOnly &&
-       (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) { 
-        // use a tried node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int i = 0;
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.rand32()) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-                if (i++ > kMaxRetries)
-                    return CAddrInfo();
-                if (i % kRetriesBetweenSleep == 0 && !nKey.IsNull())
-                    MilliSleep(kRetrySleepInterval);
-            }
-            int nId = vvTried[nKBucket][nKBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
-        }
-    } else {
-        // use a new node
-        double fChanceFactor = 1.0;
-        while (1) {
-            int i = 0;
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.rand32()) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-                if (i++ > kMaxRetries)
-                    return CAddrInfo();
-                if (i % kRetriesBetweenSleep == 0 && !nKey.IsNull())
-                    MilliSleep(kRetrySleepInterval);
-            }
-            int nId = vvNew[nUBucket][nUBucketPos];
-            assert(mapInfo.count(nId) == 1);
-            CAddrInfo& info = mapInfo[nId];
-            if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
-                return info;
-            fChanceFactor *= 1.2;
-        }
+    bool fTried = !newOnly && (nTried > 0 && (nNew == 0 || RandomInt(2) == 0));
+
+    // Picking uniformly from the occupied positions is the same as probing
+    // random positions until an occupied one comes up, without the probing.
+    const std::vector<int>& vUsed = fTried ? vTriedUsed : vNewUsed;
+    if (vUsed.empty())
+        return CAddrInfo();
+    const int* pvv = fTried ? &vvTried[0][0] : &vvNew[0][0];
+    int64_t nNow = GetTime();
+    double fChanceFactor = 1.0;
+    while (1) {
+        const CAddrInfo& info = vInfo[pvv[vUsed[RandomInt(vUsed.size())]]];
+        if (RandomInt(1 << 30) < fChanceFactor * info.GetChance(nNow) * (1 << 30))
+            return info;
+        fChanceFactor *= 1.2;
     }
-    
-    return CAddrInfo();
 }
 
 #ifdef DEBUG_ADDRMAN
-int CAddrMan::Check_()
+int CAddrMan::Check_() const
 {
     std::set<int> setTried;
     std::map<int, int> mapNew;
@@ -402,9 +486,10 @@ int CAddrMan::Check_()
     if (vRandom.size() != nTried + nNew)
         return -7;
 
-    for (std::map<int, CAddrInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-        int n = (*it).first;
-        CAddrInfo& info = (*it).second;
+    for (size_t n = 0; n < vInfo.size(); n++) {
+        const CAddrInfo& info = vInfo[n];
+        if (info.nRandomPos == -1)
+            continue;
         if (info.fInTried) {
             if (!info.nLastSuccess)
                 return -1;
@@ -418,7 +503,7 @@ int CAddrMan::Check_()
                 return -4;
             mapNew[n] = info.nRefCount;
         }
-        if (mapAddr[info] != n)
+        if (vAddrIndex[IndexSlot(info)] != (int)n)
             return -5;
         if (info.nRandomPos < 0 || info.nRandomPos >= vRandom.size() || vRandom[info.nRandomPos] != n)
             return -14;
@@ -438,10 +523,12 @@ int CAddrMan::Check_()
              if (vvTried[n][i] != -1) {
                  if (!setTried.count(vvTried[n][i]))
                      return -11;
-                 if (mapInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
+                 if (vInfo[vvTried[n][i]].GetTriedBucket(nKey) != n)
                      return -17;
-                 if (mapInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
+                 if (vInfo[vvTried[n][i]].GetBucketPosition(nKey, false, n) != i)
                      return -18;
+                 if (vTriedUsed[vvTriedUsedPos[n][i]] != n * ADDRMAN_BUCKET_SIZE + i)
+                     return -20;
                  setTried.erase(vvTried[n][i]);
              }
         }
@@ -452,8 +539,10 @@ int CAddrMan::Check_()
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
-                if (mapInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
+                if (vInfo[vvNew[n][i]].GetBucketPosition(nKey, true, n) != i)
                     return -19;
+                if (vNewUsed[vvNewUsedPos[n][i]] != n * ADDRMAN_BUCKET_SIZE + i)
+                    return -21;
                 if (--mapNew[vvNew[n][i]] == 0)
                     mapNew.erase(vvNew[n][i]);
             }
@@ -464,6 +553,8 @@ int CAddrMan::Check_()
         return -13;
     if (mapNew.size())
         return -15;
+    if (vTriedUsed.size() != (size_t)nTried)
+        return -22;
     if (nKey.IsNull())
         return -16;
 
@@ -477,17 +568,19 @@ void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
     if (nNodes > ADDRMAN_GETADDR_MAX)
         nNodes = ADDRMAN_GETADDR_MAX;
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
+    // gather a list of random nodes, skipping those of low quality; the
+    // shuffle works on a copy, as we may only hold a shared lock
+    std::vector<int> vIds(vRandom);
+    int64_t nNow = GetTime();
+    for (unsigned int n = 0; n < vIds.size(); n++) {
         if (vAddr.size() >= nNodes)
             break;
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+        int nRndPos = RandomInt(vIds.size() - n) + n;
+        std::swap(vIds[n], vIds[nRndPos]);
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
-        if (!ai.IsTerrible())
+        const CAddrInfo& ai = vInfo[vIds[n]];
+        if (!ai.IsTerrible(nNow))
             vAddr.push_back(ai);
     }
 }
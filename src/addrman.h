@@ -17,6 +17,9 @@
 #include <stdint.h>
 #include <vector>
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
 /**
  * Extended statistics about a CAddress
  */
@@ -44,7 +47,7 @@ private:
     //! in tried set? (memory only)
     bool fInTried;
 
-    //! position in vRandom
+    //! position in vRandom, -1 for an unused slot of CAddrMan::vInfo
     int nRandomPos;
 
     friend class CAddrMan;
@@ -128,6 +131,9 @@ public:
  *      be observable by adversaries.
  *    * Several indexes are kept for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
  *      consistency checks for the entire data structure.
+ *  * Entries live in one flat vector indexed by their id, found by network address through an open addressing
+ *    table, and the occupied bucket positions of both tables are listed so that Select picks one in constant time.
+ *    Select and GetAddr only read, so they share the lock and do not hold up each other.
  */
 
 //! total number of buckets for tried addresses
@@ -172,17 +178,23 @@ public:
 class CAddrMan
 {
 private:
-    //! critical section to protect the inner data structures
-    mutable CCriticalSection cs;
+    typedef boost::unique_lock<boost::shared_mutex> WriteLock;
+    typedef boost::shared_lock<boost::shared_mutex> ReadLock;
+
+    //! protects the inner data structures; Select and GetAddr only take it shared
+    mutable boost::shared_mutex cs;
+
+    //! information about all nIds, indexed by nId (unused slots have nRandomPos == -1)
+    std::vector<CAddrInfo> vInfo;
 
-    //! last used nId
-    int nIdCount;
+    //! unused slots of vInfo, reused before it grows
+    std::vector<int> vFreeIds;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! open addressing table (linear probing, power of two size) of the nIds, by network address
+    std::vector<int> vAddrIndex;
 
-    //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    //! key for hashing network addresses into vAddrIndex
+    uint64_t nIndexK0, nIndexK1;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -199,13 +211,34 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! occupied positions (bucket * ADDRMAN_BUCKET_SIZE + position) of vvTried and vvNew, in no particular order
+    std::vector<int> vTriedUsed;
+    std::vector<int> vNewUsed;
+
+    //! where each occupied position is in vTriedUsed or vNewUsed
+    int vvTriedUsedPos[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+    int vvNewUsedPos[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+
+    //! Slot of vAddrIndex where addr is, or the empty slot where it would go.
+    size_t IndexSlot(const CNetAddr& addr) const;
+
+    //! Add nId to vAddrIndex, growing it if needed.
+    void IndexInsert(int nId);
+
+    //! Remove nId from vAddrIndex.
+    void IndexErase(int nId);
+
+    //! Put nId (or -1) at a position of the tried or new table, keeping vTriedUsed and vNewUsed up to date.
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+
+    //! Empty all tables and pick new keys.
+    void Clear_();
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
 
-    //! Source of random numbers for randomization in inner loops
-    FastRandomContext insecure_rand;
-
     //! Find an entry.
     CAddrInfo* Find(const CNetAddr& addr, int *pnId = NULL);
 
@@ -235,6 +268,7 @@ protected:
     void Attempt_(const CService &addr, int64_t nTime);
 
     //! Select an address to connect to, if newOnly is set to true, only the new table is selected from.
+    //! Only reads, so it may run under the shared lock.
     CAddrInfo Select_(bool newOnly);
 
     //! Wraps GetRandInt to allow tests to override RandomInt and make it deterministic.
@@ -242,10 +276,10 @@ protected:
 
 #ifdef DEBUG_ADDRMAN
     //! Perform consistency check. Returns an error code or zero.
-    int Check_();
+    int Check_() const;
 #endif
 
-    //! Select several addresses at once.
+    //! Select several addresses at once. Only reads, so it may run under the shared lock.
     void GetAddr_(std::vector<CAddress> &vAddr);
 
     //! Mark an entry as currently-connected-to.
@@ -254,7 +288,7 @@ protected:
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
@@ -264,17 +298,24 @@ public:
      * * for each bucket:
      *   * number of elements
      *   * for each element: index
+     * * (version 2) number of "tried" buckets and bucket size
+     * * (version 2) for each tried addrinfo: its position (bucket * bucket size + position) in vvTried
+     * * (version 2) for each element of each "new" bucket: its position in the bucket
      *
      * 2**30 is xorred with the number of buckets to make addrman deserializer v0 detect it
      * as incompatible. This is necessary because it did not check the version number on
      * deserialization.
      *
-     * Notice that vvTried, mapAddr and vVector are never encoded explicitly;
+     * Notice that vvTried, the address index and vRandom are never encoded explicitly;
      * they are instead reconstructed from the other information.
      *
      * vvNew is serialized, but only used if ADDRMAN_UNKNOWN_BUCKET_COUNT didn't change,
      * otherwise it is reconstructed as well.
      *
+     * The positions added in version 2 let loading place every entry without hashing it
+     * again, as long as the bucket parameters are the same. They come last, so that
+     * version 1 readers, which rebucket the new table of unknown versions, still load it.
+     *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
      * changes to the ADDRMAN_ parameters without breaking the on-disk structure.
      *
@@ -284,9 +325,9 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        ReadLock lock(cs);
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
         s << nKey;
@@ -295,24 +336,27 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            const CAddrInfo &info = vInfo[n];
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
                 s << info;
-                nIds++;
+                vUnkIds[n] = nIds++;
             }
         }
+        std::vector<int> vTriedPos;
+        vTriedPos.reserve(nTried);
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
-            if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
-                s << info;
-                nIds++;
+        for (int bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvTried[bucket][i] != -1) {
+                    assert(nIds != nTried); // this means nTried was wrong, oh ow
+                    s << vInfo[vvTried[bucket][i]];
+                    vTriedPos.push_back(bucket * ADDRMAN_BUCKET_SIZE + i);
+                    nIds++;
+                }
             }
         }
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
@@ -324,19 +368,30 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
         }
+
+        s << (int)ADDRMAN_TRIED_BUCKET_COUNT;
+        s << (int)ADDRMAN_BUCKET_SIZE;
+        for (size_t n = 0; n < vTriedPos.size(); n++)
+            s << vTriedPos[n];
+        for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                if (vvNew[bucket][i] != -1)
+                    s << i;
+            }
+        }
     }
 
     template<typename Stream>
     void Unserialize(Stream& s)
     {
-        LOCK(cs);
+        WriteLock lock(cs);
 
-        Clear();
+        Clear_();
 
         unsigned char nVersion;
         s >> nVersion;
@@ -352,82 +407,125 @@ public:
             nUBuckets ^= (1 << 30);
         }
 
-        if (nNew > ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE) {
+        if (nNew > ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE || nNew < 0) {
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nNew exceeds limit.");
         }
 
-        if (nTried > ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE) {
+        if (nTried > ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE || nTried < 0) {
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // The new table data can only be used if we know the version and the bucket count is unchanged.
+        bool fNewTableUsable = (nVersion == 1 || nVersion == 2) && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT;
+
         // Deserialize entries from the new table.
+        vInfo.reserve(nNew + nTried);
+        vRandom.reserve(nNew + nTried);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
-            s >> info;
-            mapAddr[info] = n;
-            info.nRandomPos = vRandom.size();
+            vInfo.push_back(CAddrInfo());
+            s >> vInfo[n];
+            vInfo[n].nRandomPos = vRandom.size();
+            IndexInsert(n);
             vRandom.push_back(n);
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
-                // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
-                // immediately try to give them a reference based on their primary source address.
-                int nUBucket = info.GetNewBucket(nKey);
-                int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
-                if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
-                    info.nRefCount++;
-                }
+        }
+
+        // Deserialize entries from the tried table; they are placed once their positions are known.
+        std::vector<CAddrInfo> vTriedInfo(nTried);
+        for (int n = 0; n < nTried; n++)
+            s >> vTriedInfo[n];
+
+        // Deserialize the contents of the new buckets.
+        std::vector<std::pair<int, int> > vNewRefs;
+        for (int bucket = 0; bucket < nUBuckets; bucket++) {
+            int nSize = 0;
+            s >> nSize;
+            for (int n = 0; n < nSize; n++) {
+                int nIndex = 0;
+                s >> nIndex;
+                vNewRefs.push_back(std::make_pair(bucket, nIndex));
+            }
+        }
+
+        // Deserialize the positions, if they were stored for the same bucket parameters.
+        std::vector<int> vTriedPos, vNewPos;
+        if (nVersion == 2) {
+            int nTriedBuckets = 0, nBucketSize = 0;
+            s >> nTriedBuckets;
+            s >> nBucketSize;
+            if (nTriedBuckets == ADDRMAN_TRIED_BUCKET_COUNT && nBucketSize == ADDRMAN_BUCKET_SIZE) {
+                vTriedPos.resize(nTried);
+                for (int n = 0; n < nTried; n++)
+                    s >> vTriedPos[n];
+                vNewPos.resize(vNewRefs.size());
+                for (size_t n = 0; n < vNewRefs.size(); n++)
+                    s >> vNewPos[n];
             }
         }
-        nIdCount = nNew;
 
-        // Deserialize entries from the tried table.
+        // Place the tried entries.
         int nLost = 0;
         for (int n = 0; n < nTried; n++) {
-            CAddrInfo info;
-            s >> info;
-            int nKBucket = info.GetTriedBucket(nKey);
-            int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            CAddrInfo& info = vTriedInfo[n];
+            int nKBucket, nKBucketPos;
+            if (vTriedPos.empty()) {
+                nKBucket = info.GetTriedBucket(nKey);
+                nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            } else if (vTriedPos[n] >= 0 && vTriedPos[n] < ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE) {
+                nKBucket = vTriedPos[n] / ADDRMAN_BUCKET_SIZE;
+                nKBucketPos = vTriedPos[n] % ADDRMAN_BUCKET_SIZE;
+            } else {
+                nLost++;
+                continue;
+            }
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vInfo.push_back(info);
+                IndexInsert(nId);
+                vRandom.push_back(nId);
+                SetTried(nKBucket, nKBucketPos, nId);
             } else {
                 nLost++;
             }
         }
         nTried -= nLost;
 
-        // Deserialize positions in the new table (if possible).
-        for (int bucket = 0; bucket < nUBuckets; bucket++) {
-            int nSize = 0;
-            s >> nSize;
-            for (int n = 0; n < nSize; n++) {
-                int nIndex = 0;
-                s >> nIndex;
-                if (nIndex >= 0 && nIndex < nNew) {
-                    CAddrInfo &info = mapInfo[nIndex];
-                    int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
-                        info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
-                    }
+        // Place the new entries.
+        if (fNewTableUsable) {
+            for (size_t n = 0; n < vNewRefs.size(); n++) {
+                int bucket = vNewRefs[n].first;
+                int nIndex = vNewRefs[n].second;
+                if (nIndex < 0 || nIndex >= nNew)
+                    continue;
+                CAddrInfo &info = vInfo[nIndex];
+                int nUBucketPos = vNewPos.empty() ? info.GetBucketPosition(nKey, true, bucket) : vNewPos[n];
+                if (nUBucketPos < 0 || nUBucketPos >= ADDRMAN_BUCKET_SIZE)
+                    continue;
+                if (vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
+                    info.nRefCount++;
+                    SetNew(bucket, nUBucketPos, nIndex);
+                }
+            }
+        } else {
+            // Give them a reference based on their primary source address instead.
+            for (int n = 0; n < nNew; n++) {
+                CAddrInfo &info = vInfo[n];
+                int nUBucket = info.GetNewBucket(nKey);
+                int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
+                if (vvNew[nUBucket][nUBucketPos] == -1) {
+                    SetNew(nUBucket, nUBucketPos, n);
+                    info.nRefCount++;
                 }
             }
         }
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
-                Delete(itCopy->first);
+        for (size_t n = 0; n < vInfo.size(); n++) {
+            if (vInfo[n].nRandomPos != -1 && !vInfo[n].fInTried && vInfo[n].nRefCount == 0) {
+                Delete(n);
                 nLostUnk++;
-            } else {
-                it++;
             }
         }
         if (nLost + nLostUnk > 0) {
@@ -439,27 +537,13 @@ public:
 
     void Clear()
     {
-        std::vector<int>().swap(vRandom);
-        nKey = GetRandHash();
-        for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvNew[bucket][entry] = -1;
-            }
-        }
-        for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
-            for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
-                vvTried[bucket][entry] = -1;
-            }
-        }
-
-        nIdCount = 0;
-        nTried = 0;
-        nNew = 0;
+        WriteLock lock(cs);
+        Clear_();
     }
 
     CAddrMan()
     {
-        Clear();
+        Clear_();
     }
 
     ~CAddrMan()
@@ -473,16 +557,13 @@ public:
         return vRandom.size();
     }
 
-    //! Consistency check
-    void Check()
+    //! Consistency check; cs must be held.
+    void Check() const
     {
 #ifdef DEBUG_ADDRMAN
-        {
-            LOCK(cs);
-            int err;
-            if ((err=Check_()))
-                LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
-        }
+        int err;
+        if ((err=Check_()))
+            LogPrintf("ADDRMAN CONSISTENCY CHECK FAILED!!! err=%i\n", err);
 #endif
     }
 
@@ -491,7 +572,7 @@ public:
     {
         bool fRet = false;
         {
-            LOCK(cs);
+            WriteLock lock(cs);
             Check();
             fRet |= Add_(addr, source, nTimePenalty);
             Check();
@@ -506,7 +587,7 @@ public:
     {
         int nAdd = 0;
         {
-            LOCK(cs);
+            WriteLock lock(cs);
             Check();
             for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
                 nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
@@ -521,7 +602,7 @@ public:
     void Good(const CService &addr, int64_t nTime = GetTime())
     {
         {
-            LOCK(cs);
+            WriteLock lock(cs);
             Check();
             Good_(addr, nTime);
             Check();
@@ -532,7 +613,7 @@ public:
     void Attempt(const CService &addr, int64_t nTime = GetTime())
     {
         {
-            LOCK(cs);
+            WriteLock lock(cs);
             Check();
             Attempt_(addr, nTime);
             Check();
@@ -546,10 +627,9 @@ public:
     {
         CAddrInfo addrRet;
         {
-            LOCK(cs);
+            ReadLock lock(cs);
             Check();
             addrRet = Select_(newOnly);
-            Check();
         }
         return addrRet;
     }
@@ -557,13 +637,12 @@ public:
     //! Return a bunch of addresses, selected at random.
     std::vector<CAddress> GetAddr()
     {
-        Check();
         std::vector<CAddress> vAddr;
         {
-            LOCK(cs);
+            ReadLock lock(cs);
+            Check();
             GetAddr_(vAddr);
         }
-        Check();
         return vAddr;
     }
 
@@ -571,7 +650,7 @@ public:
     void Connected(const CService &addr, int64_t nTime = GetTime())
     {
         {
-            LOCK(cs);
+            WriteLock lock(cs);
             Check();
             Connected_(addr, nTime);
             Check();
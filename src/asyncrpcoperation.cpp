@@ -10,6 +10,7 @@
 
 #include <string>
 #include <ctime>
+#include <time.h>
 #include <chrono>
 
 using namespace std;
@@ -24,10 +25,31 @@ static std::map<OperationStatus, std::string> OperationStatusMap = {
     {OperationStatus::SUCCESS, "success"}
 };
 
+static std::map<OperationPriority, std::string> OperationPriorityMap = {
+    {OperationPriority::HIGH, "high"},
+    {OperationPriority::NORMAL, "normal"},
+    {OperationPriority::LOW, "low"}
+};
+
+/**
+ * CPU time consumed so far by the calling thread, in seconds.
+ * Returns 0 where no per-thread clock is available.
+ */
+static double GetThreadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    return 0;
+}
+
 /**
  * Every operation instance should have a globally unique id
  */
-AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
+AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_(),
+        cpu_start_time_(0), cpu_end_time_(0), priority_(OperationPriority::NORMAL) {
     // Set a unique reference for each operation
     boost::uuids::uuid uuid = uuidgen();
     id_ = "opid-" + boost::uuids::to_string(uuid);
@@ -38,6 +60,8 @@ AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
 AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
         start_time_(o.start_time_), end_time_(o.end_time_),
+        cpu_start_time_(o.cpu_start_time_), cpu_end_time_(o.cpu_end_time_),
+        priority_(o.priority_),
         error_code_(o.error_code_), error_message_(o.error_message_),
         result_(o.result_)
 {
@@ -49,6 +73,9 @@ AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other
     this->state_.store(other.state_.load());
     this->start_time_ = other.start_time_;
     this->end_time_ = other.end_time_;
+    this->cpu_start_time_ = other.cpu_start_time_;
+    this->cpu_end_time_ = other.cpu_end_time_;
+    this->priority_ = other.priority_;
     this->error_code_ = other.error_code_;
     this->error_message_ = other.error_message_;
     this->result_ = other.result_;
@@ -74,6 +101,7 @@ void AsyncRPCOperation::cancel() {
 void AsyncRPCOperation::start_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     start_time_ = std::chrono::system_clock::now();
+    cpu_start_time_ = GetThreadCpuTime();
 }
 
 /**
@@ -82,6 +110,24 @@ void AsyncRPCOperation::start_execution_clock() {
 void AsyncRPCOperation::stop_execution_clock() {
     std::lock_guard<std::mutex> guard(lock_);
     end_time_ = std::chrono::system_clock::now();
+    cpu_end_time_ = GetThreadCpuTime();
+}
+
+/**
+ * Wall-clock seconds between starting and stopping the execution clock
+ */
+double AsyncRPCOperation::getExecutionSecs() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::chrono::duration<double> elapsed_seconds = end_time_ - start_time_;
+    return elapsed_seconds.count();
+}
+
+/**
+ * CPU seconds used by the worker thread between starting and stopping the execution clock
+ */
+double AsyncRPCOperation::getCpuSecs() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return cpu_end_time_ - cpu_start_time_;
 }
 
 /**
@@ -155,6 +201,7 @@ UniValue AsyncRPCOperation::getStatus() const {
     obj.pushKV("id", this->id_);
     obj.pushKV("status", OperationStatusMap[status]);
     obj.pushKV("creation_time", this->creation_time_);
+    obj.pushKV("priority", OperationPriorityMap[priority_]);
     // TODO: Issue #1354: There may be other useful metadata to return to the user.
     UniValue err = this->getError();
     if (!err.isNull()) {
@@ -163,11 +210,11 @@ UniValue AsyncRPCOperation::getStatus() const {
     UniValue result = this->getResult();
     if (!result.isNull()) {
         obj.pushKV("result", result);
-
-        // Include execution time for successful operation
-        std::chrono::duration<double> elapsed_seconds = end_time_ - start_time_;
-        obj.pushKV("execution_secs", elapsed_seconds.count());
-
+    }
+    if (status == OperationStatus::SUCCESS || status == OperationStatus::FAILED) {
+        // Include resource usage for operations which ran
+        obj.pushKV("execution_secs", getExecutionSecs());
+        obj.pushKV("cpu_secs", getCpuSecs());
     }
     return obj;
 }
@@ -37,6 +37,16 @@ typedef enum class operationStateEnum {
     SUCCESS
 } OperationStatus;
 
+/**
+ * Operations are dequeued highest priority first, and in submission order
+ * within a priority.
+ */
+typedef enum class operationPriorityEnum {
+    HIGH = 0,
+    NORMAL,
+    LOW
+} OperationPriority;
+
 class AsyncRPCOperation {
 public:
     AsyncRPCOperation();
@@ -62,6 +72,15 @@ public:
         return creation_time_;
     }
 
+    OperationPriority getPriority() const {
+        return priority_;
+    }
+
+    // Wall-clock and CPU time spent between start_execution_clock() and
+    // stop_execution_clock(), in seconds.
+    double getExecutionSecs() const;
+    double getCpuSecs() const;
+
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
@@ -101,6 +120,11 @@ public:
         return OperationStatus::SUCCESS == getState();
     }
 
+    bool isFinished() const {
+        OperationStatus status = getState();
+        return OperationStatus::CANCELLED == status || OperationStatus::FAILED == status || OperationStatus::SUCCESS == status;
+    }
+
 protected:
     // The state_ is atomic because only it can be mutated externally.
     // For example, the user initiates a shut down of the application, which closes
@@ -115,10 +139,17 @@ protected:
     std::string error_message_;
     std::atomic<OperationStatus> state_;
     std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    double cpu_start_time_, cpu_end_time_;  // CPU time of the executing thread
+    OperationPriority priority_;
 
     void start_execution_clock();
     void stop_execution_clock();
 
+    // Call from the subclass constructor, before the operation is queued.
+    void set_priority(OperationPriority priority) {
+        this->priority_ = priority;
+    }
+
     void set_state(OperationStatus state) {
         this->state_.store(state);
     }
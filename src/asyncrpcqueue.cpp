@@ -15,13 +15,57 @@ shared_ptr<AsyncRPCQueue> AsyncRPCQueue::sharedInstance() {
     return q;
 }
 
-AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false) {
+AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false), queued_count_(0), retention_(0) {
 }
 
 AsyncRPCQueue::~AsyncRPCQueue() {
     closeAndWait();     // join on all worker threads
 }
 
+/**
+ * Take the id at the front of the highest priority non-empty queue.
+ * Caller must hold lock_.
+ */
+bool AsyncRPCQueue::pop_next_operation_id(AsyncRPCOperationId& key) {
+    for (auto& ids : operation_id_queues_) {
+        if (!ids.empty()) {
+            key = ids.front();
+            ids.pop_front();
+            queued_count_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Drop the oldest finished operations beyond the retention limit.
+ * Caller must hold lock_.
+ */
+void AsyncRPCQueue::reap_finished_operations() {
+    if (retention_ > 0) {
+        while (finished_ids_.size() > retention_) {
+            AsyncRPCOperationId id = finished_id_queue_.front();
+            finished_id_queue_.pop_front();
+            if (finished_ids_.erase(id)) {
+                operation_map_.erase(id);
+            }
+        }
+    }
+
+    // Compact ids the caller already popped, so polling clients which
+    // collect every result don't grow the queue without bound.
+    if (finished_id_queue_.size() > 2 * finished_ids_.size() + 64) {
+        std::deque<AsyncRPCOperationId> live;
+        for (const AsyncRPCOperationId& id : finished_id_queue_) {
+            if (finished_ids_.count(id)) {
+                live.push_back(id);
+            }
+        }
+        finished_id_queue_.swap(live);
+    }
+}
+
 /**
  * A worker will execute this method on a new thread
  */
@@ -32,26 +76,26 @@ void AsyncRPCQueue::run(size_t workerId) {
         std::shared_ptr<AsyncRPCOperation> operation;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
+            while (queued_count_ == 0 && !isClosed() && !isFinishing()) {
                 this->condition_.wait(guard);
             }
 
             // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
+            if (isFinishing() && queued_count_ == 0) {
                 break;
             }
 
             // Exit if the queue is closing.
             if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                for (auto& ids : operation_id_queues_) {
+                    ids.clear();
                 }
+                queued_count_ = 0;
                 break;
             }
 
             // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+            pop_next_operation_id(key);
 
             // Search operation map
             AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
@@ -62,11 +106,18 @@ void AsyncRPCQueue::run(size_t workerId) {
 
         if (!operation) {
             // cannot find operation in map, may have been removed
+            continue;
         } else if (operation->isCancelled()) {
             // skip cancelled operation
         } else {
             operation->main();
         }
+
+        std::lock_guard<std::mutex> guard(lock_);
+        if (operation_map_.count(key) && finished_ids_.insert(key).second) {
+            finished_id_queue_.push_back(key);
+            reap_finished_operations();
+        }
     }
 }
 
@@ -91,7 +142,8 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queues_[static_cast<size_t>(ptrOperation->getPriority())].push_back(id);
+    queued_count_++;
     this->condition_.notify_one();
 }
 
@@ -119,6 +171,7 @@ std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::popOperationForId(AsyncRPCOper
         // Note: if the id still exists in the operationIdQueue, when it gets processed by a worker
         // there will no operation in the map to execute, so nothing will happen.
         operation_map_.erase(id);
+        finished_ids_.erase(id);
     }
     return ptr;
 }
@@ -168,7 +221,7 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    return queued_count_;
 }
 
 /**
@@ -199,6 +252,34 @@ std::vector<AsyncRPCOperationId> AsyncRPCQueue::getAllOperationIds() const {
     return v;
 }
 
+/**
+ * Return all operations found in internal storage, taking the lock once.
+ */
+std::vector<std::shared_ptr<AsyncRPCOperation>> AsyncRPCQueue::getAllOperations() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    std::vector<std::shared_ptr<AsyncRPCOperation>> v;
+    v.reserve(operation_map_.size());
+    for (auto & entry: operation_map_) {
+        v.push_back(entry.second);
+    }
+    return v;
+}
+
+/**
+ * Set the number of finished operations to keep. Once exceeded, the
+ * operations which finished first are removed. Zero keeps all of them.
+ */
+void AsyncRPCQueue::setRetention(size_t retention) {
+    std::lock_guard<std::mutex> guard(lock_);
+    retention_ = retention;
+    reap_finished_operations();
+}
+
+size_t AsyncRPCQueue::getRetention() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return retention_;
+}
+
 /**
  * Calling thread will close and wait for worker threads to join.
  */
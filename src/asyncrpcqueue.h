@@ -10,8 +10,9 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <future>
 #include <thread>
@@ -21,6 +22,9 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+/** Default number of finished operations kept for z_getoperationstatus/z_getoperationresult */
+static const size_t DEFAULT_ASYNC_RPC_RETENTION = 1000;
+
 
 class AsyncRPCQueue {
 public:
@@ -49,11 +53,16 @@ public:
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
+    std::vector<std::shared_ptr<AsyncRPCOperation>> getAllOperations() const;
+    void setRetention(size_t retention); // 0 keeps all finished operations
+    size_t getRetention() const;
 
 private:
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    bool pop_next_operation_id(AsyncRPCOperationId& key);
+    void reap_finished_operations();
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -61,7 +70,14 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    // One queue per OperationPriority, highest priority first
+    std::deque<AsyncRPCOperationId> operation_id_queues_[3];
+    size_t queued_count_;
+    // Finished operations still in operation_map_, oldest first. Ids that
+    // were popped by the caller stay in the deque until they reach the front.
+    std::deque<AsyncRPCOperationId> finished_id_queue_;
+    std::unordered_set<AsyncRPCOperationId> finished_ids_;
+    size_t retention_;
     std::vector<std::thread> workers_;
 };
 
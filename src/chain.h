@@ -601,4 +601,49 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * An immutable view of a chain, given by its tip. Block index entries are
+ * never freed while the node runs, and the header, height and ancestry of an
+ * entry do not change once it is in the index, so the queries below are safe
+ * without cs_main. They walk the skiplist rather than a copy of vChain, which
+ * makes them O(log n) instead of O(1) but publishing a snapshot free.
+ */
+class CChainTipSnapshot {
+private:
+    CBlockIndex *pindexTip;
+
+public:
+    explicit CChainTipSnapshot(CBlockIndex *pindexTipIn = NULL) : pindexTip(pindexTipIn) {}
+
+    /** Returns the index entry for the tip of this chain, or NULL if none. */
+    CBlockIndex *Tip() const {
+        return pindexTip;
+    }
+
+    /** Return the maximal height in the chain, or -1 if it is empty. */
+    int Height() const {
+        return pindexTip ? pindexTip->nHeight : -1;
+    }
+
+    /** Returns the index entry at a particular height in this chain, or NULL if no such height exists. */
+    CBlockIndex *operator[](int nHeight) const {
+        if (pindexTip == NULL || nHeight < 0 || nHeight > pindexTip->nHeight)
+            return NULL;
+        return pindexTip->GetAncestor(nHeight);
+    }
+
+    /** Check whether a block is present in this chain. */
+    bool Contains(const CBlockIndex *pindex) const {
+        return pindex != NULL && (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Find the successor of a block in this chain, or NULL if the given index is not found or is the tip. */
+    CBlockIndex *Next(const CBlockIndex *pindex) const {
+        if (Contains(pindex))
+            return (*this)[pindex->nHeight + 1];
+        else
+            return NULL;
+    }
+};
+
 #endif // BITCOIN_CHAIN_H
@@ -292,6 +292,11 @@ public:
         nSproutValuePoolCheckpointHeight = 1000;
         nSproutValuePoolCheckpointBalance = 0;
         fZIP209Enabled = true;
+
+        // UTXO set snapshots accepted by loadtxoutset, as (height, {block
+        // hash, txoutset_hash}) from dumptxoutset on a fully validating
+        // node. None yet; added at release time like the checkpoints.
+        mapAssumeutxo = MapAssumeutxo();
         //hashSproutValuePoolCheckpointBlock = uint256S("0000000000c7b46b6bc04b4cbf87d8bb08722aebd51232619b214f7273f8460e");
         
         // Founders reward script expects a vector of 2-of-3 multisig addresses
@@ -716,6 +721,11 @@ public:
         consensus.powLimit = powLimit;
     }
 
+    void UpdateAssumeutxo(int nHeight, const CAssumeutxoData& data)
+    {
+        mapAssumeutxo[nHeight] = data;
+    }
+
     void SetRegTestZIP209Enabled() {
         fZIP209Enabled = true;
     }
@@ -814,3 +824,8 @@ void UpdateFundingStreamParameters(Consensus::FundingStreamIndex idx, Consensus:
 void UpdateRegtestPow(int64_t nPowMaxAdjustDown, int64_t nPowMaxAdjustUp, uint256 powLimit) {
     regTestParams.UpdateRegtestPow(nPowMaxAdjustDown, nPowMaxAdjustUp, powLimit);
 }
+
+void UpdateRegtestAssumeutxo(int nHeight, const CAssumeutxoData& data)
+{
+    regTestParams.UpdateAssumeutxo(nHeight, data);
+}
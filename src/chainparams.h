@@ -32,6 +32,14 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/** A UTXO set snapshot that loadtxoutset accepts, as dumped by dumptxoutset */
+struct CAssumeutxoData {
+    uint256 hashBlock;    //!< the block the snapshot was taken at
+    uint256 hashSnapshot; //!< txoutset_hash reported by dumptxoutset
+};
+
+typedef std::map<int, CAssumeutxoData> MapAssumeutxo;
+
 class CBaseKeyConstants : public KeyConstants {
 public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
@@ -86,6 +94,8 @@ public:
     }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    /** UTXO set snapshots that can be loaded, by height */
+    const MapAssumeutxo& Assumeutxo() const { return mapAssumeutxo; }
     /** Return the founder's reward address and script for a given block height */
     std::string GetFoundersRewardAddressAtHeight(int height) const;
     CScript GetFoundersRewardScriptAtHeight(int height) const;
@@ -115,6 +125,7 @@ protected:
     bool fMineBlocksOnDemand = false;
     bool fTestnetToBeDeprecatedFieldRPC = false;
     CCheckpointData checkpointData;
+    MapAssumeutxo mapAssumeutxo;
     std::vector<std::string> vFoundersRewardAddress;
     std::vector<std::string> vLicensedMiners;
     
@@ -148,6 +159,12 @@ void UpdateNetworkUpgradeParameters(Consensus::UpgradeIndex idx, int nActivation
 
 void UpdateRegtestPow(int64_t nPowMaxAdjustDown, int64_t nPowMaxAdjustUp, uint256 powLimit);
 
+/**
+ * Allows adding a regtest UTXO set snapshot. Regtest chains differ from run
+ * to run, so their snapshots cannot be listed in advance.
+ */
+void UpdateRegtestAssumeutxo(int nHeight, const CAssumeutxoData& data);
+
 /**
  * Allows modifying the regtest funding stream parameters.
  */
@@ -9,6 +9,7 @@
 #include "version.h"
 #include "policy/fees.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -95,7 +96,11 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) :
+    CCoinsViewBacked(baseIn), hasModifier(false),
+    cacheCoinsMemoryResource(new CCoinsMapMemoryResource()),
+    cacheCoins(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(cacheCoinsMemoryResource.get())),
+    cachedCoinsUsage(0), cacheEpoch(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -114,13 +119,16 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.lastUsed = cacheEpoch;
         return it;
+    }
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
+    ret->second.lastUsed = cacheEpoch;
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
@@ -671,6 +679,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    ret.first->second.lastUsed = cacheEpoch;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
@@ -680,6 +689,7 @@ CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
     ret.first->second.coins.Clear();
     ret.first->second.flags = CCoinsCacheEntry::FRESH;
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    ret.first->second.lastUsed = cacheEpoch;
     return CCoinsModifier(*this, ret.first, 0);
 }
 
@@ -835,6 +845,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     entry.coins.swap(it->second.coins);
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.lastUsed = cacheEpoch;
                 }
             } else {
                 if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
@@ -849,6 +860,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.lastUsed = cacheEpoch;
                 }
             }
         }
@@ -866,6 +878,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
     hashSproutAnchor = hashSproutAnchorIn;
     hashSaplingAnchor = hashSaplingAnchorIn;
     hashBlock = hashBlockIn;
+    cacheEpoch++;
     return true;
 }
 
@@ -880,6 +893,7 @@ bool CCoinsViewCache::Flush() {
                                 cacheSaplingNullifiers,
                                 historyCacheMap);
     cacheCoins.clear();
+    ReallocateCacheCoins();
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
     cacheSproutNullifiers.clear();
@@ -889,6 +903,110 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+template<typename Map, typename MapEntry>
+void PartialFlushAnchors(
+    Map &cacheAnchors,
+    Map &mapWrite,
+    const uint256 &hashBestAnchor,
+    size_t &cachedCoinsUsage
+)
+{
+    for (auto it = cacheAnchors.begin(); it != cacheAnchors.end();) {
+        bool fKeep = it->second.entered && it->first == hashBestAnchor;
+        if (it->second.flags & MapEntry::DIRTY) {
+            MapEntry& entry = mapWrite[it->first];
+            entry.entered = it->second.entered;
+            entry.tree = it->second.tree;
+            entry.flags = it->second.flags;
+        }
+        if (fKeep) {
+            it->second.flags = 0;
+            it++;
+        } else {
+            cachedCoinsUsage -= it->second.tree.DynamicMemoryUsage();
+            it = cacheAnchors.erase(it);
+        }
+    }
+}
+
+bool CCoinsViewCache::PartialFlush(size_t nTargetUsage) {
+    assert(!hasModifier);
+
+    // Memory taken by the coins, by the number of epochs since they were
+    // last used. Pruned dirty entries are dropped whatever their age.
+    static const uint32_t MAX_AGE = 255;
+    std::vector<size_t> vUsageByAge(MAX_AGE + 1, 0);
+    const size_t nNodeUsage = memusage::MallocUsage(sizeof(memusage::boost_unordered_node<CCoinsMap::value_type>));
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.coins.IsPruned())
+            continue;
+        vUsageByAge[std::min(cacheEpoch - it->second.lastUsed, MAX_AGE)] += nNodeUsage + it->second.coins.DynamicMemoryUsage();
+    }
+
+    // Keep the coins used in the last nKeepAge epochs, as many epochs as fit.
+    size_t nOtherUsage = memusage::MallocUsage(sizeof(void*) * cacheCoins.bucket_count());
+    size_t nBudget = nTargetUsage > nOtherUsage ? nTargetUsage - nOtherUsage : 0;
+    size_t nKept = 0;
+    uint32_t nKeepAge = 0;
+    while (nKeepAge <= MAX_AGE && nKept + vUsageByAge[nKeepAge] <= nBudget) {
+        nKept += vUsageByAge[nKeepAge];
+        nKeepAge++;
+    }
+
+    // Dirty coins go to the base: copied if they stay, moved if they go.
+    CCoinsMap mapCoinsWrite;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        bool fKeep = !it->second.coins.IsPruned() && std::min(cacheEpoch - it->second.lastUsed, MAX_AGE) < nKeepAge;
+        if (!fKeep)
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = mapCoinsWrite[it->first];
+            if (fKeep)
+                entry.coins = it->second.coins;
+            else
+                entry.coins.swap(it->second.coins);
+            entry.flags = it->second.flags;
+        }
+        if (fKeep) {
+            // The base has it now
+            it->second.flags = 0;
+            it++;
+        } else {
+            it = cacheCoins.erase(it);
+        }
+    }
+
+    CAnchorsSproutMap mapSproutAnchorsWrite;
+    CAnchorsSaplingMap mapSaplingAnchorsWrite;
+    ::PartialFlushAnchors<CAnchorsSproutMap, CAnchorsSproutCacheEntry>(cacheSproutAnchors, mapSproutAnchorsWrite, hashSproutAnchor, cachedCoinsUsage);
+    ::PartialFlushAnchors<CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(cacheSaplingAnchors, mapSaplingAnchorsWrite, hashSaplingAnchor, cachedCoinsUsage);
+
+    bool fOk = base->BatchWrite(mapCoinsWrite,
+                                hashBlock,
+                                hashSproutAnchor,
+                                hashSaplingAnchor,
+                                mapSproutAnchorsWrite,
+                                mapSaplingAnchorsWrite,
+                                cacheSproutNullifiers,
+                                cacheSaplingNullifiers,
+                                historyCacheMap);
+    cacheSproutNullifiers.clear();
+    cacheSaplingNullifiers.clear();
+    historyCacheMap.clear();
+    return fOk;
+}
+
+void CCoinsViewCache::ReallocateCacheCoins() {
+    assert(cacheCoins.empty());
+    std::unique_ptr<CCoinsMapMemoryResource> resource(new CCoinsMapMemoryResource());
+    {
+        CCoinsMap mapCoins(0, cacheCoins.hash_function(), cacheCoins.key_eq(), CCoinsMapAllocator(resource.get()));
+        // The allocators are swapped too, and the old one goes with mapCoins
+        cacheCoins.swap(mapCoins);
+    }
+    cacheCoinsMemoryResource.swap(resource);
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -10,11 +10,14 @@
 #include "core_memusage.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <memory>
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_map.hpp>
 #include "zcash/History.hpp"
@@ -265,13 +268,14 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    uint32_t lastUsed; // The epoch of the cache in which this entry was last used.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), lastUsed(0) {}
 };
 
 struct CAnchorsSproutCacheEntry
@@ -318,7 +322,15 @@ enum ShieldedType
     SAPLING,
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * The entries of a coins cache are allocated from a pool of its own, a
+ * chunk at a time rather than one by one, with room in each block for
+ * the overhead of the map node.
+ */
+typedef PoolAllocator<std::pair<const uint256, CCoinsCacheEntry>,
+                      sizeof(std::pair<const uint256, CCoinsCacheEntry>) + sizeof(void*) * 4> CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher> CAnchorsSproutMap;
 typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher> CAnchorsSaplingMap;
 typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
@@ -332,6 +344,7 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
@@ -460,6 +473,7 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    std::unique_ptr<CCoinsMapMemoryResource> cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
     mutable uint256 hashSproutAnchor;
     mutable uint256 hashSaplingAnchor;
@@ -472,6 +486,13 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /**
+     * Advanced each time a child cache is written into this one, that is
+     * once per block for pcoinsTip. Entries remember the epoch in which
+     * they were last used, so PartialFlush can tell hot ones from cold.
+     */
+    uint32_t cacheEpoch;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -546,6 +567,16 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush,
+     * but keep the most recently used coins, now clean, as long as they fit
+     * in nTargetUsage bytes. Coins are evicted least recently used first;
+     * the best anchors are kept, the other anchors, the nullifiers and the
+     * history are dropped as by Flush. Like Flush, this must not be called
+     * while a cache on top of this one holds changes.
+     */
+    bool PartialFlush(size_t nTargetUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
@@ -579,6 +610,12 @@ private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 
+    /**
+     * Give the emptied cacheCoins a new pool and free the old one, which
+     * still holds the memory of all the entries it ever had.
+     */
+    void ReallocateCacheCoins();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -0,0 +1,151 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace {
+
+/** 2^3072 minus the modulus */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Add n to the number in limbs, returning the carry out of the top limb. */
+uint64_t AddSmall(uint32_t* limbs, size_t nLimbs, uint64_t n)
+{
+    for (size_t i = 0; i < nLimbs && n; i++) {
+        n += limbs[i];
+        limbs[i] = (uint32_t)n;
+        n >>= 32;
+    }
+    return n;
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (size_t i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE32(data + 4 * i);
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (size_t i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= 0xFFFFFFFF - MAX_PRIME_DIFF)
+        return false;
+    for (size_t i = 1; i < LIMBS; i++) {
+        if (limbs[i] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the modulus is adding MAX_PRIME_DIFF modulo 2^3072
+    if (IsOverflow())
+        AddSmall(limbs, LIMBS, MAX_PRIME_DIFF);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product; a may be *this
+    uint32_t t[2 * LIMBS] = {0};
+    for (size_t i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < LIMBS; j++) {
+            uint64_t v = (uint64_t)limbs[i] * a.limbs[j] + t[i + j] + carry;
+            t[i + j] = (uint32_t)v;
+            carry = v >> 32;
+        }
+        t[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // 2^3072 is MAX_PRIME_DIFF modulo the prime, so fold the top half in
+    uint64_t carry = 0;
+    for (size_t i = 0; i < LIMBS; i++) {
+        uint64_t v = (uint64_t)t[i] + (uint64_t)t[i + LIMBS] * MAX_PRIME_DIFF + carry;
+        limbs[i] = (uint32_t)v;
+        carry = v >> 32;
+    }
+    // ...and what carried out of it. Wrapping past 2^3072 again leaves a
+    // small number, to which the last fold cannot overflow.
+    if (AddSmall(limbs, LIMBS, carry * MAX_PRIME_DIFF))
+        AddSmall(limbs, LIMBS, MAX_PRIME_DIFF);
+}
+
+void Num3072::Invert()
+{
+    // a^(p-2) by square and multiply. The exponent is 2^3072 - 1103719:
+    // all ones but for the low limb.
+    Num3072 base(*this);
+    const uint32_t nLowLimb = 0xFFFFFFFF - (MAX_PRIME_DIFF + 1);
+    SetToOne();
+    for (int nBit = LIMBS * 32 - 1; nBit >= 0; nBit--) {
+        Multiply(*this);
+        uint32_t nLimb = nBit >= 32 ? 0xFFFFFFFF : nLowLimb;
+        if ((nLimb >> (nBit % 32)) & 1)
+            Multiply(base);
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE])
+{
+    FullReduce();
+    for (size_t i = 0; i < LIMBS; i++)
+        WriteLE32(out + 4 * i, limbs[i]);
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // Expand the SHA256 of the string to 3072 bits in counter mode
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(seed);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (size_t i = 0; i < Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(seed, sizeof(seed)).Write(counter, sizeof(counter)).Finalize(expanded + i * CSHA256::OUTPUT_SIZE);
+    }
+    return Num3072(expanded);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Combine(const MuHash3072& other)
+{
+    numerator.Multiply(other.numerator);
+    denominator.Multiply(other.denominator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    Num3072 result(denominator);
+    result.Invert();
+    result.Multiply(numerator);
+    unsigned char data[Num3072::BYTE_SIZE];
+    result.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
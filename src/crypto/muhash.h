@@ -0,0 +1,61 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, kept below 2^3072 but not always fully reduced. */
+class Num3072
+{
+public:
+    static const size_t LIMBS = 96;
+    static const size_t BYTE_SIZE = 384;
+
+    Num3072() { SetToOne(); }
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    /** Replace the number with its multiplicative inverse. */
+    void Invert();
+    /** Fully reduce and write out, little endian. */
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+
+private:
+    uint32_t limbs[LIMBS];
+
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that does not depend on their order, and
+ * to which strings can be added and from which they can be removed at any
+ * time (MuHash). Each string is mapped to a number modulo a 3072-bit prime;
+ * the set hash is the product of the numbers of the strings added, divided
+ * by the product of those removed. Hashes of disjoint sets can be combined,
+ * so a set can be hashed in parts, in parallel.
+ */
+class MuHash3072
+{
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    /** Add the strings of other, which must not have any in common with ours. */
+    MuHash3072& Combine(const MuHash3072& other);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
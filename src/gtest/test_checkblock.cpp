@@ -2,11 +2,14 @@
 #include <gmock/gmock.h>
 
 #include "consensus/validation.h"
+#include "crypto/equihash.h"
 #include "main.h"
 #include "proof_verifier.h"
 #include "utiltest.h"
 #include "zcash/Proof.hpp"
 
+#include <boost/thread.hpp>
+
 class MockCValidationState : public CValidationState {
 public:
     MOCK_METHOD5(DoS, bool(int level, bool ret,
@@ -35,6 +38,77 @@ TEST(CheckBlock, VersionTooLow) {
     EXPECT_FALSE(CheckBlock(block, state, Params(), verifier, false, false));
 }
 
+TEST(CheckBlock, EquihashSolutionsBatch) {
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockHeader> vHeaders(1, Params().GenesisBlock().GetBlockHeader());
+    EXPECT_TRUE(CheckEquihashSolutions(vHeaders, params));
+    // Valid solutions are remembered
+    EXPECT_TRUE(CheckEquihashSolutions(vHeaders, params));
+
+    // One invalid solution fails the batch, and is checked again next time
+    vHeaders.push_back(vHeaders[0]);
+    vHeaders[1].nTime++;
+    EXPECT_FALSE(CheckEquihashSolutions(vHeaders, params));
+    EXPECT_FALSE(CheckEquihashSolutions(vHeaders, params));
+
+    vHeaders[1] = vHeaders[0];
+    vHeaders[1].nSolution[0] ^= 1;
+    EXPECT_FALSE(CheckEquihashSolutions(vHeaders, params));
+}
+
+// Give header a valid solution, ignoring the target
+static void SolveEquihash(CBlockHeader& header, const Consensus::Params& params)
+{
+    crypto_generichash_blake2b_state state;
+    EhInitialiseState(params.nEquihashN, params.nEquihashK, state);
+    CEquihashInput I{header};
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << I;
+    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+
+    while (true) {
+        header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+        crypto_generichash_blake2b_state curr_state = state;
+        crypto_generichash_blake2b_update(&curr_state, header.nNonce.begin(), header.nNonce.size());
+        std::function<bool(std::vector<unsigned char>)> validBlock =
+            [&header](std::vector<unsigned char> soln) {
+                header.nSolution = soln;
+                return true;
+            };
+        if (EhBasicSolveUncancellable(params.nEquihashN, params.nEquihashK, curr_state, validBlock))
+            return;
+    }
+}
+
+TEST(CheckBlock, EquihashSolutionsBatchParallel) {
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    nScriptCheckThreads = 4;
+    boost::thread_group threads;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threads.create_thread(&ThreadEquihashCheck);
+
+    std::vector<CBlockHeader> vHeaders(20, Params().GenesisBlock().GetBlockHeader());
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vHeaders[i].nTime += i + 1;
+        SolveEquihash(vHeaders[i], params);
+    }
+    std::vector<CBlockHeader> vInvalid(vHeaders);
+    vInvalid[7].nSolution[0] ^= 1;
+    vInvalid[15].nTime++;
+
+    EXPECT_FALSE(CheckEquihashSolutions(vInvalid, params));
+    EXPECT_TRUE(CheckEquihashSolutions(vHeaders, params));
+    // The queue is ready for the next batch after a failure
+    EXPECT_FALSE(CheckEquihashSolutions(vInvalid, params));
+
+    threads.interrupt_all();
+    threads.join_all();
+    nScriptCheckThreads = 0;
+}
 
 // Test that a Sprout tx with negative version is still rejected
 // by CheckBlock under Sprout consensus rules.
@@ -149,6 +149,65 @@ TEST(TransactionBuilder, SaplingToSapling) {
     RegtestDeactivateSapling();
 }
 
+TEST(TransactionBuilder, SaplingManySpendsAndOutputs) {
+    auto consensusParams = RegtestActivateSapling();
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+
+    // Notes in one tree, so that they share an anchor
+    SaplingMerkleTree tree;
+    std::vector<libzcash::SaplingNote> notes;
+    std::vector<SaplingWitness> witnesses;
+    for (CAmount value : {10000, 20000, 30000}) {
+        libzcash::SaplingNote note(pa, value, libzcash::Zip212Enabled::BeforeZip212);
+        uint256 cm = note.cmu().get();
+        tree.append(cm);
+        for (auto& witness : witnesses) {
+            witness.append(cm);
+        }
+        witnesses.push_back(tree.witness());
+        notes.push_back(note);
+    }
+
+    // The descriptions come out the same with one thread or several
+    for (const std::string strThreads : {"1", "0"}) {
+        mapArgs["-provethreads"] = strThreads;
+
+        // 0.0006 z-ZEC in, 0.0004 z-ZEC out, 0.0001 t-ZEC fee, 0.0001 z-ZEC change
+        auto builder = TransactionBuilder(consensusParams, 2);
+        for (size_t i = 0; i < notes.size(); i++) {
+            builder.AddSaplingSpend(expsk, notes[i], tree.root(), witnesses[i]);
+        }
+        builder.AddSaplingOutput(fvk.ovk, pa, 15000, {});
+        builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+        auto tx = builder.Build().GetTxOrThrow();
+
+        EXPECT_EQ(tx.vin.size(), 0);
+        EXPECT_EQ(tx.vout.size(), 0);
+        EXPECT_EQ(tx.vJoinSplit.size(), 0);
+        ASSERT_EQ(tx.vShieldedSpend.size(), 3);
+        EXPECT_EQ(tx.vShieldedOutput.size(), 3);
+        EXPECT_EQ(tx.valueBalance, 10000);
+
+        // Spends are in the order they were added
+        for (size_t i = 0; i < notes.size(); i++) {
+            EXPECT_EQ(tx.vShieldedSpend[i].nullifier,
+                      notes[i].nullifier(fvk, witnesses[i].position()).get());
+        }
+
+        CValidationState state;
+        EXPECT_TRUE(ContextualCheckTransaction(tx, state, Params(), 3, true));
+        EXPECT_EQ(state.GetRejectReason(), "");
+    }
+    mapArgs.erase("-provethreads");
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(TransactionBuilder, SaplingToSprout) {
     auto consensusParams = RegtestActivateSapling();
 
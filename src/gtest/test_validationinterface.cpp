@@ -0,0 +1,59 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "utiltime.h"
+#include "validationinterface.h"
+
+#include <atomic>
+
+#include <boost/thread.hpp>
+
+TEST(WalletNotifyLag, WaitsWhileTooFarBehind)
+{
+    // Without a notification thread there is nothing to wait for
+    LimitWalletNotifyLag(10 * MAX_WALLET_NOTIFY_LAG);
+
+    int64_t nWaitBefore = GetWalletNotifyStats().nWaitMicros;
+    WalletNotifyStarted(100);
+    LimitWalletNotifyLag(100 + MAX_WALLET_NOTIFY_LAG);
+    EXPECT_EQ(GetWalletNotifyStats().nWaitMicros, nWaitBefore);
+
+    std::atomic<bool> fDone(false);
+    boost::thread waiter([&fDone]() {
+        LimitWalletNotifyLag(110 + MAX_WALLET_NOTIFY_LAG);
+        fDone = true;
+    });
+    MilliSleep(200);
+    EXPECT_FALSE(fDone);
+
+    // Still more than MAX_WALLET_NOTIFY_LAG behind
+    WalletNotifyCycleDone(105, 5, 1000);
+    MilliSleep(200);
+    EXPECT_FALSE(fDone);
+
+    WalletNotifyCycleDone(110, 5, 1000);
+    waiter.join();
+    EXPECT_TRUE(fDone);
+
+    CWalletNotifyStats stats = GetWalletNotifyStats();
+    EXPECT_TRUE(stats.fRunning);
+    EXPECT_EQ(stats.nNotifiedHeight, 110);
+    EXPECT_EQ(stats.nLastBatchBlocks, 5);
+    EXPECT_EQ(stats.nLastCycleMicros, 1000);
+    EXPECT_GE(stats.nWaitMicros - nWaitBefore, 300000);
+
+    WalletNotifyStopped();
+}
+
+TEST(WalletNotifyLag, StopsWaitingWhenThreadStops)
+{
+    WalletNotifyStarted(0);
+    boost::thread waiter([]() { LimitWalletNotifyLag(2 * MAX_WALLET_NOTIFY_LAG); });
+    MilliSleep(100);
+    WalletNotifyStopped();
+    waiter.join();
+    EXPECT_FALSE(GetWalletNotifyStats().fRunning);
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "chain.h"
+#include "crypto/common.h"
+#include "random.h"
+#include "utiltime.h"
+#include "zmq/zmqpublishnotifier.h"
+
+#include <string.h>
+
+// Receive one notification and return its sequence number, or -1
+static int64_t ReceiveSequence(void* psocket, const std::string& strCommand)
+{
+    char pchCommand[32];
+    unsigned char pchBody[32];
+    unsigned char pchSequence[4];
+    int nCommand = zmq_recv(psocket, pchCommand, sizeof(pchCommand), 0);
+    if (nCommand < 0 || std::string(pchCommand, nCommand) != strCommand)
+        return -1;
+    if (zmq_recv(psocket, pchBody, sizeof(pchBody), 0) != 32)
+        return -1;
+    if (zmq_recv(psocket, pchSequence, sizeof(pchSequence), 0) != 4)
+        return -1;
+    return ReadLE32(pchSequence);
+}
+
+TEST(ZMQPublish, HighWaterMark)
+{
+    void* pcontext = zmq_init(1);
+    ASSERT_NE(pcontext, nullptr);
+
+    CZMQPublishHashBlockNotifier notifier;
+    notifier.SetType("pubhashblock");
+    notifier.SetAddress("inproc://gtest_zmq_hwm");
+    notifier.SetHighWaterMark(3);
+    ASSERT_TRUE(notifier.Initialize(pcontext));
+
+    void* psubscriber = zmq_socket(pcontext, ZMQ_SUB);
+    ASSERT_NE(psubscriber, nullptr);
+    int nTimeout = 10000;
+    ASSERT_EQ(zmq_setsockopt(psubscriber, ZMQ_RCVTIMEO, &nTimeout, sizeof(nTimeout)), 0);
+    ASSERT_EQ(zmq_setsockopt(psubscriber, ZMQ_SUBSCRIBE, "", 0), 0);
+    ASSERT_EQ(zmq_connect(psubscriber, "inproc://gtest_zmq_hwm"), 0);
+    // Let the subscription reach the publisher
+    MilliSleep(100);
+
+    uint256 hash = GetRandHash();
+    CBlockIndex index;
+    index.phashBlock = &hash;
+
+    // Without the sender thread messages wait in the queue, up to the
+    // high-water mark; the rest are dropped
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(notifier.NotifyBlock(&index));
+    }
+    CZMQPublishStats stats = notifier.GetStats();
+    EXPECT_EQ(stats.nQueued, 3);
+    EXPECT_EQ(stats.nPeakQueued, 3);
+    EXPECT_EQ(stats.nSent, 0);
+    EXPECT_EQ(stats.nDropped, 2);
+
+    // Stopping the sender sends what was queued first
+    StartZMQSender();
+    StopZMQSender();
+    stats = notifier.GetStats();
+    EXPECT_EQ(stats.nQueued, 0);
+    EXPECT_EQ(stats.nPeakQueued, 3);
+    EXPECT_EQ(stats.nSent, 3);
+    EXPECT_EQ(stats.nDropped, 2);
+    EXPECT_EQ(stats.nFailed, 0);
+
+    // With room in the queue again, the next message is queued; the
+    // dropped ones show up as a gap in the sequence numbers
+    EXPECT_TRUE(notifier.NotifyBlock(&index));
+    StartZMQSender();
+    StopZMQSender();
+    stats = notifier.GetStats();
+    EXPECT_EQ(stats.nSent, 4);
+    EXPECT_EQ(stats.nDropped, 2);
+
+    EXPECT_EQ(ReceiveSequence(psubscriber, "hashblock"), 0);
+    EXPECT_EQ(ReceiveSequence(psubscriber, "hashblock"), 1);
+    EXPECT_EQ(ReceiveSequence(psubscriber, "hashblock"), 2);
+    EXPECT_EQ(ReceiveSequence(psubscriber, "hashblock"), 5);
+
+    zmq_close(psubscriber);
+    notifier.Shutdown();
+    zmq_ctx_destroy(pcontext);
+}
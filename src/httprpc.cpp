@@ -3,6 +3,7 @@
 #include "chainparams.h"
 #include "httpserver.h"
 #include "key_io.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -79,6 +80,36 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+/**
+ * Reply to a single request through the method's streaming actor, if it
+ * has one, so that a large result goes out in chunks as it is produced.
+ * Errors raised before the first chunk still get a normal error reply;
+ * after that the reply can only be cut short.
+ * Returns false, without replying, if the method did not stream.
+ */
+static bool JSONRPCStreamReply(HTTPRequest* req, const JSONRequest& jreq)
+{
+    CHTTPJSONWriter writer(req);
+    writer.BeginObject();
+    writer.Key("result");
+    try {
+        if (!tableRPC.executeStreaming(jreq.strMethod, jreq.params, writer))
+            return false;
+    } catch (const UniValue& objError) {
+        if (!writer.Started())
+            throw;
+        LogPrintf("%s: %s failed after sending part of its result: %s\n", __func__, jreq.strMethod, objError.write());
+        writer.Abort();
+        return true;
+    }
+    writer.PushKV("error", NullUniValue);
+    writer.PushKV("id", jreq.id);
+    writer.EndObject();
+    writer.Raw("\n");
+    writer.Finish();
+    return true;
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -180,6 +211,9 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            if (JSONRPCStreamReply(req, jreq))
+                return true;
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -24,6 +24,7 @@
 #include <event2/http.h>
 #include <event2/thread.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
@@ -535,13 +536,52 @@ void HTTPEvent::trigger(struct timeval* tv)
     else
         evtimer_add(ev, tv); // trigger after timeval passed
 }
+/** Most bytes of a chunked reply that may wait for the client before the writer blocks */
+static const size_t HTTP_STREAM_MAX_PENDING = 4 * 1024 * 1024;
+
+/** State shared by the worker thread writing a chunked reply and the event thread sending it */
+struct HTTPReplyStream
+{
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    //! Bytes handed to the event thread but not yet added to the connection's output buffer
+    size_t nQueued;
+    //! Bytes in the connection's output buffer that the client has not taken yet
+    size_t nBuffered;
+    //! The connection went away
+    bool fClosed;
+    //! Seconds the writer waits for the client to make progress
+    int64_t nTimeout;
+
+    HTTPReplyStream(int64_t nTimeoutIn) : nQueued(0), nBuffered(0), fClosed(false), nTimeout(nTimeoutIn) {}
+};
+
+static void http_stream_written_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPReplyStream* stream = (HTTPReplyStream*)arg;
+    boost::lock_guard<boost::mutex> lock(stream->cs);
+    stream->nBuffered = 0;
+    stream->cond.notify_all();
+}
+
+static void http_stream_close_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPReplyStream* stream = (HTTPReplyStream*)arg;
+    boost::lock_guard<boost::mutex> lock(stream->cs);
+    stream->fClosed = true;
+    stream->cond.notify_all();
+}
+
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
                                                        replySent(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (stream && !replySent) {
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyAbort();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -606,6 +646,113 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** Chunked replies: the worker thread hands each chunk to the main http
+ * thread, which queues it on the connection. The connection's close
+ * callback and write callback tell the worker when the client went away or
+ * caught up, so that a slow client makes the worker wait instead of the
+ * whole reply piling up in memory.
+ */
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !stream && req);
+    stream = std::make_shared<HTTPReplyStream>(GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    std::shared_ptr<HTTPReplyStream> s = stream;
+    struct evhttp_request* r = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [r, s, nStatus]() {
+        struct evhttp_connection* evcon = evhttp_request_get_connection(r);
+        if (!evcon) {
+            boost::lock_guard<boost::mutex> lock(s->cs);
+            s->fClosed = true;
+            s->cond.notify_all();
+            return;
+        }
+        evhttp_connection_set_closecb(evcon, http_stream_close_cb, s.get());
+        evhttp_send_reply_start(r, nStatus, NULL);
+    });
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && stream && req);
+    {
+        boost::unique_lock<boost::mutex> lock(stream->cs);
+        while (!stream->fClosed && stream->nQueued + stream->nBuffered > HTTP_STREAM_MAX_PENDING) {
+            // Any wakeup means the event thread made progress
+            boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(stream->nTimeout);
+            if (!stream->cond.timed_wait(lock, deadline)) {
+                LogPrint("http", "Client stopped reading chunked reply, giving up\n");
+                stream->fClosed = true;
+            }
+        }
+        if (stream->fClosed)
+            return false;
+        stream->nQueued += strChunk.size();
+    }
+    if (strChunk.empty())
+        return true;
+
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    std::shared_ptr<HTTPReplyStream> s = stream;
+    struct evhttp_request* r = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [r, s, evb]() {
+        size_t nSize = evbuffer_get_length(evb);
+        struct evhttp_connection* evcon = evhttp_request_get_connection(r);
+        if (evcon)
+            evhttp_send_reply_chunk_with_cb(r, evb, http_stream_written_cb, s.get());
+        evbuffer_free(evb);
+
+        boost::lock_guard<boost::mutex> lock(s->cs);
+        s->nQueued -= nSize;
+        if (evcon)
+            s->nBuffered = evbuffer_get_length(bufferevent_get_output(evhttp_connection_get_bufferevent(evcon)));
+        else
+            s->fClosed = true;
+        s->cond.notify_all();
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && stream && req);
+    std::shared_ptr<HTTPReplyStream> s = stream;
+    struct evhttp_request* r = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [r, s]() {
+        struct evhttp_connection* evcon = evhttp_request_get_connection(r);
+        if (evcon)
+            evhttp_connection_set_closecb(evcon, NULL, NULL);
+        // Also frees the request if the connection is already gone
+        evhttp_send_reply_end(r);
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+void HTTPRequest::WriteReplyAbort()
+{
+    assert(!replySent && stream && req);
+    std::shared_ptr<HTTPReplyStream> s = stream;
+    struct evhttp_request* r = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [r, s]() {
+        struct evhttp_connection* evcon = evhttp_request_get_connection(r);
+        if (evcon) {
+            evhttp_connection_set_closecb(evcon, NULL, NULL);
+            // Frees the request along with the connection
+            evhttp_connection_free(evcon);
+        } else {
+            evhttp_send_reply_end(r);
+        }
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
 #include <stdint.h>
 #include <boost/thread.hpp>
@@ -18,6 +19,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyStream;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -55,6 +57,8 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! State of a chunked reply, once WriteReplyStart was called
+    std::shared_ptr<HTTPReplyStream> stream;
 
     // For test access
 protected:
@@ -114,6 +118,37 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent piece by piece with WriteReplyChunk,
+     * using chunked transfer encoding for HTTP/1.1 clients. For replies too
+     * large to build in memory first.
+     *
+     * @note Use instead of WriteReply, and finish with WriteReplyEnd.
+     */
+    virtual void WriteReplyStart(int nStatus);
+
+    /**
+     * Send the next part of a reply started with WriteReplyStart. Blocks
+     * while too much earlier output is still waiting for the client.
+     * Returns false once the client has gone away or stopped reading, after
+     * which the rest of the reply can be skipped.
+     */
+    virtual bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a reply started with WriteReplyStart. Like WriteReply, this
+     * gives the request back to the main thread.
+     */
+    virtual void WriteReplyEnd();
+
+    /**
+     * Give up on a reply started with WriteReplyStart. The connection is
+     * closed without the terminating chunk, so that the client sees a
+     * reply that was cut short instead of taking it for complete. Like
+     * WriteReplyEnd, this gives the request back to the main thread.
+     */
+    virtual void WriteReplyAbort();
 };
 
 /** Event handler closure.
@@ -11,6 +11,7 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -18,6 +19,7 @@
 #include "consensus/funding.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "crypto/muhash.h"
 #include "deprecation.h"
 #include "experimental_features.h"
 #include "init.h"
@@ -28,6 +30,7 @@
 #include "net.h"
 #include "policy/policy.h"
 #include "pow.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -41,7 +44,9 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -66,6 +71,9 @@ CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
+CCriticalSection cs_mapBlockIndex;
+/** Published with std::atomic_store after every change of chainActive's tip. */
+static std::shared_ptr<const CChainTipSnapshot> pchainTipSnapshot = std::make_shared<const CChainTipSnapshot>();
 CBlockIndex *pindexBestHeader = NULL;
 static int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -80,6 +88,7 @@ bool fTimestampIndex = false;   // insightexplorer
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
+bool fTxReconciliation = DEFAULT_TXRECONCILIATION_ENABLE;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 bool fCoinbaseEnforcedShieldingEnabled = true;
@@ -226,15 +235,22 @@ namespace {
         int64_t nTime;           //!< Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //!< The timeout for this block request (for disconnecting a slow peer)
+        std::unique_ptr<PartiallyDownloadedBlock> partialBlock; //!< Optional, used for compact block relay.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Peers we asked to announce new blocks with cmpctblock, least recent first. Protected by cs_main. */
+    list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
+    /** Current block stalling timeout in seconds, see BLOCK_STALLING_TIMEOUT_DEFAULT. Protected by cs_main. */
+    int64_t nBlockStallingTimeout = BLOCK_STALLING_TIMEOUT_DEFAULT;
+
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -289,6 +305,16 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer wants invs or headers (when possible) for block announcements.
+    bool fPreferHeaders;
+    //! The last header we sent to this peer (in a headers message or announcement).
+    CBlockIndex *pindexBestHeaderSent;
+    //! Length of the current streak of headers announcements that did not connect.
+    int nUnconnectingHeaders;
+    //! Smoothed time in microseconds this peer takes to deliver a block we asked for, or 0 until measured.
+    int64_t nAvgBlockDeliveryTime;
+    //! When this peer last delivered a block we asked for (in microseconds), or 0.
+    int64_t nLastBlockDelivered;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -302,6 +328,11 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        fPreferHeaders = false;
+        pindexBestHeaderSent = NULL;
+        nUnconnectingHeaders = 0;
+        nAvgBlockDeliveryTime = 0;
+        nLastBlockDelivered = 0;
     }
 };
 
@@ -360,16 +391,28 @@ void FinalizeNode(NodeId nodeid) {
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
 }
 
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// If the block was delivered by nodeFrom, the peer it was requested from,
+// this updates that peer's delivery time estimate.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (itInFlight->second.first == nodeFrom) {
+            // With several blocks in flight the peer works through them back
+            // to back, so time the delivery from the previous one.
+            int64_t nNow = GetTimeMicros();
+            int64_t nSample = nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockDelivered);
+            state->nAvgBlockDeliveryTime = state->nAvgBlockDeliveryTime == 0 ? nSample :
+                (7 * state->nAvgBlockDeliveryTime + nSample) / 8;
+            state->nLastBlockDelivered = nNow;
+        }
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -382,10 +425,19 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// Returns false if the block was already in flight from this peer. If pit is
+// given, it is set to the queue entry, so a compact block can be attached.
+bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
+    // Short-circuit if it is already in flight from the same peer
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (pit && itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        *pit = &itInFlight->second.second;
+        return false;
+    }
+
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
@@ -393,10 +445,65 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     int nHeight = pindex != NULL ? pindex->nHeight : chainActive.Height(); // Help block timeout computation
     QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams, nHeight)};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
-    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), std::move(newentry));
     state->nBlocksInFlight++;
-    state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
-    mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
+    itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
+    if (pit)
+        *pit = &itInFlight->second.second;
+    return true;
+}
+
+// Requires cs_main.
+bool PeerHasHeader(CNodeState *state, CBlockIndex *pindex)
+{
+    if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
+        return true;
+    if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->nHeight))
+        return true;
+    return false;
+}
+
+// Requires cs_main.
+// Whether we are close enough to the tip to fetch announced blocks directly.
+bool CanDirectFetch(const Consensus::Params& consensusParams)
+{
+    return chainActive.Tip()->GetBlockTime() > GetTime() - consensusParams.PoWTargetSpacing(pindexBestHeader->nHeight) * 20;
+}
+
+/**
+ * Ask pfrom, which just gave us a new best block, to announce its next
+ * blocks with cmpctblock messages. Only MAX_CMPCTBLOCK_HB_PEERS peers are
+ * kept in high-bandwidth mode; the one that was promoted least recently is
+ * asked to go back to announcing with inv. Requires cs_main.
+ */
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(CNode* pfrom)
+{
+    if (!pfrom->fProvidesHeaderAndIDs)
+        return;
+
+    for (list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
+        if (*it == pfrom->GetId()) {
+            lNodesAnnouncingHeaderAndIDs.erase(it);
+            lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
+            return;
+        }
+    }
+
+    uint64_t nCMPCTBLOCKVersion = 1;
+    if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+        NodeId nodeid = lNodesAnnouncingHeaderAndIDs.front();
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeid) {
+                pnode->PushMessage("sendcmpct", false, nCMPCTBLOCKVersion);
+                break;
+            }
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, nCMPCTBLOCKVersion);
+    lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
 }
 
 /** Check whether the last unknown block a peer advertized is not yet known. */
@@ -453,7 +560,7 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStalling) {
     if (count == 0)
         return;
 
@@ -489,6 +596,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex* pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -520,6 +628,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalling = pindexWaitingFor;
                     }
                     return;
                 }
@@ -530,6 +639,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -537,6 +647,25 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+// Number of blocks to keep in flight from a peer during parallel download:
+// enough to cover its round trip time at the rate it has been delivering
+// blocks, with 2x headroom. A peer that delivers faster than its round trip
+// gets a larger window, much like TCP slow start, until the link is full.
+int GetBlocksInFlightLimit(int64_t nAvgBlockDeliveryTime, int64_t nPingUsecTime)
+{
+    if (nAvgBlockDeliveryTime <= 0 || nPingUsecTime <= 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = 2 * (1 + nPingUsecTime / nAvgBlockDeliveryTime);
+    return (int)std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER,
+                                  std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, nLimit));
+}
+
+static int GetBlocksInFlightLimit(const CNodeState* state, const CNode* pnode)
+{
+    int64_t nPingUsecTime = pnode->nMinPingUsecTime != std::numeric_limits<int64_t>::max() ? pnode->nMinPingUsecTime : pnode->nPingUsecTime;
+    return GetBlocksInFlightLimit(state->nAvgBlockDeliveryTime, nPingUsecTime);
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -590,6 +719,52 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
+
+namespace {
+    /**
+     * Block of the loaded UTXO set snapshot, until the blocks below it have
+     * been downloaded and validated in the background.
+     */
+    CBlockIndex *pindexSnapshotBase = NULL;
+    /** Last block connected to the historical chainstate, on the way to pindexSnapshotBase */
+    CBlockIndex *pindexHistoricalTip = NULL;
+
+/**
+ * Update vBlocks with up to count blocks below the snapshot base that the
+ * peer can serve, within BLOCK_DOWNLOAD_WINDOW of the blocks validated
+ * in the background so far.
+ */
+void FindHistoricalBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks) {
+    if (count == 0 || pindexSnapshotBase == NULL)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    // FindNextBlocksToDownload brought pindexBestKnownBlock up to date
+    if (state->pindexBestKnownBlock == NULL ||
+        state->pindexBestKnownBlock->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase)
+        return;
+
+    int nStartHeight = pindexHistoricalTip ? pindexHistoricalTip->nHeight + 1 : 0;
+    int nEndHeight = std::min<int>(nStartHeight + BLOCK_DOWNLOAD_WINDOW, pindexSnapshotBase->nHeight);
+    if (nStartHeight > nEndHeight)
+        return;
+    std::vector<CBlockIndex*> vWindow(nEndHeight - nStartHeight + 1);
+    CBlockIndex *pindexWalk = pindexSnapshotBase->GetAncestor(nEndHeight);
+    for (int i = vWindow.size() - 1; i >= 0; i--) {
+        vWindow[i] = pindexWalk;
+        pindexWalk = pindexWalk->pprev;
+    }
+    BOOST_FOREACH(CBlockIndex* pindex, vWindow) {
+        if (pindex->nStatus & BLOCK_HAVE_DATA || mapBlocksInFlight.count(pindex->GetBlockHash()))
+            continue;
+        vBlocks.push_back(pindex);
+        if (vBlocks.size() == count)
+            return;
+    }
+}
+} // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1754,8 +1929,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 {
     CBlockIndex *pindexSlow = NULL;
 
-    LOCK(cs_main);
-
+    // The mempool and the transaction index have their own locking, so only
+    // the coins database scan below needs cs_main.
     if (mempool.lookup(hash, txOut))
     {
         return true;
@@ -1783,6 +1958,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        LOCK(cs_main);
         int nHeight = -1;
         {
             CCoinsViewCache &view = *pcoinsTip;
@@ -1792,16 +1968,16 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
-    }
 
-    if (pindexSlow) {
-        CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-                if (tx.GetHash() == hash) {
-                    txOut = tx;
-                    hashBlock = pindexSlow->GetBlockHash();
-                    return true;
+        if (pindexSlow) {
+            CBlock block;
+            if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
+                BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+                    if (tx.GetHash() == hash) {
+                        txOut = tx;
+                        hashBlock = pindexSlow->GetBlockHash();
+                        return true;
+                    }
                 }
             }
         }
@@ -2395,6 +2571,110 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
+namespace {
+
+/**
+ * A MUHASH hash of the UTXO set kept up to date as blocks are connected
+ * and disconnected, once gettxoutsetinfo has started one. Blocks only queue
+ * their outputs here; the multiplications are left to the next
+ * gettxoutsetinfo, off the validation path. Protected by cs_main.
+ */
+struct CTxOutSetCommitment
+{
+    uint256 hashBlock; //!< the UTXO set it is for, null if not maintained
+    MuHash3072 muhash;
+    std::vector<std::vector<unsigned char>> vInserted;
+    std::vector<std::vector<unsigned char>> vRemoved;
+    size_t nPendingBytes;
+    int64_t nTransactions;
+    int64_t nTransactionOutputs;
+    CAmount nTotalAmount;
+    //! bumped on every reset, so that a gettxoutsetinfo in progress can tell
+    uint64_t nResets;
+
+    CTxOutSetCommitment() : nResets(0) { SetNull(); }
+
+    void SetNull()
+    {
+        nResets++;
+        hashBlock.SetNull();
+        muhash = MuHash3072();
+        vInserted.clear();
+        vRemoved.clear();
+        nPendingBytes = 0;
+        nTransactions = 0;
+        nTransactionOutputs = 0;
+        nTotalAmount = 0;
+    }
+};
+CTxOutSetCommitment txOutSetCommitment;
+
+/** Queue the outputs block creates and spends, or the reverse when disconnecting. */
+void UpdateTxOutSetCommitment(const CBlock& block, const CBlockUndo& blockundo, bool fConnect)
+{
+    AssertLockHeld(cs_main);
+    CTxOutSetCommitment& commitment = txOutSetCommitment;
+    std::vector<std::vector<unsigned char>>& vCreated = fConnect ? commitment.vInserted : commitment.vRemoved;
+    std::vector<std::vector<unsigned char>>& vSpent = fConnect ? commitment.vRemoved : commitment.vInserted;
+    int nSign = fConnect ? 1 : -1;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        bool fAnyOutput = false;
+        for (uint32_t k = 0; k < tx.vout.size(); k++) {
+            if (tx.vout[k].scriptPubKey.IsUnspendable())
+                continue;
+            vCreated.push_back(TxOutSetElement(COutPoint(tx.GetHash(), k), tx.vout[k]));
+            commitment.nPendingBytes += vCreated.back().size() + sizeof(vCreated.back());
+            commitment.nTransactionOutputs += nSign;
+            commitment.nTotalAmount += nSign * tx.vout[k].nValue;
+            fAnyOutput = true;
+        }
+        if (fAnyOutput)
+            commitment.nTransactions += nSign;
+        if (i == 0)
+            continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i-1];
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CTxInUndo& undo = txundo.vprevout[j];
+            vSpent.push_back(TxOutSetElement(tx.vin[j].prevout, undo.txout));
+            commitment.nPendingBytes += vSpent.back().size() + sizeof(vSpent.back());
+            commitment.nTransactionOutputs -= nSign;
+            commitment.nTotalAmount -= nSign * undo.txout.nValue;
+            // The undo data has the height only for the last output of a transaction
+            if (undo.nHeight != 0)
+                commitment.nTransactions -= nSign;
+        }
+    }
+    if (commitment.nPendingBytes > MAX_TXOUTSET_COMMITMENT_PENDING_BYTES) {
+        LogPrint("bench", "%s: too many outputs queued, dropping the UTXO set hash\n", __func__);
+        commitment.SetNull();
+    }
+}
+
+/** MuHash3072 of the queued outputs, on as many threads as there are cores. */
+MuHash3072 HashTxOutSetElements(const std::vector<std::vector<unsigned char>>& vInserted,
+                                const std::vector<std::vector<unsigned char>>& vRemoved)
+{
+    size_t nThreads = std::max(1, std::min(GetNumCores(), MAX_TXOUTSET_STATS_THREADS));
+    std::vector<MuHash3072> vMuHash(nThreads);
+    boost::thread_group threadGroup;
+    for (size_t i = 0; i < nThreads; i++) {
+        threadGroup.create_thread([&vInserted, &vRemoved, &vMuHash, i, nThreads] {
+            RenameThread("vect-txoutset");
+            for (size_t j = i; j < vInserted.size(); j += nThreads)
+                vMuHash[i].Insert(vInserted[j].data(), vInserted[j].size());
+            for (size_t j = i; j < vRemoved.size(); j += nThreads)
+                vMuHash[i].Remove(vRemoved[j].data(), vRemoved[j].size());
+        });
+    }
+    threadGroup.join_all();
+    for (size_t i = 1; i < nThreads; i++)
+        vMuHash[0].Combine(vMuHash[i]);
+    return vMuHash[0];
+}
+
+} // namespace
+
 enum DisconnectResult
 {
     DISCONNECT_OK,      // All good.
@@ -2569,6 +2849,14 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
             return DISCONNECT_FAILED;
         }
     }
+    if (updateIndices && !txOutSetCommitment.hashBlock.IsNull()) {
+        if (fClean && txOutSetCommitment.hashBlock == pindex->GetBlockHash()) {
+            UpdateTxOutSetCommitment(block, blockUndo, false);
+            txOutSetCommitment.hashBlock = pindex->pprev->GetBlockHash();
+        } else {
+            txOutSetCommitment.SetNull();
+        }
+    }
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -2604,6 +2892,111 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Closure representing the check of one Equihash solution, which stores the result in *pfValid */
+class CEquihashCheck
+{
+private:
+    const CBlockHeader* pheader;
+    const Consensus::Params* pparams;
+    char* pfValid;
+
+public:
+    CEquihashCheck() : pheader(NULL), pparams(NULL), pfValid(NULL) {}
+    CEquihashCheck(const CBlockHeader& header, const Consensus::Params& params, char* pfValidIn) :
+        pheader(&header), pparams(&params), pfValid(pfValidIn) {}
+
+    bool operator()() {
+        *pfValid = CheckEquihashSolution(pheader, *pparams);
+        // One invalid solution is enough to reject the batch, so the
+        // queue skips the checks that are left
+        return *pfValid;
+    }
+
+    void swap(CEquihashCheck& check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pparams, check.pparams);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(8);
+// The queue takes one master at a time
+static CCriticalSection cs_equihashcheckqueue;
+
+void ThreadEquihashCheck() {
+    RenameThread("vect-ehcheck");
+    equihashcheckqueue.Thread();
+}
+
+// Block hashes whose Equihash solution is known to be valid; the hash
+// covers the solution. Oldest first in vEquihashValid.
+static CCriticalSection cs_equihashvalid;
+static std::unordered_set<uint256, BlockHasher> setEquihashValid;
+static std::deque<uint256> vEquihashValid;
+
+static bool IsEquihashKnownValid(const uint256& hash)
+{
+    LOCK(cs_equihashvalid);
+    return setEquihashValid.count(hash) > 0;
+}
+
+static void AddEquihashKnownValid(const uint256& hash)
+{
+    LOCK(cs_equihashvalid);
+    if (!setEquihashValid.insert(hash).second)
+        return;
+    vEquihashValid.push_back(hash);
+    if (vEquihashValid.size() > EQUIHASH_CACHE_SIZE) {
+        setEquihashValid.erase(vEquihashValid.front());
+        vEquihashValid.pop_front();
+    }
+}
+
+static bool CheckEquihashSolutionCached(const CBlockHeader& block, const Consensus::Params& params)
+{
+    uint256 hash = block.GetHash();
+    if (IsEquihashKnownValid(hash))
+        return true;
+    if (!CheckEquihashSolution(&block, params))
+        return false;
+    AddEquihashKnownValid(hash);
+    return true;
+}
+
+bool CheckEquihashSolutions(const std::vector<CBlockHeader>& vHeaders, const Consensus::Params& params)
+{
+    // Results are left at -1 for the checks skipped after a failure
+    std::vector<uint256> vHashes(vHeaders.size());
+    std::vector<char> vResults(vHeaders.size(), -1);
+    std::vector<CEquihashCheck> vChecks;
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vHashes[i] = vHeaders[i].GetHash();
+        if (!IsEquihashKnownValid(vHashes[i]))
+            vChecks.push_back(CEquihashCheck(vHeaders[i], params, &vResults[i]));
+    }
+
+    bool fValid = true;
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        LOCK(cs_equihashcheckqueue);
+        CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+        control.Add(vChecks);
+        fValid = control.Wait();
+    } else {
+        BOOST_FOREACH(CEquihashCheck& check, vChecks) {
+            if (!check()) {
+                fValid = false;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        if (vResults[i] == 1)
+            AddEquihashKnownValid(vHashes[i]);
+    }
+    return fValid;
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3118,6 +3511,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
     // END insightexplorer
 
+    // Only blocks connected on top of the hashed UTXO set update it, which
+    // leaves out those VerifyDB reconnects
+    if (!txOutSetCommitment.hashBlock.IsNull() && txOutSetCommitment.hashBlock == pindex->pprev->GetBlockHash()) {
+        UpdateTxOutSetCommitment(block, blockundo, true);
+        txOutSetCommitment.hashBlock = pindex->GetBlockHash();
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -3226,8 +3626,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
-            return AbortNode(state, "Failed to write to coin database");
+        // Unless asked to write everything, keep the coins used most
+        // recently in the cache, so that it is not cold after the flush.
+        if (mode == FLUSH_STATE_ALWAYS) {
+            if (!pcoinsTip->Flush())
+                return AbortNode(state, "Failed to write to coin database");
+        } else {
+            if (!pcoinsTip->PartialFlush(nCoinCacheUsage / 100 * COINS_CACHE_RETAIN_PERCENT))
+                return AbortNode(state, "Failed to write to coin database");
+            LogPrint("coindb", "Flushed coins cache of %.1fMiB, %.1fMiB kept\n",
+                cacheSize * (1.0 / 1024 / 1024), pcoinsTip->DynamicMemoryUsage() * (1.0 / 1024 / 1024));
+        }
         nLastFlush = nNow;
     }
     // Don't flush the wallet witness cache (SetBestChain()) here, see #4301
@@ -3248,9 +3657,29 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+/** Publish the current tip of chainActive to lock-free readers. */
+static void PublishChainTipSnapshot()
+{
+    AssertLockHeld(cs_main);
+    std::atomic_store(&pchainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(std::make_shared<const CChainTipSnapshot>(chainActive.Tip())));
+}
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&pchainTipSnapshot);
+}
+
+CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_mapBlockIndex);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? NULL : it->second;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    PublishChainTipSnapshot();
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -3315,7 +3744,7 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
             list<CTransaction> removed;
             CValidationState stateDummy;
             if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
-                mempool.remove(tx, removed, true);
+                mempool.remove(tx, removed, true, MemPoolRemovalReason::REORG);
         }
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
@@ -3347,6 +3776,10 @@ static int64_t nTimePostConnect = 0;
 std::map<CBlockIndex*, std::list<CTransaction>> recentlyConflictedTxs;
 uint64_t nRecentlyConflictedSequence = 0;
 uint64_t nNotifiedSequence = 0;
+// Blocks connected since the last DrainRecentlyConnectedBlocks(), while
+// they fit in MAX_NOTIFY_BLOCK_CACHE_BYTES. Protected by cs_main
+std::map<CBlockIndex*, std::shared_ptr<const CBlock>> recentlyConnectedBlocks;
+size_t nRecentlyConnectedBlocksBytes = 0;
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
@@ -3400,9 +3833,22 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Updates to connected wallets are triggered by ThreadNotifyWallets
     recentlyConflictedTxs.insert(std::make_pair(pindexNew, txConflicted));
     nRecentlyConflictedSequence += 1;
+    // Keep the block too, so that it need not be read back from disk
+    size_t nBlockSize = ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
+    if (nRecentlyConnectedBlocksBytes + nBlockSize <= MAX_NOTIFY_BLOCK_CACHE_BYTES) {
+        recentlyConnectedBlocks[pindexNew] = std::make_shared<const CBlock>(*pblock);
+        nRecentlyConnectedBlocksBytes += nBlockSize;
+    }
 
     EnforceNodeDeprecation(pindexNew->nHeight);
 
+    // Download is making progress again; let the stalling timeout, if it
+    // was raised, come back down slowly
+    if (nBlockStallingTimeout > BLOCK_STALLING_TIMEOUT_DEFAULT) {
+        nBlockStallingTimeout = std::max(BLOCK_STALLING_TIMEOUT_DEFAULT, nBlockStallingTimeout * 85 / 100);
+        LogPrint("net", "Decreased block stalling timeout to %d seconds\n", nBlockStallingTimeout);
+    }
+
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
@@ -3422,6 +3868,15 @@ std::pair<std::map<CBlockIndex*, std::list<CTransaction>>, uint64_t> DrainRecent
     return std::make_pair(txs, recentlyConflictedSequence);
 }
 
+std::map<CBlockIndex*, std::shared_ptr<const CBlock>> DrainRecentlyConnectedBlocks()
+{
+    std::map<CBlockIndex*, std::shared_ptr<const CBlock>> blocks;
+    LOCK(cs_main);
+    blocks.swap(recentlyConnectedBlocks);
+    nRecentlyConnectedBlocksBytes = 0;
+    return blocks;
+}
+
 void SetChainNotifiedSequence(uint64_t recentlyConflictedSequence) {
     assert(Params().NetworkIDString() == "regtest");
     LOCK(cs_main);
@@ -3450,6 +3905,13 @@ static CBlockIndex* FindMostWorkChain() {
             pindexNew = *it;
         }
 
+        // The snapshot base cannot be disconnected before the blocks below
+        // it are validated, so chains that fork below it are out of reach.
+        if (pindexSnapshotBase && pindexNew->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase) {
+            setBlockIndexCandidates.erase(pindexNew);
+            continue;
+        }
+
         // Check whether all blocks on the path between the currently active chain and the candidate are valid.
         // Just going until the active chain is an optimization, as we know all blocks in it are valid already.
         CBlockIndex *pindexTest = pindexNew;
@@ -3627,12 +4089,17 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
 {
     CBlockIndex *pindexNewTip = NULL;
     CBlockIndex *pindexMostWork = NULL;
+    std::vector<uint256> vHashes;
     do {
         boost::this_thread::interruption_point();
 
+        // Let the wallet notifications catch up if they fell too far behind
+        LimitWalletNotifyLag(GetChainTipSnapshot()->Height());
+
         bool fInitialDownload;
         {
             LOCK(cs_main);
+            CBlockIndex *pindexOldTip = chainActive.Tip();
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
@@ -3644,6 +4111,16 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
 
             pindexNewTip = chainActive.Tip();
             fInitialDownload = IsInitialBlockDownload(chainparams);
+
+            // The blocks connected in this step, newest first, to be announced
+            // to peers that prefer headers.
+            vHashes.clear();
+            const CBlockIndex *pindexFork = chainActive.FindFork(pindexOldTip);
+            for (const CBlockIndex *pindexToAnnounce = pindexNewTip;
+                 pindexToAnnounce != pindexFork && vHashes.size() < MAX_BLOCKS_TO_ANNOUNCE;
+                 pindexToAnnounce = pindexToAnnounce->pprev) {
+                vHashes.push_back(pindexToAnnounce->GetBlockHash());
+            }
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
 
@@ -3655,10 +4132,31 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints());
             {
+                // Peers in compact block high-bandwidth mode get the block
+                // right away as a cmpctblock. Everyone else gets the new
+                // blocks queued for SendMessages, which announces them with
+                // headers to peers that asked for that, and an inv otherwise.
+                boost::optional<CBlockHeaderAndShortTxIDs> cmpctblock;
+                CInv inv(MSG_BLOCK, hashNewTip);
                 LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (pnode->fPreferHeaderAndIDs && pblock && pblock->GetHash() == hashNewTip) {
+                        {
+                            LOCK(pnode->cs_inventory);
+                            if (!pnode->setInventoryKnown.insert(inv).second)
+                                continue;
+                        }
+                        if (!cmpctblock)
+                            cmpctblock = CBlockHeaderAndShortTxIDs(*pblock);
+                        pnode->PushMessage("cmpctblock", *cmpctblock);
+                    } else {
+                        BOOST_REVERSE_FOREACH(const uint256& hash, vHashes) {
+                            pnode->PushBlockHash(hash);
+                        }
+                    }
+                }
             }
             // Notify external listeners about the new tip.
             GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -3764,6 +4262,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
+    // Lock-free readers must not see the entry before it is linked in
+    LOCK(cs_mapBlockIndex);
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
@@ -3842,8 +4342,12 @@ bool ReceivedBlockTransactions(
     CBlockIndex *pindexNew,
     const CDiskBlockPos& pos)
 {
+    // The chain values of a snapshot base come from the snapshot until the
+    // blocks below it are linked
+    bool fSnapshotBase = pindexNew == pindexSnapshotBase;
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainTx = 0;
+    if (!fSnapshotBase)
+        pindexNew->nChainTx = 0;
     CAmount sproutValue = 0;
     CAmount saplingValue = 0;
     for (auto tx : block.vtx) {
@@ -3859,9 +4363,11 @@ bool ReceivedBlockTransactions(
         }
     }
     pindexNew->nSproutValue = sproutValue;
-    pindexNew->nChainSproutValue = boost::none;
     pindexNew->nSaplingValue = saplingValue;
-    pindexNew->nChainSaplingValue = boost::none;
+    if (!fSnapshotBase) {
+        pindexNew->nChainSproutValue = boost::none;
+        pindexNew->nChainSaplingValue = boost::none;
+    }
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
@@ -3898,7 +4404,9 @@ bool ReceivedBlockTransactions(
             // Fall back to hardcoded Sprout value pool balance
             FallbackSproutValuePoolBalance(pindex, chainparams);
 
-            {
+            // The snapshot base may be among the candidates already, which
+            // are ordered by nSequenceId
+            if (pindex != pindexSnapshotBase) {
                 LOCK(cs_nBlockSequenceId);
                 pindex->nSequenceId = nBlockSequenceId++;
             }
@@ -4020,7 +4528,7 @@ bool CheckBlockHeader(
                          REJECT_INVALID, "version-too-low");
 
     // Check Equihash solution is valid
-    if (fCheckPOW && !CheckEquihashSolution(&block, chainparams.GetConsensus()))
+    if (fCheckPOW && !CheckEquihashSolutionCached(block, chainparams.GetConsensus()))
         return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                          REJECT_INVALID, "invalid-solution");
 
@@ -4371,7 +4879,7 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -4586,100 +5094,511 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     CBlockIndex* pindexNew = new CBlockIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    LOCK(cs_mapBlockIndex);
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
-{
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
-        return false;
-
-    boost::this_thread::interruption_point();
+namespace {
+    /** Serializes gettxoutsetinfo; a caller waiting for another gets its result. */
+    CCriticalSection cs_txOutSetStats;
+    /** The statistics of each hash type for one best block (protected by cs_txOutSetStats) */
+    std::map<TxOutSetHashType, CCoinsStats> mapTxOutSetStats;
+}
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+bool GetTxOutSetStats(TxOutSetHashType hashType, CCoinsStats& stats)
+{
+    LOCK(cs_txOutSetStats);
+    CTxOutSetCommitment& commitment = txOutSetCommitment;
+    std::vector<std::unique_ptr<CDBIterator>> vCursors;
+    std::vector<std::vector<unsigned char>> vInserted, vRemoved;
+    MuHash3072 muhash;
+    uint64_t nResets;
     {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        // We can link the chain of blocks for which we've received transactions at some point.
-        // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainTx) {
-                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
-                    if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
-                        pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
-                    } else {
-                        pindex->nChainSproutValue = boost::none;
-                    }
-                    if (pindex->pprev->nChainSaplingValue) {
-                        pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
-                    } else {
-                        pindex->nChainSaplingValue = boost::none;
-                    }
-                } else {
-                    pindex->nChainTx = 0;
-                    pindex->nChainSproutValue = boost::none;
-                    pindex->nChainSaplingValue = boost::none;
-                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
-                }
-            } else {
-                pindex->nChainTx = pindex->nTx;
-                pindex->nChainSproutValue = pindex->nSproutValue;
-                pindex->nChainSaplingValue = pindex->nSaplingValue;
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive.Tip();
+        std::map<TxOutSetHashType, CCoinsStats>::const_iterator it = mapTxOutSetStats.find(hashType);
+        if (it != mapTxOutSetStats.end() && it->second.hashBlock == pindex->GetBlockHash()) {
+            stats = it->second;
+            return true;
+        }
+        stats = CCoinsStats();
+        stats.hashBlock = pindex->GetBlockHash();
+        stats.nHeight = pindex->nHeight;
+
+        if (hashType == TxOutSetHashType::MUHASH && commitment.hashBlock == stats.hashBlock) {
+            // Maintained since an earlier call: take the outputs queued by
+            // the blocks since then
+            vInserted.swap(commitment.vInserted);
+            vRemoved.swap(commitment.vRemoved);
+            commitment.nPendingBytes = 0;
+            muhash = commitment.muhash;
+            stats.nTransactions = commitment.nTransactions;
+            stats.nTransactionOutputs = commitment.nTransactionOutputs;
+            stats.nTotalAmount = commitment.nTotalAmount;
+        } else {
+            FlushStateToDisk();
+            // The cursors are all created before cs_main is released, so
+            // they see the same state
+            size_t nCursors = hashType == TxOutSetHashType::HASH_SERIALIZED ? 1 :
+                std::max(1, std::min(GetNumCores(), MAX_TXOUTSET_STATS_THREADS));
+            for (size_t i = 0; i < nCursors; i++)
+                vCursors.emplace_back(pcoinsdbview->NewIterator());
+            if (hashType == TxOutSetHashType::MUHASH) {
+                // Blocks connected during the scan are queued on top of it
+                commitment.SetNull();
+                commitment.hashBlock = stats.hashBlock;
             }
+        }
+        nResets = commitment.nResets;
+    }
 
-            // Fall back to hardcoded Sprout value pool balance
-            FallbackSproutValuePoolBalance(pindex, chainparams);
-
-            // If developer option -developersetpoolsizezero has been enabled,
-            // override and set the in-memory size of shielded pools to zero.  An unshielding transaction
-            // can then be used to trigger and test the handling of turnstile violations.
-            if (fExperimentalDeveloperSetPoolSizeZero) {
-                pindex->nChainSproutValue = 0;
-                pindex->nChainSaplingValue = 0;
-            }
+    bool fScan = !vCursors.empty();
+    MuHash3072 muhashNew;
+    if (!fScan) {
+        muhashNew = HashTxOutSetElements(vInserted, vRemoved);
+    } else {
+        std::vector<CDBIterator*> vRawCursors;
+        for (size_t i = 0; i < vCursors.size(); i++)
+            vRawCursors.push_back(vCursors[i].get());
+        bool fOk = pcoinsdbview->GetStats(vRawCursors, hashType, stats, muhashNew);
+        vCursors.clear();
+        if (!fOk) {
+            LOCK(cs_main);
+            if (hashType == TxOutSetHashType::MUHASH && commitment.nResets == nResets)
+                commitment.SetNull();
+            return false;
         }
-        // Construct in-memory chain of branch IDs.
-        // Relies on invariant: a block that does not activate a network upgrade
-        // will always be valid under the same consensus rules as its parent.
-        // Genesis block has a branch ID of zero by definition, but has no
-        // validity status because it is side-loaded into a fresh chain.
-        // Activation blocks will have branch IDs set (read from disk).
-        if (pindex->pprev) {
-            if (pindex->IsValid(BLOCK_VALID_CONSENSUS) && !pindex->nCachedBranchId) {
-                pindex->nCachedBranchId = pindex->pprev->nCachedBranchId;
+    }
+
+    if (hashType == TxOutSetHashType::MUHASH) {
+        {
+            LOCK(cs_main);
+            if (commitment.nResets == nResets) {
+                commitment.muhash.Combine(muhashNew);
+                if (fScan) {
+                    commitment.nTransactions += stats.nTransactions;
+                    commitment.nTransactionOutputs += stats.nTransactionOutputs;
+                    commitment.nTotalAmount += stats.nTotalAmount;
+                }
             }
-        } else {
-            pindex->nCachedBranchId = SPROUT_BRANCH_ID;
         }
-        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
-            setBlockIndexCandidates.insert(pindex);
-        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
-            pindexBestInvalid = pindex;
-        if (pindex->pprev)
-            pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
-            pindexBestHeader = pindex;
+        muhash.Combine(muhashNew);
+        muhash.Finalize(stats.hashMuHash.begin());
     }
 
-    // Load block file info
-    pblocktree->ReadLastBlockFile(nLastBlockFile);
-    vinfoBlockFile.resize(nLastBlockFile + 1);
-    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
-    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
+    if (!mapTxOutSetStats.empty() && mapTxOutSetStats.begin()->second.hashBlock != stats.hashBlock)
+        mapTxOutSetStats.clear();
+    mapTxOutSetStats[hashType] = stats;
+    return true;
+}
+
+CBlockIndex* GetSnapshotBase()
+{
+    AssertLockHeld(cs_main);
+    return pindexSnapshotBase;
+}
+
+bool ActivateTxOutSetSnapshot(CAutoFile& file, const CChainParams& chainparams, CTxOutSetSnapshotMetadata& metadata,
+                              uint64_t& nRecords, std::string& strError)
+{
+    // Check the whole file before touching the chainstate
+    uint256 hashSnapshot;
+    long nStart = ftell(file.Get());
+    if (!pcoinsdbview->LoadSnapshot(file, false, metadata, hashSnapshot, nRecords)) {
+        strError = "Not a valid UTXO set snapshot";
+        return false;
+    }
+    MapAssumeutxo::const_iterator itAssumed = chainparams.Assumeutxo().find(metadata.nHeight);
+    if (itAssumed == chainparams.Assumeutxo().end() ||
+        itAssumed->second.hashBlock != metadata.hashBlock ||
+        itAssumed->second.hashSnapshot != hashSnapshot) {
+        strError = strprintf("Snapshot %s at height %d is not one of the snapshots of this network", hashSnapshot.GetHex(), metadata.nHeight);
+        return false;
+    }
+
+    LOCK(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(metadata.hashBlock);
+    if (mi == mapBlockIndex.end()) {
+        strError = "The snapshot block header is not known yet";
+        return false;
+    }
+    CBlockIndex* pindexBase = mi->second;
+    if (pindexBase->nHeight != metadata.nHeight || (pindexBase->nStatus & BLOCK_FAILED_MASK)) {
+        strError = "The snapshot block is invalid";
+        return false;
+    }
+    if (chainActive.Height() >= pindexBase->nHeight) {
+        strError = "The active chain is already past the snapshot block";
+        return false;
+    }
+    if (fTxIndex || fAddressIndex || fSpentIndex || fTimestampIndex) {
+        strError = "A snapshot cannot be loaded with -txindex or the insight explorer indexes";
+        return false;
+    }
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Unable to flush the chainstate";
+        return false;
+    }
+    // Left set if loading is interrupted, so that the chainstate is rebuilt
+    if (!pblocktree->WriteFlag("loadingtxoutset", true)) {
+        strError = "Unable to write the block index";
+        return false;
+    }
+    // From here on the chainstate is being replaced, and the node must not
+    // go on validating blocks against it if that fails: it shuts down, with
+    // the flag left set.
+    if (fseek(file.Get(), nStart, SEEK_SET) != 0 ||
+        !pcoinsdbview->LoadSnapshot(file, true, metadata, hashSnapshot, nRecords) ||
+        hashSnapshot != itAssumed->second.hashSnapshot) {
+        strError = "Error loading the snapshot, restart with -reindex";
+        return AbortNode(strError);
+    }
+
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+    if (!pcoinsdbview->GetSproutAnchorAt(metadata.hashSproutAnchor, sproutTree) ||
+        !pcoinsdbview->GetSaplingAnchorAt(metadata.hashSaplingAnchor, saplingTree)) {
+        strError = "The snapshot lacks its best anchors, restart with -reindex";
+        return AbortNode(strError);
+    }
+    {
+        CCoinsViewCache view(pcoinsTip);
+        view.PushAnchor(sproutTree);
+        view.PushAnchor(saplingTree);
+        view.SetBestBlock(metadata.hashBlock);
+        view.Flush();
+    }
+    if (!pcoinsTip->Flush()) {
+        strError = "Unable to write the chainstate, restart with -reindex";
+        return AbortNode(strError);
+    }
+
+    // The snapshot vouches for the blocks up to its base, as if they had
+    // been connected.
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    for (CBlockIndex* pindex = pindexBase; pindex && !pindex->IsValid(BLOCK_VALID_SCRIPTS); pindex = pindex->pprev) {
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        if (IsActivationHeightForAnyUpgrade(pindex->nHeight, consensusParams))
+            pindex->nStatus |= BLOCK_ACTIVATES_UPGRADE;
+        pindex->nCachedBranchId = CurrentEpochBranchId(pindex->nHeight, consensusParams);
+        setDirtyBlockIndex.insert(pindex);
+    }
+    pindexBase->nChainTx = metadata.nChainTx;
+    pindexBase->nChainSproutValue = metadata.nChainSproutValue;
+    pindexBase->nChainSaplingValue = metadata.nChainSaplingValue;
+    pindexSnapshotBase = pindexBase;
+    chainActive.SetTip(pindexBase);
+    PublishChainTipSnapshot();
+    setBlockIndexCandidates.clear();
+    setBlockIndexCandidates.insert(pindexBase);
+
+    // Blocks after the base that were already downloaded can now be connected
+    deque<CBlockIndex*> queue;
+    queue.push_back(pindexBase);
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        if (pindex != pindexBase) {
+            pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
+                pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+            }
+            if (pindex->pprev->nChainSaplingValue) {
+                pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
+            }
+            setBlockIndexCandidates.insert(pindex);
+        }
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        while (range.first != range.second) {
+            queue.push_back(range.first->second);
+            range.first = mapBlocksUnlinked.erase(range.first);
+        }
+    }
+
+    mempool.clear();
+    txOutSetCommitment.SetNull();
+    if (!pblocktree->WriteSnapshotBase(metadata) || !FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Unable to write the block index, restart with -reindex";
+        return AbortNode(strError);
+    }
+    pblocktree->WriteFlag("loadingtxoutset", false);
+    // The blocks below the base are not there to serve to peers
+    nLocalServices &= ~NODE_NETWORK;
+    LogPrintf("%s: loaded %u records of snapshot %s, new tip %s at height %d\n", __func__,
+        (unsigned int)nRecords, hashSnapshot.GetHex(), pindexBase->GetBlockHash().GetHex(), pindexBase->nHeight);
+    return true;
+}
+
+CBlockIndex* GetHistoricalTip()
+{
+    AssertLockHeld(cs_main);
+    return pindexHistoricalTip;
+}
+
+static const char* HISTORICAL_CHAINSTATE_DIR = "chainstate_historical";
+static const size_t HISTORICAL_CHAINSTATE_DB_CACHE = 8 << 20;
+
+/**
+ * Open the chainstate the blocks below the snapshot base are connected to,
+ * resuming from its best block if that leads to the base.
+ */
+static void OpenHistoricalChainstate(std::unique_ptr<CCoinsViewDB>& pdb, std::unique_ptr<CCoinsViewCache>& pcache)
+{
+    AssertLockHeld(cs_main);
+    pindexHistoricalTip = NULL;
+    pdb.reset(new CCoinsViewDB(HISTORICAL_CHAINSTATE_DIR, HISTORICAL_CHAINSTATE_DB_CACHE));
+    uint256 hashBest = pdb->GetBestBlock();
+    if (!hashBest.IsNull()) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+        if (mi != mapBlockIndex.end() && pindexSnapshotBase->GetAncestor(mi->second->nHeight) == mi->second) {
+            pindexHistoricalTip = mi->second;
+        } else {
+            pdb.reset();
+            pdb.reset(new CCoinsViewDB(HISTORICAL_CHAINSTATE_DIR, HISTORICAL_CHAINSTATE_DB_CACHE, false, true));
+        }
+    }
+    pcache.reset(new CCoinsViewCache(pdb.get()));
+    LogPrintf("%s: validating the blocks below the snapshot at height %d from height %d\n", __func__,
+        pindexSnapshotBase->nHeight, pindexHistoricalTip ? pindexHistoricalTip->nHeight + 1 : 0);
+}
+
+/**
+ * Connect the downloaded blocks after pindexHistoricalTip to view, for at
+ * most nMaxMicros. Returns false, having shut the node down, if one of them
+ * is invalid: the snapshot it was vouching for cannot be trusted then.
+ */
+static bool ConnectHistoricalBlocks(CCoinsViewCache& view, const CChainParams& chainparams, int64_t nMaxMicros, bool& fProgress)
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMicros();
+    fProgress = false;
+    while (pindexHistoricalTip != pindexSnapshotBase && GetTimeMicros() - nStart < nMaxMicros) {
+        CBlockIndex *pindex = pindexSnapshotBase->GetAncestor(pindexHistoricalTip ? pindexHistoricalTip->nHeight + 1 : 0);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return AbortNode(strprintf("Failed to read block %s", pindex->GetBlockHash().ToString()));
+        CValidationState state;
+        if (!ConnectBlock(block, state, pindex, view, chainparams, false)) {
+            return AbortNode(strprintf("Block %s at height %d below the UTXO set snapshot is invalid (%s), restart with -reindex",
+                pindex->GetBlockHash().ToString(), pindex->nHeight, state.GetRejectReason()));
+        }
+        pindexHistoricalTip = pindex;
+        fProgress = true;
+    }
+    return true;
+}
+
+/**
+ * Once the blocks below the snapshot base have been connected, the UTXO set
+ * they lead to must be the snapshot. The node is then like any other.
+ */
+static bool CompleteHistoricalValidation(const CChainParams& chainparams, const uint256& hashSnapshot)
+{
+    AssertLockHeld(cs_main);
+    MapAssumeutxo::const_iterator itAssumed = chainparams.Assumeutxo().find(pindexSnapshotBase->nHeight);
+    if (itAssumed == chainparams.Assumeutxo().end() ||
+        itAssumed->second.hashBlock != pindexSnapshotBase->GetBlockHash() ||
+        itAssumed->second.hashSnapshot != hashSnapshot) {
+        return AbortNode(strprintf("The blocks below the UTXO set snapshot at height %d lead to UTXO set %s instead, restart with -reindex",
+            pindexSnapshotBase->nHeight, hashSnapshot.GetHex()));
+    }
+    if (!pblocktree->EraseSnapshotBase())
+        return AbortNode("Failed to write the block index");
+    LogPrintf("%s: the blocks below the snapshot at height %d are valid\n", __func__, pindexSnapshotBase->nHeight);
+    pindexSnapshotBase = NULL;
+    pindexHistoricalTip = NULL;
+    if (!fPruneMode)
+        nLocalServices |= NODE_NETWORK;
+    return true;
+}
+
+void ThreadValidateHistoricalBlocks()
+{
+    RenameThread("vect-histval");
+    const CChainParams& chainparams = Params();
+    std::unique_ptr<CCoinsViewDB> pdb;
+    std::unique_ptr<CCoinsViewCache> pcache;
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+            bool fProgress = false;
+            std::unique_ptr<CDBIterator> pcursor;
+            CTxOutSetSnapshotMetadata metadata;
+            {
+                LOCK(cs_main);
+                if (pindexSnapshotBase && !pdb)
+                    OpenHistoricalChainstate(pdb, pcache);
+                if (pdb) {
+                    // Short turns, so that cs_main is not held up for long
+                    if (!ConnectHistoricalBlocks(*pcache, chainparams, 100000, fProgress))
+                        return;
+                    bool fDone = pindexHistoricalTip == pindexSnapshotBase;
+                    if (fDone || pcache->DynamicMemoryUsage() > nCoinCacheUsage / 2) {
+                        // The undo data written for the blocks goes first
+                        CValidationState state;
+                        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS) || !pcache->Flush()) {
+                            AbortNode("Failed to write the historical chainstate");
+                            return;
+                        }
+                    }
+                    if (fDone) {
+                        metadata.hashBlock = pindexSnapshotBase->GetBlockHash();
+                        metadata.nHeight = pindexSnapshotBase->nHeight;
+                        metadata.nChainTx = pindexSnapshotBase->nChainTx;
+                        metadata.nChainSproutValue = pindexSnapshotBase->nChainSproutValue;
+                        metadata.nChainSaplingValue = pindexSnapshotBase->nChainSaplingValue;
+                        metadata.hashSproutAnchor = pcache->GetBestAnchor(SPROUT);
+                        metadata.hashSaplingAnchor = pcache->GetBestAnchor(SAPLING);
+                        pcursor.reset(pdb->NewIterator());
+                    }
+                }
+            }
+            if (pcursor) {
+                // Nothing else writes to the historical chainstate, which
+                // can be hashed without cs_main
+                uint256 hashSnapshot;
+                uint64_t nRecords;
+                if (!pdb->HashSnapshot(pcursor.get(), metadata, hashSnapshot, nRecords)) {
+                    AbortNode("Failed to read the historical chainstate");
+                    return;
+                }
+                pcursor.reset();
+                {
+                    LOCK(cs_main);
+                    if (!CompleteHistoricalValidation(chainparams, hashSnapshot))
+                        return;
+                }
+                pcache.reset();
+                pdb.reset();
+                boost::filesystem::remove_all(GetDataDir() / HISTORICAL_CHAINSTATE_DIR);
+            }
+            if (!fProgress)
+                MilliSleep(1000);
+        }
+    } catch (const boost::thread_interrupted&) {
+        if (pcache) {
+            LOCK(cs_main);
+            CValidationState state;
+            if (FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+                pcache->Flush();
+        }
+        throw;
+    }
+}
+
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
+    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
+        return false;
+
+    bool fLoadingTxOutSet = false;
+    pblocktree->ReadFlag("loadingtxoutset", fLoadingTxOutSet);
+    if (fLoadingTxOutSet)
+        return error("%s: loading a UTXO set snapshot was interrupted", __func__);
+    CTxOutSetSnapshotMetadata snapshotBase;
+    if (!pblocktree->ReadSnapshotBase(snapshotBase))
+        snapshotBase = CTxOutSetSnapshotMetadata();
+
+    boost::this_thread::interruption_point();
+
+    // Calculate nChainWork
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        CBlockIndex* pindex = item.second;
+        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    }
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block. A loaded UTXO set snapshot
+        // stands in for the blocks up to its base.
+        if (!snapshotBase.hashBlock.IsNull() && pindex->GetBlockHash() == snapshotBase.hashBlock) {
+            pindex->nChainTx = snapshotBase.nChainTx;
+            pindex->nChainSproutValue = snapshotBase.nChainSproutValue;
+            pindex->nChainSaplingValue = snapshotBase.nChainSaplingValue;
+            pindexSnapshotBase = pindex;
+        } else if (pindex->nTx > 0) {
+            if (pindex->pprev) {
+                if (pindex->pprev->nChainTx) {
+                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+                    if (pindex->pprev->nChainSproutValue && pindex->nSproutValue) {
+                        pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+                    } else {
+                        pindex->nChainSproutValue = boost::none;
+                    }
+                    if (pindex->pprev->nChainSaplingValue) {
+                        pindex->nChainSaplingValue = *pindex->pprev->nChainSaplingValue + pindex->nSaplingValue;
+                    } else {
+                        pindex->nChainSaplingValue = boost::none;
+                    }
+                } else {
+                    pindex->nChainTx = 0;
+                    pindex->nChainSproutValue = boost::none;
+                    pindex->nChainSaplingValue = boost::none;
+                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+                }
+            } else {
+                pindex->nChainTx = pindex->nTx;
+                pindex->nChainSproutValue = pindex->nSproutValue;
+                pindex->nChainSaplingValue = pindex->nSaplingValue;
+            }
+
+            // Fall back to hardcoded Sprout value pool balance
+            FallbackSproutValuePoolBalance(pindex, chainparams);
+
+            // If developer option -developersetpoolsizezero has been enabled,
+            // override and set the in-memory size of shielded pools to zero.  An unshielding transaction
+            // can then be used to trigger and test the handling of turnstile violations.
+            if (fExperimentalDeveloperSetPoolSizeZero) {
+                pindex->nChainSproutValue = 0;
+                pindex->nChainSaplingValue = 0;
+            }
+        }
+        // Construct in-memory chain of branch IDs.
+        // Relies on invariant: a block that does not activate a network upgrade
+        // will always be valid under the same consensus rules as its parent.
+        // Genesis block has a branch ID of zero by definition, but has no
+        // validity status because it is side-loaded into a fresh chain.
+        // Activation blocks will have branch IDs set (read from disk).
+        if (pindex->pprev) {
+            if (pindex->IsValid(BLOCK_VALID_CONSENSUS) && !pindex->nCachedBranchId) {
+                pindex->nCachedBranchId = pindex->pprev->nCachedBranchId;
+            }
+        } else {
+            pindex->nCachedBranchId = SPROUT_BRANCH_ID;
+        }
+        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
+            setBlockIndexCandidates.insert(pindex);
+        if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
+            pindexBestInvalid = pindex;
+        if (pindex->pprev)
+            pindex->BuildSkip();
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+            pindexBestHeader = pindex;
+    }
+
+    // Load block file info
+    pblocktree->ReadLastBlockFile(nLastBlockFile);
+    vinfoBlockFile.resize(nLastBlockFile + 1);
+    LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
+    for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
         pblocktree->ReadBlockFileInfo(nFile, vinfoBlockFile[nFile]);
     }
     LogPrintf("%s: last block file info: %s\n", __func__, vinfoBlockFile[nLastBlockFile].ToString());
@@ -4760,6 +5679,7 @@ bool static LoadBlockIndexDB()
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainTipSnapshot();
     // Set hashFinalSproutRoot for the end of best chain
     it->second->hashFinalSproutRoot = pcoinsTip->GetBestAnchor(SPROUT);
 
@@ -4811,6 +5731,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // There is no block data for the blocks of a UTXO set snapshot
+        if (pindexSnapshotBase && pindex->nHeight <= pindexSnapshotBase->nHeight)
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -5009,12 +5932,17 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
         return AbortNode(state, "Failed to erase from block index database");
     }
 
-    // Erase block indices in-memory
-    for (auto pindex : vBlocks) {
-        auto ret = mapBlockIndex.find(*pindex->phashBlock);
-        if (ret != mapBlockIndex.end()) {
-            mapBlockIndex.erase(ret);
-            delete pindex;
+    // Erase block indices in-memory. This only runs at startup, before the
+    // RPC server is out of warmup, so there are no lock-free readers left
+    // holding the entries.
+    {
+        LOCK(cs_mapBlockIndex);
+        for (auto pindex : vBlocks) {
+            auto ret = mapBlockIndex.find(*pindex->phashBlock);
+            if (ret != mapBlockIndex.end()) {
+                mapBlockIndex.erase(ret);
+                delete pindex;
+            }
         }
     }
 
@@ -5031,12 +5959,18 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
 
 void UnloadBlockIndex()
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_mapBlockIndex);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    PublishChainTipSnapshot();
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
+    pindexHistoricalTip = NULL;
+    txOutSetCommitment.SetNull();
     mempool.clear();
+    recentlyConnectedBlocks.clear();
+    nRecentlyConnectedBlocksBytes = 0;
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
     nSyncStarted = 0;
@@ -5184,14 +6118,15 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 }
 
                 // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CBlockIndex* pindex = LookupBlockIndex(hash);
+                if (pindex == NULL || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
                     CValidationState state;
                     if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
                         nLoaded++;
                     if (state.IsError())
                         break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
                 }
 
                 // Recursively process earlier encountered successors of this block
@@ -5244,6 +6179,12 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         return;
     }
 
+    // The blocks of a loaded UTXO set snapshot have no data, which breaks
+    // most of the invariants below.
+    if (pindexSnapshotBase) {
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
@@ -5469,7 +6410,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -5500,6 +6441,16 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // A peer asking for an old block is unlikely to have
+                        // its transactions in its mempool, so send it in full.
+                        if (mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
+                            CBlockHeaderAndShortTxIDs cmpctblock(block);
+                            pfrom->PushMessage("cmpctblock", cmpctblock);
+                        } else
+                            pfrom->PushMessage("block", block);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
@@ -5577,7 +6528,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5596,7 +6547,33 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+/**
+ * Process a block received from pfrom, whether sent in full or rebuilt from
+ * a compact block, and punish the peer if it is invalid.
+ */
+void static ProcessBlockFromPeer(CNode* pfrom, const CChainParams& chainparams, const CBlock& block, bool fForceProcessing, const string& strCommand)
+{
+    CValidationState state;
+    ProcessNewBlock(state, chainparams, pfrom, &block, fForceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+        return;
+    }
+
+    LOCK(cs_main);
+    // The peer gave us our new best block, so it is a good candidate to
+    // push the next ones to us with compact blocks.
+    if (chainActive.Tip()->GetBlockHash() == block.GetHash() && !IsInitialBlockDownload(chainparams))
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom);
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CPreparedMessage* pprepared)
 {
     const CChainParams& chainparams = Params();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5687,6 +6664,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // Potentially mark this peer as a preferred download peer.
         UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
 
+        // Offer transaction reconciliation; it has to be agreed on before verack
+        if (fTxReconciliation && pfrom->nVersion >= TXRECONCILIATION_VERSION && pfrom->fRelayTxes) {
+            pfrom->nReconSalt = GetRand(std::numeric_limits<uint64_t>::max() - 1) + 1;
+            pfrom->PushMessage("sendtxrcncl", TXRECONCILIATION_PROTOCOL_VERSION, pfrom->nReconSalt);
+        }
+
         // Change version
         pfrom->PushMessage("verack");
         pfrom->ssSend.SetVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
@@ -5763,9 +6746,123 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell the peer we understand compact blocks, but don't ask it
+            // to push them to us until it has given us a new best block.
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
+
+        if (pfrom->nVersion >= SENDHEADERS_VERSION) {
+            // Tell our peer we prefer to receive headers rather than inv's
+            // We send this to non-NODE NETWORK peers as well, because even
+            // non-NODE NETWORK peers can announce blocks (such as pruning
+            // nodes)
+            pfrom->PushMessage("sendheaders");
+        }
+    }
+
+
+    else if (strCommand == "sendheaders")
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreferHeaders = true;
+    }
+
+
+    else if (strCommand == "sendtxrcncl")
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nRemoteSalt = 0;
+        vRecv >> nReconVersion >> nRemoteSalt;
+
+        // Only valid between version and verack, and only if we offered it too
+        if (pfrom->fSuccessfullyConnected || pfrom->nReconSalt == 0 || nReconVersion < 1) {
+            LogPrint("net", "ignoring sendtxrcncl from peer=%d\n", pfrom->id);
+        } else {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->txReconciliation) {
+                pfrom->txReconciliation.reset(new CTxReconciliationState(!pfrom->fInbound, pfrom->nReconSalt, nRemoteSalt));
+                LogPrint("net", "reconciling transactions with peer=%d as %s\n", pfrom->id,
+                    pfrom->fInbound ? "responder" : "initiator");
+            }
+        }
+    }
+
+
+    else if (strCommand == "reqrecon")
+    {
+        uint32_t nRemoteSetSize = 0;
+        vRecv >> nRemoteSetSize;
+
+        std::vector<uint256> vFlood;
+        CTxReconSketch sketch;
+        bool fRespond = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (pfrom->txReconciliation && !pfrom->txReconciliation->fInitiator) {
+                sketch = pfrom->txReconciliation->PrepareSketch(nRemoteSetSize, vFlood);
+                fRespond = true;
+            }
+        }
+        if (fRespond) {
+            // A previous round the peer never answered is announced in full
+            BOOST_FOREACH(const uint256& hash, vFlood)
+                pfrom->PushInventory(CInv(MSG_TX, hash));
+            pfrom->PushMessage("sketch", sketch);
+        } else {
+            LogPrint("net", "unexpected reqrecon from peer=%d\n", pfrom->id);
+        }
     }
 
 
+    else if (strCommand == "sketch")
+    {
+        CTxReconSketch sketch;
+        vRecv >> sketch;
+
+        std::vector<uint256> vAnnounce;
+        std::vector<uint32_t> vWanted;
+        bool fAnswer = false, fSuccess = false;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (pfrom->txReconciliation && pfrom->txReconciliation->AwaitingSketch()) {
+                fSuccess = pfrom->txReconciliation->Reconcile(sketch, vAnnounce, vWanted);
+                fAnswer = true;
+            }
+        }
+        if (fAnswer) {
+            LogPrint("net", "reconciliation with peer=%d %s: announcing %u, requesting %u\n", pfrom->id,
+                fSuccess ? "succeeded" : "failed", vAnnounce.size(), vWanted.size());
+            BOOST_FOREACH(const uint256& hash, vAnnounce)
+                pfrom->PushInventory(CInv(MSG_TX, hash));
+            pfrom->PushMessage("reconcildiff", fSuccess, vWanted);
+        } else {
+            LogPrint("net", "unexpected sketch from peer=%d\n", pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == "reconcildiff")
+    {
+        bool fSuccess = false;
+        std::vector<uint32_t> vWanted;
+        vRecv >> fSuccess >> vWanted;
+
+        std::vector<uint256> vAnnounce;
+        {
+            LOCK(pfrom->cs_inventory);
+            if (!pfrom->txReconciliation || !pfrom->txReconciliation->FinishReconciliation(fSuccess, vWanted, vAnnounce))
+                LogPrint("net", "unexpected reconcildiff from peer=%d\n", pfrom->id);
+        }
+        BOOST_FOREACH(const uint256& hash, vAnnounce)
+            pfrom->PushInventory(CInv(MSG_TX, hash));
+    }
+
+
+
     // Disconnect existing peer connection when:
     // 1. The version message has been received
     // 2. Peer version is below the minimum version for the current epoch
@@ -5895,9 +6992,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
 
-                    if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                    if (CanDirectFetch(chainparams.GetConsensus()) &&
+                        nodestate->nBlocksInFlight < GetBlocksInFlightLimit(nodestate, pfrom)) {
+                        // Near the tip the peer's block is most likely made of
+                        // transactions in our mempool already.
+                        if (pfrom->fProvidesHeaderAndIDs)
+                            vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                        else
+                            vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -6023,6 +7125,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
+        // pindex can be NULL either if we sent chainActive.Tip() OR
+        // if our peer has chainActive.Tip() (and thus we are sending an empty
+        // headers message). In both cases it's safe to update
+        // pindexBestHeaderSent to be our tip.
+        State(pfrom->GetId())->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         pfrom->PushMessage("headers", vHeaders);
     }
 
@@ -6031,8 +7138,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
-        CTransaction tx;
-        vRecv >> tx;
+        CTransaction txRecv;
+        if (!pprepared)
+            vRecv >> txRecv;
+        const CTransaction& tx = pprepared ? pprepared->GetTransaction() : txRecv;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
@@ -6176,20 +7285,73 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
-        LOCK(cs_main);
-
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peer for more headers.
             return true;
         }
 
+        // The headers we do not have yet, if they chain from one we have
+        std::vector<CBlockHeader> vUnknown;
+        {
+            LOCK(cs_main);
+
+            CNodeState *nodestate = State(pfrom->GetId());
+
+            // If this looks like it could be a block announcement (nCount <
+            // MAX_BLOCKS_TO_ANNOUNCE), use special logic for handling headers that
+            // don't connect:
+            // - Send a getheaders message in response to try to connect the chain.
+            // - The peer can send up to MAX_UNCONNECTING_HEADERS in a row that
+            //   don't connect before giving DoS points
+            // - Once a headers message is received that is valid and does connect,
+            //   nUnconnectingHeaders gets reset back to 0.
+            if (mapBlockIndex.find(headers[0].hashPrevBlock) == mapBlockIndex.end() && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
+                nodestate->nUnconnectingHeaders++;
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                LogPrint("net", "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
+                        headers[0].GetHash().ToString(),
+                        headers[0].hashPrevBlock.ToString(),
+                        pindexBestHeader->nHeight,
+                        pfrom->id, nodestate->nUnconnectingHeaders);
+                // Set hashLastUnknownBlock for this peer, so that if we
+                // eventually get the headers - even from a different peer -
+                // we can use this peer to download.
+                UpdateBlockAvailability(pfrom->GetId(), headers.back().GetHash());
+
+                if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
+                    Misbehaving(pfrom->GetId(), 20);
+                }
+                return true;
+            }
+
+            bool fConnects = mapBlockIndex.count(headers[0].hashPrevBlock) > 0;
+            uint256 hashLast = headers[0].hashPrevBlock;
+            BOOST_FOREACH(const CBlockHeader& header, headers) {
+                if (header.hashPrevBlock != hashLast) {
+                    Misbehaving(pfrom->GetId(), 20);
+                    return error("non-continuous headers sequence");
+                }
+                hashLast = header.GetHash();
+                if (fConnects && !mapBlockIndex.count(hashLast))
+                    vUnknown.push_back(header);
+            }
+        }
+
+        // Check the Equihash solutions of the new headers in parallel,
+        // without cs_main. Valid ones are remembered, so AcceptBlockHeader
+        // does not check them again.
+        if (!CheckEquihashSolutions(vUnknown, chainparams.GetConsensus())) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100);
+            return error("invalid Equihash solution in headers sequence");
+        }
+
+        LOCK(cs_main);
+
+        CNodeState *nodestate = State(pfrom->GetId());
         CBlockIndex *pindexLast = NULL;
         BOOST_FOREACH(const CBlockHeader& header, headers) {
             CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
-                Misbehaving(pfrom->GetId(), 20);
-                return error("non-continuous headers sequence");
-            }
             if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
@@ -6200,10 +7362,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
-        if (pindexLast)
-            UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
+        nodestate->nUnconnectingHeaders = 0;
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (!pindexLast)
+            return true;
+        UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
+
+        if (nCount == MAX_HEADERS_RESULTS) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -6211,36 +7376,270 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256());
         }
 
+        // If this set of headers is valid and ends in a block with at least as
+        // much work as our tip, download as much as possible.
+        if (CanDirectFetch(chainparams.GetConsensus()) && pindexLast->IsValid(BLOCK_VALID_TREE) && chainActive.Tip()->nChainWork <= pindexLast->nChainWork) {
+            vector<CBlockIndex *> vToFetch;
+            CBlockIndex *pindexWalk = pindexLast;
+            int nMaxInFlight = GetBlocksInFlightLimit(nodestate, pfrom);
+            // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= (size_t)nMaxInFlight) {
+                if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
+                        !mapBlocksInFlight.count(pindexWalk->GetBlockHash())) {
+                    // We don't have this block, and it's not yet in flight.
+                    vToFetch.push_back(pindexWalk);
+                }
+                pindexWalk = pindexWalk->pprev;
+            }
+            // If pindexWalk still isn't on our main chain, we're looking at a
+            // very large reorg at a time we think we're close to caught up to
+            // the main chain -- this shouldn't really happen. Bail out on the
+            // direct fetch and rely on parallel download instead.
+            if (!chainActive.Contains(pindexWalk)) {
+                LogPrint("net", "Large reorg, won't direct fetch to %s (%d)\n",
+                        pindexLast->GetBlockHash().ToString(),
+                        pindexLast->nHeight);
+            } else {
+                vector<CInv> vGetData;
+                // Download as much as possible, from earliest to latest.
+                BOOST_REVERSE_FOREACH(CBlockIndex *pindex, vToFetch) {
+                    if (nodestate->nBlocksInFlight >= nMaxInFlight) {
+                        // Can't download any more from this peer
+                        break;
+                    }
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex);
+                    LogPrint("net", "Requesting block %s from peer=%d\n",
+                            pindex->GetBlockHash().ToString(), pfrom->id);
+                }
+                if (vGetData.size() > 1) {
+                    LogPrint("net", "Downloading blocks toward %s (%d) via headers direct fetch\n",
+                            pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
+                }
+                if (vGetData.size() > 0) {
+                    if (vGetData.size() == 1 && pfrom->fProvidesHeaderAndIDs && pindexLast->pprev == chainActive.Tip()) {
+                        // A single block on top of our tip: a compact block saves
+                        // sending the transactions we already have
+                        vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                    }
+                    pfrom->PushMessage("getdata", vGetData);
+                }
+            }
+        }
+
         CheckBlockIndex(chainparams.GetConsensus());
     }
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
-        vRecv >> block;
+        CBlock blockRecv;
+        if (!pprepared)
+            vRecv >> blockRecv;
+        const CBlock& block = pprepared ? pprepared->GetBlock() : blockRecv;
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload(chainparams);
-        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        ProcessBlockFromPeer(pfrom, chainparams, block, forceProcessing, strCommand);
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // Ignore versions we don't know, the peer may offer several
+        if (nCMPCTBLOCKVersion == 1) {
+            pfrom->fProvidesHeaderAndIDs = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect to what we know; ask for the headers in between
+                if (!IsInitialBlockDownload(chainparams))
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                    return true;
+                }
+            }
+            assert(pindex);
+            const uint256 hash = pindex->GetBlockHash();
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            bool fAlreadyInFlight = itInFlight != mapBlocksInFlight.end();
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+                return true;
+
+            if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                    pindex->nHeight > chainActive.Height() + 2) {      // Our mempool won't help much
+                if (fAlreadyInFlight) {
+                    // We asked for this block, so get it the usual way
+                    vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                    pfrom->PushMessage("getdata", vInv);
+                }
+                return true;
+            }
+
+            // Unless we asked for it, only use an unsolicited compact block
+            // when we are close to the tip, and don't let it take over a
+            // request already sent to another peer.
+            if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
+                return true;
+            if (fAlreadyInFlight ? itInFlight->second.first != pfrom->GetId() :
+                    State(pfrom->GetId())->nBlocksInFlight >= GetBlocksInFlightLimit(State(pfrom->GetId()), pfrom))
+                return true;
+
+            list<QueuedBlock>::iterator* queuedBlockIt = NULL;
+            MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex, &queuedBlockIt);
+            if ((*queuedBlockIt)->partialBlock) {
+                LogPrint("net", "Peer %d sent us a compact block we were already syncing\n", pfrom->id);
+                return true;
+            }
+            (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+
+            PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+            ReadStatus status = partialBlock.InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Duplicate short ids; the block is in flight, so just request it in full
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                req.blockhash = hash;
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+
+            // We had every transaction
+            status = partialBlock.FillBlock(block, vector<CTransaction>());
+            if (status == READ_STATUS_OK) {
+                fBlockReconstructed = true;
+            } else {
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
             }
         }
 
+        if (fBlockReconstructed)
+            ProcessBlockFromPeer(pfrom, chainparams, block, true, strCommand);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+            ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+            } else {
+                fBlockReconstructed = true;
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessBlockFromPeer(pfrom, chainparams, block, true, strCommand);
     }
 
 
@@ -6550,8 +7949,9 @@ bool ProcessMessages(CNode* pfrom)
         //            msg.hdr.nMessageSize, msg.vRecv.size(),
         //            msg.complete() ? "Y" : "N");
 
-        // end, if an incomplete message is found
-        if (!msg.complete())
+        // end, if an incomplete message is found, or one still being checked
+        // by the preprocessing threads
+        if (!msg.ready())
             break;
 
         // at this point, any failure means we can delete the current message
@@ -6576,10 +7976,17 @@ bool ProcessMessages(CNode* pfrom)
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
 
-        // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
+        // Checksum, unless the preprocessing threads already verified it
+        CPreparedMessage* pprepared = msg.prepared.get();
+        CDataStream& vRecv = pprepared ? pprepared->vRecv : msg.vRecv;
+        unsigned int nChecksum;
+        if (pprepared) {
+            vRecv.SetVersion(pfrom->nRecvVersion);
+            nChecksum = pprepared->nChecksumComputed;
+        } else {
+            uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+            nChecksum = ReadLE32((unsigned char*)&hash);
+        }
         if (nChecksum != hdr.nChecksum)
         {
             LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
@@ -6589,9 +7996,10 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, pprepared);
             boost::this_thread::interruption_point();
         }
         catch (const std::ios_base::failure& e)
@@ -6620,6 +8028,7 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        pfrom->RecordMsgProcessTime(strCommand, GetTimeMicros() - nProcessStart);
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -6628,8 +8037,14 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itDone = pfrom->vRecvMsg.begin(); itDone != it; ++itDone)
+            itDone->ReleaseBuffer();
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+        // The socket handler stopped reading while the buffer was full
+        if (pfrom->fRecvPaused)
+            pfrom->SocketEventsChanged();
+    }
 
     return fOk;
 }
@@ -6764,6 +8179,123 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             GetMainSignals().Broadcast(nTimeBestReceived);
         }
 
+        //
+        // Try sending block announcements via headers
+        //
+        {
+            // If we have less than MAX_BLOCKS_TO_ANNOUNCE in our
+            // list of block hashes we're relaying, and our peer wants
+            // headers announcements, then find the first header
+            // not yet known to our peer but would connect, and send.
+            // If no header would connect, or if we have too many
+            // blocks, or if the peer doesn't want headers, just
+            // add all to the inv queue.
+            LOCK(pto->cs_inventory);
+            vector<CBlock> vHeaders;
+            bool fRevertToInv = (!state.fPreferHeaders || pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
+            CBlockIndex *pBestIndex = NULL; // last header queued for delivery
+            ProcessBlockAvailability(pto->id); // ensure pindexBestKnownBlock is up-to-date
+
+            if (!fRevertToInv) {
+                bool fFoundStartingHeader = false;
+                // Try to find first header that our peer doesn't have, and
+                // then send all headers past that one.  If we come across any
+                // headers that aren't on chainActive, give up.
+                BOOST_FOREACH(const uint256 &hash, pto->vBlockHashesToAnnounce) {
+                    BlockMap::iterator mi = mapBlockIndex.find(hash);
+                    assert(mi != mapBlockIndex.end());
+                    CBlockIndex *pindex = mi->second;
+                    if (chainActive[pindex->nHeight] != pindex) {
+                        // Bail out if we reorged away from this block
+                        fRevertToInv = true;
+                        break;
+                    }
+                    if (pBestIndex != NULL && pindex->pprev != pBestIndex) {
+                        // This means that the list of blocks to announce don't
+                        // connect to each other.
+                        // This shouldn't really be possible to hit during
+                        // regular operation (because reorgs should take us to
+                        // a chain that has some block not on the prior chain,
+                        // which should be caught by the prior check), but one
+                        // way this could happen is by using invalidateblock /
+                        // reconsiderblock repeatedly on the tip, causing it to
+                        // be added multiple times to vBlockHashesToAnnounce.
+                        // Robustly deal with this rare situation by reverting
+                        // to an inv.
+                        fRevertToInv = true;
+                        break;
+                    }
+                    pBestIndex = pindex;
+                    if (fFoundStartingHeader) {
+                        // add this to the headers message
+                        vHeaders.push_back(pindex->GetBlockHeader());
+                    } else if (PeerHasHeader(&state, pindex)) {
+                        continue; // keep looking for the first new block
+                    } else if (pindex->pprev == NULL || PeerHasHeader(&state, pindex->pprev)) {
+                        // Peer doesn't have this header but they do have the prior one.
+                        // Start sending headers.
+                        fFoundStartingHeader = true;
+                        vHeaders.push_back(pindex->GetBlockHeader());
+                    } else {
+                        // Peer doesn't have this header or the prior one -- nothing will
+                        // connect, so bail out.
+                        fRevertToInv = true;
+                        break;
+                    }
+                }
+            }
+            if (fRevertToInv) {
+                // If falling back to using an inv, just try to inv the tip.
+                // The last entry in vBlockHashesToAnnounce was our tip at some point
+                // in the past.
+                if (!pto->vBlockHashesToAnnounce.empty()) {
+                    const uint256 &hashToAnnounce = pto->vBlockHashesToAnnounce.back();
+                    BlockMap::iterator mi = mapBlockIndex.find(hashToAnnounce);
+                    assert(mi != mapBlockIndex.end());
+                    CBlockIndex *pindex = mi->second;
+
+                    // Warn if we're announcing a block that is not on the main chain.
+                    // This should be very rare and could be optimized out.
+                    // Just log for now.
+                    if (chainActive[pindex->nHeight] != pindex) {
+                        LogPrint("net", "Announcing block %s not on main chain (tip=%s)\n",
+                            hashToAnnounce.ToString(), chainActive.Tip()->GetBlockHash().ToString());
+                    }
+
+                    // If the peer announced this block to us, don't inv it back.
+                    // (Since block announcements may not be via inv's, we can't solely rely on
+                    // setInventoryKnown to track this.)
+                    if (!PeerHasHeader(&state, pindex)) {
+                        pto->PushInventory(CInv(MSG_BLOCK, hashToAnnounce));
+                        LogPrint("net", "%s: sending inv peer=%d hash=%s\n", __func__,
+                            pto->id, hashToAnnounce.ToString());
+                    }
+                }
+            } else if (!vHeaders.empty()) {
+                if (vHeaders.size() > 1) {
+                    LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
+                            vHeaders.size(),
+                            vHeaders.front().GetHash().ToString(),
+                            vHeaders.back().GetHash().ToString(), pto->id);
+                } else {
+                    LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
+                            vHeaders.front().GetHash().ToString(), pto->id);
+                }
+                pto->PushMessage("headers", vHeaders);
+                state.pindexBestHeaderSent = pBestIndex;
+            }
+            pto->vBlockHashesToAnnounce.clear();
+        }
+
+        //
+        // Message: reconciliation request
+        //
+        {
+            LOCK(pto->cs_inventory);
+            if (pto->txReconciliation && pto->txReconciliation->ShouldRequest(GetTime()))
+                pto->PushMessage("reqrecon", (uint32_t)pto->txReconciliation->SetSize());
+        }
+
         //
         // Message: inventory
         //
@@ -6814,12 +8346,18 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
         // Detect whether we're stalling
         int64_t nNow = GetTimeMicros();
-        if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * nBlockStallingTimeout) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
             LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
             pto->fDisconnect = true;
+            // Give the next peer longer, so that we don't disconnect one
+            // after another if our own bandwidth is what holds them back
+            if (nBlockStallingTimeout < BLOCK_STALLING_TIMEOUT_MAX) {
+                nBlockStallingTimeout = std::min(BLOCK_STALLING_TIMEOUT_MAX, 2 * nBlockStallingTimeout);
+                LogPrint("net", "Increased block stalling timeout to %d seconds\n", nBlockStallingTimeout);
+            }
         }
         // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
         // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
@@ -6848,22 +8386,53 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nMaxInFlight = GetBlocksInFlightLimit(&state, pto);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(chainParams)) && state.nBlocksInFlight < nMaxInFlight) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStalling = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nMaxInFlight - state.nBlocksInFlight, vToDownload, staller, pindexStalling);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
-                vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                if (pto->fProvidesHeaderAndIDs && pindex->pprev == chainActive.Tip() && !IsInitialBlockDownload(chainParams))
+                    vGetData.push_back(CInv(MSG_CMPCT_BLOCK, pindex->GetBlockHash()));
+                else
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                CNodeState *stallerState = State(staller);
+                map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itStalling =
+                    pindexStalling ? mapBlocksInFlight.find(pindexStalling->GetBlockHash()) : mapBlocksInFlight.end();
+                if (itStalling != mapBlocksInFlight.end() && itStalling->second.first == staller &&
+                    itStalling->second.second->nTime < nNow - 1000000 * nBlockStallingTimeout) {
+                    // The block holding back the download window has been
+                    // outstanding for a while; ask this idle peer for it
+                    // instead, and shrink the staller's window so it is
+                    // not handed as much work next time.
+                    int64_t nOutstanding = nNow - itStalling->second.second->nTime;
+                    stallerState->nAvgBlockDeliveryTime = std::max(stallerState->nAvgBlockDeliveryTime * 2, nOutstanding);
+                    LogPrint("net", "Reassigning stalled block %s (%d) from peer=%d to peer=%d\n",
+                        pindexStalling->GetBlockHash().ToString(), pindexStalling->nHeight, staller, pto->id);
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStalling->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalling->GetBlockHash(), consensusParams, pindexStalling);
+                } else if (stallerState->nStallingSince == 0) {
+                    stallerState->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
+            // Blocks below a loaded snapshot get what is left of the window
+            if (pindexSnapshotBase && state.nBlocksInFlight < nMaxInFlight) {
+                vToDownload.clear();
+                FindHistoricalBlocksToDownload(pto->GetId(), nMaxInFlight - state.nBlocksInFlight, vToDownload);
+                BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
+                    LogPrint("net", "Requesting historical block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
+                        pindex->nHeight, pto->id);
+                }
+            }
         }
 
         //
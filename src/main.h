@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -84,10 +85,36 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of block hashes whose Equihash solution is remembered as valid */
+static const unsigned int EQUIHASH_CACHE_SIZE = 20000;
+/** Memory for the outputs of connected blocks queued for the UTXO set hash before it is dropped */
+static const size_t MAX_TXOUTSET_COMMITMENT_PENDING_BYTES = 64 * 1024 * 1024;
+/** Most threads a gettxoutsetinfo scan of the coins database uses */
+static const int MAX_TXOUTSET_STATS_THREADS = 16;
+/** Serialized size of the connected blocks kept in memory until the wallets are notified of them */
+static const size_t MAX_NOTIFY_BLOCK_CACHE_BYTES = 32 * 1024 * 1024;
+/** Number of blocks that can be requested at any given time from a single peer, until its download rate
+ *  has been measured. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 32;
-/** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
-static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Bounds of the per-peer download window during parallel block download, which adapts to the rate at
+ *  which the peer delivers blocks and its round trip time. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Timeout in seconds during which a peer must stall block download progress before being disconnected.
+ *  It doubles, up to the maximum, each time a peer is disconnected for stalling, in case our own link is
+ *  the bottleneck, and shrinks back as blocks are connected. */
+static const int64_t BLOCK_STALLING_TIMEOUT_DEFAULT = 2;
+static const int64_t BLOCK_STALLING_TIMEOUT_MAX = 64;
+/** Maximum number of headers to announce when relaying blocks with headers message. */
+static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
+/** Maximum number of unconnecting headers announcements before DoS score */
+static const int MAX_UNCONNECTING_HEADERS = 10;
+/** Number of peers we ask to announce new blocks to us with cmpctblock messages (BIP 152 high-bandwidth mode). */
+static const unsigned int MAX_CMPCTBLOCK_HB_PEERS = 3;
+/** Maximum depth of a block requested with MSG_CMPCT_BLOCK that is answered with a cmpctblock rather than the full block. */
+static const int MAX_CMPCTBLOCK_DEPTH = 10;
+/** Maximum depth of a block whose transactions are served in response to getblocktxn. */
+static const int MAX_BLOCKTXN_DEPTH = 15;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 1000;
@@ -100,6 +127,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of -dbcache the most recently used coins may keep after a flush of the chainstate. */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const unsigned int DEFAULT_LIMITFREERELAY = 15;
@@ -133,6 +162,11 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+/**
+ * Guards mapBlockIndex for readers that do not hold cs_main. Writers hold
+ * both cs_main and this, so readers holding either one are safe.
+ */
+extern CCriticalSection cs_mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -158,6 +192,8 @@ extern bool fTimestampIndex;
 // END insightexplorer
 
 extern bool fIsBareMultisigStd;
+/** Offer transaction reconciliation to peers that support it */
+extern bool fTxReconciliation;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 // TODO: remove this flag by structuring our code such that
@@ -246,6 +282,15 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Equihash checking thread */
+void ThreadEquihashCheck();
+/**
+ * Check the Equihash solutions of many headers at once, on the Equihash
+ * checking threads if there are any. Returns false as soon as one is found
+ * invalid, leaving the rest unchecked. Valid ones are remembered, so
+ * CheckBlockHeader does not check them again.
+ */
+bool CheckEquihashSolutions(const std::vector<CBlockHeader>& vHeaders, const Consensus::Params& params);
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(const CChainParams&), CCriticalSection& cs, const CBlockIndex *const &bestHeader);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -284,6 +329,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Number of blocks to keep in flight from a peer, given the time in microseconds it takes to deliver one and its round trip time. */
+int GetBlocksInFlightLimit(int64_t nAvgBlockDeliveryTime, int64_t nPingUsecTime);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
@@ -502,12 +549,66 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * The tip of chainActive as of the last completed tip change. Readers that
+ * only need the active chain, such as the chain query RPCs, use this instead
+ * of taking cs_main, so they do not wait on block validation.
+ */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
+/**
+ * Look up a block index entry by hash without holding cs_main. Returns NULL
+ * if the block is not known. Entries are never freed while running, so the
+ * pointer stays valid; fields other than the header, height and ancestry
+ * (nStatus, nTx, ...) still require cs_main.
+ */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** The chainstate database under pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/**
+ * Replace the chainstate with a UTXO set snapshot from dumptxoutset, and
+ * make the block it was taken at the tip of the active chain. The snapshot
+ * must be listed in the chain parameters and its block header known, ahead
+ * of the current tip. Blocks up to it are then treated as validated, and the
+ * chain cannot be reorganized below it, until ThreadValidateHistoricalBlocks
+ * has downloaded and connected them and found that they lead to the same
+ * UTXO set.
+ */
+bool ActivateTxOutSetSnapshot(CAutoFile& file, const CChainParams& chainparams, CTxOutSetSnapshotMetadata& metadata,
+                              uint64_t& nRecords, std::string& strError);
+
+/**
+ * Statistics of the UTXO set at the tip for gettxoutsetinfo. They are
+ * cached until the tip changes. Otherwise the coins database is scanned,
+ * in parallel unless hashType is HASH_SERIALIZED, without holding cs_main;
+ * a MUHASH scan also starts a hash that later blocks keep up to date, so
+ * that the next MUHASH call does not need to scan. That one leaves
+ * nSerializedSize unset.
+ */
+bool GetTxOutSetStats(TxOutSetHashType hashType, CCoinsStats& stats);
+
+/**
+ * The block a loaded UTXO set snapshot was taken at, or NULL once the blocks
+ * below it are validated (protected by cs_main)
+ */
+CBlockIndex* GetSnapshotBase();
+/** The last block below the snapshot base validated so far, or NULL (protected by cs_main) */
+CBlockIndex* GetHistoricalTip();
+/**
+ * Run the thread that connects the blocks below a loaded snapshot, as they
+ * are downloaded, to a chainstate of their own in chainstate_historical/,
+ * and checks the result against the snapshot.
+ */
+void ThreadValidateHistoricalBlocks();
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -524,6 +625,8 @@ uint64_t CalculateCurrentUsage();
 CMutableTransaction CreateNewContextualCMutableTransaction(const Consensus::Params& consensusParams, int nHeight);
 
 std::pair<std::map<CBlockIndex*, std::list<CTransaction>>, uint64_t> DrainRecentlyConflicted();
+/** The blocks ConnectTip kept for ThreadNotifyWallets since the last call. */
+std::map<CBlockIndex*, std::shared_ptr<const CBlock>> DrainRecentlyConnectedBlocks();
 void SetChainNotifiedSequence(uint64_t recentlyConflictedSequence);
 bool ChainIsFullyNotified();
 
@@ -441,6 +441,25 @@ int printMiningStatus(bool mining)
 #endif // !ENABLE_MINING
 }
 
+// The three message commands with the largest value of f(sent, received)
+template <typename F>
+static std::vector<std::pair<int64_t, std::string> > TopMessageTypes(const mapMsgCmdStats& mapSent, const mapMsgCmdStats& mapRecv, F f)
+{
+    std::vector<std::pair<int64_t, std::string> > vTop;
+    for (const std::string& strCommand : getAllNetMessageTypes()) {
+        mapMsgCmdStats::const_iterator itSent = mapSent.find(strCommand);
+        mapMsgCmdStats::const_iterator itRecv = mapRecv.find(strCommand);
+        int64_t nValue = f(itSent != mapSent.end() ? itSent->second : CNetMsgStats(),
+                           itRecv != mapRecv.end() ? itRecv->second : CNetMsgStats());
+        if (nValue > 0)
+            vTop.push_back(std::make_pair(nValue, strCommand));
+    }
+    std::sort(vTop.rbegin(), vTop.rend());
+    if (vTop.size() > 3)
+        vTop.resize(3);
+    return vTop;
+}
+
 int printMetrics(size_t cols, bool mining)
 {
     // Number of lines that are always displayed
@@ -462,6 +481,29 @@ int printMetrics(size_t cols, bool mining)
       std::cout << "- " << _("You have validated no transactions.") << std::endl;
     }
 
+    mapMsgCmdStats mapSent, mapRecv;
+    CNode::GetTotalMsgStats(mapSent, mapRecv);
+    auto topTraffic = TopMessageTypes(mapSent, mapRecv, [](const CNetMsgStats& sent, const CNetMsgStats& recv) {
+        return (int64_t)(sent.nBytes + recv.nBytes);
+    });
+    if (!topTraffic.empty()) {
+        std::vector<std::string> vParts;
+        for (const auto& top : topTraffic)
+            vParts.push_back(strprintf("%s %s", top.second, DisplaySize(top.first)));
+        std::cout << "- " << strprintf(_("Most network traffic: %s"), boost::algorithm::join(vParts, ", ")) << std::endl;
+        lines++;
+    }
+    auto topProcessTime = TopMessageTypes(mapSent, mapRecv, [](const CNetMsgStats& sent, const CNetMsgStats& recv) {
+        return recv.nProcessTimeMicros;
+    });
+    if (!topProcessTime.empty()) {
+        std::vector<std::string> vParts;
+        for (const auto& top : topProcessTime)
+            vParts.push_back(strprintf("%s %.3fs", top.second, top.first / 1e6));
+        std::cout << "- " << strprintf(_("Most message processing time: %s"), boost::algorithm::join(vParts, ", ")) << std::endl;
+        lines++;
+    }
+
     if (mining && loaded) {
         std::cout << "- " << strprintf(_("You have completed %d Equihash solver runs."), ehSolverRuns.get()) << std::endl;
         lines++;
@@ -480,9 +522,9 @@ int printMetrics(size_t cols, bool mining)
             std::list<uint256>::iterator it = u->begin();
             while (it != u->end()) {
                 auto hash = *it;
-                if (mapBlockIndex.count(hash) > 0 &&
-                        chainActive.Contains(mapBlockIndex[hash])) {
-                    int height = mapBlockIndex[hash]->nHeight;
+                CBlockIndex* pindex = LookupBlockIndex(hash);
+                if (pindex && chainActive.Contains(pindex)) {
+                    int height = pindex->nHeight;
                     CAmount subsidy = GetBlockSubsidy(height, consensusParams);
                     if ((height > 0) && (height <= consensusParams.GetLastFoundersRewardBlockHeight(height))) {
                         subsidy -= subsidy/5;
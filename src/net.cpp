@@ -13,8 +13,10 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "socketevents.h"
 #include "ui_interface.h"
 #include "crypto/common.h"
 
@@ -66,6 +68,7 @@ bool fListen = true;
 uint64_t nLocalServices = NODE_NETWORK;
 CCriticalSection cs_mapLocalHost;
 map<CNetAddr, LocalServiceInfo> mapLocalHost;
+CNetBufferPool netBufferPool;
 static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
@@ -77,6 +80,8 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
+static vector<NodeId> vNodesEventsChanged; // see CNode::SocketEventsChanged()
+static CCriticalSection cs_vNodesEventsChanged;
 map<CInv, CDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
@@ -97,6 +102,12 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 static boost::condition_variable messageHandlerCondition;
 
+// Messages waiting for the preprocessing threads, oldest first
+static boost::mutex cs_vPrepareQueue;
+static boost::condition_variable prepareQueueCondition;
+static std::deque<std::shared_ptr<CPreparedMessage> > vPrepareQueue;
+static int nMessagePrepThreads = 0;
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -317,6 +328,9 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_totalMsgStats;
+mapMsgCmdStats CNode::mapTotalSendMsgStats;
+mapMsgCmdStats CNode::mapTotalRecvMsgStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -396,6 +410,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
         }
+        pnode->SocketEventsChanged();
 
         pnode->nTimeConnected = GetTime();
 
@@ -424,6 +439,14 @@ void CNode::CloseSocketDisconnect()
         vRecvMsg.clear();
 }
 
+void CNode::SocketEventsChanged()
+{
+    if (fSocketEventsChanged.exchange(true))
+        return;
+    LOCK(cs_vNodesEventsChanged);
+    vNodesEventsChanged.push_back(id);
+}
+
 void CNode::PushVersion()
 {
     int nBestHeight = g_signals.GetHeight().get_value_or(0);
@@ -553,6 +576,15 @@ void CNode::copyStats(CNodeStats &stats)
     stats.nSendBytes = nSendBytes;
     stats.nRecvBytes = nRecvBytes;
     stats.fWhitelisted = fWhitelisted;
+    {
+        LOCK(cs_inventory);
+        stats.fTxReconciliation = txReconciliation != NULL;
+    }
+    {
+        LOCK(cs_msgStats);
+        stats.mapSendMsgStats = mapSendMsgStats;
+        stats.mapRecvMsgStats = mapRecvMsgStats;
+    }
 
     // It is common for nodes with good ping times to suddenly become lagged,
     // due to a new block arriving or other large transfer.
@@ -573,6 +605,33 @@ void CNode::copyStats(CNodeStats &stats)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
 }
 
+// Hand a complete message to the preprocessing threads if it is worth
+// it. The message handler is notified once it is ready.
+static bool QueueMessagePreparation(CNetMessage& msg)
+{
+    if (nMessagePrepThreads == 0)
+        return false;
+    std::string strCommand = msg.hdr.GetCommand();
+    if (strCommand != "tx" && strCommand != "block" && msg.hdr.nMessageSize < MIN_PREPARED_MESSAGE_SIZE)
+        return false;
+
+    msg.prepared = std::make_shared<CPreparedMessage>(std::move(msg.vRecv), msg.hdr);
+    msg.vRecv.clear();
+    {
+        boost::unique_lock<boost::mutex> lock(cs_vPrepareQueue);
+        vPrepareQueue.push_back(msg.prepared);
+    }
+    prepareQueueCondition.notify_one();
+    return true;
+}
+
+static void MessageComplete(CNetMessage& msg)
+{
+    msg.nTime = GetTimeMicros();
+    if (!QueueMessagePreparation(msg))
+        messageHandlerCondition.notify_one();
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 {
@@ -604,14 +663,33 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         nBytes -= handled;
 
         if (msg.complete()) {
-            msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            RecordMsgRecv(msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize);
+            MessageComplete(msg);
         }
     }
 
     return true;
 }
 
+// requires LOCK(cs_vRecvMsg)
+char* CNode::GetDirectRecvBuffer(unsigned int& nMax)
+{
+    if (vRecvMsg.empty() || vRecvMsg.back().complete())
+        return NULL;
+    return vRecvMsg.back().GetDataBuffer(nMax);
+}
+
+// requires LOCK(cs_vRecvMsg)
+void CNode::DirectRecvBytes(unsigned int nBytes)
+{
+    CNetMessage& msg = vRecvMsg.back();
+    msg.DataReceived(nBytes);
+    if (msg.complete()) {
+        RecordMsgRecv(msg.hdr.GetCommand(), CMessageHeader::HEADER_SIZE + msg.hdr.nMessageSize);
+        MessageComplete(msg);
+    }
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -640,9 +718,171 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    // Receive into a recycled buffer that is already large enough, if there is one
+    if (hdr.nMessageSize > 0 && hdr.nMessageSize <= MAX_PROTOCOL_MESSAGE_LENGTH) {
+        CSerializeData buf;
+        if (netBufferPool.Get(buf, hdr.nMessageSize))
+            vRecv.swap(buf);
+    }
+
     return nCopy;
 }
 
+CPreparedMessage::CPreparedMessage(CDataStream&& vRecvIn, const CMessageHeader& hdr) :
+    vRecv(std::move(vRecvIn)), strCommand(hdr.GetCommand()), nChecksum(hdr.nChecksum),
+    nChecksumComputed(0), fChecksumValid(false), fReady(false), fIosFailure(false)
+{
+}
+
+void CPreparedMessage::Prepare()
+{
+    uint256 hash = Hash(vRecv.begin(), vRecv.end());
+    nChecksumComputed = ReadLE32((unsigned char*)&hash);
+    fChecksumValid = (nChecksumComputed == nChecksum);
+
+    // The encoding of transactions and blocks does not depend on the
+    // protocol version, so they can be read before the handler has seen
+    // the peer's version message.
+    if (fChecksumValid) {
+        try {
+            if (strCommand == "tx") {
+                std::shared_ptr<CTransaction> ptx = std::make_shared<CTransaction>();
+                vRecv >> *ptx;
+                tx = ptx;
+            } else if (strCommand == "block") {
+                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                vRecv >> *pblock;
+                block = pblock;
+            }
+        } catch (const std::ios_base::failure& e) {
+            strError = e.what();
+            fIosFailure = true;
+        } catch (const std::exception& e) {
+            strError = e.what();
+        }
+    }
+
+    fReady = true;
+}
+
+void CPreparedMessage::ThrowError() const
+{
+    if (fIosFailure)
+        throw std::ios_base::failure(strError);
+    throw std::runtime_error(strError);
+}
+
+const CTransaction& CPreparedMessage::GetTransaction() const
+{
+    assert(fReady);
+    if (!tx)
+        ThrowError();
+    return *tx;
+}
+
+const CBlock& CPreparedMessage::GetBlock() const
+{
+    assert(fReady);
+    if (!block)
+        ThrowError();
+    return *block;
+}
+
+char* CNetMessage::GetDataBuffer(unsigned int& nMax)
+{
+    if (!in_data || hdr.nMessageSize - nDataPos < MIN_DIRECT_RECV_SIZE)
+        return NULL;
+
+    if (vRecv.size() < nDataPos + MIN_DIRECT_RECV_SIZE) {
+        // Allocate up to 256 KiB ahead, as readData does
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + 256 * 1024));
+    }
+    nMax = vRecv.size() - nDataPos;
+    return &vRecv[nDataPos];
+}
+
+void CNetMessage::ReleaseBuffer()
+{
+    if (prepared && !prepared->fReady)
+        return;
+    CSerializeData buf;
+    (prepared ? prepared->vRecv : vRecv).swap(buf);
+    netBufferPool.Put(buf);
+}
+
+void CNetBufferPool::Take(std::vector<CSerializeData>& vList, std::vector<CSerializeData>::iterator it, CSerializeData& buf)
+{
+    nFreeBytes -= it->capacity();
+    buf.clear();
+    buf.swap(*it);
+    if (it != vList.end() - 1)
+        it->swap(vList.back());
+    vList.pop_back();
+}
+
+static std::vector<CSerializeData>::iterator BestFitNetBuffer(std::vector<CSerializeData>& vList, size_t nMinCapacity)
+{
+    std::vector<CSerializeData>::iterator itBest = vList.end();
+    for (std::vector<CSerializeData>::iterator it = vList.begin(); it != vList.end(); ++it) {
+        if (it->capacity() >= nMinCapacity && (itBest == vList.end() || it->capacity() < itBest->capacity()))
+            itBest = it;
+    }
+    return itBest;
+}
+
+bool CNetBufferPool::Get(CSerializeData& buf, size_t nMinCapacity)
+{
+    LOCK(cs);
+    // Best fit, so small messages don't take the buffers sized for blocks.
+    // The last small buffer put back usually fits, and is taken without
+    // searching.
+    if (nMinCapacity <= MAX_SMALL_NET_BUFFER_SIZE && !vFreeSmall.empty()) {
+        std::vector<CSerializeData>::iterator it = vFreeSmall.end() - 1;
+        if (it->capacity() < nMinCapacity)
+            it = BestFitNetBuffer(vFreeSmall, nMinCapacity);
+        if (it != vFreeSmall.end()) {
+            Take(vFreeSmall, it, buf);
+            return true;
+        }
+    }
+    std::vector<CSerializeData>::iterator it = BestFitNetBuffer(vFree, nMinCapacity);
+    if (it == vFree.end())
+        return false;
+    Take(vFree, it, buf);
+    return true;
+}
+
+bool CNetBufferPool::GetSmall(CSerializeData& buf)
+{
+    LOCK(cs);
+    if (vFreeSmall.empty())
+        return false;
+    Take(vFreeSmall, vFreeSmall.end() - 1, buf);
+    return true;
+}
+
+void CNetBufferPool::Put(CSerializeData& buf)
+{
+    size_t nCapacity = buf.capacity();
+    if (nCapacity == 0 || nCapacity > MAX_PROTOCOL_MESSAGE_LENGTH + CMessageHeader::HEADER_SIZE)
+        return;
+
+    LOCK(cs);
+    if (vFree.size() + vFreeSmall.size() >= MAX_POOLED_NET_BUFFERS || nFreeBytes + nCapacity > MAX_POOLED_NET_BUFFER_BYTES)
+        return;
+    std::vector<CSerializeData>& vList = nCapacity <= MAX_SMALL_NET_BUFFER_SIZE ? vFreeSmall : vFree;
+    buf.clear();
+    vList.push_back(CSerializeData());
+    vList.back().swap(buf);
+    nFreeBytes += nCapacity;
+}
+
+size_t CNetBufferPool::Size()
+{
+    LOCK(cs);
+    return vFree.size() + vFreeSmall.size();
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
@@ -667,25 +907,112 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
-// requires LOCK(cs_vSend)
-void SocketSendData(CNode *pnode)
+// Whether a serialized vector<CInv> has a block in it
+static bool InvHasBlock(const char* pchPayload, size_t nPayloadSize)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    if (nPayloadSize == 0)
+        return false;
+    // The count, as a compact size, then the entries, type first
+    unsigned char chSize = pchPayload[0];
+    size_t nOffset = (chSize < 253 ? 1 : chSize == 253 ? 3 : chSize == 254 ? 5 : 9);
+    const size_t nInvSize = 4 + 32;
+    for (; nOffset + nInvSize <= nPayloadSize; nOffset += nInvSize) {
+        if (ReadLE32((const unsigned char*)pchPayload + nOffset) == (uint32_t)MSG_BLOCK)
+            return true;
+    }
+    return false;
+}
+
+SendPriority GetSendPriority(const std::string& strCommand, const char* pchPayload, size_t nPayloadSize)
+{
+    static const std::map<std::string, SendPriority> mapPriority = {
+        {"version", SEND_PRIORITY_CONTROL}, {"verack", SEND_PRIORITY_CONTROL},
+        {"ping", SEND_PRIORITY_CONTROL}, {"pong", SEND_PRIORITY_CONTROL},
+        {"reject", SEND_PRIORITY_CONTROL}, {"sendheaders", SEND_PRIORITY_CONTROL},
+        {"sendcmpct", SEND_PRIORITY_CONTROL}, {"sendtxrcncl", SEND_PRIORITY_CONTROL},
+        {"filterload", SEND_PRIORITY_CONTROL}, {"filteradd", SEND_PRIORITY_CONTROL},
+        {"filterclear", SEND_PRIORITY_CONTROL}, {"getdata", SEND_PRIORITY_CONTROL},
+        {"getheaders", SEND_PRIORITY_CONTROL}, {"getblocks", SEND_PRIORITY_CONTROL},
+        {"getblocktxn", SEND_PRIORITY_CONTROL},
+        {"block", SEND_PRIORITY_BLOCK}, {"cmpctblock", SEND_PRIORITY_BLOCK},
+        {"blocktxn", SEND_PRIORITY_BLOCK}, {"headers", SEND_PRIORITY_BLOCK},
+        {"merkleblock", SEND_PRIORITY_BLOCK},
+        {"tx", SEND_PRIORITY_TX},
+    };
+    std::map<std::string, SendPriority>::const_iterator it = mapPriority.find(strCommand);
+    if (it != mapPriority.end())
+        return it->second;
+    // Announcing blocks by inv is part of sending them
+    if (strCommand == "inv" && InvHasBlock(pchPayload, nPayloadSize))
+        return SEND_PRIORITY_BLOCK;
+    return SEND_PRIORITY_BULK;
+}
+
+// requires LOCK(cs_vSend)
+void SocketSendData(CNode *pnode, int nMaxPriority)
+{
+    while (pnode->nSendSize > 0) {
+        // The messages in the order they go out: the rest of a partly sent
+        // one, which cannot be interrupted, then the queues, most urgent first
+        CSerializeData* vpMsg[MAX_SEND_IOVECS];
+        int vPriority[MAX_SEND_IOVECS];
+        int nMsgs = 0;
+        if (pnode->nSendOffset > 0) {
+            vpMsg[0] = &pnode->vSendMsg[pnode->nSendPriority].front();
+            vPriority[0] = pnode->nSendPriority;
+            nMsgs = 1;
+        }
+        for (int nPriority = 0; nPriority <= nMaxPriority && nMsgs < MAX_SEND_IOVECS; nPriority++) {
+            std::deque<CSerializeData>& queue = pnode->vSendMsg[nPriority];
+            std::deque<CSerializeData>::iterator it = queue.begin();
+            if (pnode->nSendOffset > 0 && nPriority == pnode->nSendPriority)
+                ++it;
+            for (; it != queue.end() && nMsgs < MAX_SEND_IOVECS; ++it) {
+                vpMsg[nMsgs] = &*it;
+                vPriority[nMsgs] = nPriority;
+                nMsgs++;
+            }
+        }
+        if (nMsgs == 0)
+            break;
 
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert(vpMsg[0]->size() > pnode->nSendOffset);
+#ifdef WIN32
+        int nBytes = send(pnode->hSocket, &(*vpMsg[0])[pnode->nSendOffset], vpMsg[0]->size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand the queued messages to the kernel in one call rather than one by one
+        struct iovec iov[MAX_SEND_IOVECS];
+        for (int i = 0; i < nMsgs; i++) {
+            size_t nOffset = (i == 0 ? pnode->nSendOffset : 0);
+            iov[i].iov_base = &(*vpMsg[i])[nOffset];
+            iov[i].iov_len = vpMsg[i]->size() - nOffset;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nMsgs;
+        int nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Every message was gathered from the front of its queue, so
+            // the ones sent in full can be popped in the same order
+            size_t nSent = nBytes;
+            for (int i = 0; nSent > 0; i++) {
+                size_t nLeft = vpMsg[i]->size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    pnode->nSendPriority = vPriority[i];
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                it++;
-            } else {
+                pnode->nSendSize -= vpMsg[i]->size();
+                netBufferPool.Put(*vpMsg[i]);
+                pnode->vSendMsg[vPriority[i]].pop_front();
+            }
+            if (pnode->nSendOffset != 0) {
                 // could not send full message; stop sending more
                 break;
             }
@@ -704,11 +1031,8 @@ void SocketSendData(CNode *pnode)
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->nSendSize == 0)
         assert(pnode->nSendOffset == 0);
-        assert(pnode->nSendSize == 0);
-    }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -975,204 +1299,300 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    pnode->SocketEventsChanged();
+}
+
+namespace {
+
+/**
+ * The peer sockets ThreadSocketHandler watches, kept from one wakeup to the
+ * next, so that a wakeup only deals with the sockets that are ready and the
+ * nodes whose events changed rather than with every peer. Nodes are only
+ * deleted by that thread, after Forget(), so the pointers stay valid.
+ */
+class CWatchedNodes
+{
+private:
+    CSocketEvents& socketEvents;
+    std::unordered_map<SOCKET, CNode*> mapSocketNode;
+    std::unordered_map<NodeId, std::pair<CNode*, SOCKET>> mapNodeSocket;
+
+public:
+    explicit CWatchedNodes(CSocketEvents& socketEventsIn) : socketEvents(socketEventsIn) {}
+
+    CNode* Find(SOCKET hSocket) const
+    {
+        auto it = mapSocketNode.find(hSocket);
+        return it == mapSocketNode.end() ? NULL : it->second;
+    }
+
+    /** Watch the socket of pnode for the events it waits for now. */
+    void Update(CNode* pnode)
+    {
+        pnode->fSocketEventsChanged = false;
+        SOCKET hSocket = pnode->hSocket;
+        if (hSocket == INVALID_SOCKET || pnode->fDisconnect) {
+            Forget(pnode);
+            return;
+        }
+        auto it = mapNodeSocket.find(pnode->id);
+        bool fWatched = (it != mapNodeSocket.end() && it->second.second == hSocket);
+        if (!fWatched)
+            Forget(pnode);
+
+        // Implement the following logic:
+        // * If there is data to send, wait for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signaling.
+        // * Otherwise, if there is no (complete) message in the receive buffer,
+        //   or there is space left in the buffer, wait for receiving data.
+        // * (if neither of the above applies, there is certainly one message
+        //   in the receiver buffer ready to be processed).
+        // Together, that means that at least one of the following is always possible,
+        // so we don't deadlock:
+        // * We send some data.
+        // * We wait for data to be received (and disconnect after timeout).
+        // * We process a message in the buffer (message handler thread).
+        // Errors are reported regardless. Whoever changes any of this calls
+        // SocketEventsChanged(); the message handler does so once it drains
+        // a buffer we stopped reading into, which fRecvPaused tells it about.
+        int nEvents = 0;
+        bool fLocked = false;
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            fLocked = lockSend;
+            if (lockSend && pnode->nSendSize > 0)
+                nEvents = SOCKET_EVENT_SEND;
+        }
+        if (fLocked && nEvents == 0)
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            fLocked = lockRecv;
+            if (lockRecv) {
+                if (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                    pnode->GetTotalRecvSize() <= ReceiveFloodSize())
+                    nEvents = SOCKET_EVENT_RECV;
+                pnode->fRecvPaused = (nEvents == 0);
+            }
+        }
+        if (!fLocked) {
+            // In use by another thread; look again on the next wakeup
+            pnode->SocketEventsChanged();
+            if (fWatched)
+                return;
+        }
+
+        socketEvents.Watch(hSocket, nEvents, pnode->id);
+        mapSocketNode[hSocket] = pnode;
+        mapNodeSocket[pnode->id] = std::make_pair(pnode, hSocket);
+    }
+
+    /** Update the nodes SocketEventsChanged() was called for. */
+    void UpdateChanged()
+    {
+        std::vector<NodeId> vChanged;
+        {
+            LOCK(cs_vNodesEventsChanged);
+            vChanged.swap(vNodesEventsChanged);
+        }
+
+        std::set<NodeId> setNew;
+        BOOST_FOREACH(NodeId id, vChanged)
+        {
+            auto it = mapNodeSocket.find(id);
+            if (it != mapNodeSocket.end())
+                Update(it->second.first);
+            else
+                setNew.insert(id);
+        }
+
+        // Nodes not watched yet are looked up once for all of them
+        if (!setNew.empty()) {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
+            {
+                if (setNew.count(pnode->id))
+                    Update(pnode);
+            }
+        }
+    }
+
+    /** Stop watching the socket of pnode; it is closed or about to be. */
+    void Forget(CNode* pnode)
+    {
+        auto it = mapNodeSocket.find(pnode->id);
+        if (it == mapNodeSocket.end())
+            return;
+        SOCKET hSocket = it->second.second;
+        auto itSocket = mapSocketNode.find(hSocket);
+        // The descriptor may already belong to a newer connection
+        if (itSocket != mapSocketNode.end() && itSocket->second == pnode) {
+            mapSocketNode.erase(itSocket);
+            socketEvents.Unwatch(hSocket, pnode->id);
+        }
+        mapNodeSocket.erase(it);
+    }
+};
+
 }
 
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastDisconnect = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fDisconnected = false;
+    std::unique_ptr<CSocketEvents> socketEvents = CSocketEvents::Create();
+    LogPrint("net", "socket handler using %s\n", socketEvents->GetName());
+    CWatchedNodes watchedNodes(*socketEvents);
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        socketEvents->Watch(hListenSocket.socket, SOCKET_EVENT_RECV, -1);
+    }
+
     while (true)
     {
         //
-        // Disconnect nodes
+        // Disconnect nodes, every 100ms or right after a socket was closed
+        // here, rather than on every wakeup
         //
+        int64_t nTimeMicros = GetTimeMicros();
+        if (fDisconnected || nTimeMicros - nLastDisconnect >= 100000)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            fDisconnected = false;
+            nLastDisconnect = nTimeMicros;
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
+                LOCK(cs_vNodes);
+                // Disconnect unused nodes
+                vector<CNode*> vNodesCopy = vNodes;
+                BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 {
-                    auto spanGuard = pnode->span.Enter();
+                    if (pnode->fDisconnect ||
+                        (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
+                    {
+                        auto spanGuard = pnode->span.Enter();
 
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                        // remove from vNodes
+                        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                        // release outbound grant (if any)
+                        pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                        // close socket and cleanup
+                        watchedNodes.Forget(pnode);
+                        pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
+                        // hold in disconnected pool until all refs are released
+                        if (pnode->fNetworkNode || pnode->fInbound)
+                            pnode->Release();
+                        vNodesDisconnected.push_back(pnode);
+                    }
                 }
             }
-        }
-        {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                // Delete disconnected nodes
+                list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+                BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
                 {
-                    bool fDelete = false;
+                    // wait until threads are done using it
+                    if (pnode->GetRefCount() <= 0)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        bool fDelete = false;
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
+                            TRY_LOCK(pnode->cs_vSend, lockSend);
+                            if (lockSend)
                             {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
+                                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                                if (lockRecv)
+                                {
+                                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                                    if (lockInv)
+                                        fDelete = true;
+                                }
                             }
                         }
-                    }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
+                        if (fDelete)
+                        {
+                            vNodesDisconnected.remove(pnode);
+                            delete pnode;
+                        }
                     }
                 }
             }
-        }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+            if(vNodes.size() != nPrevNodeCount) {
+                nPrevNodeCount = vNodes.size();
+                uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+            }
         }
 
         //
-        // Find which sockets have data to receive
+        // Re-register the sockets whose events changed, and new ones
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signaling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
+        watchedNodes.UpdateChanged();
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        //
+        // Wait for sockets to become ready
+        //
+        std::vector<std::pair<SOCKET, int>> vReady;
+        if (!socketEvents->Wait(50, vReady))
+            MilliSleep(50);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket == INVALID_SOCKET)
+                continue;
+            BOOST_FOREACH(const PAIRTYPE(SOCKET, int)& ready, vReady)
             {
-                AcceptConnection(hListenSocket);
+                if (ready.first == hListenSocket.socket && (ready.second & SOCKET_EVENT_RECV))
+                    AcceptConnection(hListenSocket);
             }
         }
 
         //
-        // Service each socket
+        // Service each ready socket
         //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        std::vector<CNode*> vServiced;
+        std::vector<CNode*> vSendReady;
+        BOOST_FOREACH(const PAIRTYPE(SOCKET, int)& ready, vReady)
         {
             boost::this_thread::interruption_point();
 
+            CNode* pnode = watchedNodes.Find(ready.first);
+            if (pnode == NULL)
+                continue;
+            vServiced.push_back(pnode);
+
             auto spanGuard = pnode->span.Enter();
 
             //
             // Receive
             //
-            if (pnode->hSocket == INVALID_SOCKET)
+            if (pnode->hSocket != ready.first)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (ready.second & (SOCKET_EVENT_RECV | SOCKET_EVENT_ERR))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
                 {
                     {
-                        // typical socket buffer is 8K-64K
+                        // typical socket buffer is 8K-64K. The bulk of a
+                        // large message is read straight into its buffer.
                         char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        unsigned int nDirect = 0;
+                        char* pchDirect = pnode->GetDirectRecvBuffer(nDirect);
+                        int nBytes = pchDirect ? recv(pnode->hSocket, pchDirect, nDirect, MSG_DONTWAIT)
+                                               : recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                         if (nBytes > 0)
                         {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                            if (pchDirect)
+                                pnode->DirectRecvBytes(nBytes);
+                            else if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
                                 pnode->CloseSocketDisconnect();
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
@@ -1200,55 +1620,81 @@ void ThreadSocketHandler()
                 }
             }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (ready.second & SOCKET_EVENT_SEND)
+                vSendReady.push_back(pnode);
+        }
+
+        //
+        // Send, in two rounds: blocks and anything more urgent to every
+        // peer first, then the rest, so a new block is not held up behind
+        // bulk data queued for the peers served before it
+        //
+        for (int nRound = 0; nRound < 2; nRound++)
+        {
+            int nMaxPriority = (nRound == 0 ? SEND_PRIORITY_BLOCK : SEND_PRIORITY_COUNT - 1);
+            BOOST_FOREACH(CNode* pnode, vSendReady)
             {
+                boost::this_thread::interruption_point();
+
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                auto spanGuard = pnode->span.Enter();
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
-                    SocketSendData(pnode);
+                    SocketSendData(pnode, nMaxPriority);
             }
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
+        // Receiving fills the buffer and sending drains the queue, either of
+        // which can change what the socket waits for
+        BOOST_FOREACH(CNode* pnode, vServiced)
+        {
+            watchedNodes.Update(pnode);
+            if (pnode->fDisconnect)
+                fDisconnected = true;
+        }
+
+        //
+        // Inactivity checking, once a second rather than on every wakeup.
+        // Every socket is looked at again too, in case a change of its
+        // events went unnoticed.
+        //
+        int64_t nTime = GetTime();
+        if (nTime != nLastInactivityCheck)
+        {
+            nLastInactivityCheck = nTime;
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+                if (nTime - pnode->nTimeConnected > 60)
                 {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                    if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+                    {
+                        LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+                        pnode->fDisconnect = true;
+                    }
+                    else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+                    {
+                        LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+                        pnode->fDisconnect = true;
+                    }
+                    else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+                    {
+                        LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+                        pnode->fDisconnect = true;
+                    }
+                    else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+                    {
+                        LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+                        pnode->fDisconnect = true;
+                    }
                 }
+                watchedNodes.Update(pnode);
             }
         }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
-        }
     }
 }
 
-
 void ThreadDNSAddressSeed()
 {
     // goal: only query DNS seeds if address need is acute
@@ -1532,6 +1978,27 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
+void ThreadMessagePreparation()
+{
+    while (true)
+    {
+        std::shared_ptr<CPreparedMessage> prepared;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_vPrepareQueue);
+            while (vPrepareQueue.empty())
+                prepareQueueCondition.wait(lock);
+            prepared = vPrepareQueue.front();
+            vPrepareQueue.pop_front();
+        }
+
+        // Skip messages whose peer disconnected while they were queued
+        if (prepared.use_count() > 1) {
+            prepared->Prepare();
+            messageHandlerCondition.notify_one();
+        }
+    }
+}
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1573,7 +2040,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].ready()))
                         {
                             fSleep = false;
                         }
@@ -1790,6 +2257,12 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     else
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "dnsseed", &ThreadDNSAddressSeed));
 
+    // Checksum and deserialize messages ahead of the message handler; set before
+    // the socket handler starts queueing them
+    nMessagePrepThreads = std::max(0, (int)GetArg("-msgprepthreads", DEFAULT_MSGPREP_THREADS));
+    for (int i = 0; i < nMessagePrepThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msgprep", &ThreadMessagePreparation));
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1902,7 +2375,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             if (pnode->pfilter->IsRelevantAndUpdate(tx))
                 pnode->PushInventory(inv);
         } else
-            pnode->PushInventory(inv);
+            pnode->AnnounceTransaction(inv);
     }
 }
 
@@ -1930,6 +2403,77 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+void CNetMsgStats::AddProcessTime(int64_t nMicros)
+{
+    nProcessed++;
+    nProcessTimeMicros += nMicros;
+    int nBucket = 0;
+    for (int64_t nLimit = 4; nMicros >= nLimit && nBucket < NET_PROCESS_TIME_BUCKETS - 1; nLimit *= 4)
+        nBucket++;
+    vProcessTimeHist[nBucket]++;
+}
+
+CNetMsgStats& CNetMsgStats::operator+=(const CNetMsgStats& other)
+{
+    nMessages += other.nMessages;
+    nBytes += other.nBytes;
+    nProcessed += other.nProcessed;
+    nProcessTimeMicros += other.nProcessTimeMicros;
+    for (int i = 0; i < NET_PROCESS_TIME_BUCKETS; i++)
+        vProcessTimeHist[i] += other.vProcessTimeHist[i];
+    return *this;
+}
+
+// Peers can send any command they like, so only the ones we know get an
+// entry of their own; the rest share one.
+static const std::string& MsgStatsKey(const std::string& strCommand)
+{
+    static const std::set<std::string> setKnown(getAllNetMessageTypes().begin(), getAllNetMessageTypes().end());
+    static const std::string strOther(NET_MESSAGE_COMMAND_OTHER);
+    std::set<std::string>::const_iterator it = setKnown.find(strCommand);
+    return it != setKnown.end() ? *it : strOther;
+}
+
+void CNode::RecordMsgSent(const std::string& strCommand, uint64_t nBytes)
+{
+    const std::string& strKey = MsgStatsKey(strCommand);
+    {
+        LOCK(cs_msgStats);
+        mapSendMsgStats[strKey].AddMessage(nBytes);
+    }
+    LOCK(cs_totalMsgStats);
+    mapTotalSendMsgStats[strKey].AddMessage(nBytes);
+}
+
+void CNode::RecordMsgRecv(const std::string& strCommand, uint64_t nBytes)
+{
+    const std::string& strKey = MsgStatsKey(strCommand);
+    {
+        LOCK(cs_msgStats);
+        mapRecvMsgStats[strKey].AddMessage(nBytes);
+    }
+    LOCK(cs_totalMsgStats);
+    mapTotalRecvMsgStats[strKey].AddMessage(nBytes);
+}
+
+void CNode::RecordMsgProcessTime(const std::string& strCommand, int64_t nMicros)
+{
+    const std::string& strKey = MsgStatsKey(strCommand);
+    {
+        LOCK(cs_msgStats);
+        mapRecvMsgStats[strKey].AddProcessTime(nMicros);
+    }
+    LOCK(cs_totalMsgStats);
+    mapTotalRecvMsgStats[strKey].AddProcessTime(nMicros);
+}
+
+void CNode::GetTotalMsgStats(mapMsgCmdStats& mapSent, mapMsgCmdStats& mapRecv)
+{
+    LOCK(cs_totalMsgStats);
+    mapSent = mapTotalSendMsgStats;
+    mapRecv = mapTotalRecvMsgStats;
+}
+
 void CNode::Fuzz(int nChance)
 {
     if (!fSuccessfullyConnected) return; // Don't fuzz initial handshake
@@ -2026,13 +2570,14 @@ bool CAddrDB::Read(CAddrMan& addr)
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    // read straight into the stream the addresses are deserialized from
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char *)&vchData[0], dataSize);
+        filein.read(&ssPeers[0], dataSize);
         filein >> hashIn;
     }
     catch (const std::exception& e) {
@@ -2040,8 +2585,6 @@ bool CAddrDB::Read(CAddrMan& addr)
     }
     filein.fclose();
 
-    CDataStream ssPeers(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssPeers.begin(), ssPeers.end());
     if (hashIn != hashTmp)
@@ -2097,11 +2640,18 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendPriority = 0;
+    fSendMerkleBlockTxs = false;
+    fSocketEventsChanged = false;
+    fRecvPaused = false;
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
     fSentAddr = false;
+    fProvidesHeaderAndIDs = false;
+    fPreferHeaderAndIDs = false;
+    nReconSalt = 0;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2181,6 +2731,13 @@ void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSen
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0);
+    // Serialize into a recycled buffer; ssSend's own storage, if it kept
+    // any, goes back to the pool
+    CSerializeData buf;
+    if (netBufferPool.GetSmall(buf)) {
+        ssSend.swap(buf);
+        netBufferPool.Put(buf);
+    }
     ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
@@ -2226,13 +2783,36 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
+    char pchCommand[CMessageHeader::COMMAND_SIZE];
+    memcpy(pchCommand, &ssSend[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE);
+    std::string strCommand(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE));
+    RecordMsgSent(strCommand, ssSend.size());
+
+    int nPriority = GetSendPriority(strCommand, &ssSend[0] + CMessageHeader::HEADER_SIZE, nSize);
+    // BIP 37 clients expect the matched transactions of a merkleblock
+    // right after it, so they go in its class; in their own, the next
+    // merkleblock would overtake them
+    if (strCommand == "merkleblock")
+        fSendMerkleBlockTxs = true;
+    else if (strCommand == "tx" && fSendMerkleBlockTxs)
+        nPriority = SEND_PRIORITY_BLOCK;
+    else
+        fSendMerkleBlockTxs = false;
+
+    std::deque<CSerializeData>& queue = vSendMsg[nPriority];
+    std::deque<CSerializeData>::iterator it = queue.insert(queue.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
 
-    // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    // If nothing as urgent is waiting, attempt "optimistic write"
+    bool fNext = (it == queue.begin());
+    for (int i = 0; i < nPriority && fNext; i++)
+        fNext = vSendMsg[i].empty();
+    if (fNext)
         SocketSendData(this);
+    // What did not go out waits for the socket to take more
+    if (nSendSize > 0)
+        SocketEventsChanged();
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
@@ -16,10 +16,15 @@
 #include "random.h"
 #include "streams.h"
 #include "sync.h"
+#include "txreconciliation.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <atomic>
 #include <deque>
+#include <map>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -70,6 +75,19 @@ static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 1728;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msgprepthreads default: threads that checksum and deserialize received messages ahead of the message handler */
+static const int DEFAULT_MSGPREP_THREADS = 2;
+/** Other messages at least this large are also checksummed off the message handler thread */
+static const unsigned int MIN_PREPARED_MESSAGE_SIZE = 64 * 1024;
+/** Message bodies with at least this much left to receive are read from the socket straight into their buffer */
+static const unsigned int MIN_DIRECT_RECV_SIZE = 64 * 1024;
+/** Maximum number of queued messages handed to the kernel in one send call */
+static const int MAX_SEND_IOVECS = 64;
+/** Limits on the message buffers kept for reuse by CNetBufferPool */
+static const size_t MAX_POOLED_NET_BUFFERS = 256;
+static const size_t MAX_POOLED_NET_BUFFER_BYTES = 32 * 1024 * 1024;
+/** Pooled buffers up to this capacity are kept on a free list and handed out without a best-fit search */
+static const size_t MAX_SMALL_NET_BUFFER_SIZE = 64 * 1024;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -89,7 +107,27 @@ unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
-void SocketSendData(CNode *pnode);
+
+/**
+ * Outgoing messages wait in one queue per class, and the most urgent
+ * non-empty queue is sent first. Messages in the same class keep their
+ * order; those in different classes must not depend on each other's.
+ */
+enum SendPriority {
+    SEND_PRIORITY_CONTROL = 0, //!< handshake, pings, filters and data requests
+    SEND_PRIORITY_BLOCK,       //!< block and header relay, block announcements by inv
+    SEND_PRIORITY_TX,          //!< transactions
+    SEND_PRIORITY_BULK,        //!< announcements, addresses and anything else
+    SEND_PRIORITY_COUNT
+};
+
+// The class of a message, from its command and, for an inv, whether it
+// announces a block
+SendPriority GetSendPriority(const std::string& strCommand, const char* pchPayload = NULL, size_t nPayloadSize = 0);
+
+// Send queued messages up to class nMaxPriority, plus the rest of one
+// already partly sent. requires LOCK(cs_vSend)
+void SocketSendData(CNode *pnode, int nMaxPriority = SEND_PRIORITY_COUNT - 1);
 
 typedef int NodeId;
 
@@ -181,6 +219,74 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/**
+ * Message buffers kept for reuse once a message has been sent or
+ * processed, so that steady peer traffic does not allocate (and, with
+ * zero_after_free_allocator, wipe and free) a buffer per message. Large
+ * payloads are then received into a buffer that already has room for
+ * them. Buffers keep their capacity; the pool holds at most
+ * MAX_POOLED_NET_BUFFERS of them, MAX_POOLED_NET_BUFFER_BYTES in total.
+ * Small buffers, which most messages fit in, are kept apart so that they
+ * can be handed out in constant time.
+ */
+class CNetBufferPool
+{
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree;
+    std::vector<CSerializeData> vFreeSmall; // Capacity up to MAX_SMALL_NET_BUFFER_SIZE, most recently put last
+    size_t nFreeBytes;
+
+    void Take(std::vector<CSerializeData>& vList, std::vector<CSerializeData>::iterator it, CSerializeData& buf);
+
+public:
+    CNetBufferPool() : nFreeBytes(0) {}
+
+    /** Swap an empty buffer with at least nMinCapacity bytes of room into buf, if the pool has one. */
+    bool Get(CSerializeData& buf, size_t nMinCapacity);
+    /** Swap the most recently put small buffer into buf, if the pool has one. */
+    bool GetSmall(CSerializeData& buf);
+    /** Take over the storage of buf, which is left empty. */
+    void Put(CSerializeData& buf);
+
+    size_t Size();
+};
+
+extern CNetBufferPool netBufferPool;
+
+/** Number of buckets in the message processing time histograms */
+static const int NET_PROCESS_TIME_BUCKETS = 12;
+
+/**
+ * Traffic and processing time for one message command. Bucket i of the
+ * histogram counts messages that took less than 4^(i+1) microseconds to
+ * process, and at least 4^i (the last bucket is open ended).
+ */
+struct CNetMsgStats
+{
+    uint64_t nMessages;
+    uint64_t nBytes;
+    uint64_t nProcessed;
+    int64_t nProcessTimeMicros;
+    uint64_t vProcessTimeHist[NET_PROCESS_TIME_BUCKETS];
+
+    CNetMsgStats() : nMessages(0), nBytes(0), nProcessed(0), nProcessTimeMicros(0)
+    {
+        std::fill(vProcessTimeHist, vProcessTimeHist + NET_PROCESS_TIME_BUCKETS, 0);
+    }
+
+    void AddMessage(uint64_t nSize)
+    {
+        nMessages++;
+        nBytes += nSize;
+    }
+
+    void AddProcessTime(int64_t nMicros);
+    CNetMsgStats& operator+=(const CNetMsgStats& other);
+};
+
+typedef std::map<std::string, CNetMsgStats> mapMsgCmdStats;
+
 class CNodeStats
 {
 public:
@@ -201,11 +307,54 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    bool fTxReconciliation;
+    mapMsgCmdStats mapSendMsgStats;
+    mapMsgCmdStats mapRecvMsgStats;
 };
 
 
 
 
+class CBlock;
+class CTransaction;
+
+/**
+ * A complete message handed to the message preprocessing threads, which
+ * verify its checksum and, for "tx" and "block", deserialize the payload
+ * (computing the txids on the way) so that the message handler thread
+ * only has to act on it. The payload is moved here from the CNetMessage
+ * and shared with the worker, so a message dropped on disconnect does not
+ * free data a worker is still reading. Nothing but the worker may touch
+ * the fields below until fReady is set.
+ */
+class CPreparedMessage
+{
+public:
+    CDataStream vRecv;
+    std::string strCommand;
+    uint32_t nChecksum;         // from the header
+    uint32_t nChecksumComputed;
+    bool fChecksumValid;
+    std::atomic<bool> fReady;
+
+    CPreparedMessage(CDataStream&& vRecvIn, const CMessageHeader& hdr);
+
+    void Prepare();
+
+    /** The deserialized payload of a "tx" message; rethrows the deserialization error if there was one. */
+    const CTransaction& GetTransaction() const;
+    /** The deserialized payload of a "block" message; rethrows the deserialization error if there was one. */
+    const CBlock& GetBlock() const;
+
+private:
+    std::shared_ptr<const CTransaction> tx;
+    std::shared_ptr<const CBlock> block;
+    std::string strError;
+    bool fIosFailure;
+
+    void ThrowError() const;
+};
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -219,6 +368,10 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    // Set when the message was handed to the preprocessing threads, which
+    // then own the payload; vRecv is empty in that case.
+    std::shared_ptr<CPreparedMessage> prepared;
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
@@ -234,6 +387,12 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    // Whether the message can be processed: complete, and done with preprocessing if it needed any.
+    bool ready() const
+    {
+        return complete() && (!prepared || prepared->fReady);
+    }
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -242,6 +401,14 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    // Room for up to nMax bytes of the body, to receive into directly; NULL
+    // when too little of the body remains for that to be worthwhile.
+    char* GetDataBuffer(unsigned int& nMax);
+    void DataReceived(unsigned int nBytes) { nDataPos += nBytes; }
+
+    // Return the payload buffer to netBufferPool once the message is done with
+    void ReleaseBuffer();
 };
 
 
@@ -257,9 +424,15 @@ public:
     SOCKET hSocket;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
-    size_t nSendOffset; // offset inside the first vSendMsg already sent
+    size_t nSendOffset; // offset inside the partly sent message already sent
+    int nSendPriority; // class of the partly sent message, at the front of its queue
+    bool fSendMerkleBlockTxs; // the last messages queued were a merkleblock and its transactions
+    // ThreadSocketHandler only looks at the events a socket waits for when
+    // SocketEventsChanged() says they may have changed
+    std::atomic<bool> fSocketEventsChanged;
+    std::atomic<bool> fRecvPaused; // not read from until the receive buffer drains
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializeData> vSendMsg[SEND_PRIORITY_COUNT];
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -268,6 +441,12 @@ public:
     uint64_t nRecvBytes;
     int nRecvVersion;
 
+    // Per command traffic and processing time. Kept under a lock of its
+    // own, so getpeerinfo does not wait for the message handler.
+    CCriticalSection cs_msgStats;
+    mapMsgCmdStats mapSendMsgStats;
+    mapMsgCmdStats mapRecvMsgStats;
+
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -329,10 +508,23 @@ public:
     // inventory based relay
     mruset<CInv> setInventoryKnown;
     std::vector<CInv> vInventoryToSend;
+    // Blocks to announce with headers (or an inv), in chain order
+    std::vector<uint256> vBlockHashesToAnnounce;
     CCriticalSection cs_inventory;
+    // Set once the peer has agreed to reconcile transactions instead of
+    // having them all announced with an inv; protected by cs_inventory.
+    std::unique_ptr<CTxReconciliationState> txReconciliation;
+    // Salt we sent in "sendtxrcncl", 0 if we did not offer reconciliation
+    uint64_t nReconSalt;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
+    // compact block relay (BIP 152)
+    // Whether the peer sent sendcmpct, so it answers MSG_CMPCT_BLOCK and getblocktxn.
+    std::atomic<bool> fProvidesHeaderAndIDs;
+    // Whether the peer wants new blocks pushed as cmpctblock instead of inv (high-bandwidth mode).
+    std::atomic<bool> fPreferHeaderAndIDs;
+
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
     uint64_t nPingNonceSent;
@@ -354,6 +546,9 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static CCriticalSection cs_totalMsgStats;
+    static mapMsgCmdStats mapTotalSendMsgStats;
+    static mapMsgCmdStats mapTotalRecvMsgStats;
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -375,13 +570,20 @@ public:
     {
         unsigned int total = 0;
         BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += (msg.complete() ? msg.hdr.nMessageSize : msg.vRecv.size()) + 24;
         return total;
     }
 
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // Where the socket handler can read the rest of a large message body
+    // to, skipping the copy through ReceiveMsgBytes, or NULL.
+    // requires LOCK(cs_vRecvMsg)
+    char* GetDirectRecvBuffer(unsigned int& nMax);
+    // requires LOCK(cs_vRecvMsg)
+    void DirectRecvBytes(unsigned int nBytes);
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -428,6 +630,8 @@ public:
         {
             LOCK(cs_inventory);
             setInventoryKnown.insert(inv);
+            if (txReconciliation && inv.type == MSG_TX)
+                txReconciliation->RemoveFromSet(inv.hash);
         }
     }
 
@@ -440,6 +644,27 @@ public:
         }
     }
 
+    /**
+     * Announce a transaction: queue it for the next reconciliation if the
+     * peer reconciles and it is not one of the transactions still fanned
+     * out, otherwise push an inv.
+     */
+    void AnnounceTransaction(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        if (setInventoryKnown.count(inv))
+            return;
+        if (txReconciliation && !txReconciliation->ShouldFanout(inv.hash) && txReconciliation->AddToSet(inv.hash))
+            return;
+        vInventoryToSend.push_back(inv);
+    }
+
+    void PushBlockHash(const uint256 &hash)
+    {
+        LOCK(cs_inventory);
+        vBlockHashesToAnnounce.push_back(hash);
+    }
+
     void AskFor(const CInv& inv);
 
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
@@ -614,6 +839,13 @@ public:
 
     void CloseSocketDisconnect();
 
+    /**
+     * Have ThreadSocketHandler look at the events this node's socket waits
+     * for again: after queueing data the optimistic write did not get out,
+     * or after draining a receive buffer it stopped reading into.
+     */
+    void SocketEventsChanged();
+
     // Denial-of-service detection/prevention
     // The idea is to detect peers that are behaving
     // badly and disconnect/ban them, but do it in a
@@ -648,6 +880,13 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Per command accounting, for this peer and the node-wide totals
+    void RecordMsgSent(const std::string& strCommand, uint64_t nBytes);
+    void RecordMsgRecv(const std::string& strCommand, uint64_t nBytes);
+    void RecordMsgProcessTime(const std::string& strCommand, int64_t nMicros);
+
+    static void GetTotalMsgStats(mapMsgCmdStats& mapSent, mapMsgCmdStats& mapRecv);
 };
 
 
@@ -17,9 +17,28 @@ static const char* ppszTypeName[] =
     "ERROR",
     "tx",
     "block",
-    "filtered block"
+    "filtered block",
+    "compact block"
 };
 
+static const char* allNetMessageTypes[] =
+{
+    "version", "verack", "addr", "inv", "getdata", "merkleblock",
+    "getblocks", "getheaders", "tx", "headers", "block", "getaddr",
+    "mempool", "ping", "pong", "alert", "notfound", "filterload",
+    "filteradd", "filterclear", "reject", "sendheaders", "sendcmpct",
+    "cmpctblock", "getblocktxn", "blocktxn", "sendtxrcncl", "reqrecon",
+    "sketch", "reconcildiff"
+};
+static const std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes + ARRAYLEN(allNetMessageTypes));
+
+const char* NET_MESSAGE_COMMAND_OTHER = "*other*";
+
+const std::vector<std::string>& getAllNetMessageTypes()
+{
+    return allNetMessageTypesVec;
+}
+
 CMessageHeader::CMessageHeader(const MessageStartChars& pchMessageStartIn)
 {
     memcpy(pchMessageStart, pchMessageStartIn, MESSAGE_START_SIZE);
@@ -17,6 +17,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #define MESSAGE_START_SIZE 4
 
@@ -65,6 +66,12 @@ public:
     unsigned int nChecksum;
 };
 
+/** Name under which messages with a command not in getAllNetMessageTypes() are accounted */
+extern const char* NET_MESSAGE_COMMAND_OTHER;
+
+/** All message commands this node sends or handles, for per-command statistics */
+const std::vector<std::string>& getAllNetMessageTypes();
+
 /** nServices flags */
 enum {
     // NODE_NETWORK means that the node is capable of serving the block chain. It is currently
@@ -154,6 +161,9 @@ enum {
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Requests a cmpctblock instead of a block; like MSG_FILTERED_BLOCK it
+    // only appears in getdata.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -13,10 +13,16 @@
 #include "main.h"
 #include "metrics.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "util.h"
+#include "validationinterface.h"
+
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
 
 #include <stdint.h>
 
@@ -24,6 +30,9 @@
 
 #include <regex>
 
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
 using namespace std;
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
@@ -35,10 +44,9 @@ double GetDifficultyINTERNAL(const CBlockIndex* blockindex, bool networkDifficul
     // minimum difficulty = 1.0.
     if (blockindex == NULL)
     {
-        if (chainActive.Tip() == NULL)
+        blockindex = GetChainTipSnapshot()->Tip();
+        if (blockindex == NULL)
             return 1.0;
-        else
-            blockindex = chainActive.Tip();
     }
 
     uint32_t bits;
@@ -102,12 +110,14 @@ static UniValue ValuePoolDesc(
 
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    // Needs cs_main only for entries off the active chain
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
     UniValue result(UniValue::VOBJ);
     result.pushKV("hash", blockindex->GetBlockHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (tip->Contains(blockindex))
+        confirmations = tip->Height() - blockindex->nHeight + 1;
     result.pushKV("confirmations", confirmations);
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", blockindex->nVersion);
@@ -122,117 +132,212 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+    CBlockIndex *pnext = tip->Next(blockindex);
     if (pnext)
         result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
     return result;
 }
 
 // insightexplorer
-UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
+/**
+ * Look up the block with the given hash and read it from disk, with the
+ * errors getblock reports. Requires cs_main.
+ */
+static CBlockIndex* ReadBlockForRPC(const uint256& hash, CBlock& block)
 {
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", block.GetHash().GetHex());
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
+/**
+ * The fields of blockToDeltasJSON before and after "deltas", so that the
+ * deltas can be streamed between them. Requires cs_main.
+ */
+static void blockToDeltasJSONFields(const CBlock& block, const CBlockIndex* blockindex, UniValue& head, UniValue& tail)
+{
+    head.pushKV("hash", block.GetHash().GetHex());
     // Only report confirmations if the block is on the main chain
     if (!chainActive.Contains(blockindex))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is an orphan");
     int confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.pushKV("confirmations", confirmations);
-    result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
-    result.pushKV("height", blockindex->nHeight);
-    result.pushKV("version", block.nVersion);
-    result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
+    head.pushKV("confirmations", confirmations);
+    head.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    head.pushKV("height", blockindex->nHeight);
+    head.pushKV("version", block.nVersion);
+    head.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
+
+    tail.pushKV("time", block.GetBlockTime());
+    tail.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
+    tail.pushKV("nonce", block.nNonce.GetHex());
+    tail.pushKV("bits", strprintf("%08x", block.nBits));
+    tail.pushKV("difficulty", GetDifficulty(blockindex));
+    tail.pushKV("chainwork", blockindex->nChainWork.GetHex());
 
-    KeyIO keyIO(Params());
-    UniValue deltas(UniValue::VARR);
-    for (unsigned int i = 0; i < block.vtx.size(); i++) {
-        const CTransaction &tx = block.vtx[i];
-        const uint256 txhash = tx.GetHash();
-
-        UniValue entry(UniValue::VOBJ);
-        entry.pushKV("txid", txhash.GetHex());
-        entry.pushKV("index", (int)i);
-
-        UniValue inputs(UniValue::VARR);
-        if (!tx.IsCoinBase()) {
-            for (size_t j = 0; j < tx.vin.size(); j++) {
-                const CTxIn input = tx.vin[j];
-                UniValue delta(UniValue::VOBJ);
-                CSpentIndexValue spentInfo;
-                CSpentIndexKey spentKey(input.prevout.hash, input.prevout.n);
-
-                if (!GetSpentIndex(spentKey, spentInfo)) {
-                    throw JSONRPCError(RPC_INTERNAL_ERROR, "Spent information not available");
-                }
-                CTxDestination dest = DestFromAddressHash(spentInfo.addressType, spentInfo.addressHash);
-                if (IsValidDestination(dest)) {
-                    delta.pushKV("address", keyIO.EncodeDestination(dest));
-                }
-                delta.pushKV("satoshis", -1 * spentInfo.satoshis);
-                delta.pushKV("index", (int)j);
-                delta.pushKV("prevtxid", input.prevout.hash.GetHex());
-                delta.pushKV("prevout", (int)input.prevout.n);
-
-                inputs.push_back(delta);
-            }
-        }
-        entry.pushKV("inputs", inputs);
+    if (blockindex->pprev)
+        tail.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        tail.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+/** One element of the "deltas" of blockToDeltasJSON. Requires cs_main. */
+static UniValue txToDeltasJSON(const CTransaction& tx, unsigned int nIndex, KeyIO& keyIO)
+{
+    const uint256 txhash = tx.GetHash();
+
+    UniValue entry(UniValue::VOBJ);
+    entry.pushKV("txid", txhash.GetHex());
+    entry.pushKV("index", (int)nIndex);
 
-        UniValue outputs(UniValue::VARR);
-        for (unsigned int k = 0; k < tx.vout.size(); k++) {
-            const CTxOut &out = tx.vout[k];
+    UniValue inputs(UniValue::VARR);
+    if (!tx.IsCoinBase()) {
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CTxIn input = tx.vin[j];
             UniValue delta(UniValue::VOBJ);
-            const uint160 addrhash = out.scriptPubKey.AddressHash();
-            CTxDestination dest;
+            CSpentIndexValue spentInfo;
+            CSpentIndexKey spentKey(input.prevout.hash, input.prevout.n);
 
-            if (out.scriptPubKey.IsPayToScriptHash()) {
-                dest = CScriptID(addrhash);
-            } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                dest = CKeyID(addrhash);
+            if (!GetSpentIndex(spentKey, spentInfo)) {
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Spent information not available");
             }
+            CTxDestination dest = DestFromAddressHash(spentInfo.addressType, spentInfo.addressHash);
             if (IsValidDestination(dest)) {
                 delta.pushKV("address", keyIO.EncodeDestination(dest));
             }
-            delta.pushKV("address", keyIO.EncodeDestination(dest));
-            delta.pushKV("satoshis", out.nValue);
-            delta.pushKV("index", (int)k);
+            delta.pushKV("satoshis", -1 * spentInfo.satoshis);
+            delta.pushKV("index", (int)j);
+            delta.pushKV("prevtxid", input.prevout.hash.GetHex());
+            delta.pushKV("prevout", (int)input.prevout.n);
 
-            outputs.push_back(delta);
+            inputs.push_back(delta);
+        }
+    }
+    entry.pushKV("inputs", inputs);
+
+    UniValue outputs(UniValue::VARR);
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut &out = tx.vout[k];
+        UniValue delta(UniValue::VOBJ);
+        const uint160 addrhash = out.scriptPubKey.AddressHash();
+        CTxDestination dest;
+
+        if (out.scriptPubKey.IsPayToScriptHash()) {
+            dest = CScriptID(addrhash);
+        } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
+            dest = CKeyID(addrhash);
         }
-        entry.pushKV("outputs", outputs);
-        deltas.push_back(entry);
+        if (IsValidDestination(dest)) {
+            delta.pushKV("address", keyIO.EncodeDestination(dest));
+        }
+        delta.pushKV("address", keyIO.EncodeDestination(dest));
+        delta.pushKV("satoshis", out.nValue);
+        delta.pushKV("index", (int)k);
+
+        outputs.push_back(delta);
+    }
+    entry.pushKV("outputs", outputs);
+    return entry;
+}
+
+UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue tail(UniValue::VOBJ);
+    blockToDeltasJSONFields(block, blockindex, result, tail);
+
+    KeyIO keyIO(Params());
+    UniValue deltas(UniValue::VARR);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        deltas.push_back(txToDeltasJSON(block.vtx[i], i, keyIO));
     }
     result.pushKV("deltas", deltas);
-    result.pushKV("time", block.GetBlockTime());
-    result.pushKV("mediantime", (int64_t)blockindex->GetMedianTimePast());
-    result.pushKV("nonce", block.nNonce.GetHex());
-    result.pushKV("bits", strprintf("%08x", block.nBits));
-    result.pushKV("difficulty", GetDifficulty(blockindex));
-    result.pushKV("chainwork", blockindex->nChainWork.GetHex());
+    result.pushKVs(tail);
+    return result;
+}
+
+/**
+ * blockToDeltasJSON written into writer one transaction at a time. cs_main
+ * is only held while a transaction is looked up, never while writing.
+ */
+static void blockToDeltasJSONStream(const CBlock& block, const CBlockIndex* blockindex, CJSONStreamWriter& writer)
+{
+    UniValue head(UniValue::VOBJ);
+    UniValue tail(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        blockToDeltasJSONFields(block, blockindex, head, tail);
+    }
+
+    KeyIO keyIO(Params());
+    writer.BeginObject();
+    writer.PushKVs(head);
+    writer.Key("deltas");
+    writer.BeginArray();
+    for (unsigned int i = 0; i < block.vtx.size() && writer.Ok(); i++) {
+        {
+            LOCK(cs_main);
+            writer.Value(txToDeltasJSON(block.vtx[i], i, keyIO));
+        }
+        writer.MaybeFlush();
+    }
+    writer.EndArray();
+    writer.PushKVs(tail);
+    writer.EndObject();
+}
+
+/**
+ * The fields of blockToJSON before and after "tx", so that the
+ * transactions can be streamed between them. Requires cs_main.
+ */
+static void blockToJSONFields(const CBlock& block, const CBlockIndex* blockindex, UniValue& head, UniValue& tail)
+{
+    head.pushKV("hash", block.GetHash().GetHex());
+    int confirmations = -1;
+    // Only report confirmations if the block is on the main chain
+    if (chainActive.Contains(blockindex))
+        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    head.pushKV("confirmations", confirmations);
+    head.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    head.pushKV("height", blockindex->nHeight);
+    head.pushKV("version", block.nVersion);
+    head.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
+    head.pushKV("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex());
+    head.pushKV("chainhistoryroot", blockindex->hashChainHistoryRoot.GetHex());
+
+    tail.pushKV("time", block.GetBlockTime());
+    tail.pushKV("nonce", block.nNonce.GetHex());
+    tail.pushKV("solution", HexStr(block.nSolution));
+    tail.pushKV("bits", strprintf("%08x", block.nBits));
+    tail.pushKV("difficulty", GetDifficulty(blockindex));
+    tail.pushKV("chainwork", blockindex->nChainWork.GetHex());
+    tail.pushKV("anchor", blockindex->hashFinalSproutRoot.GetHex());
+
+    UniValue valuePools(UniValue::VARR);
+    valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
+    valuePools.push_back(ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue));
+    tail.pushKV("valuePools", valuePools);
 
     if (blockindex->pprev)
-        result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+        tail.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     CBlockIndex *pnext = chainActive.Next(blockindex);
     if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
-    return result;
+        tail.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
 }
 
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
     UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", block.GetHash().GetHex());
-    int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.pushKV("confirmations", confirmations);
-    result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
-    result.pushKV("height", blockindex->nHeight);
-    result.pushKV("version", block.nVersion);
-    result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
-    result.pushKV("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex());
-    result.pushKV("chainhistoryroot", blockindex->hashChainHistoryRoot.GetHex());
+    UniValue tail(UniValue::VOBJ);
+    blockToJSONFields(block, blockindex, result, tail);
     UniValue txs(UniValue::VARR);
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
     {
@@ -246,25 +351,43 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
             txs.push_back(tx.GetHash().GetHex());
     }
     result.pushKV("tx", txs);
-    result.pushKV("time", block.GetBlockTime());
-    result.pushKV("nonce", block.nNonce.GetHex());
-    result.pushKV("solution", HexStr(block.nSolution));
-    result.pushKV("bits", strprintf("%08x", block.nBits));
-    result.pushKV("difficulty", GetDifficulty(blockindex));
-    result.pushKV("chainwork", blockindex->nChainWork.GetHex());
-    result.pushKV("anchor", blockindex->hashFinalSproutRoot.GetHex());
+    result.pushKVs(tail);
+    return result;
+}
 
-    UniValue valuePools(UniValue::VARR);
-    valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
-    valuePools.push_back(ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue));
-    result.pushKV("valuePools", valuePools);
+/**
+ * blockToJSON written into writer one transaction at a time. cs_main is
+ * only held while a transaction is converted, never while writing.
+ */
+void blockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer)
+{
+    UniValue head(UniValue::VOBJ);
+    UniValue tail(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        blockToJSONFields(block, blockindex, head, tail);
+    }
 
-    if (blockindex->pprev)
-        result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
-    return result;
+    writer.BeginObject();
+    writer.PushKVs(head);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (size_t i = 0; i < block.vtx.size() && writer.Ok(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (txDetails) {
+            UniValue objTx(UniValue::VOBJ);
+            {
+                LOCK(cs_main); // for the spent index
+                TxToJSON(tx, uint256(), objTx);
+            }
+            writer.Value(objTx);
+        } else
+            writer.Value(tx.GetHash().GetHex());
+        writer.MaybeFlush();
+    }
+    writer.EndArray();
+    writer.PushKVs(tail);
+    writer.EndObject();
 }
 
 UniValue getblockcount(const UniValue& params, bool fHelp)
@@ -280,8 +403,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSnapshot()->Height();
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -297,8 +419,10 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    CBlockIndex* pindexTip = GetChainTipSnapshot()->Tip();
+    if (pindexTip == NULL)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "No active chain");
+    return pindexTip->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -314,11 +438,38 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
     return GetNetworkDifficulty();
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+/** The entry of a transaction in the verbose mempool listing. Requires cs_main and mempool.cs. */
+static UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    UniValue info(UniValue::VOBJ);
+    info.pushKV("size", (int)e.GetTxSize());
+    info.pushKV("fee", ValueFromAmount(e.GetFee()));
+    info.pushKV("time", e.GetTime());
+    info.pushKV("height", (int)e.GetHeight());
+    info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
+    info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.pushKV("depends", depends);
+    return info;
+}
+
+UniValue mempoolToJSON(bool fVerbose = false, bool fIncludeMempoolSequence = false)
 {
     if (fVerbose)
     {
@@ -326,59 +477,83 @@ UniValue mempoolToJSON(bool fVerbose = false)
         UniValue o(UniValue::VOBJ);
         BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.pushKV("size", (int)e.GetTxSize());
-            info.pushKV("fee", ValueFromAmount(e.GetFee()));
-            info.pushKV("time", e.GetTime());
-            info.pushKV("height", (int)e.GetHeight());
-            info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
-            info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.pushKV("depends", depends);
-            o.pushKV(hash.ToString(), info);
+            o.pushKV(e.GetTx().GetHash().ToString(), mempoolEntryToJSON(e));
         }
         return o;
     }
     else
     {
         vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
+        uint64_t nMempoolSequence;
+        {
+            LOCK(mempool.cs);
+            mempool.queryHashes(vtxid);
+            nMempoolSequence = mempool.GetSequence();
+        }
 
         UniValue a(UniValue::VARR);
         BOOST_FOREACH(const uint256& hash, vtxid)
             a.push_back(hash.ToString());
 
-        return a;
+        if (!fIncludeMempoolSequence)
+            return a;
+
+        UniValue o(UniValue::VOBJ);
+        o.pushKV("txids", a);
+        o.pushKV("mempool_sequence", nMempoolSequence);
+        return o;
+    }
+}
+
+/**
+ * The verbose mempool listing written into writer. The locks are taken for
+ * a batch of entries at a time and released while writing, so unlike
+ * mempoolToJSON(true) this is not a snapshot: transactions that leave the
+ * mempool meanwhile are skipped, and those arriving are not listed.
+ */
+void mempoolToJSONStream(CJSONStreamWriter& writer)
+{
+    vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    static const size_t nBatchSize = 1000;
+    writer.BeginObject();
+    for (size_t i = 0; i < vtxid.size() && writer.Ok(); i += nBatchSize) {
+        {
+            LOCK2(cs_main, mempool.cs);
+            for (size_t j = i; j < std::min(i + nBatchSize, vtxid.size()); j++) {
+                CTxMemPool::indexed_transaction_set::const_iterator it = mempool.mapTx.find(vtxid[j]);
+                if (it != mempool.mapTx.end())
+                    writer.PushKV(vtxid[j].ToString(), mempoolEntryToJSON(*it));
+            }
+        }
+        writer.MaybeFlush();
     }
+    writer.EndObject();
 }
 
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose mempool_sequence )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nArguments:\n"
             "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
+            "2. mempool_sequence  (boolean, optional, default=false) If verbose=false, returns a json object with transaction list and mempool sequence number attached.\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult: (for verbose = false and mempool_sequence = true):\n"
+            "{                            (json object)\n"
+            "  \"txids\" : [               (json array of string)\n"
+            "    \"transactionid\"        (string) The transaction id\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"mempool_sequence\" : n    (numeric) The mempool sequence number the list reflects, as in the zmq sequence notifications\n"
+            "}\n"
             "\nResult: (for verbose = true):\n"
             "{                           (json object)\n"
             "  \"transactionid\" : {       (json object)\n"
@@ -404,7 +579,23 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    return mempoolToJSON(fVerbose);
+    bool fIncludeMempoolSequence = false;
+    if (params.size() > 1)
+        fIncludeMempoolSequence = params[1].get_bool();
+    if (fVerbose && fIncludeMempoolSequence)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbose results cannot contain mempool sequence values.");
+
+    return mempoolToJSON(fVerbose, fIncludeMempoolSequence);
+}
+
+static bool getrawmempool_stream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    // Only the verbose listing is worth streaming
+    if (params.size() != 1 || !params[0].get_bool())
+        return false;
+
+    mempoolToJSONStream(writer);
+    return true;
 }
 
 // insightexplorer
@@ -475,19 +666,26 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex = ReadBlockForRPC(hash, block);
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    return blockToDeltasJSON(block, pblockindex);
+}
 
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+static bool getblockdeltas_stream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    if (params.size() != 1 || !(fExperimentalInsightExplorer || fExperimentalLightWalletd))
+        return false;
 
-    return blockToDeltasJSON(block, pblockindex);
+    uint256 hash(uint256S(params[0].get_str()));
+    CBlock block;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        pblockindex = ReadBlockForRPC(hash, block);
+    }
+    blockToDeltasJSONStream(block, pblockindex, writer);
+    return true;
 }
 
 // insightexplorer
@@ -586,18 +784,18 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
 
     int nHeight = params[0].get_int();
 
     if (nHeight < 0) {
-        nHeight += chainActive.Height() + 1;
+        nHeight += tip->Height() + 1;
     }
 
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > tip->Height())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    CBlockIndex* pblockindex = (*tip)[nHeight];
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -633,8 +831,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -642,11 +838,10 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -655,9 +850,67 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
         return strHex;
     }
 
+    if (GetChainTipSnapshot()->Contains(pblockindex))
+        return blockheaderToJSON(pblockindex);
+
+    // ConnectBlock may still be filling in an entry off the active chain
+    LOCK(cs_main);
     return blockheaderToJSON(pblockindex);
 }
 
+/** The block hash given to getblock, which may also be a height. Requires cs_main. */
+static uint256 ParseBlockHashOrHeight(const UniValue& params)
+{
+    std::string strHash = params[0].get_str();
+
+    // If height is supplied, find the hash
+    if (strHash.size() < (2 * sizeof(uint256))) {
+        // std::stoi allows characters, whereas we want to be strict
+        regex r("(?:(-?)[1-9][0-9]*|[0-9]+)");
+        if (!regex_match(strHash, r)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        int nHeight = -1;
+        try {
+            nHeight = std::stoi(strHash);
+        }
+        catch (const std::exception &e) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        if (nHeight < 0) {
+            nHeight += chainActive.Height() + 1;
+        }
+
+        if (nHeight < 0 || nHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
+
+        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+    }
+
+    return uint256S(strHash);
+}
+
+/** The verbosity given to getblock, where true and false mean 1 and 0 */
+static int ParseBlockVerbosity(const UniValue& params)
+{
+    int verbosity = 1;
+    if (params.size() > 1) {
+        if(params[1].isNum()) {
+            verbosity = params[1].get_int();
+        } else {
+            verbosity = params[1].get_bool() ? 1 : 0;
+        }
+    }
+
+    if (verbosity < 0 || verbosity > 2) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    }
+    return verbosity;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -708,61 +961,11 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    std::string strHash = params[0].get_str();
-
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        // std::stoi allows characters, whereas we want to be strict
-        regex r("(?:(-?)[1-9][0-9]*|[0-9]+)");
-        if (!regex_match(strHash, r)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
-
-        int nHeight = -1;
-        try {
-            nHeight = std::stoi(strHash);
-        }
-        catch (const std::exception &e) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
-
-        if (nHeight < 0) {
-            nHeight += chainActive.Height() + 1;
-        }
-
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-        }
-
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
-    }
-
-    uint256 hash(uint256S(strHash));
-
-    int verbosity = 1;
-    if (params.size() > 1) {
-        if(params[1].isNum()) {
-            verbosity = params[1].get_int();
-        } else {
-            verbosity = params[1].get_bool() ? 1 : 0;
-        }
-    }
-
-    if (verbosity < 0 || verbosity > 2) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
-    }
-
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    uint256 hash = ParseBlockHashOrHeight(params);
+    int verbosity = ParseBlockVerbosity(params);
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(hash, block);
 
     if (verbosity == 0)
     {
@@ -775,44 +978,207 @@ UniValue getblock(const UniValue& params, bool fHelp)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
+static bool getblock_stream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    // Only the transaction details make the result large
+    if (params.size() != 2 || ParseBlockVerbosity(params) < 2)
+        return false;
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        pblockindex = ReadBlockForRPC(ParseBlockHashOrHeight(params), block);
+    }
+    blockToJSONStream(block, pblockindex, true, writer);
+    return true;
+}
+
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, except when the tip has not changed since the last call\n"
+            "of the same hash_type, and for \"muhash\" after the first call.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=\"hash_serialized\") Which UTXO set hash to compute:\n"
+            "                  \"hash_serialized\" (scans on one thread), \"muhash\" (a MuHash3072 of the outputs,\n"
+            "                  kept up to date as blocks are connected once computed) or \"none\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size (not with \"muhash\")\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (only with \"hash_serialized\")\n"
+            "  \"muhash\": \"hash\",     (string) The MuHash3072 of the unspent outputs (only with \"muhash\")\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    TxOutSetHashType hashType = TxOutSetHashType::HASH_SERIALIZED;
+    if (params.size() > 0) {
+        std::string strHashType = params[0].get_str();
+        if (strHashType == "muhash")
+            hashType = TxOutSetHashType::MUHASH;
+        else if (strHashType == "none")
+            hashType = TxOutSetHashType::NONE;
+        else if (strHashType != "hash_serialized")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    }
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    if (GetTxOutSetStats(hashType, stats)) {
         ret.pushKV("height", (int64_t)stats.nHeight);
         ret.pushKV("bestblock", stats.hashBlock.GetHex());
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
-        ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
+        if (hashType != TxOutSetHashType::MUHASH)
+            ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
+        if (hashType == TxOutSetHashType::HASH_SERIALIZED)
+            ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
+        if (hashType == TxOutSetHashType::MUHASH)
+            ret.pushKV("muhash", stats.hashMuHash.GetHex());
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     }
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the UTXO set as of the current tip to a file, for loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"records\": n,             (numeric) The number of coins, anchor, nullifier and history records written\n"
+            "  \"base_hash\": \"hash\",      (string) The block the snapshot was taken at\n"
+            "  \"base_height\": n,         (numeric) The height of that block\n"
+            "  \"nchaintx\": n,            (numeric) The number of transactions in the chain up to that block\n"
+            "  \"txoutset_hash\": \"hash\",  (string) The hash of the snapshot, as listed in the chain parameters\n"
+            "  \"path\": \"path\"            (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    boost::filesystem::path pathTemp = path;
+    pathTemp += ".incomplete";
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CAutoFile file(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + pathTemp.string() + " for writing");
+
+    // Take a cursor on the flushed chainstate, then write it out without
+    // holding cs_main.
+    CTxOutSetSnapshotMetadata metadata;
+    boost::scoped_ptr<CDBIterator> pcursor;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        CBlockIndex* pindex = chainActive.Tip();
+        metadata.hashBlock = pindex->GetBlockHash();
+        metadata.nHeight = pindex->nHeight;
+        metadata.nChainTx = pindex->nChainTx;
+        metadata.nChainSproutValue = pindex->nChainSproutValue;
+        metadata.nChainSaplingValue = pindex->nChainSaplingValue;
+        metadata.hashSproutAnchor = pcoinsTip->GetBestAnchor(SPROUT);
+        metadata.hashSaplingAnchor = pcoinsTip->GetBestAnchor(SAPLING);
+        pcursor.reset(pcoinsdbview->NewIterator());
+    }
+
+    uint256 hashSnapshot;
+    uint64_t nRecords;
+    if (!pcoinsdbview->DumpSnapshot(pcursor.get(), metadata, file, hashSnapshot, nRecords))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the chainstate");
+    pcursor.reset();
+    file.fclose();
+    if (!RenameOver(pathTemp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTemp.string());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("records", nRecords);
+    ret.pushKV("base_hash", metadata.hashBlock.GetHex());
+    ret.pushKV("base_height", metadata.nHeight);
+    ret.pushKV("nchaintx", (int64_t)metadata.nChainTx);
+    ret.pushKV("txoutset_hash", hashSnapshot.GetHex());
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nReplace the UTXO set with a snapshot written by dumptxoutset and make its block the tip.\n"
+            "The snapshot must be one of those listed in the chain parameters, and its block header\n"
+            "must be known. Blocks up to it are downloaded and validated in the background, see \"snapshot\"\n"
+            "in getblockchaininfo, and until then the chain cannot be reorganized below it. Not available\n"
+            "with a wallet, -txindex or the insight explorer indexes.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The snapshot, relative to the data directory if not absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"records\": n,             (numeric) The number of records loaded\n"
+            "  \"tip_hash\": \"hash\",       (string) The block the snapshot was taken at\n"
+            "  \"base_height\": n,         (numeric) The height of that block\n"
+            "  \"path\": \"path\"            (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+#ifdef ENABLE_WALLET
+    if (pwalletMain)
+        throw JSONRPCError(RPC_MISC_ERROR, "A snapshot cannot be loaded with a wallet, restart with -disablewallet");
+#endif
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + path.string());
+
+    CTxOutSetSnapshotMetadata metadata;
+    uint64_t nRecords;
+    std::string strError;
+    try {
+        if (!ActivateTxOutSetSnapshot(file, Params(), metadata, nRecords, strError))
+            throw JSONRPCError(RPC_MISC_ERROR, strError);
+    } catch (const std::ios_base::failure& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, std::string("Truncated or corrupt snapshot: ") + e.what());
+    }
+
+    // Connect the blocks after the base that are already here
+    CValidationState state;
+    ActivateBestChain(state, Params());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("records", nRecords);
+    ret.pushKV("tip_hash", metadata.hashBlock.GetHex());
+    ret.pushKV("base_height", metadata.nHeight);
+    ret.pushKV("path", path.string());
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -1028,6 +1394,17 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"consensus\": {               (object) branch IDs of the current and upcoming consensus rules\n"
             "     \"chaintip\": \"xxxxxxxx\",   (string) branch ID used to validate the current chain tip\n"
             "     \"nextblock\": \"xxxxxxxx\"   (string) branch ID that the next block will be validated under\n"
+            "  },\n"
+            "  \"notifications\": {           (object) progress of the wallet and zmq block notifications\n"
+            "     \"height\": xxxxxx,          (numeric) height of the last block notified\n"
+            "     \"lag\": xxxxxx,             (numeric) blocks the notifications are behind the chain tip\n"
+            "     \"lastbatch\": xxxxxx,       (numeric) blocks notified in the last pass, once a second\n"
+            "     \"lastbatchtime\": xxxxxx,   (numeric) milliseconds the last pass took\n"
+            "     \"waittime\": xxxxxx         (numeric) milliseconds block validation waited for notifications more than " + itostr(MAX_WALLET_NOTIFY_LAG) + " blocks behind\n"
+            "  },\n"
+            "  \"snapshot\": {                (object) only while the blocks below a snapshot from loadtxoutset are validated\n"
+            "     \"baseheight\": xxxxxx,      (numeric) height of the block the snapshot was taken at\n"
+            "     \"validatedheight\": xxxxxx  (numeric) height of the last block below it validated so far, or -1\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -1091,6 +1468,26 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
         obj.pushKV("pruneheight",        block->nHeight);
     }
 
+    CWalletNotifyStats notifyStats = GetWalletNotifyStats();
+    if (notifyStats.fRunning) {
+        UniValue notifications(UniValue::VOBJ);
+        notifications.pushKV("height", notifyStats.nNotifiedHeight);
+        notifications.pushKV("lag", chainActive.Height() - notifyStats.nNotifiedHeight);
+        notifications.pushKV("lastbatch", notifyStats.nLastBatchBlocks);
+        notifications.pushKV("lastbatchtime", notifyStats.nLastCycleMicros / 1000);
+        notifications.pushKV("waittime", notifyStats.nWaitMicros / 1000);
+        obj.pushKV("notifications", notifications);
+    }
+
+    CBlockIndex* pindexSnapshotBase = GetSnapshotBase();
+    if (pindexSnapshotBase) {
+        CBlockIndex* pindexHistoricalTip = GetHistoricalTip();
+        UniValue snapshot(UniValue::VOBJ);
+        snapshot.pushKV("baseheight", pindexSnapshotBase->nHeight);
+        snapshot.pushKV("validatedheight", pindexHistoricalTip ? pindexHistoricalTip->nHeight : -1);
+        obj.pushKV("snapshot", snapshot);
+    }
+
     if (Params().NetworkIDString() == "regtest") {
         obj.pushKV("fullyNotified", ChainIsFullyNotified());
     }
@@ -1257,10 +1654,9 @@ UniValue invalidateblock(const UniValue& params, bool fHelp)
 
     {
         LOCK(cs_main);
-        if (mapBlockIndex.count(hash) == 0)
+        CBlockIndex* pblockindex = LookupBlockIndex(hash);
+        if (!pblockindex)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
-        CBlockIndex* pblockindex = mapBlockIndex[hash];
         InvalidateBlock(state, Params(), pblockindex);
     }
 
@@ -1296,10 +1692,9 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 
     {
         LOCK(cs_main);
-        if (mapBlockIndex.count(hash) == 0)
+        CBlockIndex* pblockindex = LookupBlockIndex(hash);
+        if (!pblockindex)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
-        CBlockIndex* pblockindex = mapBlockIndex[hash];
         ReconsiderBlock(state, pblockindex);
     }
 
@@ -1315,33 +1710,39 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      true  },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true  },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true  },
+    { "blockchain",         "getblock",               &getblock,               true,      true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true  },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,      true  },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      true  },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true  },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true  },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false,     false },
+    { "blockchain",         "verifychain",            &verifychain,            true,      false },
 
     // insightexplorer
-    { "blockchain",         "getblockdeltas",         &getblockdeltas,         false },    
-    { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
+    { "blockchain",         "getblockdeltas",         &getblockdeltas,         false,     true  },    
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,      true  },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      false },
 };
 
 void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    tableRPC.appendStreamingActor("getblock", &getblock_stream);
+    tableRPC.appendStreamingActor("getblockdeltas", &getblockdeltas_stream);
+    tableRPC.appendStreamingActor("getrawmempool", &getrawmempool_stream);
 }
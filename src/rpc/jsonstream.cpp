@@ -0,0 +1,157 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/jsonstream.h"
+
+#include "httpserver.h"
+#include "rpc/protocol.h"
+
+#include <assert.h>
+
+CJSONStreamWriter::CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fOk(true), fStarted(false), fAfterKey(false)
+{
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vHasElements.empty()) {
+        if (vHasElements.back())
+            strBuffer += ',';
+        vHasElements.back() = true;
+    }
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    if (!fOk)
+        return;
+    Separate();
+    strBuffer += '{';
+    vHasElements.push_back(false);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    if (!fOk)
+        return;
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    strBuffer += '}';
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    if (!fOk)
+        return;
+    Separate();
+    strBuffer += '[';
+    vHasElements.push_back(false);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    if (!fOk)
+        return;
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    strBuffer += ']';
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    if (!fOk)
+        return;
+    assert(!fAfterKey);
+    Separate();
+    strBuffer += UniValue(key).write();
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& val)
+{
+    if (!fOk)
+        return;
+    Separate();
+    strBuffer += val.write();
+}
+
+void CJSONStreamWriter::PushKVs(const UniValue& obj)
+{
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        PushKV(keys[i], values[i]);
+}
+
+void CJSONStreamWriter::Raw(const std::string& str)
+{
+    if (!fOk)
+        return;
+    strBuffer += str;
+}
+
+bool CJSONStreamWriter::MaybeFlush()
+{
+    if (strBuffer.size() < nFlushSize)
+        return fOk;
+    return Flush();
+}
+
+bool CJSONStreamWriter::Flush()
+{
+    if (!fOk)
+        return false;
+    if (strBuffer.empty())
+        return true;
+    fStarted = true;
+    fOk = sink(strBuffer);
+    strBuffer.clear();
+    return fOk;
+}
+
+std::string CJSONStreamWriter::ReleaseBuffer()
+{
+    std::string strRet;
+    strRet.swap(strBuffer);
+    return strRet;
+}
+
+CHTTPJSONWriter::CHTTPJSONWriter(HTTPRequest* reqIn) :
+    CJSONStreamWriter([this](const std::string& strChunk) { return WriteChunk(strChunk); }),
+    req(reqIn), fReplyStarted(false)
+{
+}
+
+bool CHTTPJSONWriter::WriteChunk(const std::string& strChunk)
+{
+    if (!fReplyStarted) {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReplyStart(HTTP_OK);
+        fReplyStarted = true;
+    }
+    return req->WriteReplyChunk(strChunk);
+}
+
+void CHTTPJSONWriter::Finish()
+{
+    if (!fReplyStarted) {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, ReleaseBuffer());
+        return;
+    }
+    Flush();
+    req->WriteReplyEnd();
+}
+
+void CHTTPJSONWriter::Abort()
+{
+    assert(fReplyStarted);
+    req->WriteReplyAbort();
+}
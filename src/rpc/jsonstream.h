@@ -0,0 +1,103 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_RPC_JSONSTREAM_H
+#define BITCOIN_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+class HTTPRequest;
+
+/** Bytes a CJSONStreamWriter collects before MaybeFlush hands them on */
+static const size_t JSON_STREAM_FLUSH_SIZE = 64 * 1024;
+
+/**
+ * Writes a JSON document piece by piece, for replies too large to build as
+ * one UniValue. Separators are added automatically; the values themselves
+ * are written with UniValue::write, so the output matches a UniValue tree
+ * with the same contents.
+ *
+ * Output is collected in a buffer and only handed to the sink by
+ * MaybeFlush and Flush, which callers place where they hold no locks. Once
+ * the sink fails, all further output is dropped and Ok() returns false, so
+ * long loops can stop early.
+ */
+class CJSONStreamWriter
+{
+public:
+    /** Takes the next part of the output; returns false if it cannot take any more */
+    typedef std::function<bool(const std::string&)> Sink;
+
+    explicit CJSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn = JSON_STREAM_FLUSH_SIZE);
+    virtual ~CJSONStreamWriter() {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Write the key of the next object member */
+    void Key(const std::string& key);
+    /** Write an array element, or the value of the member just named with Key */
+    void Value(const UniValue& val);
+    void PushKV(const std::string& key, const UniValue& val) { Key(key); Value(val); }
+    /** Write all members of obj into the current object */
+    void PushKVs(const UniValue& obj);
+    /** Append text as is, outside of the document structure */
+    void Raw(const std::string& str);
+
+    /** Hand the buffer to the sink if it has grown beyond the flush size */
+    bool MaybeFlush();
+    bool Flush();
+
+    bool Ok() const { return fOk; }
+    /** Whether any output was handed to the sink yet */
+    bool Started() const { return fStarted; }
+    /** Take the output not flushed yet, e.g. to send a short document in one piece */
+    std::string ReleaseBuffer();
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string strBuffer;
+    bool fOk;
+    bool fStarted;
+    //! For each open object or array, whether it has an element yet
+    std::vector<bool> vHasElements;
+    //! A key was written and awaits its value
+    bool fAfterKey;
+
+    void Separate();
+};
+
+/**
+ * Writes a JSON document as the body of an HTTP reply. The reply only
+ * switches to chunked encoding when the first chunk is flushed; until then
+ * the request can still be answered with an ordinary error reply.
+ */
+class CHTTPJSONWriter : public CJSONStreamWriter
+{
+public:
+    explicit CHTTPJSONWriter(HTTPRequest* reqIn);
+
+    /** Send what is left: the whole document in one reply if nothing went out yet, else the last chunk */
+    void Finish();
+    /**
+     * Cut short a reply that was already started. Nothing more is sent and
+     * the connection is closed, so that the client cannot mistake the
+     * incomplete document for the whole reply.
+     */
+    void Abort();
+
+private:
+    HTTPRequest* req;
+    bool fReplyStarted;
+
+    bool WriteChunk(const std::string& strChunk);
+};
+
+#endif // BITCOIN_RPC_JSONSTREAM_H
@@ -268,11 +268,11 @@ UniValue kv_verifymessage(const UniValue& params, bool fHelp)
 
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "key-value",          "kv_getinfo",             &kv_getinfo,             true  }, /* uses wallet if enabled */
-    { "key-value",          "kv_validateaddress",     &kv_validateaddress,     true  }, 
-    { "key-value",          "kv_verifymessage",       &kv_verifymessage,       true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "key-value",          "kv_getinfo",             &kv_getinfo,             true,      false }, /* uses wallet if enabled */
+    { "key-value",          "kv_validateaddress",     &kv_validateaddress,     true,      false }, 
+    { "key-value",          "kv_verifymessage",       &kv_verifymessage,       true,      true  },
 };
 
 void RegisterKVRPCCommands(CRPCTable &tableRPC)
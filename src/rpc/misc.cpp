@@ -10,6 +10,7 @@
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util.h"
@@ -662,6 +663,56 @@ UniValue getaddressmempool(const UniValue& params, bool fHelp)
     return result;
 }
 
+// insightexplorer
+static bool getIncludeChainInfo(const UniValue& params)
+{
+    bool includeChainInfo = false;
+    if (params[0].isObject()) {
+        UniValue chainInfo = find_value(params[0].get_obj(), "chainInfo");
+        if (!chainInfo.isNull()) {
+            includeChainInfo = chainInfo.get_bool();
+        }
+    }
+    return includeChainInfo;
+}
+
+// Fetch the unspent outputs of the addresses in params, oldest first.
+static void getAddressUnspentSorted(
+    const UniValue& params,
+    std::vector<CAddressUnspentDbEntry>& unspentOutputs)
+{
+    std::vector<std::pair<uint160, int>> addresses;
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+    for (const auto& it : addresses) {
+        if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+    }
+    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
+        [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
+            return a.second.blockHeight < b.second.blockHeight;
+        });
+}
+
+static UniValue addressUnspentToJSON(const CAddressUnspentDbEntry& it)
+{
+    UniValue output(UniValue::VOBJ);
+    std::string address;
+    if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    output.pushKV("address", address);
+    output.pushKV("txid", it.first.txhash.GetHex());
+    output.pushKV("outputIndex", (int)it.first.index);
+    output.pushKV("script", HexStr(it.second.script.begin(), it.second.script.end()));
+    output.pushKV("satoshis", it.second.satoshis);
+    output.pushKV("height", it.second.blockHeight);
+    return output;
+}
+
 // insightexplorer
 UniValue getaddressutxos(const UniValue& params, bool fHelp)
 {
@@ -722,43 +773,13 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "Run './vect-cli help getaddressutxos' for instructions on how to enable this feature.");
     }
 
-    bool includeChainInfo = false;
-    if (params[0].isObject()) {
-        UniValue chainInfo = find_value(params[0].get_obj(), "chainInfo");
-        if (!chainInfo.isNull()) {
-            includeChainInfo = chainInfo.get_bool();
-        }
-    }
-    std::vector<std::pair<uint160, int>> addresses;
-    if (!getAddressesFromParams(params, addresses)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
-    }
+    bool includeChainInfo = getIncludeChainInfo(params);
     std::vector<CAddressUnspentDbEntry> unspentOutputs;
-    for (const auto& it : addresses) {
-        if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
-        [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
-            return a.second.blockHeight < b.second.blockHeight;
-        });
+    getAddressUnspentSorted(params, unspentOutputs);
 
     UniValue utxos(UniValue::VARR);
     for (const auto& it : unspentOutputs) {
-        UniValue output(UniValue::VOBJ);
-        std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        output.pushKV("address", address);
-        output.pushKV("txid", it.first.txhash.GetHex());
-        output.pushKV("outputIndex", (int)it.first.index);
-        output.pushKV("script", HexStr(it.second.script.begin(), it.second.script.end()));
-        output.pushKV("satoshis", it.second.satoshis);
-        output.pushKV("height", it.second.blockHeight);
-        utxos.push_back(output);
+        utxos.push_back(addressUnspentToJSON(it));
     }
 
     if (!includeChainInfo)
@@ -773,6 +794,34 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
     return result;
 }
 
+static bool getaddressutxos_stream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    if (params.size() != 1 || !fExperimentalInsightExplorer)
+        return false;
+
+    bool includeChainInfo = getIncludeChainInfo(params);
+    std::vector<CAddressUnspentDbEntry> unspentOutputs;
+    getAddressUnspentSorted(params, unspentOutputs);
+
+    if (includeChainInfo) {
+        writer.BeginObject();
+        writer.Key("utxos");
+    }
+    writer.BeginArray();
+    for (size_t i = 0; i < unspentOutputs.size() && writer.Ok(); i++) {
+        writer.Value(addressUnspentToJSON(unspentOutputs[i]));
+        writer.MaybeFlush();
+    }
+    writer.EndArray();
+    if (includeChainInfo) {
+        LOCK(cs_main);  // for chainActive
+        writer.PushKV("hash", chainActive.Tip()->GetBlockHash().GetHex());
+        writer.PushKV("height", (int)chainActive.Height());
+        writer.EndObject();
+    }
+    return true;
+}
+
 static void getHeightRange(const UniValue& params, int& start, int& end)
 {
     start = 0;
@@ -819,6 +868,38 @@ static void getAddressesInHeightRange(
     }
 }
 
+static UniValue addressDeltaToJSON(const std::pair<CAddressIndexKey, CAmount>& it)
+{
+    std::string address;
+    if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+    }
+
+    UniValue delta(UniValue::VOBJ);
+    delta.pushKV("address", address);
+    delta.pushKV("blockindex", (int)it.first.txindex);
+    delta.pushKV("height", it.first.blockHeight);
+    delta.pushKV("index", (int)it.first.index);
+    delta.pushKV("satoshis", it.second);
+    delta.pushKV("txid", it.first.txhash.GetHex());
+    return delta;
+}
+
+// The "start" and "end" chain info of getaddressdeltas.
+static void getHeightRangeInfo(int start, int end, UniValue& startInfo, UniValue& endInfo)
+{
+    {
+        LOCK(cs_main);  // for chainActive
+        if (start > chainActive.Height() || end > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
+        }
+        startInfo.pushKV("hash", chainActive[start]->GetBlockHash().GetHex());
+        endInfo.pushKV("hash", chainActive[end]->GetBlockHash().GetHex());
+    }
+    startInfo.pushKV("height", start);
+    endInfo.pushKV("height", end);
+}
+
 // insightexplorer
 UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 {
@@ -897,29 +978,11 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
     getAddressesInHeightRange(params, start, end, addresses, addressIndex);
 
-    bool includeChainInfo = false;
-    if (params[0].isObject()) {
-        UniValue chainInfo = find_value(params[0].get_obj(), "chainInfo");
-        if (!chainInfo.isNull()) {
-            includeChainInfo = chainInfo.get_bool();
-        }
-    }
+    bool includeChainInfo = getIncludeChainInfo(params);
 
     UniValue deltas(UniValue::VARR);
     for (const auto& it : addressIndex) {
-        std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
-
-        UniValue delta(UniValue::VOBJ);
-        delta.pushKV("address", address);
-        delta.pushKV("blockindex", (int)it.first.txindex);
-        delta.pushKV("height", it.first.blockHeight);
-        delta.pushKV("index", (int)it.first.index);
-        delta.pushKV("satoshis", it.second);
-        delta.pushKV("txid", it.first.txhash.GetHex());
-        deltas.push_back(delta);
+        deltas.push_back(addressDeltaToJSON(it));
     }
 
     UniValue result(UniValue::VOBJ);
@@ -930,16 +993,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 
     UniValue startInfo(UniValue::VOBJ);
     UniValue endInfo(UniValue::VOBJ);
-    {
-        LOCK(cs_main);  // for chainActive
-        if (start > chainActive.Height() || end > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Start or end is outside chain range");
-        }
-        startInfo.pushKV("hash", chainActive[start]->GetBlockHash().GetHex());
-        endInfo.pushKV("hash", chainActive[end]->GetBlockHash().GetHex());
-    }
-    startInfo.pushKV("height", start);
-    endInfo.pushKV("height", end);
+    getHeightRangeInfo(start, end, startInfo, endInfo);
 
     result.pushKV("deltas", deltas);
     result.pushKV("start", startInfo);
@@ -948,6 +1002,41 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     return result;
 }
 
+static bool getaddressdeltas_stream(const UniValue& params, CJSONStreamWriter& writer)
+{
+    if (params.size() != 1 || !(fExperimentalInsightExplorer || fExperimentalLightWalletd))
+        return false;
+
+    int start = 0;
+    int end = 0;
+    getHeightRange(params, start, end);
+
+    std::vector<std::pair<uint160, int>> addresses;
+    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
+    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+
+    bool includeChainInfo = getIncludeChainInfo(params) && start > 0 && end > 0;
+    UniValue startInfo(UniValue::VOBJ);
+    UniValue endInfo(UniValue::VOBJ);
+    if (includeChainInfo) {
+        getHeightRangeInfo(start, end, startInfo, endInfo);
+        writer.BeginObject();
+        writer.Key("deltas");
+    }
+    writer.BeginArray();
+    for (size_t i = 0; i < addressIndex.size() && writer.Ok(); i++) {
+        writer.Value(addressDeltaToJSON(addressIndex[i]));
+        writer.MaybeFlush();
+    }
+    writer.EndArray();
+    if (includeChainInfo) {
+        writer.PushKV("start", startInfo);
+        writer.PushKV("end", endInfo);
+        writer.EndObject();
+    }
+    return true;
+}
+
 // insightexplorer
 UniValue getaddressbalance(const UniValue& params, bool fHelp)
 {
@@ -1131,31 +1220,34 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "verifymessage",          &verifymessage,          true  },
-    { "control",            "getexperimentalfeatures",&getexperimentalfeatures,true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "control",            "getinfo",                &getinfo,                true,      false }, /* uses wallet if enabled */
+    { "util",               "validateaddress",        &validateaddress,        true,      false }, /* uses wallet if enabled */
+    { "util",               "z_validateaddress",      &z_validateaddress,      true,      false }, /* uses wallet if enabled */
+    { "util",               "createmultisig",         &createmultisig,         true,      false },
+    { "util",               "verifymessage",          &verifymessage,          true,      true  },
+    { "control",            "getexperimentalfeatures",&getexperimentalfeatures,true,      true  },
 
     // START insightexplorer
     /* Address index */
-    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false }, /* insight explorer */
-    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false }, /* insight explorer */
-    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false }, /* insight explorer */
-    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false }, /* insight explorer */
-    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  }, /* insight explorer */
-    { "blockchain",         "getspentinfo",           &getspentinfo,           false }, /* insight explorer */
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false,     true  }, /* insight explorer */
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,      true  }, /* insight explorer */
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false,     true  }, /* insight explorer */
     // END insightexplorer
 
     /* Not shown in help */
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      false },
 };
 
 void RegisterMiscRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+
+    tableRPC.appendStreamingActor("getaddressdeltas", &getaddressdeltas_stream);
+    tableRPC.appendStreamingActor("getaddressutxos", &getaddressutxos_stream);
 }
@@ -98,6 +98,19 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"version\": v,              (numeric) The peer version, such as 170002\n"
             "    \"subver\": \"/MagicBean:x.y.z[-v]/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
+            "    \"bytessent_per_msg\": {     (json object) Bytes sent, by message command\n"
+            "       \"cmd\": n,\n"
+            "       ...\n"
+            "    },\n"
+            "    \"bytesrecv_per_msg\": {     (json object) Bytes received, by message command\n"
+            "       \"cmd\": n,\n"
+            "       ...\n"
+            "    },\n"
+            "    \"processtime_per_msg\": {   (json object) Microseconds spent processing received messages, by command\n"
+            "       \"cmd\": n,\n"
+            "       ...\n"
+            "    },\n"
+            "    \"txreconciliation\": true|false, (boolean) Whether transactions are reconciled with this peer instead of flooded\n"
             "    \"startingheight\": n,       (numeric) The starting height (block) of the peer\n"
             "    \"banscore\": n,             (numeric) The ban score\n"
             "    \"synced_headers\": n,       (numeric) The last header we have in common with this peer\n"
@@ -145,6 +158,19 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         // their ver message.
         obj.pushKV("subver", stats.cleanSubVer);
         obj.pushKV("inbound", stats.fInbound);
+        UniValue sendPerMsg(UniValue::VOBJ);
+        for (mapMsgCmdStats::const_iterator it = stats.mapSendMsgStats.begin(); it != stats.mapSendMsgStats.end(); ++it)
+            sendPerMsg.pushKV(it->first, it->second.nBytes);
+        obj.pushKV("bytessent_per_msg", sendPerMsg);
+        UniValue recvPerMsg(UniValue::VOBJ);
+        UniValue timePerMsg(UniValue::VOBJ);
+        for (mapMsgCmdStats::const_iterator it = stats.mapRecvMsgStats.begin(); it != stats.mapRecvMsgStats.end(); ++it) {
+            recvPerMsg.pushKV(it->first, it->second.nBytes);
+            timePerMsg.pushKV(it->first, it->second.nProcessTimeMicros);
+        }
+        obj.pushKV("bytesrecv_per_msg", recvPerMsg);
+        obj.pushKV("processtime_per_msg", timePerMsg);
+        obj.pushKV("txreconciliation", stats.fTxReconciliation);
         obj.pushKV("startingheight", stats.nStartingHeight);
         if (fStateStats) {
             obj.pushKV("banscore", statestats.nMisbehavior);
@@ -377,6 +403,92 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+static UniValue MsgStatsToJSON(const mapMsgCmdStats& mapStats, bool fProcessTime)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (mapMsgCmdStats::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        const CNetMsgStats& msgStats = it->second;
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("count", msgStats.nMessages);
+        obj.pushKV("bytes", msgStats.nBytes);
+        if (fProcessTime) {
+            obj.pushKV("processed", msgStats.nProcessed);
+            obj.pushKV("processtime", msgStats.nProcessTimeMicros);
+            UniValue hist(UniValue::VARR);
+            for (int i = 0; i < NET_PROCESS_TIME_BUCKETS; i++)
+                hist.push_back(msgStats.vProcessTimeHist[i]);
+            obj.pushKV("processtime_hist", hist);
+        }
+        ret.pushKV(it->first, obj);
+    }
+    return ret;
+}
+
+UniValue getnetmsgstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getnetmsgstats ( nodeid )\n"
+            "\nReturns network traffic and processing time by message command, for all peers\n"
+            "since startup or for one connected peer.\n"
+            "\nArguments:\n"
+            "1. nodeid          (numeric, optional) The peer id, as in getpeerinfo\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sent\": {                    (json object) Messages sent, by command\n"
+            "    \"cmd\": {\n"
+            "      \"count\": n,              (numeric) Number of messages\n"
+            "      \"bytes\": n               (numeric) Bytes, including message headers\n"
+            "    },\n"
+            "    ...\n"
+            "  },\n"
+            "  \"received\": {                (json object) Messages received, by command\n"
+            "    \"cmd\": {\n"
+            "      \"count\": n,              (numeric) Number of messages\n"
+            "      \"bytes\": n,              (numeric) Bytes, including message headers\n"
+            "      \"processed\": n,          (numeric) Number of messages processed\n"
+            "      \"processtime\": n,        (numeric) Total processing time in microseconds\n"
+            "      \"processtime_hist\": [    (json array) Messages by processing time: the i-th entry counts\n"
+            "         n,                     those that took at least 4^i and less than 4^(i+1) microseconds\n"
+            "         ...\n"
+            "      ]\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nCommands the node does not know are counted together as \"" + std::string(NET_MESSAGE_COMMAND_OTHER) + "\".\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleCli("getnetmsgstats", "3")
+            + HelpExampleRpc("getnetmsgstats", "3")
+        );
+
+    mapMsgCmdStats mapSent, mapRecv;
+    if (params.size() > 0) {
+        NodeId nodeid = params[0].get_int();
+        bool fFound = false;
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            if (pnode->GetId() == nodeid) {
+                LOCK(pnode->cs_msgStats);
+                mapSent = pnode->mapSendMsgStats;
+                mapRecv = pnode->mapRecvMsgStats;
+                fFound = true;
+                break;
+            }
+        }
+        if (!fFound)
+            throw JSONRPCError(RPC_CLIENT_NODE_NOT_CONNECTED, "Node not found in connected nodes");
+    } else {
+        CNode::GetTotalMsgStats(mapSent, mapRecv);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("sent", MsgStatsToJSON(mapSent, false));
+    obj.pushKV("received", MsgStatsToJSON(mapRecv, true));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -599,20 +711,21 @@ UniValue clearbanned(const UniValue& params, bool fHelp)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      true  },
+    { "network",            "getdeprecationinfo",     &getdeprecationinfo,     true,      true  },
+    { "network",            "ping",                   &ping,                   true,      false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      true  },
+    { "network",            "addnode",                &addnode,                true,      false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,      false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true  },
+    { "network",            "getnettotals",           &getnettotals,           true,      true  },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true,      true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      true  },
+    { "network",            "setban",                 &setban,                 true,      false },
+    { "network",            "listbanned",             &listbanned,             true,      true  },
+    { "network",            "clearbanned",            &clearbanned,            true,      false },
 };
 
 void RegisterNetRPCCommands(CRPCTable &tableRPC)
@@ -5,6 +5,7 @@
 
 #include "rpc/server.h"
 
+#include "httpserver.h"
 #include "init.h"
 #include "key_io.h"
 #include "random.h"
@@ -14,6 +15,8 @@
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
+#include <deque>
 #include <memory>
 
 #include <univalue.h>
@@ -294,12 +297,12 @@ UniValue stop(const UniValue& params, bool fHelp)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
     /* Overall control/query calls */
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "setlogfilter",           &setlogfilter,           true  },
-    { "control",            "stop",                   &stop,                   true  },
+    { "control",            "help",                   &help,                   true,      true  },
+    { "control",            "setlogfilter",           &setlogfilter,           true,      false },
+    { "control",            "stop",                   &stop,                   true,      false },
 };
 
 CRPCTable::CRPCTable()
@@ -336,14 +339,44 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamingActor(const std::string& name, rpcstreamfn_type fn)
+{
+    if (IsRPCRunning() || !mapCommands.count(name))
+        return false;
+
+    return mapStreamingActors.insert(std::make_pair(name, fn)).second;
+}
+
+static void ThreadRPCBatch();
+
+/**
+ * Threads that execute the read-only calls of batch requests. Each batch
+ * is split between them and the HTTP worker that received it, which
+ * takes part too, so batches make progress even when the pool is busy.
+ */
+static boost::mutex cs_rpcBatch;
+static boost::condition_variable condRPCBatch;
+static std::deque<std::shared_ptr<struct RPCBatchRun> > vRPCBatchRuns;
+static boost::thread_group rpcBatchThreads;
+static bool fRPCBatchQuit = false;
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
     fRPCRunning = true;
     g_rpcSignals.Started();
 
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcBatch);
+        fRPCBatchQuit = false;
+    }
+    int nBatchThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    for (int i = 0; i < nBatchThreads; i++)
+        rpcBatchThreads.create_thread(&ThreadRPCBatch);
+
     // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
     getAsyncRPCQueue()->addWorker();
+    getAsyncRPCQueue()->setRetention(std::max<int64_t>(0, GetArg("-rpcasyncretention", DEFAULT_ASYNC_RPC_RETENTION)));
 /*
     int n = GetArg("-rpcasyncthreads", 1);
     if (n<1) {
@@ -375,6 +408,13 @@ void StopRPC()
     // Tells async queue to cancel all operations and shutdown.
     LogPrintf("%s: waiting for async rpc workers to stop\n", __func__);
     getAsyncRPCQueue()->closeAndWait();
+
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcBatch);
+        fRPCBatchQuit = true;
+    }
+    condRPCBatch.notify_all();
+    rpcBatchThreads.join_all();
 }
 
 bool IsRPCRunning()
@@ -457,13 +497,120 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+/** A run of consecutive read-only calls in a batch, executed in parallel */
+struct RPCBatchRun
+{
+    const UniValue& vReq;
+    std::vector<std::string>& vReply;
+    const size_t nEnd;
+    std::atomic<size_t> nNext;
+    size_t nDone;
+    boost::mutex cs;
+    boost::condition_variable cond;
+
+    RPCBatchRun(const UniValue& vReqIn, std::vector<std::string>& vReplyIn, size_t nBegin, size_t nEndIn) :
+        vReq(vReqIn), vReply(vReplyIn), nEnd(nEndIn), nNext(nBegin), nDone(nBegin) {}
+
+    bool Exhausted() const { return nNext >= nEnd; }
+
+    // Execute calls until none are left to start. Each reply is written
+    // to its own slot, so the order of the batch is kept.
+    void Work()
+    {
+        size_t nCount = 0;
+        for (size_t i = nNext++; i < nEnd; i = nNext++, nCount++)
+            vReply[i] = JSONRPCExecOne(vReq[i]).write();
+        if (nCount > 0) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            nDone += nCount;
+            if (nDone == nEnd)
+                cond.notify_all();
+        }
+    }
+};
+
+static void ThreadRPCBatch()
+{
+    RenameThread("vect-rpcbatch");
+    while (true) {
+        std::shared_ptr<RPCBatchRun> run;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_rpcBatch);
+            while (!fRPCBatchQuit && vRPCBatchRuns.empty())
+                condRPCBatch.wait(lock);
+            if (fRPCBatchQuit)
+                return;
+            run = vRPCBatchRuns.front();
+            if (run->Exhausted()) {
+                vRPCBatchRuns.pop_front();
+                continue;
+            }
+        }
+        run->Work();
+    }
+}
+
+static void JSONRPCExecParallel(const UniValue& vReq, std::vector<std::string>& vReply, size_t nBegin, size_t nEnd)
+{
+    std::shared_ptr<RPCBatchRun> run = std::make_shared<RPCBatchRun>(vReq, vReply, nBegin, nEnd);
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcBatch);
+        vRPCBatchRuns.push_back(run);
+    }
+    condRPCBatch.notify_all();
+
+    run->Work();
+
+    // Every call has been started; take the run off the queue before vReq
+    // and vReply go away, and wait for the pool to finish its share
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcBatch);
+        std::deque<std::shared_ptr<RPCBatchRun> >::iterator it = std::find(vRPCBatchRuns.begin(), vRPCBatchRuns.end(), run);
+        if (it != vRPCBatchRuns.end())
+            vRPCBatchRuns.erase(it);
+    }
+    boost::unique_lock<boost::mutex> lock(run->cs);
+    while (run->nDone != nEnd)
+        run->cond.wait(lock);
+}
+
+static bool IsReadOnlyRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    if (!method.isStr())
+        return false;
+    const CRPCCommand* pcmd = tableRPC[method.get_str()];
+    return pcmd && pcmd->readOnly;
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
-    UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    // Calls that change state keep their place in the sequence; runs of
+    // read-only calls between them are executed in parallel
+    std::vector<std::string> vReply(vReq.size());
+    size_t nBegin = 0;
+    while (nBegin < vReq.size()) {
+        size_t nEnd = nBegin;
+        while (nEnd < vReq.size() && IsReadOnlyRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - nBegin > 1) {
+            JSONRPCExecParallel(vReq, vReply, nBegin, nEnd);
+            nBegin = nEnd;
+        } else {
+            vReply[nBegin] = JSONRPCExecOne(vReq[nBegin]).write();
+            nBegin++;
+        }
+    }
 
-    return ret.write() + "\n";
+    std::string strReply = "[";
+    for (size_t i = 0; i < vReply.size(); i++) {
+        if (i > 0)
+            strReply += ",";
+        strReply += vReply[i];
+    }
+    return strReply + "]\n";
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -495,6 +642,36 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::executeStreaming(const std::string &strMethod, const UniValue &params, CJSONStreamWriter& writer) const
+{
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamingActors.find(strMethod);
+    if (it == mapStreamingActors.end())
+        return false;
+
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    assert(pcmd);
+    g_rpcSignals.PreCommand(*pcmd);
+
+    bool fStreamed;
+    try
+    {
+        fStreamed = it->second(params, writer);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+    return fStreamed;
+}
+
 std::string HelpExampleCli(const std::string& methodname, const std::string& args)
 {
     return "> vect-cli " + methodname + " " + args + "\n";
@@ -19,6 +19,7 @@
 #include <univalue.h>
 
 class AsyncRPCQueue;
+class CJSONStreamWriter;
 class CRPCCommand;
 
 namespace RPCServer
@@ -116,6 +117,12 @@ void RPCUnregisterTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
+/**
+ * Writes the result of a command into writer instead of returning it.
+ * Returns false, before writing anything, to leave the call to the
+ * command's normal actor, e.g. for a small result or for help.
+ */
+typedef bool(*rpcstreamfn_type)(const UniValue& params, CJSONStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -124,6 +131,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Changes no state, so consecutive calls of such commands in a batch may run concurrently
+    bool readOnly;
 };
 
 /**
@@ -133,6 +142,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamingActors;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -147,6 +157,14 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Execute a method through its streaming actor, writing the result
+     * into writer.
+     * @returns false if the method has no streaming actor or it declined
+     * the call; nothing has been written then.
+     * @throws an exception (UniValue) when an error happens.
+     */
+    bool executeStreaming(const std::string &method, const UniValue &params, CJSONStreamWriter& writer) const;
 
     /**
      * Appends a CRPCCommand to the dispatch table.
@@ -154,6 +172,12 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Registers a streaming actor for a command already in the table, used
+     * for single requests over HTTP whose results can be large.
+     */
+    bool appendStreamingActor(const std::string& name, rpcstreamfn_type fn);
 };
 
 extern CRPCTable tableRPC;
@@ -181,6 +205,10 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/**
+ * Execute a batch of requests and return the array of replies, serialized.
+ * Runs of consecutive read-only calls are executed in parallel.
+ */
 std::string JSONRPCExecBatch(const UniValue& vReq);
 
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::vector<std::string>& enableArgs);
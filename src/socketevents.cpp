@@ -0,0 +1,256 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#include <stdexcept>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#elif !defined(WIN32)
+#include <poll.h>
+#endif
+
+void CSocketEvents::Watch(SOCKET hSocket, int nEvents, int64_t nToken)
+{
+    if (hSocket == INVALID_SOCKET)
+        return;
+
+    auto it = mapWatched.find(hSocket);
+    if (it != mapWatched.end() && it->second.nToken != nToken) {
+        // The descriptor was closed and reused by a different owner
+        Unregister(hSocket);
+        mapWatched.erase(it);
+        it = mapWatched.end();
+    }
+
+    if (it == mapWatched.end()) {
+        if (!Register(hSocket, nEvents, true))
+            return;
+        WatchedSocket watched = {nEvents, nToken};
+        mapWatched.emplace(hSocket, watched);
+        return;
+    }
+
+    if (it->second.nEvents != nEvents) {
+        if (!Register(hSocket, nEvents, false)) {
+            Unregister(hSocket);
+            mapWatched.erase(it);
+            return;
+        }
+        it->second.nEvents = nEvents;
+    }
+}
+
+void CSocketEvents::Unwatch(SOCKET hSocket, int64_t nToken)
+{
+    auto it = mapWatched.find(hSocket);
+    if (it == mapWatched.end() || it->second.nToken != nToken)
+        return;
+    Unregister(hSocket);
+    mapWatched.erase(it);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+class CSocketEventsEpoll : public CSocketEvents
+{
+private:
+    int hEpoll;
+    std::vector<struct epoll_event> vEvents;
+
+    static uint32_t ToEpoll(int nEvents)
+    {
+        uint32_t events = 0;
+        if (nEvents & SOCKET_EVENT_RECV)
+            events |= EPOLLIN;
+        if (nEvents & SOCKET_EVENT_SEND)
+            events |= EPOLLOUT;
+        return events;
+    }
+
+protected:
+    bool Register(SOCKET hSocket, int nEvents, bool fNew)
+    {
+        struct epoll_event event = {};
+        event.events = ToEpoll(nEvents);
+        event.data.fd = hSocket;
+        if (epoll_ctl(hEpoll, fNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, hSocket, &event) == 0)
+            return true;
+        // Closing a descriptor removes it from the epoll set, and adding one
+        // the set still holds (a dup, or a missed close) fails; retry the
+        // other way round before giving up.
+        if (epoll_ctl(hEpoll, fNew ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, hSocket, &event) == 0)
+            return true;
+        LogPrint("net", "epoll_ctl failed for socket %d: %s\n", hSocket, NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+
+    void Unregister(SOCKET hSocket)
+    {
+        // Fails harmlessly if the socket was already closed
+        struct epoll_event event = {};
+        epoll_ctl(hEpoll, EPOLL_CTL_DEL, hSocket, &event);
+    }
+
+public:
+    CSocketEventsEpoll()
+    {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll < 0)
+            throw std::runtime_error(strprintf("epoll_create1 failed: %s", NetworkErrorString(WSAGetLastError())));
+    }
+
+    ~CSocketEventsEpoll()
+    {
+        close(hEpoll);
+    }
+
+    const char* GetName() const { return "epoll"; }
+
+    bool Wait(int nTimeoutMs, std::vector<std::pair<SOCKET, int>>& vReady)
+    {
+        vReady.clear();
+        vEvents.resize(std::max<size_t>(mapWatched.size(), 1));
+        int nReady = epoll_wait(hEpoll, vEvents.data(), vEvents.size(), nTimeoutMs);
+        if (nReady < 0) {
+            if (WSAGetLastError() == WSAEINTR)
+                return true;
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        for (int i = 0; i < nReady; i++) {
+            int nEvents = 0;
+            if (vEvents[i].events & EPOLLIN)
+                nEvents |= SOCKET_EVENT_RECV;
+            if (vEvents[i].events & EPOLLOUT)
+                nEvents |= SOCKET_EVENT_SEND;
+            if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+                nEvents |= SOCKET_EVENT_ERR;
+            vReady.push_back(std::make_pair((SOCKET)vEvents[i].data.fd, nEvents));
+        }
+        return true;
+    }
+};
+
+#elif !defined(WIN32)
+
+class CSocketEventsPoll : public CSocketEvents
+{
+private:
+    std::vector<struct pollfd> vPollFds;
+
+public:
+    const char* GetName() const { return "poll"; }
+
+    bool Wait(int nTimeoutMs, std::vector<std::pair<SOCKET, int>>& vReady)
+    {
+        vReady.clear();
+        vPollFds.clear();
+        for (const auto& item : mapWatched) {
+            struct pollfd pfd = {};
+            pfd.fd = item.first;
+            if (item.second.nEvents & SOCKET_EVENT_RECV)
+                pfd.events |= POLLIN;
+            if (item.second.nEvents & SOCKET_EVENT_SEND)
+                pfd.events |= POLLOUT;
+            vPollFds.push_back(pfd);
+        }
+
+        int nReady = poll(vPollFds.data(), vPollFds.size(), nTimeoutMs);
+        if (nReady < 0) {
+            if (WSAGetLastError() == WSAEINTR)
+                return true;
+            LogPrintf("socket poll error %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        for (size_t i = 0; i < vPollFds.size() && nReady > 0; i++) {
+            if (vPollFds[i].revents == 0)
+                continue;
+            nReady--;
+            int nEvents = 0;
+            if (vPollFds[i].revents & POLLIN)
+                nEvents |= SOCKET_EVENT_RECV;
+            if (vPollFds[i].revents & POLLOUT)
+                nEvents |= SOCKET_EVENT_SEND;
+            if (vPollFds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+                nEvents |= SOCKET_EVENT_ERR;
+            vReady.push_back(std::make_pair((SOCKET)vPollFds[i].fd, nEvents));
+        }
+        return true;
+    }
+};
+
+#else
+
+class CSocketEventsSelect : public CSocketEvents
+{
+public:
+    const char* GetName() const { return "select"; }
+
+    bool Wait(int nTimeoutMs, std::vector<std::pair<SOCKET, int>>& vReady)
+    {
+        vReady.clear();
+
+        struct timeval timeout;
+        timeout.tv_sec  = nTimeoutMs / 1000;
+        timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+
+        for (const auto& item : mapWatched) {
+            FD_SET(item.first, &fdsetError);
+            if (item.second.nEvents & SOCKET_EVENT_RECV)
+                FD_SET(item.first, &fdsetRecv);
+            if (item.second.nEvents & SOCKET_EVENT_SEND)
+                FD_SET(item.first, &fdsetSend);
+            hSocketMax = std::max(hSocketMax, item.first);
+        }
+
+        if (mapWatched.empty()) {
+            MilliSleep(nTimeoutMs);
+            return true;
+        }
+
+        int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        if (nSelect == SOCKET_ERROR) {
+            LogPrintf("socket select error %s\n", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+        for (const auto& item : mapWatched) {
+            int nEvents = 0;
+            if (FD_ISSET(item.first, &fdsetRecv))
+                nEvents |= SOCKET_EVENT_RECV;
+            if (FD_ISSET(item.first, &fdsetSend))
+                nEvents |= SOCKET_EVENT_SEND;
+            if (FD_ISSET(item.first, &fdsetError))
+                nEvents |= SOCKET_EVENT_ERR;
+            if (nEvents)
+                vReady.push_back(std::make_pair(item.first, nEvents));
+        }
+        return true;
+    }
+};
+
+#endif
+
+std::unique_ptr<CSocketEvents> CSocketEvents::Create()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return std::unique_ptr<CSocketEvents>(new CSocketEventsEpoll());
+#elif !defined(WIN32)
+    return std::unique_ptr<CSocketEvents>(new CSocketEventsPoll());
+#else
+    return std::unique_ptr<CSocketEvents>(new CSocketEventsSelect());
+#endif
+}
@@ -0,0 +1,78 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum SocketEvent
+{
+    SOCKET_EVENT_RECV = (1 << 0),
+    SOCKET_EVENT_SEND = (1 << 1),
+    // Always reported, never needs to be requested
+    SOCKET_EVENT_ERR  = (1 << 2),
+};
+
+/**
+ * Readiness notification for the sockets serviced by ThreadSocketHandler.
+ *
+ * Sockets are registered with the kernel once and only re-registered when
+ * the requested events change, so a wakeup costs O(ready sockets) rather
+ * than O(open sockets). The backend is epoll where available, poll()
+ * otherwise, and select() on Windows.
+ *
+ * Not thread safe; owned by the socket handler thread.
+ */
+class CSocketEvents
+{
+public:
+    virtual ~CSocketEvents() {}
+
+    /** Creates the best backend available on this platform. */
+    static std::unique_ptr<CSocketEvents> Create();
+
+    virtual const char* GetName() const = 0;
+
+    /**
+     * Watch hSocket for nEvents (a combination of SOCKET_EVENT_RECV and
+     * SOCKET_EVENT_SEND, possibly none). nToken identifies the owner of the
+     * socket, so that a descriptor which was closed and reused is
+     * registered afresh.
+     */
+    void Watch(SOCKET hSocket, int nEvents, int64_t nToken);
+
+    /** Stop watching hSocket, if it is still registered for nToken. */
+    void Unwatch(SOCKET hSocket, int64_t nToken);
+
+    /**
+     * Wait up to nTimeoutMs for any watched socket to become ready, and
+     * return the ready sockets with the events they are ready for.
+     * Returns false if waiting failed.
+     */
+    virtual bool Wait(int nTimeoutMs, std::vector<std::pair<SOCKET, int>>& vReady) = 0;
+
+    size_t Size() const { return mapWatched.size(); }
+
+protected:
+    struct WatchedSocket
+    {
+        int nEvents;
+        int64_t nToken;
+    };
+
+    std::unordered_map<SOCKET, WatchedSocket> mapWatched;
+
+    /** Register a new socket, or change the events of a registered one. */
+    virtual bool Register(SOCKET hSocket, int nEvents, bool fNew) { return true; }
+    virtual void Unregister(SOCKET hSocket) {}
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
@@ -347,9 +347,20 @@ public:
     }
 
     void GetAndClear(CSerializeData &d) {
-        d.insert(d.end(), begin(), end());
+        if (d.empty() && nReadPos == 0) {
+            // Hand over the buffer rather than copying it
+            d.swap(vch);
+        } else {
+            d.insert(d.end(), begin(), end());
+        }
         clear();
     }
+
+    /** Exchange the underlying buffer with v, e.g. to reuse an allocation. Resets the read position. */
+    void swap(vector_type& v) {
+        vch.swap(v);
+        nReadPos = 0;
+    }
 };
 
 class CDataStream : public CBaseDataStream<CSerializeData>
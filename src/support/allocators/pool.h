@@ -0,0 +1,206 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Memory for many small objects of a few sizes, such as the nodes of a
+ * node based container. Blocks are carved one after the other out of
+ * large chunks, so that objects allocated together lie together, and
+ * there is no malloc overhead per object. A freed block goes to the free
+ * list of its size, from which the next allocation of that size is
+ * served; chunks are only given back when the resource is destroyed, so
+ * NumUsedBytes can be well below the memory held.
+ *
+ * Blocks are multiples of ELEM_ALIGN_BYTES. Requests larger than
+ * MAX_BLOCK_SIZE_BYTES, or more aligned, go to operator new.
+ *
+ * Not thread safe: all allocators using a resource must be used under
+ * the same lock.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource
+{
+public:
+    static const size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > sizeof(void*) ? ALIGN_BYTES : sizeof(void*);
+    static const size_t DEFAULT_CHUNK_SIZE_BYTES = 256 * 1024;
+
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "alignment must be a power of two");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "blocks must hold at least one element");
+
+    explicit PoolResource(size_t nChunkSizeBytesIn = DEFAULT_CHUNK_SIZE_BYTES) :
+        vFreeLists(MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1, NULL),
+        pAvailable(NULL), pEnd(NULL), nChunkSizeBytes(nChunkSizeBytesIn), nUsedBytes(0)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    ~PoolResource()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    void* Allocate(size_t nBytes, size_t nAlignment)
+    {
+        if (!IsFreeListUsable(nBytes, nAlignment))
+            return ::operator new(nBytes);
+
+        const size_t nElems = NumElems(nBytes);
+        const size_t nRoundedBytes = nElems * ELEM_ALIGN_BYTES;
+        nUsedBytes += nRoundedBytes;
+        ListNode* pNode = vFreeLists[nElems];
+        if (pNode) {
+            vFreeLists[nElems] = pNode->pNext;
+            return pNode;
+        }
+        if ((size_t)(pEnd - pAvailable) < nRoundedBytes)
+            AllocateChunk();
+        void* p = pAvailable;
+        pAvailable += nRoundedBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlignment)
+    {
+        if (!IsFreeListUsable(nBytes, nAlignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const size_t nElems = NumElems(nBytes);
+        nUsedBytes -= nElems * ELEM_ALIGN_BYTES;
+        PushFree(p, nElems);
+    }
+
+    size_t NumAllocatedChunks() const { return vChunks.size(); }
+    size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+    //! Bytes of the blocks handed out from the chunks and not yet freed
+    size_t NumUsedBytes() const { return nUsedBytes; }
+
+private:
+    struct ListNode
+    {
+        ListNode* pNext;
+    };
+
+    //! Free blocks, by their size in ELEM_ALIGN_BYTES
+    std::vector<ListNode*> vFreeLists;
+    std::vector<char*> vChunks;
+    //! What is left of the last chunk
+    char* pAvailable;
+    char* pEnd;
+    const size_t nChunkSizeBytes;
+    size_t nUsedBytes;
+
+    static size_t NumElems(size_t nBytes)
+    {
+        // Zero sized requests still get a block of their own
+        return nBytes == 0 ? 1 : (nBytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES;
+    }
+
+    static bool IsFreeListUsable(size_t nBytes, size_t nAlignment)
+    {
+        return nAlignment <= ELEM_ALIGN_BYTES && nBytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, size_t nElems)
+    {
+        ListNode* pNode = new (p) ListNode;
+        pNode->pNext = vFreeLists[nElems];
+        vFreeLists[nElems] = pNode;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is too small for this request, but
+        // may do for a smaller one later.
+        size_t nRemaining = pEnd - pAvailable;
+        if (nRemaining >= ELEM_ALIGN_BYTES)
+            PushFree(pAvailable, nRemaining / ELEM_ALIGN_BYTES);
+
+        pAvailable = static_cast<char*>(::operator new(nChunkSizeBytes));
+        pEnd = pAvailable + nChunkSizeBytes;
+        vChunks.push_back(pAvailable);
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+};
+
+/**
+ * Allocator serving from a PoolResource, for node based containers. A
+ * default constructed allocator has no resource and uses operator new,
+ * so that containers of the same type need not all share a pool. The
+ * allocator moves with the container on swap and assignment; containers
+ * with different resources must not exchange nodes any other way.
+ */
+template <typename T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = sizeof(void*)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator() throw() : pResource(NULL) {}
+    explicit PoolAllocator(ResourceType* pResourceIn) throw() : pResource(pResourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) throw() : pResource(other.resource())
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (!pResource)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), std::alignment_of<T>::value));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (!pResource) {
+            ::operator delete(p);
+            return;
+        }
+        pResource->Deallocate(p, n * sizeof(T), std::alignment_of<T>::value);
+    }
+
+    ResourceType* resource() const { return pResource; }
+
+private:
+    ResourceType* pResource;
+};
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
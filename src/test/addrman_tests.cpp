@@ -6,8 +6,10 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
 
 using namespace std;
 
@@ -25,7 +27,6 @@ public:
     void MakeDeterministic()
     {
         nKey.SetNull();
-        insecure_rand = FastRandomContext(true);
     }
 
     int RandomInt(int nMax)
@@ -180,9 +181,9 @@ BOOST_AUTO_TEST_CASE(addrman_select)
     BOOST_CHECK(addrman.size() == 7);
 
     // Test 12: Select pulls from new and tried regardless of port number.
-    BOOST_CHECK(addrman.Select().ToString() == "250.4.6.6:8333");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.2.2:9999");
-    BOOST_CHECK(addrman.Select().ToString() == "250.3.3.3:9999");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:8333");
+    BOOST_CHECK(addrman.Select().ToString() == "250.4.5.5:7777");
+    BOOST_CHECK(addrman.Select().ToString() == "250.3.1.1:8333");
     BOOST_CHECK(addrman.Select().ToString() == "250.4.4.4:8333");
 }
 
@@ -395,6 +396,71 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     BOOST_CHECK(addrman.size() == 2007);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_index)
+{
+    CAddrManTest addrman;
+    addrman.MakeDeterministic();
+
+    // Test 35: Find keeps working while the address index grows and
+    //  entries are deleted from the middle of probe sequences.
+    CNetAddr source = CNetAddr("252.2.2.2");
+    vector<int> vIds;
+    for (int i = 0; i < 1000; i++) {
+        int nId;
+        addrman.Create(CAddress(CService("250." + boost::to_string(i / 256) + "." + boost::to_string(i % 256) + ".1")), source, &nId);
+        vIds.push_back(nId);
+    }
+    for (int i = 0; i < 1000; i += 3)
+        addrman.Delete(vIds[i]);
+    BOOST_CHECK(addrman.size() == 666);
+    for (int i = 0; i < 1000; i++) {
+        CAddrInfo* pinfo = addrman.Find(CNetAddr("250." + boost::to_string(i / 256) + "." + boost::to_string(i % 256) + ".1"));
+        BOOST_CHECK((pinfo != NULL) == (i % 3 != 0));
+    }
+
+    // Test 36: Deleted slots are reused.
+    int nId;
+    addrman.Create(CAddress(CService("251.1.1.1")), source, &nId);
+    BOOST_CHECK(nId < 1000);
+    BOOST_CHECK(addrman.Find(CNetAddr("251.1.1.1")) != NULL);
+}
+
+BOOST_AUTO_TEST_CASE(addrman_serialize)
+{
+    CAddrManTest addrman;
+    addrman.MakeDeterministic();
+
+    for (unsigned int i = 1; i < 512; i++) {
+        CAddress addr = CAddress(CService("250." + boost::to_string(i / 64) + "." + boost::to_string(i % 64) + ".1"));
+        addr.nTime = GetTime();
+        addrman.Add(addr, CNetAddr("252." + boost::to_string(i % 16) + ".1.1"));
+        if (i % 4 == 0)
+            addrman.Good(addr);
+    }
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    std::string strData = ss.str();
+
+    // Test 37: Loading with the stored positions gives back the same tables.
+    CAddrManTest addrman2;
+    ss >> addrman2;
+    BOOST_CHECK(addrman2.size() == addrman.size());
+    BOOST_CHECK(addrman2.Find(CNetAddr("250.1.1.1")) != NULL);
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << addrman2;
+    BOOST_CHECK(ss2.str() == strData);
+
+    // Test 38: So does loading version 1, which places the entries by their hashes.
+    CDataStream ss3(strData.data(), strData.data() + strData.size(), SER_DISK, CLIENT_VERSION);
+    ss3[0] = 1;
+    CAddrManTest addrman3;
+    ss3 >> addrman3;
+    CDataStream ss4(SER_DISK, CLIENT_VERSION);
+    ss4 << addrman3;
+    BOOST_CHECK(ss4.str() == strData);
+}
+
 
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
@@ -10,6 +10,8 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "streams.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
@@ -17,6 +19,7 @@
 #include <vector>
 #include <map>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
@@ -223,6 +226,15 @@ public:
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    // Whether txid is held by this cache itself, and with which flags
+    bool HaveCoinsInCache(const uint256& txid, unsigned char& flags) const
+    {
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        if (it == cacheCoins.end())
+            return false;
+        flags = it->second.flags;
+        return true;
+    }
 };
 
 class TxWithNullifiers
@@ -786,6 +798,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool partially_flushed = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
@@ -845,7 +858,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
-            if (stack.size() > 0 && insecure_rand() % 2 == 0) {
+            if (stack.size() > 0 && insecure_rand() % 4 == 0) {
+                // Write the tip, keeping some of it.
+                stack.back()->PartialFlush(insecure_rand() % (stack.back()->DynamicMemoryUsage() + 1));
+                stack.back()->SelfTest();
+                partially_flushed = true;
+            } else if (stack.size() > 0 && insecure_rand() % 2 == 0) {
                 stack.back()->Flush();
                 delete stack.back();
                 stack.pop_back();
@@ -879,6 +897,81 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(partially_flushed);
+}
+
+BOOST_AUTO_TEST_CASE(coins_partial_flush)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    // Ten blocks of a thousand new coins each
+    std::vector<uint256> txids;
+    for (int nBlock = 0; nBlock < 10; nBlock++) {
+        CCoinsViewCacheTest block(&cache);
+        for (int i = 0; i < 1000; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = block.ModifyNewCoins(txids.back());
+            coins->nVersion = 1;
+            coins->vout.resize(1);
+            coins->vout[0].nValue = nBlock * 1000 + i;
+        }
+        block.SetBestBlock(GetRandHash());
+        block.Flush();
+    }
+    // The coins of the first block are used again in the last
+    {
+        CCoinsViewCacheTest block(&cache);
+        for (int i = 0; i < 1000; i++)
+            BOOST_CHECK(block.AccessCoins(txids[i]));
+        block.Flush();
+    }
+    // ...and one of them is spent
+    {
+        CCoinsViewCacheTest block(&cache);
+        block.ModifyCoins(txids[0])->Clear();
+        block.Flush();
+    }
+
+    // Room for about half of the coins
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(cache.PartialFlush(nUsage / 2));
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 2);
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+
+    // Everything is in the base and the spent coins are gone everywhere.
+    // The recently used coins are still cached and clean, the oldest not.
+    unsigned char flags;
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        CCoins coins;
+        BOOST_CHECK_EQUAL(base.GetCoins(txids[i], coins) && !coins.IsPruned(), i != 0);
+        if (cache.HaveCoinsInCache(txids[i], flags))
+            BOOST_CHECK(flags == 0);
+    }
+    BOOST_CHECK(!cache.HaveCoinsInCache(txids[0], flags));
+    BOOST_CHECK(cache.HaveCoinsInCache(txids[1], flags));
+    BOOST_CHECK(cache.HaveCoinsInCache(txids.back(), flags));
+    BOOST_CHECK(!cache.HaveCoinsInCache(txids[1000], flags));
+
+    // Kept coins are written again once modified
+    {
+        CCoinsViewCacheTest block(&cache);
+        block.ModifyCoins(txids[1])->vout[0].nValue = 1000;
+        block.Flush();
+    }
+    BOOST_CHECK(cache.HaveCoinsInCache(txids[1], flags));
+    BOOST_CHECK(flags == CCoinsCacheEntry::DIRTY);
+    BOOST_CHECK(cache.PartialFlush(cache.DynamicMemoryUsage()));
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txids[1], coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 1000);
+    BOOST_CHECK(base.GetBestBlock() == cache.GetBestBlock());
+
+    // Nothing is kept without room for it
+    BOOST_CHECK(cache.PartialFlush(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
 }
 
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
@@ -1093,4 +1186,86 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(txoutset_snapshot, TestingSetup)
+{
+    CCoinsViewDB source(1 << 20, true);
+    std::vector<uint256> vTxids;
+    SproutMerkleTree sproutTree;
+    {
+        CCoinsViewCache cache(&source);
+        for (int i = 0; i < 20; i++) {
+            vTxids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(vTxids.back());
+            coins->nHeight = i + 1;
+            coins->vout.resize(2);
+            coins->vout[1].nValue = 1000 * i;
+        }
+        sproutTree.append(GetRandHash());
+        cache.PushAnchor(sproutTree);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CTxOutSetSnapshotMetadata metadata;
+    metadata.hashBlock = source.GetBestBlock();
+    metadata.nHeight = 20;
+    metadata.nChainTx = 21;
+    metadata.hashSproutAnchor = sproutTree.root();
+    metadata.hashSaplingAnchor = SaplingMerkleTree::empty_root();
+
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    uint256 hashDumped;
+    uint64_t nDumped;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(source.NewIterator());
+        BOOST_CHECK(source.DumpSnapshot(pcursor.get(), metadata, file, hashDumped, nDumped));
+    }
+    BOOST_CHECK_EQUAL(nDumped, 21U);
+
+    // Checking leaves the target alone, applying replaces its records
+    CCoinsViewDB target(1 << 20, true);
+    {
+        CCoinsViewCache cache(&target);
+        {
+            CCoinsModifier coins = cache.ModifyCoins(GetRandHash());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 1;
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    for (int fApply = 0; fApply < 2; fApply++) {
+        rewind(file.Get());
+        CTxOutSetSnapshotMetadata loaded;
+        uint256 hashLoaded;
+        uint64_t nLoaded;
+        BOOST_CHECK(target.LoadSnapshot(file, fApply, loaded, hashLoaded, nLoaded));
+        BOOST_CHECK(hashLoaded == hashDumped);
+        BOOST_CHECK_EQUAL(nLoaded, nDumped);
+        BOOST_CHECK(loaded.hashBlock == metadata.hashBlock);
+        BOOST_CHECK_EQUAL(loaded.nChainTx, metadata.nChainTx);
+    }
+    CCoins coins;
+    for (size_t i = 0; i < vTxids.size(); i++) {
+        BOOST_CHECK(target.GetCoins(vTxids[i], coins));
+        BOOST_CHECK_EQUAL(coins.nHeight, i + 1);
+    }
+    SproutMerkleTree loadedTree;
+    BOOST_CHECK(target.GetSproutAnchorAt(sproutTree.root(), loadedTree));
+    CCoinsStats stats;
+    BOOST_CHECK(target.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, vTxids.size());
+
+    // Any change to the contents is caught by the trailing hash
+    fseek(file.Get(), 20, SEEK_SET);
+    int c = fgetc(file.Get());
+    fseek(file.Get(), 20, SEEK_SET);
+    fputc(c ^ 1, file.Get());
+    rewind(file.Get());
+    CTxOutSetSnapshotMetadata loaded;
+    uint256 hashLoaded;
+    uint64_t nLoaded;
+    BOOST_CHECK(!target.LoadSnapshot(file, false, loaded, hashLoaded, nLoaded));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
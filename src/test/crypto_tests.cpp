@@ -3,6 +3,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "crypto/aes.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -439,4 +440,47 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // Inverses, including of the largest number that fits
+    unsigned char data[Num3072::BYTE_SIZE];
+    for (int n = 0; n < 2; n++) {
+        for (size_t i = 0; i < sizeof(data); i++)
+            data[i] = n == 0 ? insecure_rand() : 0xff;
+        Num3072 a(data), b(data);
+        b.Invert();
+        a.Multiply(b);
+        a.ToBytes(data);
+        BOOST_CHECK_EQUAL(data[0], 1);
+        for (size_t i = 1; i < sizeof(data); i++)
+            BOOST_CHECK_EQUAL(data[i], 0);
+    }
+
+    std::vector<unsigned char> x = ParseHex("01"), y = ParseHex("0202"), z = ParseHex("030303");
+    unsigned char hashXY[MuHash3072::OUTPUT_SIZE], hash[MuHash3072::OUTPUT_SIZE];
+    MuHash3072().Insert(x.data(), x.size()).Insert(y.data(), y.size()).Finalize(hashXY);
+
+    // The order does not matter, and removing undoes inserting
+    MuHash3072().Insert(z.data(), z.size()).Insert(y.data(), y.size()).Insert(x.data(), x.size()).Remove(z.data(), z.size()).Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashXY, sizeof(hash)) == 0);
+    MuHash3072().Remove(z.data(), z.size()).Insert(x.data(), x.size()).Insert(z.data(), z.size()).Insert(y.data(), y.size()).Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashXY, sizeof(hash)) == 0);
+
+    // Hashes of parts combine
+    MuHash3072 muhashX, muhashY;
+    muhashX.Insert(x.data(), x.size());
+    muhashY.Insert(y.data(), y.size());
+    muhashX.Combine(muhashY).Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashXY, sizeof(hash)) == 0);
+
+    MuHash3072().Insert(x.data(), x.size()).Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashXY, sizeof(hash)) != 0);
+
+    // The empty set
+    unsigned char hashEmpty[MuHash3072::OUTPUT_SIZE];
+    MuHash3072().Finalize(hashEmpty);
+    MuHash3072().Insert(z.data(), z.size()).Remove(z.data(), z.size()).Finalize(hash);
+    BOOST_CHECK(memcmp(hash, hashEmpty, sizeof(hash)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
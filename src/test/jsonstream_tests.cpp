@@ -0,0 +1,161 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/jsonstream.h"
+
+#include "httpserver.h"
+#include "rpc/protocol.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+/** Records what a CHTTPJSONWriter sends instead of talking to libevent */
+class TestHTTPRequest : public HTTPRequest
+{
+public:
+    std::vector<std::string> vCalls;
+    std::string strBody;
+
+    TestHTTPRequest() : HTTPRequest(nullptr) {}
+    ~TestHTTPRequest() {
+        // So the parent destructor doesn't try to send a reply
+        replySent = true;
+    }
+
+    void WriteHeader(const std::string& hdr, const std::string& value) { vCalls.push_back("header"); }
+    void WriteReply(int nStatus, const std::string& strReply) { vCalls.push_back("reply " + std::to_string(nStatus)); strBody = strReply; }
+    void WriteReplyStart(int nStatus) { vCalls.push_back("start " + std::to_string(nStatus)); }
+    bool WriteReplyChunk(const std::string& strChunk) { vCalls.push_back("chunk"); strBody += strChunk; return true; }
+    void WriteReplyEnd() { vCalls.push_back("end"); }
+    void WriteReplyAbort() { vCalls.push_back("abort"); }
+};
+
+BOOST_FIXTURE_TEST_SUITE(jsonstream_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsonstream_matches_univalue)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.pushKV("a", 1);
+    inner.pushKV("b\"c", "d\ne");
+    UniValue arr(UniValue::VARR);
+    arr.push_back(inner);
+    arr.push_back(NullUniValue);
+    arr.push_back(UniValue(UniValue::VARR));
+    UniValue expected(UniValue::VOBJ);
+    expected.pushKV("x", arr);
+    expected.pushKV("y", true);
+    expected.pushKV("empty", UniValue(UniValue::VOBJ));
+
+    std::string strOut;
+    CJSONStreamWriter writer([&strOut](const std::string& str) { strOut += str; return true; });
+    writer.BeginObject();
+    writer.Key("x");
+    writer.BeginArray();
+    writer.BeginObject();
+    writer.PushKVs(inner);
+    writer.EndObject();
+    writer.Value(NullUniValue);
+    writer.BeginArray();
+    writer.EndArray();
+    writer.EndArray();
+    writer.PushKV("y", true);
+    writer.Key("empty");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+
+    // Nothing reaches the sink before a flush
+    BOOST_CHECK(strOut.empty());
+    BOOST_CHECK(!writer.Started());
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK(writer.Started());
+    BOOST_CHECK_EQUAL(strOut, expected.write());
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_flush)
+{
+    std::vector<std::string> vChunks;
+    CJSONStreamWriter writer([&vChunks](const std::string& str) { vChunks.push_back(str); return vChunks.size() < 2; }, 10);
+    writer.BeginArray();
+    BOOST_CHECK(writer.MaybeFlush());
+    BOOST_CHECK(vChunks.empty());
+    writer.Value("0123456789");
+    BOOST_CHECK(writer.MaybeFlush());
+    BOOST_CHECK_EQUAL(vChunks.size(), 1U);
+    BOOST_CHECK_EQUAL(vChunks[0], "[\"0123456789\"");
+
+    // The sink refuses the second chunk; later output is dropped
+    writer.Value("0123456789");
+    BOOST_CHECK(!writer.MaybeFlush());
+    BOOST_CHECK(!writer.Ok());
+    writer.EndArray();
+    BOOST_CHECK(!writer.Flush());
+    BOOST_CHECK_EQUAL(vChunks.size(), 2U);
+    BOOST_CHECK_EQUAL(vChunks[1], ",\"0123456789\"");
+
+    // A short document can be taken in one piece instead
+    CJSONStreamWriter writer2([](const std::string&) { return false; });
+    writer2.BeginObject();
+    writer2.PushKV("k", 5);
+    writer2.EndObject();
+    writer2.Raw("\n");
+    BOOST_CHECK_EQUAL(writer2.ReleaseBuffer(), "{\"k\":5}\n");
+    BOOST_CHECK(!writer2.Started());
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_http_reply)
+{
+    // Nothing flushed: a single ordinary reply
+    TestHTTPRequest req;
+    {
+        CHTTPJSONWriter writer(&req);
+        writer.BeginArray();
+        writer.Value(1);
+        writer.EndArray();
+        writer.Finish();
+    }
+    std::vector<std::string> vExpected = {"header", "reply " + std::to_string(HTTP_OK)};
+    BOOST_CHECK(req.vCalls == vExpected);
+    BOOST_CHECK_EQUAL(req.strBody, "[1]");
+
+    // Flushed: chunks, ended by the terminating chunk
+    TestHTTPRequest req2;
+    {
+        CHTTPJSONWriter writer(&req2);
+        writer.BeginArray();
+        writer.Value(1);
+        BOOST_CHECK(writer.Flush());
+        writer.Value(2);
+        writer.EndArray();
+        writer.Finish();
+    }
+    vExpected = {"header", "start " + std::to_string(HTTP_OK), "chunk", "chunk", "end"};
+    BOOST_CHECK(req2.vCalls == vExpected);
+    BOOST_CHECK_EQUAL(req2.strBody, "[1,2]");
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_http_abort)
+{
+    // Once the reply has started, aborting sends neither the rest of the
+    // document nor the terminating chunk
+    TestHTTPRequest req;
+    {
+        CHTTPJSONWriter writer(&req);
+        writer.BeginObject();
+        writer.Key("result");
+        writer.BeginArray();
+        writer.Value(1);
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK(writer.Started());
+        writer.Value(2);
+        writer.Abort();
+    }
+    std::vector<std::string> vExpected = {"header", "start " + std::to_string(HTTP_OK), "chunk", "abort"};
+    BOOST_CHECK(req.vCalls == vExpected);
+    BOOST_CHECK_EQUAL(req.strBody, "{\"result\":[1");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
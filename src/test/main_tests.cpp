@@ -123,4 +123,21 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(blocks_in_flight_limit)
+{
+    // Peers that have not been measured yet get the fixed window
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 100000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Twice the blocks the peer delivers in a round trip, plus one
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, 100000), 4);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(10000, 100000), 22);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(2000, 100000), 102);
+
+    // Within bounds however fast or slow the peer is
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1, 1000000), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1000000, 10000), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -222,4 +222,49 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolEventsTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 33000LL;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    CTxMemPool pool(CFeeRate(0));
+    BOOST_CHECK_EQUAL(pool.GetSequence(), 0);
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.FromTx(txChild));
+
+    // Removing the parent takes its child along, for the same reason
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, true, MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK_EQUAL(pool.GetSequence(), 4);
+
+    std::vector<CMempoolEvent> events = pool.DrainRecentEvents();
+    BOOST_REQUIRE_EQUAL(events.size(), 4);
+    BOOST_CHECK(events[0].fAdded && events[0].txid == txParent.GetHash());
+    BOOST_CHECK(events[1].fAdded && events[1].txid == txChild.GetHash());
+    BOOST_CHECK(!events[2].fAdded && events[2].txid == txParent.GetHash());
+    BOOST_CHECK(!events[3].fAdded && events[3].txid == txChild.GetHash());
+    for (size_t i = 0; i < events.size(); i++)
+        BOOST_CHECK_EQUAL(events[i].nSequence, i + 1);
+    BOOST_CHECK(events[3].reason == MemPoolRemovalReason::CONFLICT);
+    BOOST_CHECK(pool.DrainRecentEvents().empty());
+
+    // Removing what is not in the pool is not an event
+    pool.remove(txParent, removed, true, MemPoolRemovalReason::EXPIRY);
+    BOOST_CHECK(pool.DrainRecentEvents().empty());
+    BOOST_CHECK_EQUAL(pool.GetSequence(), 4);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
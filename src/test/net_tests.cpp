@@ -0,0 +1,587 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "net.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "protocol.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#ifndef WIN32
+#include <sys/socket.h>
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+static std::shared_ptr<CPreparedMessage> PrepareMessage(const char* pszCommand, const CDataStream& payload, bool fBadChecksum = false)
+{
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    hdr.nChecksum = ReadLE32(hash.begin()) ^ (fBadChecksum ? 1 : 0);
+
+    std::shared_ptr<CPreparedMessage> prepared = std::make_shared<CPreparedMessage>(CDataStream(payload), hdr);
+    BOOST_CHECK(!prepared->fReady);
+    prepared->Prepare();
+    BOOST_CHECK(prepared->fReady);
+    BOOST_CHECK_EQUAL(prepared->fChecksumValid, !fBadChecksum);
+    BOOST_CHECK_EQUAL(prepared->nChecksumComputed, ReadLE32(hash.begin()));
+    return prepared;
+}
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(net_prepared_message)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    CTransaction tx(mtx);
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+
+    // Transactions and blocks are deserialized, txids included
+    std::shared_ptr<CPreparedMessage> prepared = PrepareMessage("tx", ssTx);
+    BOOST_CHECK(prepared->GetTransaction().GetHash() == tx.GetHash());
+
+    CBlock block;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    prepared = PrepareMessage("block", ssBlock);
+    BOOST_CHECK(prepared->GetBlock().GetHash() == block.GetHash());
+    BOOST_CHECK(prepared->GetBlock().vtx[0].GetHash() == tx.GetHash());
+
+    // Other messages are only checksummed, and keep their payload
+    prepared = PrepareMessage("headers", ssTx);
+    BOOST_CHECK_EQUAL(prepared->vRecv.size(), ssTx.size());
+
+    // A bad checksum leaves the payload alone, for the handler to reject
+    prepared = PrepareMessage("tx", ssTx, true);
+    BOOST_CHECK_EQUAL(prepared->vRecv.size(), ssTx.size());
+
+    // A payload that does not deserialize fails where the handler reads it
+    CDataStream ssShort(ssTx.begin(), ssTx.begin() + ssTx.size() / 2, SER_NETWORK, PROTOCOL_VERSION);
+    prepared = PrepareMessage("tx", ssShort);
+    BOOST_CHECK_THROW(prepared->GetTransaction(), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(net_message_ready)
+{
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK(!msg.ready());
+    msg.in_data = true;
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK(msg.ready());
+
+    // A message handed to the preparation threads waits for them
+    msg.prepared = std::make_shared<CPreparedMessage>(CDataStream(SER_NETWORK, INIT_PROTO_VERSION), msg.hdr);
+    BOOST_CHECK(!msg.ready());
+    msg.prepared->Prepare();
+    BOOST_CHECK(msg.ready());
+}
+
+BOOST_AUTO_TEST_CASE(net_msg_process_time_hist)
+{
+    CNetMsgStats stats;
+    stats.AddProcessTime(0);
+    stats.AddProcessTime(3);
+    stats.AddProcessTime(4);
+    stats.AddProcessTime(15);
+    stats.AddProcessTime(16);
+    stats.AddProcessTime(5000);
+    stats.AddProcessTime(int64_t(1) << 40);
+    BOOST_CHECK_EQUAL(stats.nProcessed, 7);
+    BOOST_CHECK_EQUAL(stats.nProcessTimeMicros, 5038 + (int64_t(1) << 40));
+    BOOST_CHECK_EQUAL(stats.vProcessTimeHist[0], 2);
+    BOOST_CHECK_EQUAL(stats.vProcessTimeHist[1], 2);
+    BOOST_CHECK_EQUAL(stats.vProcessTimeHist[2], 1);
+    BOOST_CHECK_EQUAL(stats.vProcessTimeHist[6], 1);
+    // Anything slower ends up in the last bucket
+    BOOST_CHECK_EQUAL(stats.vProcessTimeHist[NET_PROCESS_TIME_BUCKETS - 1], 1);
+
+    CNetMsgStats total;
+    total.AddMessage(100);
+    total += stats;
+    total += stats;
+    BOOST_CHECK_EQUAL(total.nMessages, 1);
+    BOOST_CHECK_EQUAL(total.nBytes, 100);
+    BOOST_CHECK_EQUAL(total.nProcessed, 14);
+    BOOST_CHECK_EQUAL(total.vProcessTimeHist[0], 4);
+    BOOST_CHECK_EQUAL(total.vProcessTimeHist[6], 2);
+}
+
+BOOST_AUTO_TEST_CASE(net_buffer_pool_reuse)
+{
+    CNetBufferPool pool;
+    CSerializeData buf;
+    BOOST_CHECK(!pool.Get(buf, 0));
+
+    // A buffer put back keeps its storage, and is handed out empty
+    buf.resize(1000);
+    const char* pData = &buf[0];
+    size_t nCapacity = buf.capacity();
+    pool.Put(buf);
+    BOOST_CHECK(buf.empty());
+    BOOST_CHECK_EQUAL(pool.Size(), 1);
+
+    BOOST_CHECK(!pool.Get(buf, nCapacity + 1));
+    BOOST_CHECK_EQUAL(pool.Size(), 1);
+    BOOST_CHECK(pool.Get(buf, 500));
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    BOOST_CHECK(buf.empty());
+    BOOST_CHECK_EQUAL(buf.capacity(), nCapacity);
+    BOOST_CHECK(&buf[0] == pData);
+
+    // The smallest buffer that is large enough is the one handed out
+    CSerializeData small, medium, large, larger;
+    small.reserve(100);
+    medium.reserve(10000);
+    large.reserve(MAX_SMALL_NET_BUFFER_SIZE + 1);
+    larger.reserve(2 * MAX_SMALL_NET_BUFFER_SIZE);
+    pool.Put(larger);
+    pool.Put(large);
+    pool.Put(small);
+    pool.Put(medium);
+    BOOST_CHECK_EQUAL(pool.Size(), 4);
+    BOOST_CHECK(pool.Get(buf, 5000));
+    BOOST_CHECK(buf.capacity() >= 10000 && buf.capacity() <= MAX_SMALL_NET_BUFFER_SIZE);
+    BOOST_CHECK(pool.Get(buf, 50));
+    BOOST_CHECK(buf.capacity() >= 100 && buf.capacity() < 10000);
+    BOOST_CHECK(pool.Get(buf, 50));
+    BOOST_CHECK(buf.capacity() > MAX_SMALL_NET_BUFFER_SIZE && buf.capacity() < 2 * MAX_SMALL_NET_BUFFER_SIZE);
+    BOOST_CHECK(pool.Get(buf, 50));
+    BOOST_CHECK(buf.capacity() >= 2 * MAX_SMALL_NET_BUFFER_SIZE);
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+
+    // GetSmall hands out the small buffer put back last, and never a large one
+    small.reserve(100);
+    medium.reserve(10000);
+    large.reserve(MAX_SMALL_NET_BUFFER_SIZE + 1);
+    pool.Put(large);
+    BOOST_CHECK(!pool.GetSmall(buf));
+    pool.Put(medium);
+    pool.Put(small);
+    BOOST_CHECK(pool.GetSmall(buf));
+    BOOST_CHECK(buf.capacity() >= 100 && buf.capacity() < 10000);
+    BOOST_CHECK(pool.GetSmall(buf));
+    BOOST_CHECK(buf.capacity() >= 10000 && buf.capacity() <= MAX_SMALL_NET_BUFFER_SIZE);
+    BOOST_CHECK(!pool.GetSmall(buf));
+    BOOST_CHECK_EQUAL(pool.Size(), 1);
+    BOOST_CHECK(pool.Get(buf, 0));
+
+    // Buffers without storage, or larger than any message, are not kept
+    CSerializeData empty;
+    pool.Put(empty);
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+    CSerializeData huge;
+    huge.reserve(MAX_PROTOCOL_MESSAGE_LENGTH + CMessageHeader::HEADER_SIZE + 1);
+    pool.Put(huge);
+    BOOST_CHECK_EQUAL(pool.Size(), 0);
+
+    // Nor more than MAX_POOLED_NET_BUFFERS of them
+    for (size_t i = 0; i < MAX_POOLED_NET_BUFFERS + 10; i++) {
+        CSerializeData b;
+        b.reserve(10);
+        pool.Put(b);
+    }
+    BOOST_CHECK_EQUAL(pool.Size(), MAX_POOLED_NET_BUFFERS);
+}
+
+BOOST_AUTO_TEST_CASE(net_send_priority)
+{
+    BOOST_CHECK_EQUAL(GetSendPriority("ping"), SEND_PRIORITY_CONTROL);
+    BOOST_CHECK_EQUAL(GetSendPriority("getdata"), SEND_PRIORITY_CONTROL);
+    BOOST_CHECK_EQUAL(GetSendPriority("block"), SEND_PRIORITY_BLOCK);
+    BOOST_CHECK_EQUAL(GetSendPriority("headers"), SEND_PRIORITY_BLOCK);
+    BOOST_CHECK_EQUAL(GetSendPriority("tx"), SEND_PRIORITY_TX);
+    BOOST_CHECK_EQUAL(GetSendPriority("inv"), SEND_PRIORITY_BULK);
+    BOOST_CHECK_EQUAL(GetSendPriority("addr"), SEND_PRIORITY_BULK);
+    BOOST_CHECK_EQUAL(GetSendPriority("nosuchcommand"), SEND_PRIORITY_BULK);
+
+    // An inv goes with blocks if it announces one
+    std::vector<CInv> vInv;
+    vInv.push_back(CInv(MSG_TX, GetRandHash()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vInv;
+    BOOST_CHECK_EQUAL(GetSendPriority("inv", &ss[0], ss.size()), SEND_PRIORITY_BULK);
+    vInv.resize(300, CInv(MSG_TX, GetRandHash()));
+    vInv.push_back(CInv(MSG_BLOCK, GetRandHash()));
+    ss.clear();
+    ss << vInv;
+    BOOST_CHECK_EQUAL(GetSendPriority("inv", &ss[0], ss.size()), SEND_PRIORITY_BLOCK);
+    BOOST_CHECK_EQUAL(GetSendPriority("getdata", &ss[0], ss.size()), SEND_PRIORITY_CONTROL);
+}
+
+#ifndef WIN32
+// Read whatever the other end of a socket pair has sent so far
+static void ReadAvailable(int fd, std::vector<char>& vReceived)
+{
+    char pchBuf[65536];
+    ssize_t nRead;
+    while ((nRead = recv(fd, pchBuf, sizeof(pchBuf), MSG_DONTWAIT)) > 0)
+        vReceived.insert(vReceived.end(), pchBuf, pchBuf + nRead);
+}
+
+static void QueueMessage(CNode& node, int nPriority, size_t nSize, char ch)
+{
+    node.vSendMsg[nPriority].push_back(CSerializeData(nSize, ch));
+    node.nSendSize += nSize;
+}
+
+BOOST_AUTO_TEST_CASE(net_send_order)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+    LOCK(node.cs_vSend);
+
+    // Queued in the reverse order of their priority, sent most urgent first
+    QueueMessage(node, SEND_PRIORITY_BULK, 10, 'a');
+    QueueMessage(node, SEND_PRIORITY_TX, 10, 't');
+    QueueMessage(node, SEND_PRIORITY_BLOCK, 10, 'b');
+    QueueMessage(node, SEND_PRIORITY_BLOCK, 10, 'h');
+    QueueMessage(node, SEND_PRIORITY_CONTROL, 10, 'p');
+
+    // The first round of the socket handler only sends blocks and what is
+    // more urgent
+    std::vector<char> vReceived;
+    SocketSendData(&node, SEND_PRIORITY_BLOCK);
+    ReadAvailable(fds[1], vReceived);
+    BOOST_CHECK_EQUAL(std::string(vReceived.begin(), vReceived.end()),
+                      std::string(10, 'p') + std::string(10, 'b') + std::string(10, 'h'));
+    BOOST_CHECK_EQUAL(node.nSendSize, 20);
+
+    SocketSendData(&node);
+    ReadAvailable(fds[1], vReceived);
+    BOOST_CHECK_EQUAL(vReceived.size(), 50);
+    BOOST_CHECK_EQUAL(std::string(vReceived.begin() + 30, vReceived.end()),
+                      std::string(10, 't') + std::string(10, 'a'));
+    BOOST_CHECK_EQUAL(node.nSendSize, 0);
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(net_send_partial_first)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int nBufSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nBufSize, sizeof(nBufSize));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize));
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+    LOCK(node.cs_vSend);
+
+    // A message that is partly written finishes before anything more
+    // urgent that was queued since
+    const size_t nMsgSize = 256 * 1024;
+    QueueMessage(node, SEND_PRIORITY_BULK, nMsgSize, 'a');
+    SocketSendData(&node);
+    BOOST_REQUIRE(node.nSendOffset > 0);
+    BOOST_CHECK_EQUAL(node.nSendPriority, SEND_PRIORITY_BULK);
+    QueueMessage(node, SEND_PRIORITY_CONTROL, 10, 'p');
+
+    std::vector<char> vReceived;
+    for (int i = 0; i < 100000 && node.nSendSize > 0; i++) {
+        ReadAvailable(fds[1], vReceived);
+        SocketSendData(&node);
+    }
+    ReadAvailable(fds[1], vReceived);
+    BOOST_REQUIRE_EQUAL(vReceived.size(), nMsgSize + 10);
+    BOOST_CHECK(std::string(vReceived.begin(), vReceived.begin() + nMsgSize) == std::string(nMsgSize, 'a'));
+    BOOST_CHECK_EQUAL(std::string(vReceived.begin() + nMsgSize, vReceived.end()), std::string(10, 'p'));
+
+    close(fds[1]);
+}
+
+// The commands of the messages in a stream
+static std::vector<std::string> ReadCommands(const std::vector<char>& vReceived)
+{
+    std::vector<std::string> vCommands;
+    size_t nOffset = 0;
+    while (nOffset + CMessageHeader::HEADER_SIZE <= vReceived.size()) {
+        const char* pchCommand = &vReceived[nOffset + MESSAGE_START_SIZE];
+        vCommands.push_back(std::string(pchCommand, strnlen(pchCommand, CMessageHeader::COMMAND_SIZE)));
+        nOffset += CMessageHeader::HEADER_SIZE + ReadLE32((const unsigned char*)&vReceived[nOffset + CMessageHeader::MESSAGE_SIZE_OFFSET]);
+    }
+    BOOST_CHECK_EQUAL(nOffset, vReceived.size());
+    return vCommands;
+}
+
+BOOST_AUTO_TEST_CASE(net_send_block_order)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int nBufSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nBufSize, sizeof(nBufSize));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize));
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+
+    // A message too large to go out at once holds the rest in the queues
+    node.PushMessage("addr", std::vector<char>(256 * 1024));
+    BOOST_REQUIRE(node.nSendOffset > 0);
+
+    std::vector<CInv> vTxInv(1, CInv(MSG_TX, GetRandHash()));
+    std::vector<CInv> vBlockInv(1, CInv(MSG_BLOCK, GetRandHash()));
+    node.PushMessage("tx", std::string("t"));
+    node.PushMessage("inv", vTxInv);
+    node.PushMessage("merkleblock", std::string("A"));
+    node.PushMessage("tx", std::string("a"));
+    node.PushMessage("tx", std::string("a"));
+    node.PushMessage("inv", vBlockInv);
+    node.PushMessage("merkleblock", std::string("B"));
+    node.PushMessage("tx", std::string("b"));
+    node.PushMessage("ping", std::string("p"));
+
+    LOCK(node.cs_vSend);
+    std::vector<char> vReceived;
+    for (int i = 0; i < 100000 && node.nSendSize > 0; i++) {
+        ReadAvailable(fds[1], vReceived);
+        SocketSendData(&node);
+    }
+    ReadAvailable(fds[1], vReceived);
+    BOOST_CHECK_EQUAL(node.nSendSize, 0);
+
+    // The transactions of each merkleblock follow it, and the block inv
+    // goes ahead of other announcements and transactions
+    std::vector<std::string> vCommands = ReadCommands(vReceived);
+    const char* pszExpected[] = {"addr", "ping", "merkleblock", "tx", "tx", "inv", "merkleblock", "tx", "tx", "inv"};
+    BOOST_CHECK_EQUAL_COLLECTIONS(vCommands.begin(), vCommands.end(), pszExpected, pszExpected + 10);
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(net_partial_send)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int nBufSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nBufSize, sizeof(nBufSize));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize));
+
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+
+    // More than the socket takes at once: the first message is cut short
+    std::vector<char> vPayload(256 * 1024, 'a');
+    node.PushMessage("test", vPayload);
+    const size_t nMsgSize = node.nSendSize;
+    BOOST_CHECK(node.nSendBytes > 0);
+    BOOST_CHECK(node.nSendBytes < nMsgSize);
+    BOOST_CHECK_EQUAL(node.nSendOffset, node.nSendBytes);
+
+    // and the ones queued after it wait their turn
+    uint64_t nSendBytes = node.nSendBytes;
+    vPayload.assign(vPayload.size(), 'b');
+    node.PushMessage("test", vPayload);
+    vPayload.assign(vPayload.size(), 'c');
+    node.PushMessage("test", vPayload);
+    BOOST_CHECK_EQUAL(node.nSendBytes, nSendBytes);
+    BOOST_CHECK_EQUAL(node.nSendSize, 3 * nMsgSize);
+
+    // Reading the other end lets the rest through, in order; nothing is lost
+    LOCK(node.cs_vSend);
+    std::vector<char> vReceived;
+    for (int i = 0; i < 100000 && node.nSendSize > 0; i++) {
+        ReadAvailable(fds[1], vReceived);
+        SocketSendData(&node);
+    }
+    ReadAvailable(fds[1], vReceived);
+
+    BOOST_CHECK_EQUAL(node.nSendSize, 0);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0);
+    BOOST_CHECK_EQUAL(node.nSendBytes, 3 * nMsgSize);
+    BOOST_REQUIRE_EQUAL(vReceived.size(), 3 * nMsgSize);
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(memcmp(&vReceived[i * nMsgSize], Params().MessageStart(), MESSAGE_START_SIZE) == 0);
+        BOOST_CHECK_EQUAL(vReceived[(i + 1) * nMsgSize - 1], (char)('a' + i));
+    }
+
+    // The buffers sent went back to the pool
+    CSerializeData buf;
+    BOOST_CHECK(netBufferPool.Get(buf, nMsgSize));
+    BOOST_CHECK(buf.empty());
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(net_partial_send_classes)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int nBufSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nBufSize, sizeof(nBufSize));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize));
+
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+
+    // More than the socket takes at once, with a message of every class
+    const size_t nMsgSize = 256 * 1024;
+    size_t nTotal = 0;
+    for (int nPriority = SEND_PRIORITY_COUNT - 1; nPriority >= 0; nPriority--) {
+        CSerializeData msg(nMsgSize, (char)nPriority);
+        node.vSendMsg[nPriority].push_back(msg);
+        nTotal += msg.size();
+    }
+
+    LOCK(node.cs_vSend);
+    node.nSendSize = nTotal;
+    SocketSendData(&node);
+
+    // The first message, the control one, is cut short; nothing is lost
+    BOOST_CHECK(node.nSendBytes > 0);
+    BOOST_CHECK(node.nSendBytes < nMsgSize);
+    BOOST_CHECK_EQUAL(node.nSendOffset, node.nSendBytes);
+    BOOST_CHECK_EQUAL(node.nSendPriority, SEND_PRIORITY_CONTROL);
+    BOOST_CHECK_EQUAL(node.nSendSize, nTotal);
+    for (int nPriority = 0; nPriority < SEND_PRIORITY_COUNT; nPriority++)
+        BOOST_CHECK_EQUAL(node.vSendMsg[nPriority].size(), 1);
+
+    // Reading the other end lets the rest through, in priority order
+    std::vector<char> vReceived;
+    for (int i = 0; i < 100000 && node.nSendSize > 0; i++) {
+        ReadAvailable(fds[1], vReceived);
+        SocketSendData(&node);
+    }
+    ReadAvailable(fds[1], vReceived);
+
+    BOOST_CHECK_EQUAL(node.nSendSize, 0);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0);
+    BOOST_CHECK_EQUAL(node.nSendBytes, nTotal);
+    BOOST_REQUIRE_EQUAL(vReceived.size(), nTotal);
+    for (int nPriority = 0; nPriority < SEND_PRIORITY_COUNT; nPriority++) {
+        BOOST_CHECK(node.vSendMsg[nPriority].empty());
+        BOOST_CHECK_EQUAL(vReceived[nPriority * nMsgSize], (char)nPriority);
+        BOOST_CHECK_EQUAL(vReceived[(nPriority + 1) * nMsgSize - 1], (char)nPriority);
+    }
+
+    // The buffers sent went back to the pool
+    CSerializeData buf;
+    BOOST_CHECK(netBufferPool.Get(buf, nMsgSize));
+    BOOST_CHECK(buf.empty());
+
+    close(fds[1]);
+}
+
+// A message as it comes off the wire, with a zero filled payload
+static std::vector<char> WireMessage(const char* pszCommand, unsigned int nPayloadSize)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, nPayloadSize);
+    std::vector<char> vMsg(ss.begin(), ss.end());
+    vMsg.resize(vMsg.size() + nPayloadSize, 0);
+    return vMsg;
+}
+
+static void ExpectMsgStats(const mapMsgCmdStats& mapStats, const std::string& strKey, uint64_t nMessages, uint64_t nBytes)
+{
+    mapMsgCmdStats::const_iterator it = mapStats.find(strKey);
+    BOOST_REQUIRE(it != mapStats.end());
+    BOOST_CHECK_EQUAL(it->second.nMessages, nMessages);
+    BOOST_CHECK_EQUAL(it->second.nBytes, nBytes);
+}
+
+BOOST_AUTO_TEST_CASE(net_msg_stats)
+{
+    mapMsgCmdStats mapTotalSentBefore, mapTotalRecvBefore;
+    CNode::GetTotalMsgStats(mapTotalSentBefore, mapTotalRecvBefore);
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+    CNode other(INVALID_SOCKET, CAddress(CService("127.0.0.2", 0)), "", true);
+
+    // Sent messages count the header too; commands we do not know share
+    // one entry
+    node.PushMessage("ping", uint64_t(1));
+    node.PushMessage("ping", uint64_t(2));
+    node.PushMessage("bogus", std::string("x"));
+
+    std::vector<char> vInv = WireMessage("inv", 37);
+    std::vector<char> vMystery = WireMessage("mystery", 10);
+    std::vector<char> vUnknown = WireMessage("unknown", 5);
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(&vInv[0], vInv.size()));
+        BOOST_CHECK(node.ReceiveMsgBytes(&vMystery[0], vMystery.size()));
+        // Only complete messages are counted
+        BOOST_CHECK(node.ReceiveMsgBytes(&vUnknown[0], 10));
+    }
+    {
+        LOCK(node.cs_msgStats);
+        ExpectMsgStats(node.mapRecvMsgStats, NET_MESSAGE_COMMAND_OTHER, 1, 34);
+    }
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(&vUnknown[10], vUnknown.size() - 10));
+    }
+    {
+        LOCK(other.cs_vRecvMsg);
+        BOOST_CHECK(other.ReceiveMsgBytes(&vInv[0], vInv.size()));
+    }
+    node.RecordMsgProcessTime("inv", 20);
+    node.RecordMsgProcessTime("mystery", 5000);
+    other.RecordMsgProcessTime("inv", 3);
+
+    {
+        LOCK(node.cs_msgStats);
+        BOOST_CHECK_EQUAL(node.mapSendMsgStats.size(), 2);
+        ExpectMsgStats(node.mapSendMsgStats, "ping", 2, 64);
+        ExpectMsgStats(node.mapSendMsgStats, NET_MESSAGE_COMMAND_OTHER, 1, 26);
+
+        BOOST_CHECK_EQUAL(node.mapRecvMsgStats.size(), 2);
+        ExpectMsgStats(node.mapRecvMsgStats, "inv", 1, 61);
+        ExpectMsgStats(node.mapRecvMsgStats, NET_MESSAGE_COMMAND_OTHER, 2, 63);
+        const CNetMsgStats& inv = node.mapRecvMsgStats["inv"];
+        BOOST_CHECK_EQUAL(inv.nProcessed, 1);
+        BOOST_CHECK_EQUAL(inv.nProcessTimeMicros, 20);
+        BOOST_CHECK_EQUAL(inv.vProcessTimeHist[2], 1);
+        const CNetMsgStats& unknown = node.mapRecvMsgStats[NET_MESSAGE_COMMAND_OTHER];
+        BOOST_CHECK_EQUAL(unknown.nProcessed, 1);
+        BOOST_CHECK_EQUAL(unknown.nProcessTimeMicros, 5000);
+        BOOST_CHECK_EQUAL(unknown.vProcessTimeHist[6], 1);
+    }
+    {
+        // Each peer keeps its own
+        LOCK(other.cs_msgStats);
+        BOOST_CHECK(other.mapSendMsgStats.empty());
+        BOOST_CHECK_EQUAL(other.mapRecvMsgStats.size(), 1);
+        ExpectMsgStats(other.mapRecvMsgStats, "inv", 1, 61);
+        BOOST_CHECK_EQUAL(other.mapRecvMsgStats["inv"].nProcessTimeMicros, 3);
+        BOOST_CHECK_EQUAL(other.mapRecvMsgStats["inv"].vProcessTimeHist[0], 1);
+    }
+
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK_EQUAL(stats.mapSendMsgStats.size(), 2);
+    ExpectMsgStats(stats.mapSendMsgStats, "ping", 2, 64);
+    BOOST_CHECK_EQUAL(stats.mapRecvMsgStats.size(), 2);
+    ExpectMsgStats(stats.mapRecvMsgStats, NET_MESSAGE_COMMAND_OTHER, 2, 63);
+    BOOST_CHECK_EQUAL(stats.mapRecvMsgStats["inv"].nProcessTimeMicros, 20);
+
+    // The totals over all peers add up both
+    mapMsgCmdStats mapTotalSent, mapTotalRecv;
+    CNode::GetTotalMsgStats(mapTotalSent, mapTotalRecv);
+    BOOST_CHECK_EQUAL(mapTotalSent["ping"].nMessages - mapTotalSentBefore["ping"].nMessages, 2);
+    BOOST_CHECK_EQUAL(mapTotalSent["ping"].nBytes - mapTotalSentBefore["ping"].nBytes, 64);
+    BOOST_CHECK_EQUAL(mapTotalSent[NET_MESSAGE_COMMAND_OTHER].nBytes - mapTotalSentBefore[NET_MESSAGE_COMMAND_OTHER].nBytes, 26);
+    BOOST_CHECK_EQUAL(mapTotalRecv["inv"].nMessages - mapTotalRecvBefore["inv"].nMessages, 2);
+    BOOST_CHECK_EQUAL(mapTotalRecv["inv"].nBytes - mapTotalRecvBefore["inv"].nBytes, 122);
+    BOOST_CHECK_EQUAL(mapTotalRecv["inv"].nProcessTimeMicros - mapTotalRecvBefore["inv"].nProcessTimeMicros, 23);
+    BOOST_CHECK_EQUAL(mapTotalRecv[NET_MESSAGE_COMMAND_OTHER].nMessages - mapTotalRecvBefore[NET_MESSAGE_COMMAND_OTHER].nMessages, 2);
+    BOOST_CHECK_EQUAL(mapTotalRecv[NET_MESSAGE_COMMAND_OTHER].nBytes - mapTotalRecvBefore[NET_MESSAGE_COMMAND_OTHER].nBytes, 63);
+    BOOST_CHECK(!mapTotalSent.count("bogus"));
+    BOOST_CHECK(!mapTotalRecv.count("mystery"));
+    BOOST_CHECK(!mapTotalRecv.count("unknown"));
+
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
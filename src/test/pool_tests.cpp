@@ -0,0 +1,83 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "memusage.h"
+#include "support/allocators/pool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks come one after the other out of the first chunk
+    char* a = static_cast<char*>(resource.Allocate(8, 8));
+    char* b = static_cast<char*>(resource.Allocate(20, 8));
+    char* c = static_cast<char*>(resource.Allocate(8, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK(b == a + 8);
+    BOOST_CHECK(c == b + 24);
+    BOOST_CHECK_EQUAL(resource.NumUsedBytes(), 40U);
+
+    // A freed block is reused for the next request of its size only
+    resource.Deallocate(b, 20, 8);
+    BOOST_CHECK_EQUAL(resource.NumUsedBytes(), 16U);
+    BOOST_CHECK(resource.Allocate(8, 8) == c + 8);
+    BOOST_CHECK(resource.Allocate(24, 8) == b);
+    BOOST_CHECK_EQUAL(resource.NumUsedBytes(), 48U);
+
+    // Too large or too aligned requests are not served from the pool
+    void* pLarge = resource.Allocate(65, 8);
+    void* pAligned = resource.Allocate(8, 16);
+    resource.Deallocate(pLarge, 65, 8);
+    resource.Deallocate(pAligned, 8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // A new chunk is taken once the first is used up
+    for (int i = 0; i < 1024 / 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef std::pair<const int, std::vector<int> > Value;
+    typedef PoolAllocator<Value, sizeof(Value) + sizeof(void*) * 4> Allocator;
+    typedef boost::unordered_map<int, std::vector<int>, boost::hash<int>, std::equal_to<int>, Allocator> Map;
+
+    Allocator::ResourceType resource;
+    Map map(0, boost::hash<int>(), std::equal_to<int>(), Allocator(&resource));
+    for (int i = 0; i < 10000; i++)
+        map[i].push_back(i);
+    size_t nUsage = memusage::DynamicUsage(map);
+    BOOST_CHECK(nUsage >= 10000 * sizeof(Value));
+    for (int i = 0; i < 10000; i += 2)
+        map.erase(i);
+    // Erasing leaves the memory with the pool, but it is no longer counted
+    size_t nChunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(nChunks > 1);
+    BOOST_CHECK(memusage::DynamicUsage(map) < nUsage * 3 / 4);
+    for (int i = 0; i < 10000; i += 2)
+        map[i].push_back(i);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+
+    // Swapping exchanges the allocators too
+    Map mapHeap;
+    mapHeap.swap(map);
+    BOOST_CHECK(mapHeap.get_allocator().resource() == &resource);
+    BOOST_CHECK(map.get_allocator().resource() == NULL);
+    BOOST_CHECK_EQUAL(mapHeap.size(), 10000U);
+    for (int i = 0; i < 10000; i++)
+        BOOST_CHECK_EQUAL(mapHeap[i][0], i);
+    map[0].push_back(0);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
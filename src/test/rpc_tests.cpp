@@ -311,6 +311,102 @@ BOOST_AUTO_TEST_CASE(rpc_getnetworksolps)
     BOOST_CHECK_NO_THROW(CallRPC("getnetworksolps 120 -1"));
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    // Read-only calls around one that is not, and requests that fail; the
+    // replies come back in the order of the requests
+    UniValue vReq(UniValue::VARR);
+    vReq.read("["
+        "{\"method\":\"getblockcount\",\"params\":[],\"id\":1},"
+        "{\"method\":\"getbestblockhash\",\"params\":[],\"id\":2},"
+        "{\"method\":\"getblockhash\",\"params\":[1000],\"id\":3},"
+        "{\"method\":\"setmocktime\",\"params\":[0],\"id\":4},"
+        "{\"method\":\"nosuchmethod\",\"params\":[],\"id\":5},"
+        "{\"method\":\"getblockcount\",\"params\":[],\"id\":6},"
+        "17"
+        "]");
+
+    UniValue vReply;
+    BOOST_CHECK(vReply.read(JSONRPCExecBatch(vReq)));
+    BOOST_CHECK(vReply.isArray());
+    BOOST_CHECK_EQUAL(vReply.size(), 7U);
+    for (int i = 0; i < 6; i++)
+        BOOST_CHECK_EQUAL(find_value(vReply[i].get_obj(), "id").get_int(), i + 1);
+    BOOST_CHECK(find_value(vReply[0].get_obj(), "error").isNull());
+    BOOST_CHECK(find_value(vReply[1].get_obj(), "result").isStr());
+    BOOST_CHECK(!find_value(vReply[2].get_obj(), "error").isNull());
+    BOOST_CHECK_EQUAL(find_value(find_value(vReply[4].get_obj(), "error").get_obj(), "code").get_int(), RPC_METHOD_NOT_FOUND);
+    BOOST_CHECK_EQUAL(find_value(vReply[5].get_obj(), "result").get_int(), find_value(vReply[0].get_obj(), "result").get_int());
+    BOOST_CHECK(!find_value(vReply[6].get_obj(), "error").isNull());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getnetmsgstats)
+{
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getnetmsgstats"));
+    BOOST_CHECK(find_value(r.get_obj(), "sent").isObject());
+    BOOST_CHECK(find_value(r.get_obj(), "received").isObject());
+    BOOST_CHECK_THROW(CallRPC("getnetmsgstats 12345"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getnetmsgstats not_int"), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getpeerinfo_per_msg)
+{
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    pnode->RecordMsgSent("ping", 32);
+    pnode->RecordMsgSent("ping", 32);
+    pnode->RecordMsgSent("headers", 106);
+    pnode->RecordMsgRecv("inv", 61);
+    pnode->RecordMsgRecv("mystery", 30);
+    pnode->RecordMsgRecv("unknown", 24);
+    pnode->RecordMsgProcessTime("inv", 20);
+    pnode->RecordMsgProcessTime("mystery", 7);
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getpeerinfo"));
+    UniValue peer;
+    for (size_t i = 0; i < r.size(); i++) {
+        if (find_value(r[i].get_obj(), "id").get_int64() == pnode->GetId())
+            peer = r[i];
+    }
+    BOOST_REQUIRE(peer.isObject());
+
+    UniValue sent = find_value(peer.get_obj(), "bytessent_per_msg");
+    BOOST_CHECK_EQUAL(sent.size(), 2);
+    BOOST_CHECK_EQUAL(find_value(sent.get_obj(), "ping").get_int64(), 64);
+    BOOST_CHECK_EQUAL(find_value(sent.get_obj(), "headers").get_int64(), 106);
+    UniValue recv = find_value(peer.get_obj(), "bytesrecv_per_msg");
+    BOOST_CHECK_EQUAL(recv.size(), 2);
+    BOOST_CHECK_EQUAL(find_value(recv.get_obj(), "inv").get_int64(), 61);
+    BOOST_CHECK_EQUAL(find_value(recv.get_obj(), NET_MESSAGE_COMMAND_OTHER).get_int64(), 54);
+    UniValue time = find_value(peer.get_obj(), "processtime_per_msg");
+    BOOST_CHECK_EQUAL(time.size(), 2);
+    BOOST_CHECK_EQUAL(find_value(time.get_obj(), "inv").get_int64(), 20);
+    BOOST_CHECK_EQUAL(find_value(time.get_obj(), NET_MESSAGE_COMMAND_OTHER).get_int64(), 7);
+
+    // The same traffic, by peer id
+    BOOST_CHECK_NO_THROW(r = CallRPC("getnetmsgstats " + std::to_string(pnode->GetId())));
+    UniValue inv = find_value(find_value(r.get_obj(), "received").get_obj(), "inv");
+    BOOST_CHECK_EQUAL(find_value(inv.get_obj(), "count").get_int64(), 1);
+    BOOST_CHECK_EQUAL(find_value(inv.get_obj(), "bytes").get_int64(), 61);
+    BOOST_CHECK_EQUAL(find_value(inv.get_obj(), "processed").get_int64(), 1);
+    BOOST_CHECK_EQUAL(find_value(inv.get_obj(), "processtime_hist")[2].get_int64(), 1);
+    UniValue other = find_value(find_value(r.get_obj(), "received").get_obj(), NET_MESSAGE_COMMAND_OTHER);
+    BOOST_CHECK_EQUAL(find_value(other.get_obj(), "count").get_int64(), 2);
+    UniValue ping = find_value(find_value(r.get_obj(), "sent").get_obj(), "ping");
+    BOOST_CHECK_EQUAL(find_value(ping.get_obj(), "count").get_int64(), 2);
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.erase(std::find(vNodes.begin(), vNodes.end(), pnode));
+    }
+    delete pnode;
+}
+
 // Test parameter processing (not functionality).
 // These tests also ensure that src/rpc/client.cpp has the correct entries.
 BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
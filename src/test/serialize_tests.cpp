@@ -389,6 +389,24 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     CSerializeData d;
     ss.GetAndClear(d);
     BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 4);
+    BOOST_CHECK_EQUAL(d[3], (char)0xff);
+
+    // Appends when the destination is not empty, and skips what was read
+    ss << (char)7 << (char)8;
+    char c;
+    ss >> c;
+    ss.GetAndClear(d);
+    BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 5);
+    BOOST_CHECK_EQUAL(d[4], 8);
+
+    // swap() exchanges the buffers and rewinds
+    CSerializeData v(3, 1);
+    ss.swap(v);
+    BOOST_CHECK_EQUAL(ss.size(), 3);
+    BOOST_CHECK_EQUAL(ss[2], 1);
+    BOOST_CHECK(v.empty());
 }
 
 BOOST_AUTO_TEST_CASE(class_methods)
@@ -100,4 +100,44 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chaintipsnapshot_test)
+{
+    // A main chain of 10000 blocks and a branch off it at 4999
+    std::vector<CBlockIndex> vBlocksMain(10000);
+    for (unsigned int i=0; i<vBlocksMain.size(); i++) {
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].BuildSkip();
+    }
+    std::vector<CBlockIndex> vBlocksSide(1000);
+    for (unsigned int i=0; i<vBlocksSide.size(); i++) {
+        vBlocksSide[i].nHeight = i + 5000;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[4999];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    CChain chain;
+    chain.SetTip(&vBlocksMain.back());
+    CChainTipSnapshot snapshot(chain.Tip());
+    BOOST_CHECK(snapshot.Tip() == chain.Tip());
+    BOOST_CHECK_EQUAL(snapshot.Height(), chain.Height());
+    BOOST_CHECK(snapshot[-1] == NULL);
+    BOOST_CHECK(snapshot[chain.Height() + 1] == NULL);
+
+    for (int n=0; n<1000; n++) {
+        int r = insecure_rand() % 11000;
+        CBlockIndex* pindex = (r < 10000) ? &vBlocksMain[r] : &vBlocksSide[r - 10000];
+        BOOST_CHECK(snapshot[pindex->nHeight] == chain[pindex->nHeight]);
+        BOOST_CHECK_EQUAL(snapshot.Contains(pindex), chain.Contains(pindex));
+        BOOST_CHECK(snapshot.Next(pindex) == chain.Next(pindex));
+    }
+
+    // An empty snapshot contains nothing
+    CChainTipSnapshot empty;
+    BOOST_CHECK(empty.Tip() == NULL);
+    BOOST_CHECK_EQUAL(empty.Height(), -1);
+    BOOST_CHECK(empty[0] == NULL);
+    BOOST_CHECK(!empty.Contains(&vBlocksMain[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -30,7 +30,6 @@ struct JoinSplitTestingSetup: public BasicTestingSetup {
  * Included are data directory, coins database, script check threads setup.
  */
 struct TestingSetup: public JoinSplitTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path orig_current_path;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
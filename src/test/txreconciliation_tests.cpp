@@ -0,0 +1,192 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "crypto/common.h"
+#include "streams.h"
+#include "txreconciliation.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+// Sketches fail to decode now and then by design, so the tests use a fixed seed
+static uint256 InsecureRandHash()
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++)
+        WriteLE32(hash.begin() + 4 * i, insecure_rand());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    seed_insecure_rand(true);
+    CTxReconSketch a(CTxReconSketch::CellsForDifference(10));
+    CTxReconSketch b(a.Size());
+    // 100 elements in common, 6 only in a, 4 only in b
+    for (uint32_t i = 0; i < 100; i++) {
+        uint32_t n = insecure_rand();
+        a.Add(n);
+        b.Add(n);
+    }
+    std::vector<uint32_t> vOnlyA, vOnlyB;
+    for (int i = 0; i < 6; i++) {
+        vOnlyA.push_back(insecure_rand());
+        a.Add(vOnlyA.back());
+    }
+    for (int i = 0; i < 4; i++) {
+        vOnlyB.push_back(insecure_rand());
+        b.Add(vOnlyB.back());
+    }
+
+    BOOST_CHECK(a.Subtract(b));
+    std::vector<uint32_t> vPositive, vNegative;
+    BOOST_CHECK(a.Decode(vPositive, vNegative));
+    std::sort(vOnlyA.begin(), vOnlyA.end());
+    std::sort(vOnlyB.begin(), vOnlyB.end());
+    std::sort(vPositive.begin(), vPositive.end());
+    std::sort(vNegative.begin(), vNegative.end());
+    BOOST_CHECK(vPositive == vOnlyA);
+    BOOST_CHECK(vNegative == vOnlyB);
+
+    // Sketches of different sizes cannot be combined
+    CTxReconSketch c(a.Size() + 3);
+    BOOST_CHECK(!c.Subtract(a));
+
+    // A difference far larger than the sketch does not decode
+    CTxReconSketch d(CTxReconSketch::CellsForDifference(1));
+    for (int i = 0; i < 200; i++)
+        d.Add(insecure_rand());
+    BOOST_CHECK(!d.Decode(vPositive, vNegative));
+}
+
+BOOST_AUTO_TEST_CASE(sketch_serialization)
+{
+    seed_insecure_rand(true);
+    CTxReconSketch sketch(CTxReconSketch::CellsForDifference(5));
+    for (int i = 0; i < 5; i++)
+        sketch.Add(insecure_rand());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sketch;
+    CTxReconSketch sketch2;
+    ss >> sketch2;
+    BOOST_CHECK_EQUAL(sketch.Size(), sketch2.Size());
+    BOOST_CHECK(sketch2.Subtract(sketch));
+    std::vector<uint32_t> vPositive, vNegative;
+    BOOST_CHECK(sketch2.Decode(vPositive, vNegative));
+    BOOST_CHECK(vPositive.empty() && vNegative.empty());
+
+    // Sizes that are not a multiple of three are rejected
+    std::vector<CTxReconSketch::Cell> vCells(4);
+    CDataStream ssBad(SER_NETWORK, PROTOCOL_VERSION);
+    ssBad << vCells;
+    BOOST_CHECK_THROW(ssBad >> sketch2, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(reconcile_sets)
+{
+    seed_insecure_rand(true);
+    uint64_t nSaltA = 0x0123456789abcdef;
+    uint64_t nSaltB = 0xfedcba9876543210;
+    CTxReconciliationState initiator(true, nSaltA, nSaltB);
+    CTxReconciliationState responder(false, nSaltB, nSaltA);
+
+    // Both sides compute the same short ids
+    uint256 hash = InsecureRandHash();
+    BOOST_CHECK_EQUAL(initiator.GetShortID(hash), responder.GetShortID(hash));
+
+    std::vector<uint256> vCommon, vOnlyInitiator, vOnlyResponder;
+    for (int i = 0; i < 50; i++) {
+        vCommon.push_back(InsecureRandHash());
+        BOOST_CHECK(initiator.AddToSet(vCommon.back()));
+        BOOST_CHECK(responder.AddToSet(vCommon.back()));
+    }
+    for (int i = 0; i < 3; i++) {
+        vOnlyInitiator.push_back(InsecureRandHash());
+        initiator.AddToSet(vOnlyInitiator.back());
+        vOnlyResponder.push_back(InsecureRandHash());
+        responder.AddToSet(vOnlyResponder.back());
+    }
+    // Adding twice is harmless, removing takes it out of the round
+    BOOST_CHECK(initiator.AddToSet(vCommon[0]));
+    uint256 hashKnown = InsecureRandHash();
+    initiator.AddToSet(hashKnown);
+    initiator.RemoveFromSet(hashKnown);
+    BOOST_CHECK_EQUAL(initiator.SetSize(), 53U);
+
+    BOOST_CHECK(!responder.ShouldRequest(1000));
+    BOOST_CHECK(initiator.ShouldRequest(1000));
+    BOOST_CHECK(!initiator.ShouldRequest(1001));
+    BOOST_CHECK(initiator.AwaitingSketch());
+
+    std::vector<uint256> vFlood;
+    CTxReconSketch sketch = responder.PrepareSketch(initiator.SetSize(), vFlood);
+    BOOST_CHECK(vFlood.empty());
+    BOOST_CHECK(responder.AwaitingAnswer());
+    BOOST_CHECK_EQUAL(responder.SetSize(), 0U);
+
+    std::vector<uint256> vAnnounce;
+    std::vector<uint32_t> vWanted;
+    BOOST_CHECK(initiator.Reconcile(sketch, vAnnounce, vWanted));
+    BOOST_CHECK(!initiator.AwaitingSketch());
+    BOOST_CHECK_EQUAL(initiator.SetSize(), 0U);
+    std::sort(vAnnounce.begin(), vAnnounce.end());
+    std::sort(vOnlyInitiator.begin(), vOnlyInitiator.end());
+    BOOST_CHECK(vAnnounce == vOnlyInitiator);
+    BOOST_CHECK_EQUAL(vWanted.size(), 3U);
+
+    BOOST_CHECK(responder.FinishReconciliation(true, vWanted, vAnnounce));
+    BOOST_CHECK(!responder.AwaitingAnswer());
+    std::sort(vAnnounce.begin(), vAnnounce.end());
+    std::sort(vOnlyResponder.begin(), vOnlyResponder.end());
+    BOOST_CHECK(vAnnounce == vOnlyResponder);
+
+    // A second answer for the same round is ignored
+    BOOST_CHECK(!responder.FinishReconciliation(true, vWanted, vAnnounce));
+    BOOST_CHECK(vAnnounce.empty());
+}
+
+BOOST_AUTO_TEST_CASE(reconcile_fallback)
+{
+    seed_insecure_rand(true);
+    CTxReconciliationState initiator(true, 1, 2);
+    CTxReconciliationState responder(false, 2, 1);
+
+    // The responder claims an empty set, so the sketch is far too small
+    for (int i = 0; i < 100; i++)
+        initiator.AddToSet(InsecureRandHash());
+    std::vector<uint256> vFlood;
+    CTxReconSketch sketch = responder.PrepareSketch(0, vFlood);
+    for (int i = 0; i < 100; i++)
+        sketch.Add(insecure_rand());
+
+    BOOST_CHECK(initiator.ShouldRequest(0));
+    std::vector<uint256> vAnnounce;
+    std::vector<uint32_t> vWanted;
+    BOOST_CHECK(!initiator.Reconcile(sketch, vAnnounce, vWanted));
+    BOOST_CHECK_EQUAL(vAnnounce.size(), 100U);
+    BOOST_CHECK(vWanted.empty());
+
+    // A responder whose snapshot is never answered floods it with the next sketch
+    uint256 hash = InsecureRandHash();
+    responder.AddToSet(hash);
+    responder.PrepareSketch(1, vFlood);
+    responder.PrepareSketch(0, vFlood);
+    BOOST_CHECK_EQUAL(vFlood.size(), 1U);
+    BOOST_CHECK(vFlood[0] == hash);
+
+    // Unanswered requests are retried after the timeout
+    BOOST_CHECK(initiator.ShouldRequest(RECON_REQUEST_INTERVAL));
+    BOOST_CHECK(!initiator.ShouldRequest(2 * RECON_REQUEST_INTERVAL));
+    BOOST_CHECK(initiator.ShouldRequest(RECON_REQUEST_INTERVAL + RECON_REQUEST_INTERVAL + RECON_RESPONSE_TIMEOUT));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,9 +9,12 @@
 #include "pubkey.h"
 #include "rpc/protocol.h"
 #include "script/sign.h"
+#include "util.h"
 #include "utilmoneystr.h"
 #include "zcash/Note.hpp"
 
+#include <atomic>
+#include <boost/thread.hpp>
 #include <boost/variant.hpp>
 #include <librustzcash.h>
 #include <rust/ed25519.h>
@@ -25,7 +28,48 @@ SpendDescriptionInfo::SpendDescriptionInfo(
     librustzcash_sapling_generate_r(alpha.begin());
 }
 
-boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
+boost::optional<SpendDescription> SpendDescriptionInfo::Build(void* ctx, std::mutex* pmutexCtx) const {
+    auto nf = this->note.nullifier(
+        this->expsk.full_viewing_key(), this->witness.position());
+    if (!nf) {
+        return boost::none;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << this->witness.path();
+    std::vector<unsigned char> witness(ss.begin(), ss.end());
+
+    SpendDescription sdesc;
+    uint256 rcm = this->note.rcm();
+    std::unique_lock<std::mutex> lockCtx;
+    if (pmutexCtx) {
+        lockCtx = std::unique_lock<std::mutex>(*pmutexCtx);
+    }
+    if (!librustzcash_sapling_spend_proof(
+            ctx,
+            this->expsk.full_viewing_key().ak.begin(),
+            this->expsk.nsk.begin(),
+            this->note.d.data(),
+            rcm.begin(),
+            this->alpha.begin(),
+            this->note.value(),
+            this->anchor.begin(),
+            witness.data(),
+            sdesc.cv.begin(),
+            sdesc.rk.begin(),
+            sdesc.zkproof.data())) {
+        return boost::none;
+    }
+    if (lockCtx.owns_lock()) {
+        lockCtx.unlock();
+    }
+
+    sdesc.anchor = this->anchor;
+    sdesc.nullifier = *nf;
+    return sdesc;
+}
+
+boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx, std::mutex* pmutexCtx) {
     auto cmu = this->note.cmu();
     if (!cmu) {
         return boost::none;
@@ -47,6 +91,10 @@ boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
 
     OutputDescription odesc;
     uint256 rcm = this->note.rcm();
+    std::unique_lock<std::mutex> lockCtx;
+    if (pmutexCtx) {
+        lockCtx = std::unique_lock<std::mutex>(*pmutexCtx);
+    }
     if (!librustzcash_sapling_output_proof(
             ctx,
             encryptor.get_esk().begin(),
@@ -57,6 +105,9 @@ boost::optional<OutputDescription> OutputDescriptionInfo::Build(void* ctx) {
             odesc.zkproof.begin())) {
         return boost::none;
     }
+    if (lockCtx.owns_lock()) {
+        lockCtx.unlock();
+    }
 
     odesc.cmu = *cmu;
     odesc.ephemeralKey = encryptor.get_epk();
@@ -307,62 +358,93 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Sapling spends and outputs
     //
 
-    auto ctx = librustzcash_sapling_proving_ctx_init();
-
-    // Create Sapling SpendDescriptions
-    for (auto spend : spends) {
+    // Check the descriptions up front; this is cheap and keeps the proving
+    // workers free of early exits.
+    for (const auto& spend : spends) {
         auto cm = spend.note.cmu();
         auto nf = spend.note.nullifier(
             spend.expsk.full_viewing_key(), spend.witness.position());
         if (!cm || !nf) {
-            librustzcash_sapling_proving_ctx_free(ctx);
             return TransactionBuilderResult("Spend is invalid");
         }
-
-        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-        ss << spend.witness.path();
-        std::vector<unsigned char> witness(ss.begin(), ss.end());
-
-        SpendDescription sdesc;
-        uint256 rcm = spend.note.rcm();
-        if (!librustzcash_sapling_spend_proof(
-                ctx,
-                spend.expsk.full_viewing_key().ak.begin(),
-                spend.expsk.nsk.begin(),
-                spend.note.d.data(),
-                rcm.begin(),
-                spend.alpha.begin(),
-                spend.note.value(),
-                spend.anchor.begin(),
-                witness.data(),
-                sdesc.cv.begin(),
-                sdesc.rk.begin(),
-                sdesc.zkproof.data())) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Spend proof failed");
-        }
-
-        sdesc.anchor = spend.anchor;
-        sdesc.nullifier = *nf;
-        mtx.vShieldedSpend.push_back(sdesc);
     }
-
-    // Create Sapling OutputDescriptions
-    for (auto output : outputs) {
+    for (const auto& output : outputs) {
         // Check this out here as well to provide better logging.
         if (!output.note.cmu()) {
-            librustzcash_sapling_proving_ctx_free(ctx);
             return TransactionBuilderResult("Output is invalid");
         }
+    }
 
-        auto odesc = output.Build(ctx);
-        if (!odesc) {
-            librustzcash_sapling_proving_ctx_free(ctx);
-            return TransactionBuilderResult("Failed to create output description");
+    // The descriptions are independent of each other, so they are built
+    // concurrently: nullifiers, note encryption and the outgoing ciphertext
+    // of one description overlap with the proofs of the others. The proofs
+    // themselves accumulate into the one proving context the binding
+    // signature is made from, and take turns; each of them already uses
+    // every core.
+    size_t nJobs = spends.size() + outputs.size();
+    int nThreads = GetArg("-provethreads", DEFAULT_PROVE_THREADS);
+    if (nThreads <= 0) {
+        nThreads += GetNumCores();
+    }
+    size_t nWorkers = std::max<size_t>(1, std::min<size_t>(nThreads, nJobs));
+    auto ctx = librustzcash_sapling_proving_ctx_init();
+    std::mutex mutexCtx;
+
+    std::vector<SpendDescription> vSpendDescs(spends.size());
+    std::vector<OutputDescription> vOutputDescs(outputs.size());
+    std::vector<std::string> vErrors(nJobs);
+    std::atomic<size_t> nNextJob(0);
+
+    auto prove = [&]() {
+        size_t i;
+        while ((i = nNextJob++) < nJobs) {
+            try {
+                if (i < spends.size()) {
+                    auto sdesc = spends[i].Build(ctx, &mutexCtx);
+                    if (!sdesc) {
+                        vErrors[i] = "Spend proof failed";
+                    } else {
+                        vSpendDescs[i] = sdesc.get();
+                    }
+                } else {
+                    auto odesc = outputs[i - spends.size()].Build(ctx, &mutexCtx);
+                    if (!odesc) {
+                        vErrors[i] = "Failed to create output description";
+                    } else {
+                        vOutputDescs[i - spends.size()] = odesc.get();
+                    }
+                }
+            } catch (const std::exception& e) {
+                vErrors[i] = std::string("Sapling proving failed: ") + e.what();
+            }
         }
+    };
 
-        mtx.vShieldedOutput.push_back(odesc.get());
+    // Workers take the next job as they go, so if a thread cannot be
+    // started the ones that were still do all of the work.
+    boost::thread_group provers;
+    size_t nStarted = 1;
+    try {
+        for (; nStarted < nWorkers; nStarted++) {
+            provers.create_thread(prove);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("TransactionBuilder: started %d of %d proving threads: %s\n", nStarted, nWorkers, e.what());
     }
+    prove();
+    provers.join_all();
+
+    // Report the first failure in description order, independent of which
+    // worker hit it.
+    for (const std::string& strError : vErrors) {
+        if (!strError.empty()) {
+            librustzcash_sapling_proving_ctx_free(ctx);
+            return TransactionBuilderResult(strError);
+        }
+    }
+
+    mtx.vShieldedSpend.insert(mtx.vShieldedSpend.end(), vSpendDescs.begin(), vSpendDescs.end());
+    mtx.vShieldedOutput.insert(mtx.vShieldedOutput.end(), vOutputDescs.begin(), vOutputDescs.end());
 
     //
     // Sprout JoinSplits
@@ -18,10 +18,15 @@
 #include "zcash/Note.hpp"
 #include "zcash/NoteEncryption.hpp"
 
+#include <mutex>
+
 #include <boost/optional.hpp>
 
 #define NO_MEMO {{0xF6}}
 
+/** -provethreads default: one thread per core */
+static const int DEFAULT_PROVE_THREADS = 0;
+
 struct SpendDescriptionInfo {
     libzcash::SaplingExpandedSpendingKey expsk;
     libzcash::SaplingNote note;
@@ -34,6 +39,12 @@ struct SpendDescriptionInfo {
         libzcash::SaplingNote note,
         uint256 anchor,
         SaplingWitness witness);
+
+    /**
+     * ctx is not thread safe; descriptions built concurrently pass the
+     * mutex that guards it, which is only held for the proof.
+     */
+    boost::optional<SpendDescription> Build(void* ctx, std::mutex* pmutexCtx = nullptr) const;
 };
 
 struct OutputDescriptionInfo {
@@ -46,7 +57,8 @@ struct OutputDescriptionInfo {
         libzcash::SaplingNote note,
         std::array<unsigned char, ZC_MEMO_SIZE> memo) : ovk(ovk), note(note), memo(memo) {}
 
-    boost::optional<OutputDescription> Build(void* ctx);
+    /** See SpendDescriptionInfo::Build */
+    boost::optional<OutputDescription> Build(void* ctx, std::mutex* pmutexCtx = nullptr);
 };
 
 struct TransparentInputInfo {
@@ -6,11 +6,15 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "crypto/muhash.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "streams.h"
 #include "uint256.h"
 
+#include <memory>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
@@ -39,6 +43,8 @@ static const char DB_MMR_LENGTH = 'M';
 static const char DB_MMR_NODE = 'm';
 static const char DB_MMR_ROOT = 'r';
 
+static const char DB_SNAPSHOT_BASE = 'n';
+
 // insightexplorer
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
@@ -290,52 +296,359 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+std::vector<unsigned char> TxOutSetElement(const COutPoint &out, const CTxOut &txout)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << out << txout;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+namespace {
+
+/**
+ * Scan the coins whose txid starts with a byte in [nBegin, nEnd). stats
+ * gets the counts; the outputs go into whichever of pss and pmuhash is set.
+ */
+bool ScanCoinsRange(CDBIterator *pcursor, int nBegin, int nEnd, CCoinsStats &stats, CHashWriter *pss, MuHash3072 *pmuhash)
+{
+    uint256 hashStart;
+    *hashStart.begin() = nBegin;
+    pcursor->Seek(make_pair(DB_COINS, hashStart));
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+    for (uint64_t nScanned = 0; pcursor->Valid(); pcursor->Next(), nScanned++) {
+        if (nScanned % 10000 == 0 && ShutdownRequested())
+            return false;
         std::pair<char, uint256> key;
         CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+        if (!pcursor->GetKey(key) || key.first != DB_COINS || *key.second.begin() >= nEnd)
+            break;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read value", __func__);
+        stats.nTransactions++;
+        for (unsigned int i=0; i<coins.vout.size(); i++) {
+            const CTxOut &out = coins.vout[i];
+            if (!out.IsNull()) {
+                stats.nTransactionOutputs++;
+                if (pss) {
+                    *pss << VARINT(i+1);
+                    *pss << out;
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
+                if (pmuhash) {
+                    std::vector<unsigned char> vch = TxOutSetElement(COutPoint(key.second, i), out);
+                    pmuhash->Insert(vch.data(), vch.size());
+                }
+                nTotalAmount += out.nValue;
             }
-        } else {
-            break;
         }
-        pcursor->Next();
+        stats.nSerializedSize += 32 + pcursor->GetValueSize();
+        if (pss)
+            *pss << VARINT(0);
     }
+    stats.nTotalAmount = nTotalAmount;
+    return true;
+}
+
+} // namespace
+
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    stats.hashBlock = GetBestBlock();
+    std::vector<CDBIterator*> vCursors(1, pcursor.get());
+    MuHash3072 muhash;
+    if (!GetStats(vCursors, TxOutSetHashType::HASH_SERIALIZED, stats, muhash))
+        return false;
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::GetStats(const std::vector<CDBIterator*> &vCursors, TxOutSetHashType hashType,
+                            CCoinsStats &stats, MuHash3072 &muhash) const
+{
+    if (hashType == TxOutSetHashType::HASH_SERIALIZED) {
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << stats.hashBlock;
+        if (!ScanCoinsRange(vCursors[0], 0, 256, stats, &ss, NULL))
+            return false;
+        stats.hashSerialized = ss.GetHash();
+        return true;
+    }
+
+    // Split the txids in as many ranges as there are cursors
+    size_t nRanges = vCursors.size();
+    std::vector<CCoinsStats> vStats(nRanges);
+    std::vector<MuHash3072> vMuHash(nRanges);
+    std::vector<char> vOk(nRanges, false);
+    boost::thread_group threadGroup;
+    for (size_t i = 0; i < nRanges; i++) {
+        int nBegin = 256 * i / nRanges;
+        int nEnd = 256 * (i + 1) / nRanges;
+        MuHash3072 *pmuhash = hashType == TxOutSetHashType::MUHASH ? &vMuHash[i] : NULL;
+        threadGroup.create_thread([&vCursors, &vStats, &vOk, i, nBegin, nEnd, pmuhash] {
+            RenameThread("vect-txoutset");
+            vOk[i] = ScanCoinsRange(vCursors[i], nBegin, nEnd, vStats[i], NULL, pmuhash);
+        });
+    }
+    threadGroup.join_all();
+
+    CAmount nTotalAmount = stats.nTotalAmount;
+    for (size_t i = 0; i < nRanges; i++) {
+        if (!vOk[i])
+            return false;
+        stats.nTransactions += vStats[i].nTransactions;
+        stats.nTransactionOutputs += vStats[i].nTransactionOutputs;
+        stats.nSerializedSize += vStats[i].nSerializedSize;
+        nTotalAmount += vStats[i].nTotalAmount;
+        muhash.Combine(vMuHash[i]);
+    }
     stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+CDBIterator *CCoinsViewDB::NewIterator() const
+{
+    return const_cast<CDBWrapper&>(db).NewIterator();
+}
+
+namespace {
+
+const unsigned char TXOUTSET_SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+typedef std::array<unsigned char, NODE_SERIALIZED_LENGTH> HistoryNodeBytes;
+
+template <typename Key, typename Value>
+bool DumpSnapshotRecord(CDBIterator *pcursor, char chType, CAutoFile *pfile, CHashWriter &hasher)
+{
+    std::pair<char, Key> key;
+    Value value;
+    if (!pcursor->GetKey(key) || !pcursor->GetValue(value))
+        return false;
+    if (pfile)
+        *pfile << chType << key.second << value;
+    hasher << chType << key.second << value;
+    return true;
+}
+
+template <typename Key, typename Value>
+void LoadSnapshotRecord(char chType, CAutoFile &file, CHashWriter &hasher, CDBBatch *pbatch)
+{
+    Key key;
+    Value value;
+    file >> key >> value;
+    hasher << chType << key << value;
+    if (pbatch)
+        pbatch->Write(std::make_pair(chType, key), value);
+}
+
+template <typename Key>
+bool EraseSnapshotRecord(CDBIterator *pcursor, CDBBatch &batch)
+{
+    std::pair<char, Key> key;
+    if (!pcursor->GetKey(key))
+        return false;
+    batch.Erase(key);
+    return true;
+}
+
+} // namespace
+
+bool CCoinsViewDB::DumpSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata, CAutoFile &file,
+                                uint256 &hashSnapshot, uint64_t &nRecords) const
+{
+    file.write((const char*)TXOUTSET_SNAPSHOT_MAGIC, sizeof(TXOUTSET_SNAPSHOT_MAGIC));
+    file << TXOUTSET_SNAPSHOT_VERSION;
+    return WriteSnapshot(pcursor, metadata, &file, hashSnapshot, nRecords);
+}
+
+bool CCoinsViewDB::HashSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata,
+                                uint256 &hashSnapshot, uint64_t &nRecords) const
+{
+    return WriteSnapshot(pcursor, metadata, NULL, hashSnapshot, nRecords);
+}
+
+bool CCoinsViewDB::WriteSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata, CAutoFile *pfile,
+                                 uint256 &hashSnapshot, uint64_t &nRecords) const
+{
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    if (pfile)
+        *pfile << metadata;
+    hasher << metadata;
+
+    // A single cursor, so that all records come from the same state. The
+    // best block and anchors are in the metadata.
+    nRecords = 0;
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        char chType;
+        if (!pcursor->GetKey(chType))
+            continue;
+        bool fOk = true;
+        switch (chType) {
+        case DB_COINS:
+            fOk = DumpSnapshotRecord<uint256, CCoins>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_SPROUT_ANCHOR:
+            fOk = DumpSnapshotRecord<uint256, SproutMerkleTree>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_SAPLING_ANCHOR:
+            fOk = DumpSnapshotRecord<uint256, SaplingMerkleTree>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_NULLIFIER:
+        case DB_SAPLING_NULLIFIER:
+            fOk = DumpSnapshotRecord<uint256, bool>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_MMR_LENGTH:
+            fOk = DumpSnapshotRecord<uint32_t, HistoryIndex>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_MMR_NODE:
+            fOk = DumpSnapshotRecord<std::pair<uint32_t, HistoryIndex>, HistoryNodeBytes>(pcursor, chType, pfile, hasher);
+            break;
+        case DB_MMR_ROOT:
+            fOk = DumpSnapshotRecord<uint32_t, uint256>(pcursor, chType, pfile, hasher);
+            break;
+        default:
+            continue;
+        }
+        if (!fOk)
+            return error("%s: unable to read record of type '%c'", __func__, chType);
+        nRecords++;
+    }
+
+    char chEnd = 0;
+    hasher << chEnd;
+    hashSnapshot = hasher.GetHash();
+    if (pfile)
+        *pfile << chEnd << hashSnapshot;
+    return true;
+}
+
+bool CCoinsViewDB::LoadSnapshot(CAutoFile &file, bool fApply, CTxOutSetSnapshotMetadata &metadata,
+                                uint256 &hashSnapshot, uint64_t &nRecords)
+{
+    unsigned char magic[sizeof(TXOUTSET_SNAPSHOT_MAGIC)];
+    int nVersion;
+    file.read((char*)magic, sizeof(magic));
+    file >> nVersion;
+    if (memcmp(magic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+        return error("%s: not a UTXO set snapshot", __func__);
+    if (nVersion != TXOUTSET_SNAPSHOT_VERSION)
+        return error("%s: unsupported snapshot version %d", __func__, nVersion);
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    file >> metadata;
+    hasher << metadata;
+
+    static const uint64_t nBatchRecords = 100000;
+    if (fApply) {
+        // Start from nothing: the records of blocks connected before are
+        // not necessarily superseded by those of the snapshot.
+        CDBBatch batch(db);
+        uint64_t nErased = 0;
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            char chType;
+            if (!pcursor->GetKey(chType))
+                continue;
+            bool fOk = true;
+            switch (chType) {
+            case DB_COINS:
+            case DB_SPROUT_ANCHOR:
+            case DB_SAPLING_ANCHOR:
+            case DB_NULLIFIER:
+            case DB_SAPLING_NULLIFIER:
+                fOk = EraseSnapshotRecord<uint256>(pcursor.get(), batch);
+                break;
+            case DB_MMR_LENGTH:
+            case DB_MMR_ROOT:
+                fOk = EraseSnapshotRecord<uint32_t>(pcursor.get(), batch);
+                break;
+            case DB_MMR_NODE:
+                fOk = EraseSnapshotRecord<std::pair<uint32_t, HistoryIndex> >(pcursor.get(), batch);
+                break;
+            default:
+                continue;
+            }
+            if (!fOk)
+                return error("%s: unable to read record of type '%c'", __func__, chType);
+            nErased++;
+        }
+        if (!db.WriteBatch(batch))
+            return false;
+        LogPrint("coindb", "Erased %u records before loading the snapshot\n", (unsigned int)nErased);
+    }
+
+    nRecords = 0;
+    std::unique_ptr<CDBBatch> pbatch;
+    if (fApply)
+        pbatch.reset(new CDBBatch(db));
+    while (true) {
+        boost::this_thread::interruption_point();
+        char chType;
+        file >> chType;
+        if (chType == 0)
+            break;
+        switch (chType) {
+        case DB_COINS:
+            LoadSnapshotRecord<uint256, CCoins>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_SPROUT_ANCHOR:
+            LoadSnapshotRecord<uint256, SproutMerkleTree>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_SAPLING_ANCHOR:
+            LoadSnapshotRecord<uint256, SaplingMerkleTree>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_NULLIFIER:
+        case DB_SAPLING_NULLIFIER:
+            LoadSnapshotRecord<uint256, bool>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_MMR_LENGTH:
+            LoadSnapshotRecord<uint32_t, HistoryIndex>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_MMR_NODE:
+            LoadSnapshotRecord<std::pair<uint32_t, HistoryIndex>, HistoryNodeBytes>(chType, file, hasher, pbatch.get());
+            break;
+        case DB_MMR_ROOT:
+            LoadSnapshotRecord<uint32_t, uint256>(chType, file, hasher, pbatch.get());
+            break;
+        default:
+            return error("%s: unknown record type %d", __func__, (int)chType);
+        }
+        nRecords++;
+        if (pbatch && nRecords % nBatchRecords == 0) {
+            if (!db.WriteBatch(*pbatch))
+                return false;
+            pbatch.reset(new CDBBatch(db));
+            LogPrint("coindb", "Loaded %u snapshot records\n", (unsigned int)nRecords);
+        }
+    }
+    if (pbatch && !db.WriteBatch(*pbatch))
+        return false;
+
+    char chEnd = 0;
+    hasher << chEnd;
+    hashSnapshot = hasher.GetHash();
+    uint256 hashExpected;
+    file >> hashExpected;
+    if (hashSnapshot != hashExpected)
+        return error("%s: snapshot hash %s does not match its contents, %s", __func__, hashExpected.GetHex(), hashSnapshot.GetHex());
+    return true;
+}
+
+bool CBlockTreeDB::WriteSnapshotBase(const CTxOutSetSnapshotMetadata &metadata) {
+    return Write(DB_SNAPSHOT_BASE, metadata);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(CTxOutSetSnapshotMetadata &metadata) {
+    return Read(DB_SNAPSHOT_BASE, metadata);
+}
+
+bool CBlockTreeDB::EraseSnapshotBase() {
+    return Erase(DB_SNAPSHOT_BASE);
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -481,8 +794,8 @@ bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
             break;
         }
         if (fActiveOnly) {
-            CBlockIndex* pblockindex = mapBlockIndex[key.second.blockHash];
-            if (chainActive.Contains(pblockindex)) {
+            CBlockIndex* pblockindex = LookupBlockIndex(key.second.blockHash);
+            if (pblockindex && chainActive.Contains(pblockindex)) {
                 hashes.push_back(std::make_pair(key.second.blockHash, key.second.timestamp));
             }
         } else {
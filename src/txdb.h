@@ -18,7 +18,9 @@
 #include <boost/function.hpp>
 #include "zcash/History.hpp"
 
+class CAutoFile;
 class CBlockIndex;
+class MuHash3072;
 
 // START insightexplorer
 struct CAddressUnspentKey;
@@ -72,13 +74,62 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** The hash gettxoutsetinfo computes over the UTXO set */
+enum class TxOutSetHashType {
+    HASH_SERIALIZED, //!< SHA256d of the coins in txid order; needs a sequential scan
+    MUHASH,          //!< MuHash3072 of TxOutSetElement() of each unspent output
+    NONE,
+};
+
+/** The bytes a MUHASH UTXO set hash commits to for one unspent output */
+std::vector<unsigned char> TxOutSetElement(const COutPoint &out, const CTxOut &txout);
+
+/** Version of the UTXO set snapshots written by dumptxoutset */
+static const int TXOUTSET_SNAPSHOT_VERSION = 1;
+
+/**
+ * The chain state a UTXO set snapshot was taken at. A snapshot file holds
+ * a magic, the version, this, then the coins, anchors, nullifiers and
+ * history tree nodes as records of a type byte, key and value, ended by
+ * a zero type byte, and last the hash of everything from the metadata
+ * on. The hash is what chainparams commits to.
+ */
+struct CTxOutSetSnapshotMetadata
+{
+    uint256 hashBlock;
+    int nHeight;
+    unsigned int nChainTx;
+    boost::optional<CAmount> nChainSproutValue;
+    boost::optional<CAmount> nChainSaplingValue;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+
+    CTxOutSetSnapshotMetadata() : nHeight(-1), nChainTx(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nChainTx);
+        READWRITE(nChainSproutValue);
+        READWRITE(nChainSaplingValue);
+        READWRITE(hashSproutAnchor);
+        READWRITE(hashSaplingAnchor);
+    }
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
-    CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool WriteSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata, CAutoFile *pfile,
+                       uint256 &hashSnapshot, uint64_t &nRecords) const;
 public:
+    CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
@@ -101,6 +152,35 @@ public:
                     CNullifiersMap &mapSaplingNullifiers,
                     CHistoryCacheMap &historyCacheMap);
     bool GetStats(CCoinsStats &stats) const;
+    /**
+     * Add up the statistics of the coins seen by vCursors, each scanning its
+     * own range of txids on its own thread. The cursors must have been
+     * created while nothing was written, so that they see the same state;
+     * stats.hashBlock must be that state's best block. HASH_SERIALIZED uses
+     * the first cursor only. With MUHASH, the outputs are added to muhash.
+     */
+    bool GetStats(const std::vector<CDBIterator*> &vCursors, TxOutSetHashType hashType,
+                  CCoinsStats &stats, MuHash3072 &muhash) const;
+
+    /** A cursor over the database as it is now, unaffected by later writes. */
+    CDBIterator *NewIterator() const;
+    /**
+     * Write the snapshot of the state pcursor sees, which must be the state
+     * metadata describes, to file.
+     */
+    bool DumpSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata, CAutoFile &file,
+                      uint256 &hashSnapshot, uint64_t &nRecords) const;
+    /** The hash DumpSnapshot would end the snapshot with, without writing it. */
+    bool HashSnapshot(CDBIterator *pcursor, const CTxOutSetSnapshotMetadata &metadata,
+                      uint256 &hashSnapshot, uint64_t &nRecords) const;
+    /**
+     * Read a snapshot, checking it against the hash it ends with. With
+     * fApply, the coins, anchors, nullifiers and history of the database
+     * are replaced by those of the snapshot; the best block and anchors
+     * are left for the caller to set.
+     */
+    bool LoadSnapshot(CAutoFile &file, bool fApply, CTxOutSetSnapshotMetadata &metadata,
+                      uint256 &hashSnapshot, uint64_t &nRecords);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -139,6 +219,9 @@ public:
 
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteSnapshotBase(const CTxOutSetSnapshotMetadata &metadata);
+    bool ReadSnapshotBase(CTxOutSetSnapshotMetadata &metadata);
+    bool EraseSnapshotBase();
     bool LoadBlockIndexGuts(
         std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
         const CChainParams& chainParams);
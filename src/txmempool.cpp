@@ -109,6 +109,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     const CTransaction& tx = mapTx.find(hash)->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
+    CMempoolEvent event = {hash, true, MemPoolRemovalReason::UNKNOWN, ++nMempoolSequence};
+    vRecentEvents.push_back(event);
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vJoinSplit) {
@@ -234,7 +236,7 @@ void CTxMemPool::removeSpentIndex(const uint256 txhash)
 }
 // END insightexplorer
 
-void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
+void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive, MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
     {
@@ -280,6 +282,8 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
             removed.push_back(tx);
+            CMempoolEvent event = {hash, false, reason, ++nMempoolSequence};
+            vRecentEvents.push_back(event);
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
             mapTx.erase(hash);
@@ -323,7 +327,7 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     }
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::REORG);
     }
 }
 
@@ -364,7 +368,7 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot, ShieldedType type)
 
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::REORG);
     }
 }
 
@@ -379,7 +383,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
             {
-                remove(txConflict, removed, true);
+                remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
             }
         }
     }
@@ -390,7 +394,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
-                    remove(txConflict, removed, true);
+                    remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
                 }
             }
         }
@@ -400,7 +404,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
-                remove(txConflict, removed, true);
+                remove(txConflict, removed, true, MemPoolRemovalReason::CONFLICT);
             }
         }
     }
@@ -421,7 +425,7 @@ std::vector<uint256> CTxMemPool::removeExpired(unsigned int nBlockHeight)
     std::vector<uint256> ids;
     for (const CTransaction& tx : transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::EXPIRY);
         ids.push_back(tx.GetHash());
         LogPrint("mempool", "Removing expired txid: %s\n", tx.GetHash().ToString());
     }
@@ -447,7 +451,7 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
         std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
+        remove(tx, dummy, false, MemPoolRemovalReason::BLOCK);
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
@@ -473,7 +477,7 @@ void CTxMemPool::removeWithoutBranchId(uint32_t nMemPoolBranchId)
 
     for (const CTransaction& tx : transactionsToRemove) {
         std::list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MemPoolRemovalReason::BRANCHID);
     }
 }
 
@@ -753,6 +757,20 @@ std::pair<std::vector<CTransaction>, uint64_t> CTxMemPool::DrainRecentlyAdded()
     return std::make_pair(txs, recentlyAddedSequence);
 }
 
+std::vector<CMempoolEvent> CTxMemPool::DrainRecentEvents()
+{
+    std::vector<CMempoolEvent> events;
+    LOCK(cs);
+    events.swap(vRecentEvents);
+    return events;
+}
+
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs);
+    return nMempoolSequence;
+}
+
 void CTxMemPool::SetNotifiedSequence(uint64_t recentlyAddedSequence) {
     assert(Params().NetworkIDString() == "regtest");
     LOCK(cs);
@@ -844,6 +862,6 @@ void CTxMemPool::EnsureSizeLimit() {
         uint256 txId = maybeDropTxId.get();
         recentlyEvicted->add(txId);
         std::list<CTransaction> removed;
-        remove(mapTx.find(txId)->GetTx(), removed, true);
+        remove(mapTx.find(txId)->GetTx(), removed, true, MemPoolRemovalReason::SIZELIMIT);
     }
 }
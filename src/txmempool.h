@@ -101,6 +101,26 @@ public:
 
 class CBlockPolicyEstimator;
 
+/** Why a transaction left the mempool */
+enum class MemPoolRemovalReason {
+    UNKNOWN = 0, //!< Removed for a reason not listed below
+    EXPIRY,      //!< Reached its expiry height
+    SIZELIMIT,   //!< Evicted to keep the mempool within its cost limit
+    REORG,       //!< No longer valid after a block was disconnected
+    BLOCK,       //!< Included in a connected block
+    CONFLICT,    //!< Conflicts with a transaction in a connected block
+    BRANCHID,    //!< Not valid under the consensus branch of the new tip
+};
+
+/** An addition to or removal from the mempool */
+struct CMempoolEvent
+{
+    uint256 txid;
+    bool fAdded;
+    MemPoolRemovalReason reason;
+    uint64_t nSequence; //!< mempool sequence number of this event
+};
+
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
 {
@@ -139,6 +159,11 @@ private:
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
+    //! Counts every addition and removal, see GetSequence()
+    uint64_t nMempoolSequence = 0;
+    //! Additions and removals since the last DrainRecentEvents(), in order
+    std::vector<CMempoolEvent> vRecentEvents;
+
     std::map<uint256, const CTransaction*> mapSproutNullifiers;
     std::map<uint256, const CTransaction*> mapSaplingNullifiers;
     RecentlyEvictedList* recentlyEvicted = new RecentlyEvictedList(DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES * 60);
@@ -199,7 +224,8 @@ public:
     void removeSpentIndex(const uint256 txhash);
     // END insightexplorer
 
-    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false,
+                MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
     void removeWithAnchor(const uint256 &invalidRoot, ShieldedType type);
     void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
@@ -226,6 +252,18 @@ public:
     bool nullifierExists(const uint256& nullifier, ShieldedType type) const;
 
     std::pair<std::vector<CTransaction>, uint64_t> DrainRecentlyAdded();
+    /**
+     * Every addition and removal since the last call, in the order they
+     * happened. Unlike DrainRecentlyAdded(), this includes transactions
+     * that were added and removed again in between.
+     */
+    std::vector<CMempoolEvent> DrainRecentEvents();
+    /**
+     * The mempool sequence number: the number of additions and removals
+     * so far. A listing taken with mempool.cs held reflects exactly the
+     * events numbered up to it.
+     */
+    uint64_t GetSequence() const;
     void SetNotifiedSequence(uint64_t recentlyAddedSequence);
     bool IsFullyNotified();
 
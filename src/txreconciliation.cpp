@@ -0,0 +1,258 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace {
+
+// The short ids are salted SipHash outputs already, so cheap integer
+// mixing is enough to spread them over the cells.
+uint32_t Mix32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t CheckHash(uint32_t nShortID)
+{
+    return Mix32(nShortID ^ 0x5bd1e995);
+}
+
+const uint32_t CELL_SEEDS[3] = {0x9e3779b9, 0x85ebca6b, 0xc2b2ae35};
+
+bool IsPure(const CTxReconSketch::Cell& cell)
+{
+    return (cell.nCount == 1 || cell.nCount == -1) && cell.nHashSum == CheckHash(cell.nKeySum);
+}
+
+} // namespace
+
+CTxReconSketch::CTxReconSketch(size_t nCells)
+{
+    assert(nCells % 3 == 0 && nCells > 0);
+    CTxReconSketch::Cell empty = {0, 0, 0};
+    vCells.assign(nCells, empty);
+}
+
+size_t CTxReconSketch::CellsForDifference(size_t nDiff)
+{
+    // With three cells per element, plus a few for small differences,
+    // decoding fails for about 2% of small differences and fewer of
+    // large ones; a failure falls back to flooding. The table is split
+    // in three parts, one per hash function.
+    size_t nCells = 3 * nDiff + 12;
+    nCells += (3 - nCells % 3) % 3;
+    return std::min(nCells, MAX_SKETCH_CELLS);
+}
+
+void CTxReconSketch::Toggle(uint32_t nShortID, int nDelta)
+{
+    // Each hash function maps to its own third of the table, so an element
+    // never lands twice in the same cell.
+    size_t nPart = vCells.size() / 3;
+    uint32_t nCheck = CheckHash(nShortID);
+    for (int i = 0; i < 3; i++) {
+        Cell& cell = vCells[i * nPart + Mix32(nShortID ^ CELL_SEEDS[i]) % nPart];
+        cell.nCount += nDelta;
+        cell.nKeySum ^= nShortID;
+        cell.nHashSum ^= nCheck;
+    }
+}
+
+void CTxReconSketch::Add(uint32_t nShortID)
+{
+    Toggle(nShortID, 1);
+}
+
+bool CTxReconSketch::Subtract(const CTxReconSketch& other)
+{
+    if (other.vCells.size() != vCells.size())
+        return false;
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nKeySum ^= other.vCells[i].nKeySum;
+        vCells[i].nHashSum ^= other.vCells[i].nHashSum;
+    }
+    return true;
+}
+
+bool CTxReconSketch::Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const
+{
+    vPositive.clear();
+    vNegative.clear();
+    if (vCells.empty())
+        return false;
+
+    // Peel off cells holding a single element until none are left
+    CTxReconSketch work(*this);
+    std::deque<size_t> queue;
+    for (size_t i = 0; i < work.vCells.size(); i++) {
+        if (IsPure(work.vCells[i]))
+            queue.push_back(i);
+    }
+    while (!queue.empty()) {
+        const Cell& cell = work.vCells[queue.front()];
+        queue.pop_front();
+        if (!IsPure(cell))
+            continue;
+
+        uint32_t nShortID = cell.nKeySum;
+        int nCount = cell.nCount;
+        (nCount > 0 ? vPositive : vNegative).push_back(nShortID);
+        if (vPositive.size() + vNegative.size() > work.vCells.size())
+            return false;
+        work.Toggle(nShortID, -nCount);
+
+        size_t nPart = work.vCells.size() / 3;
+        for (int i = 0; i < 3; i++) {
+            size_t nIndex = i * nPart + Mix32(nShortID ^ CELL_SEEDS[i]) % nPart;
+            if (IsPure(work.vCells[nIndex]))
+                queue.push_back(nIndex);
+        }
+    }
+
+    for (size_t i = 0; i < work.vCells.size(); i++) {
+        const Cell& cell = work.vCells[i];
+        if (cell.nCount != 0 || cell.nKeySum != 0 || cell.nHashSum != 0)
+            return false;
+    }
+    return true;
+}
+
+CTxReconciliationState::CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt) :
+    fInitiator(fInitiatorIn), nNextRequest(0), fRequestPending(false), fSketchPending(false)
+{
+    // Both sides derive the same short id keys from the two salts
+    static const std::string strTag("Tx Relay Salting");
+    unsigned char salts[16];
+    WriteLE64(salts, std::min(nLocalSalt, nRemoteSalt));
+    WriteLE64(salts + 8, std::max(nLocalSalt, nRemoteSalt));
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)strTag.data(), strTag.size()).Write(salts, sizeof(salts)).Finalize(hash.begin());
+    k0 = hash.GetUint64(0);
+    k1 = hash.GetUint64(1);
+}
+
+uint32_t CTxReconciliationState::GetShortID(const uint256& txid) const
+{
+    return (uint32_t)SipHashUint256(k0, k1, txid);
+}
+
+bool CTxReconciliationState::ShouldFanout(const uint256& txid) const
+{
+    unsigned int nPercent = fInitiator ? RECON_OUTBOUND_FANOUT_PERCENT : RECON_INBOUND_FANOUT_PERCENT;
+    return (SipHashUint256(k1, k0, txid) % 100) < nPercent;
+}
+
+bool CTxReconciliationState::AddToSet(const uint256& txid)
+{
+    if (mapLocalSet.size() >= MAX_RECON_SET_SIZE)
+        return false;
+    // On a short id collision the second transaction is flooded
+    std::pair<std::map<uint32_t, uint256>::iterator, bool> ret = mapLocalSet.insert(std::make_pair(GetShortID(txid), txid));
+    return ret.second || ret.first->second == txid;
+}
+
+void CTxReconciliationState::RemoveFromSet(const uint256& txid)
+{
+    std::map<uint32_t, uint256>::iterator it = mapLocalSet.find(GetShortID(txid));
+    if (it != mapLocalSet.end() && it->second == txid)
+        mapLocalSet.erase(it);
+}
+
+bool CTxReconciliationState::ShouldRequest(int64_t nNow)
+{
+    if (!fInitiator || nNow < nNextRequest)
+        return false;
+    if (fRequestPending && nNow < nNextRequest + RECON_RESPONSE_TIMEOUT)
+        return false;
+    fRequestPending = true;
+    nNextRequest = nNow + RECON_REQUEST_INTERVAL;
+    return true;
+}
+
+CTxReconSketch CTxReconciliationState::BuildSketch(const std::map<uint32_t, uint256>& mapSet, size_t nCells) const
+{
+    CTxReconSketch sketch(nCells);
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSet.begin(); it != mapSet.end(); ++it)
+        sketch.Add(it->first);
+    return sketch;
+}
+
+CTxReconSketch CTxReconciliationState::PrepareSketch(uint32_t nRemoteSetSize, std::vector<uint256>& vFlood)
+{
+    vFlood.clear();
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+        vFlood.push_back(it->second);
+
+    size_t nLocal = mapLocalSet.size();
+    size_t nDiff = std::max<size_t>(nLocal, nRemoteSetSize) - std::min<size_t>(nLocal, nRemoteSetSize) +
+                   (size_t)(RECON_Q * std::min<size_t>(nLocal, nRemoteSetSize)) + 1;
+    CTxReconSketch sketch = BuildSketch(mapLocalSet, CTxReconSketch::CellsForDifference(nDiff));
+
+    mapSnapshot.swap(mapLocalSet);
+    mapLocalSet.clear();
+    fSketchPending = true;
+    return sketch;
+}
+
+bool CTxReconciliationState::Reconcile(const CTxReconSketch& sketchRemote, std::vector<uint256>& vAnnounce, std::vector<uint32_t>& vWanted)
+{
+    vAnnounce.clear();
+    vWanted.clear();
+    fRequestPending = false;
+
+    bool fSuccess = false;
+    std::vector<uint32_t> vOurs;
+    if (sketchRemote.Size() > 0) {
+        CTxReconSketch sketchDiff = BuildSketch(mapLocalSet, sketchRemote.Size());
+        fSuccess = sketchDiff.Subtract(sketchRemote) && sketchDiff.Decode(vOurs, vWanted);
+    }
+
+    if (fSuccess) {
+        for (size_t i = 0; i < vOurs.size(); i++) {
+            std::map<uint32_t, uint256>::const_iterator it = mapLocalSet.find(vOurs[i]);
+            if (it != mapLocalSet.end())
+                vAnnounce.push_back(it->second);
+        }
+    } else {
+        vWanted.clear();
+        for (std::map<uint32_t, uint256>::const_iterator it = mapLocalSet.begin(); it != mapLocalSet.end(); ++it)
+            vAnnounce.push_back(it->second);
+    }
+    mapLocalSet.clear();
+    return fSuccess;
+}
+
+bool CTxReconciliationState::FinishReconciliation(bool fSuccess, const std::vector<uint32_t>& vWanted, std::vector<uint256>& vAnnounce)
+{
+    vAnnounce.clear();
+    if (!fSketchPending)
+        return false;
+
+    if (fSuccess) {
+        for (size_t i = 0; i < vWanted.size(); i++) {
+            std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.find(vWanted[i]);
+            if (it != mapSnapshot.end())
+                vAnnounce.push_back(it->second);
+        }
+    } else {
+        for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+            vAnnounce.push_back(it->second);
+    }
+    mapSnapshot.clear();
+    fSketchPending = false;
+    return true;
+}
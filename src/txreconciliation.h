@@ -0,0 +1,162 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+/** Version of the reconciliation protocol announced in "sendtxrcncl" */
+static const uint32_t TXRECONCILIATION_PROTOCOL_VERSION = 1;
+/** -txreconciliation default */
+static const bool DEFAULT_TXRECONCILIATION_ENABLE = false;
+/** Seconds between reconciliation requests to each outbound peer */
+static const int64_t RECON_REQUEST_INTERVAL = 8;
+/** Seconds after which an unanswered reconciliation request is given up */
+static const int64_t RECON_RESPONSE_TIMEOUT = 60;
+/** Expected share of the smaller set that is not in the larger one, used to size sketches */
+static const double RECON_Q = 0.25;
+/** Largest sketch we build or accept, in cells */
+static const size_t MAX_SKETCH_CELLS = 3 * 4096;
+/** Most transactions waiting for reconciliation with one peer; any more are announced with an inv */
+static const size_t MAX_RECON_SET_SIZE = 3000;
+/** Percentage of transactions still announced with an inv to each reconciling outbound peer... */
+static const unsigned int RECON_OUTBOUND_FANOUT_PERCENT = 25;
+/** ...and to each reconciling inbound peer, so that transactions keep propagating quickly */
+static const unsigned int RECON_INBOUND_FANOUT_PERCENT = 10;
+
+/**
+ * A sketch of a set of 32-bit short transaction ids: an invertible Bloom
+ * lookup table. Subtracting the sketch of one set from a sketch of the
+ * same size of another leaves a sketch of their symmetric difference,
+ * which can usually be listed as long as it holds no more elements than
+ * a third of the cells, however large the sets themselves are.
+ */
+class CTxReconSketch
+{
+public:
+    struct Cell
+    {
+        int32_t nCount;
+        uint32_t nKeySum;
+        uint32_t nHashSum;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(nCount);
+            READWRITE(nKeySum);
+            READWRITE(nHashSum);
+        }
+    };
+
+    CTxReconSketch() {}
+    explicit CTxReconSketch(size_t nCells);
+
+    /** Number of cells for a sketch that should decode a difference of nDiff elements. */
+    static size_t CellsForDifference(size_t nDiff);
+
+    size_t Size() const { return vCells.size(); }
+
+    void Add(uint32_t nShortID);
+    /** Subtract a sketch of the same size. */
+    bool Subtract(const CTxReconSketch& other);
+
+    /**
+     * List the elements of a difference sketch: those added to the
+     * minuend only in vPositive, those in the subtrahend only in
+     * vNegative. Returns false if the difference was too large.
+     */
+    bool Decode(std::vector<uint32_t>& vPositive, std::vector<uint32_t>& vNegative) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vCells);
+        if (ser_action.ForRead() && (vCells.size() % 3 != 0 || vCells.size() > MAX_SKETCH_CELLS))
+            throw std::ios_base::failure("invalid sketch size");
+    }
+
+private:
+    std::vector<Cell> vCells;
+
+    void Toggle(uint32_t nShortID, int nDelta);
+};
+
+/**
+ * Transaction reconciliation (BIP 330 style) with one peer. Instead of an
+ * inv per transaction and direction, both sides collect the transactions
+ * they would have announced; periodically the side that made the
+ * connection asks for a sketch of the other's set, and only the
+ * difference is announced. Transactions both sides learnt elsewhere
+ * cancel out, which is where the bandwidth goes with inv flooding.
+ *
+ * Kept by CNode and protected by its cs_inventory.
+ */
+class CTxReconciliationState
+{
+public:
+    //! Whether we send the requests (we made the connection) or answer them
+    const bool fInitiator;
+
+    CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt);
+
+    uint32_t GetShortID(const uint256& txid) const;
+
+    /** Whether txid should still be announced to this peer with an inv. */
+    bool ShouldFanout(const uint256& txid) const;
+
+    /** Queue a transaction for reconciliation. Returns false if it must be announced with an inv instead. */
+    bool AddToSet(const uint256& txid);
+    /** Forget a transaction the peer turned out to know. */
+    void RemoveFromSet(const uint256& txid);
+    size_t SetSize() const { return mapLocalSet.size(); }
+
+    /** Initiator: whether a request is due; marks it as sent. */
+    bool ShouldRequest(int64_t nNow);
+    /** Initiator: whether we sent a request and have not had the sketch yet. */
+    bool AwaitingSketch() const { return fRequestPending; }
+    /** Responder: whether we sent a sketch and have not had the answer yet. */
+    bool AwaitingAnswer() const { return fSketchPending; }
+
+    /**
+     * Responder: sketch our set for a request from a peer with a set of
+     * nRemoteSetSize transactions. The set is moved aside until the
+     * answer arrives; a snapshot never answered is returned in vFlood.
+     */
+    CTxReconSketch PrepareSketch(uint32_t nRemoteSetSize, std::vector<uint256>& vFlood);
+
+    /**
+     * Initiator: reconcile our set with the peer's sketch. On success,
+     * vAnnounce holds what the peer lacks and vWanted the short ids of
+     * what we lack. On failure vAnnounce holds our whole set, to be
+     * flooded. Either way the set is cleared.
+     */
+    bool Reconcile(const CTxReconSketch& sketchRemote, std::vector<uint256>& vAnnounce, std::vector<uint32_t>& vWanted);
+
+    /**
+     * Responder: the initiator's answer to our sketch. vAnnounce gets the
+     * transactions it asked for, or the whole snapshot if decoding failed.
+     */
+    bool FinishReconciliation(bool fSuccess, const std::vector<uint32_t>& vWanted, std::vector<uint256>& vAnnounce);
+
+private:
+    uint64_t k0, k1;
+    std::map<uint32_t, uint256> mapLocalSet;
+    std::map<uint32_t, uint256> mapSnapshot;
+    int64_t nNextRequest;
+    bool fRequestPending;
+    bool fSketchPending;
+
+    CTxReconSketch BuildSketch(const std::map<uint32_t, uint256>& mapSet, size_t nCells) const;
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
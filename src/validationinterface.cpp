@@ -35,9 +35,13 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.AddressForMining.connect(boost::bind(&CValidationInterface::GetAddressForMining, pwalletIn, _1));
     g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
+    g_signals.TransactionAddedToMempool.connect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
+    g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2, _3));
+    g_signals.TransactionAddedToMempool.disconnect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
     g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
     g_signals.AddressForMining.disconnect(boost::bind(&CValidationInterface::GetAddressForMining, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
@@ -52,6 +56,8 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
 }
 
 void UnregisterAllValidationInterfaces() {
+    g_signals.TransactionRemovedFromMempool.disconnect_all_slots();
+    g_signals.TransactionAddedToMempool.disconnect_all_slots();
     g_signals.BlockFound.disconnect_all_slots();
     g_signals.AddressForMining.disconnect_all_slots();
     g_signals.BlockChecked.disconnect_all_slots();
@@ -73,14 +79,76 @@ struct CachedBlockData {
     CBlockIndex *pindex;
     std::pair<SproutMerkleTree, SaplingMerkleTree> oldTrees;
     std::list<CTransaction> txConflicted;
+    // The block as ConnectTip had it, or null if it must be read from disk
+    std::shared_ptr<const CBlock> pblock;
 
     CachedBlockData(
         CBlockIndex *pindex,
         std::pair<SproutMerkleTree, SaplingMerkleTree> oldTrees,
-        std::list<CTransaction> txConflicted):
-        pindex(pindex), oldTrees(oldTrees), txConflicted(txConflicted) {}
+        std::list<CTransaction> txConflicted,
+        std::shared_ptr<const CBlock> pblock):
+        pindex(pindex), oldTrees(oldTrees), txConflicted(txConflicted), pblock(pblock) {}
 };
 
+namespace {
+
+// Guards walletNotifyStats; walletNotifyCondition is notified after every cycle
+boost::mutex cs_walletNotify;
+boost::condition_variable walletNotifyCondition;
+CWalletNotifyStats walletNotifyStats;
+
+struct WalletNotifyRunning {
+    WalletNotifyRunning(int nNotifiedHeight) { WalletNotifyStarted(nNotifiedHeight); }
+    ~WalletNotifyRunning() { WalletNotifyStopped(); }
+};
+
+} // namespace
+
+void WalletNotifyStarted(int nNotifiedHeight)
+{
+    boost::unique_lock<boost::mutex> lock(cs_walletNotify);
+    walletNotifyStats.fRunning = true;
+    walletNotifyStats.nNotifiedHeight = nNotifiedHeight;
+}
+
+void WalletNotifyCycleDone(int nNotifiedHeight, int nBatchBlocks, int64_t nCycleMicros)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_walletNotify);
+        walletNotifyStats.nNotifiedHeight = nNotifiedHeight;
+        walletNotifyStats.nLastBatchBlocks = nBatchBlocks;
+        walletNotifyStats.nLastCycleMicros = nCycleMicros;
+    }
+    walletNotifyCondition.notify_all();
+}
+
+void WalletNotifyStopped()
+{
+    boost::unique_lock<boost::mutex> lock(cs_walletNotify);
+    walletNotifyStats.fRunning = false;
+    walletNotifyCondition.notify_all();
+}
+
+CWalletNotifyStats GetWalletNotifyStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs_walletNotify);
+    return walletNotifyStats;
+}
+
+void LimitWalletNotifyLag(int nHeight)
+{
+    boost::unique_lock<boost::mutex> lock(cs_walletNotify);
+    if (!walletNotifyStats.fRunning || nHeight - walletNotifyStats.nNotifiedHeight <= MAX_WALLET_NOTIFY_LAG)
+        return;
+
+    LogPrint("bench", "Waiting for wallet notifications at height %d (notified %d)\n", nHeight, walletNotifyStats.nNotifiedHeight);
+    int64_t nStart = GetTimeMicros();
+    while (walletNotifyStats.fRunning && nHeight - walletNotifyStats.nNotifiedHeight > MAX_WALLET_NOTIFY_LAG && !ShutdownRequested()) {
+        walletNotifyCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+    }
+    walletNotifyStats.nWaitMicros += GetTimeMicros() - nStart;
+}
+
 void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 {
     // If pindexLastTip == nullptr, the wallet is at genesis.
@@ -94,6 +162,8 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         MilliSleep(50);
     }
 
+    WalletNotifyRunning running(pindexLastTip->nHeight);
+
     while (true) {
         // Run the notifier on an integer second in the steady clock.
         auto now = std::chrono::steady_clock::now().time_since_epoch();
@@ -104,6 +174,8 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
         boost::this_thread::interruption_point();
 
+        int64_t nCycleStart = GetTimeMicros();
+        int nBatchBlocks = 0;
         auto chainParams = Params();
 
         //
@@ -120,6 +192,10 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         std::pair<std::map<CBlockIndex*, std::list<CTransaction>>, uint64_t> recentlyConflicted;
         // Transactions that have been recently added to the mempool.
         std::pair<std::vector<CTransaction>, uint64_t> recentlyAdded;
+        // Every mempool addition and removal since the last cycle, in order.
+        std::vector<CMempoolEvent> mempoolEvents;
+        // Blocks connected since the last cycle that are still in memory.
+        std::map<CBlockIndex*, std::shared_ptr<const CBlock>> recentlyConnected;
 
         {
             LOCK(cs_main);
@@ -129,10 +205,20 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             CBlockIndex *pindex = chainActive.Tip();
             pindexFork = chainActive.FindFork(pindexLastTip);
 
+            // There are no blocks to notify up to a loaded UTXO set
+            // snapshot; wallets only see what comes after it.
+            CBlockIndex *pindexSnapshotBase = GetSnapshotBase();
+            if (pindexSnapshotBase && chainActive.Contains(pindexSnapshotBase) &&
+                (!pindexFork || pindexFork->nHeight < pindexSnapshotBase->nHeight)) {
+                pindexFork = pindexSnapshotBase;
+                pindexLastTip = pindexSnapshotBase;
+            }
+
             // Fetch recently-conflicted transactions. These will include any
             // block that has been connected since the last cycle, but we only
             // notify for the conflicts created by the current active chain.
             recentlyConflicted = DrainRecentlyConflicted();
+            recentlyConnected = DrainRecentlyConnectedBlocks();
 
             // Iterate backwards over the connected blocks we need to notify.
             while (pindex && pindex != pindexFork) {
@@ -154,16 +240,21 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
                     assert(pcoinsTip->GetSaplingAnchorAt(SaplingMerkleTree::empty_root(), oldSaplingTree));
                 }
 
+                auto itBlock = recentlyConnected.find(pindex);
                 blockStack.emplace_back(
                     pindex,
                     std::make_pair(oldSproutTree, oldSaplingTree),
-                    recentlyConflicted.first.at(pindex));
+                    recentlyConflicted.first.at(pindex),
+                    itBlock != recentlyConnected.end() ? itBlock->second : nullptr);
 
                 pindex = pindex->pprev;
             }
 
             recentlyAdded = mempool.DrainRecentlyAdded();
+            mempoolEvents = mempool.DrainRecentEvents();
         }
+        // Free the blocks that are no longer on the path to the tip
+        recentlyConnected.clear();
 
         //
         // Execute wallet logic based on the collected state. We MUST NOT take
@@ -194,6 +285,7 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
             // On to the next block!
             pindexLastTip = pindexLastTip->pprev;
+            nBatchBlocks++;
         }
 
         // Notify block connections
@@ -201,15 +293,20 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             auto blockData = blockStack.back();
             blockStack.pop_back();
 
-            // Read block from disk.
-            CBlock block;
-            if (!ReadBlockFromDisk(block, blockData.pindex, chainParams.GetConsensus())) {
-                LogPrintf("*** %s\n", "Failed to read block while notifying wallets of block connects");
-                uiInterface.ThreadSafeMessageBox(
-                    _("Error: A fatal internal error occurred, see debug.log for details"),
-                    "", CClientUIInterface::MSG_ERROR);
-                StartShutdown();
+            // Use the block ConnectTip kept for us, or read it from disk.
+            std::shared_ptr<const CBlock> pblock = blockData.pblock;
+            if (!pblock) {
+                std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                if (!ReadBlockFromDisk(*pblockRead, blockData.pindex, chainParams.GetConsensus())) {
+                    LogPrintf("*** %s\n", "Failed to read block while notifying wallets of block connects");
+                    uiInterface.ThreadSafeMessageBox(
+                        _("Error: A fatal internal error occurred, see debug.log for details"),
+                        "", CClientUIInterface::MSG_ERROR);
+                    StartShutdown();
+                }
+                pblock = pblockRead;
             }
+            const CBlock& block = *pblock;
 
             // Tell wallet about transactions that went from mempool
             // to conflicted:
@@ -225,8 +322,11 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
             // This block is done!
             pindexLastTip = blockData.pindex;
+            nBatchBlocks++;
         }
 
+        WalletNotifyCycleDone(pindexLastTip->nHeight, nBatchBlocks, GetTimeMicros() - nCycleStart);
+
         // Notify transactions in the mempool
         for (auto tx : recentlyAdded.first) {
             try {
@@ -240,6 +340,24 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             }
         }
 
+        // Notify mempool additions and removals, after the blocks that
+        // caused most of the removals
+        for (const CMempoolEvent& event : mempoolEvents) {
+            try {
+                if (event.fAdded) {
+                    GetMainSignals().TransactionAddedToMempool(event.txid, event.nSequence);
+                } else {
+                    GetMainSignals().TransactionRemovedFromMempool(event.txid, event.reason, event.nSequence);
+                }
+            } catch (const boost::thread_interrupted&) {
+                throw;
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "ThreadNotifyWallets()");
+            } catch (...) {
+                PrintExceptionContinue(NULL, "ThreadNotifyWallets()");
+            }
+        }
+
         // Update the notified sequence numbers. We only need this in regtest mode,
         // and should not lock on cs or cs_main here otherwise.
         if (chainParams.NetworkIDString() == "regtest") {
@@ -20,6 +20,7 @@ class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
+enum class MemPoolRemovalReason;
 
 // These functions dispatch to one or all registered wallets
 
@@ -43,6 +44,8 @@ protected:
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetAddressForMining(MinerAddress&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
+    virtual void TransactionAddedToMempool(const uint256 &txid, uint64_t nMempoolSequence) {}
+    virtual void TransactionRemovedFromMempool(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence) {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -71,10 +74,43 @@ struct CMainSignals {
     boost::signals2::signal<void (MinerAddress&)> AddressForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+    /** Notifies listeners of a transaction added to the mempool, with the mempool sequence number of the addition. */
+    boost::signals2::signal<void (const uint256 &, uint64_t)> TransactionAddedToMempool;
+    /** Notifies listeners of a transaction removed from the mempool, why, and the mempool sequence number of the removal. */
+    boost::signals2::signal<void (const uint256 &, MemPoolRemovalReason, uint64_t)> TransactionRemovedFromMempool;
 };
 
 CMainSignals& GetMainSignals();
 
+/** Blocks the wallet notifications may fall behind the active chain before block connection waits for them */
+static const int MAX_WALLET_NOTIFY_LAG = 1000;
+
+/** Progress of ThreadNotifyWallets, as reported by getblockchaininfo */
+struct CWalletNotifyStats
+{
+    bool fRunning;
+    int nNotifiedHeight;     //!< height of the last block notified
+    int nLastBatchBlocks;    //!< blocks connected and disconnected in the last cycle
+    int64_t nLastCycleMicros; //!< time the last cycle took to notify its blocks
+    int64_t nWaitMicros;     //!< total time block connection waited for the notifications
+
+    CWalletNotifyStats() : fRunning(false), nNotifiedHeight(-1), nLastBatchBlocks(0), nLastCycleMicros(0), nWaitMicros(0) {}
+};
+
+CWalletNotifyStats GetWalletNotifyStats();
+
+/** Progress updates from ThreadNotifyWallets, which LimitWalletNotifyLag waits on */
+void WalletNotifyStarted(int nNotifiedHeight);
+void WalletNotifyCycleDone(int nNotifiedHeight, int nBatchBlocks, int64_t nCycleMicros);
+void WalletNotifyStopped();
+
+/**
+ * Wait while the wallet notifications are more than MAX_WALLET_NOTIFY_LAG
+ * blocks behind nHeight, so that they keep up with the chain. Must not be
+ * called with cs_main held.
+ */
+void LimitWalletNotifyLag(int nHeight);
+
 void ThreadNotifyWallets(CBlockIndex *pindexLastTip);
 
 #endif // BITCOIN_VALIDATIONINTERFACE_H
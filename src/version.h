@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 170013;
+static const int PROTOCOL_VERSION = 170015;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -33,4 +33,13 @@ static const int MEMPOOL_GD_VERSION = 60002;
 //! "filter*" commands are disabled without NODE_BLOOM after and including this version
 static const int NO_BLOOM_VERSION = 170004;
 
+//! "sendheaders" command and announcing blocks with headers starts with this version
+static const int SENDHEADERS_VERSION = 170014;
+
+//! short-id-based block download (BIP 152 compact blocks) starts with this version
+static const int SHORT_IDS_BLOCKS_VERSION = 170014;
+
+//! "sendtxrcncl" and transaction reconciliation start with this version
+static const int TXRECONCILIATION_VERSION = 170015;
+
 #endif // BITCOIN_VERSION_H
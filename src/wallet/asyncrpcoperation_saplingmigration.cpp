@@ -15,7 +15,10 @@
 const CAmount FEE = 10000;
 const int MIGRATION_EXPIRY_DELTA = 450;
 
-AsyncRPCOperation_saplingmigration::AsyncRPCOperation_saplingmigration(int targetHeight) : targetHeight_(targetHeight) {}
+AsyncRPCOperation_saplingmigration::AsyncRPCOperation_saplingmigration(int targetHeight) : targetHeight_(targetHeight) {
+    // Background migration should not delay user requests
+    set_priority(OperationPriority::LOW);
+}
 
 AsyncRPCOperation_saplingmigration::~AsyncRPCOperation_saplingmigration() {}
 
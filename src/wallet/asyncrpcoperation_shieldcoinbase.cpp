@@ -67,6 +67,9 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
 {
     assert(contextualTx.nVersion >= 2);  // transaction format version must support vJoinSplit
 
+    // Shielding is quick, don't leave it waiting behind large merges
+    set_priority(OperationPriority::HIGH);
+
     if (fee < 0 || fee > MAX_MONEY) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Fee is out of range");
     }
@@ -0,0 +1,109 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_WALLET_BALANCETALLY_H
+#define BITCOIN_WALLET_BALANCETALLY_H
+
+#include "amount.h"
+
+#include <map>
+
+/**
+ * Running sums of unspent wallet credit, per address and in total, bucketed
+ * by the height of the block that confirmed the credit.
+ *
+ * Depth filters translate into height ranges against the current tip
+ * (depth = tip - height + 1), so the sums stay valid as the chain advances
+ * and only the buckets near the tip need to be visited for the usual
+ * small minimum depths.
+ */
+template <typename Address>
+class CBalanceTally
+{
+private:
+    struct Sums
+    {
+        CAmount nTotal;
+        std::map<int, CAmount> mapHeight;
+
+        Sums() : nTotal(0) {}
+
+        void Add(int nHeight, CAmount nValue)
+        {
+            nTotal += nValue;
+            CAmount& nBucket = mapHeight[nHeight];
+            nBucket += nValue;
+            if (nBucket == 0)
+                mapHeight.erase(nHeight);
+        }
+
+        /** Sum of all buckets with nMinHeight <= height <= nMaxHeight. */
+        CAmount Get(int nMinHeight, int nMaxHeight) const
+        {
+            if (mapHeight.empty() || nMinHeight > nMaxHeight)
+                return 0;
+
+            bool fAllBelow = nMaxHeight >= mapHeight.rbegin()->first;
+            bool fAllAbove = nMinHeight <= mapHeight.begin()->first;
+            if (fAllBelow && fAllAbove)
+                return nTotal;
+
+            CAmount nSum = 0;
+            if (fAllAbove) {
+                // Subtract the (usually few) buckets above the range.
+                for (auto it = mapHeight.rbegin(); it != mapHeight.rend() && it->first > nMaxHeight; ++it)
+                    nSum += it->second;
+                return nTotal - nSum;
+            }
+
+            auto itEnd = mapHeight.upper_bound(nMaxHeight);
+            for (auto it = mapHeight.lower_bound(nMinHeight); it != itEnd; ++it)
+                nSum += it->second;
+            return nSum;
+        }
+    };
+
+    Sums all;
+    std::map<Address, Sums> mapAddress;
+
+public:
+    void Add(const Address& address, int nHeight, CAmount nValue)
+    {
+        all.Add(nHeight, nValue);
+        Sums& sums = mapAddress[address];
+        sums.Add(nHeight, nValue);
+        if (sums.mapHeight.empty())
+            mapAddress.erase(address);
+    }
+
+    void Remove(const Address& address, int nHeight, CAmount nValue)
+    {
+        Add(address, nHeight, -nValue);
+    }
+
+    /** Total credit confirmed between nMinHeight and nMaxHeight inclusive. */
+    CAmount Get(int nMinHeight, int nMaxHeight) const
+    {
+        return all.Get(nMinHeight, nMaxHeight);
+    }
+
+    /** Credit to one address confirmed between nMinHeight and nMaxHeight inclusive. */
+    CAmount Get(const Address& address, int nMinHeight, int nMaxHeight) const
+    {
+        typename std::map<Address, Sums>::const_iterator it = mapAddress.find(address);
+        if (it == mapAddress.end())
+            return 0;
+        return it->second.Get(nMinHeight, nMaxHeight);
+    }
+
+    size_t AddressCount() const { return mapAddress.size(); }
+
+    void Clear()
+    {
+        all = Sums();
+        mapAddress.clear();
+    }
+};
+
+#endif // BITCOIN_WALLET_BALANCETALLY_H
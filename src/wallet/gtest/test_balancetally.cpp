@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include "wallet/balancetally.h"
+
+#include <string>
+
+TEST(BalanceTallyTest, EmptyTally) {
+    CBalanceTally<std::string> tally;
+    EXPECT_EQ(0, tally.Get(0, 100));
+    EXPECT_EQ(0, tally.Get("a", 0, 100));
+    EXPECT_EQ(0, tally.AddressCount());
+}
+
+TEST(BalanceTallyTest, HeightRanges) {
+    CBalanceTally<std::string> tally;
+    tally.Add("a", 10, 5);
+    tally.Add("a", 20, 7);
+    tally.Add("b", 15, 11);
+    tally.Add("b", 30, 13);
+
+    EXPECT_EQ(36, tally.Get(0, 30));
+    EXPECT_EQ(36, tally.Get(-1000, 1000));
+    // Everything below a height (minimum depth filter)
+    EXPECT_EQ(23, tally.Get(0, 20));
+    EXPECT_EQ(5, tally.Get(0, 14));
+    // Everything above a height (maximum depth filter)
+    EXPECT_EQ(31, tally.Get(15, 1000));
+    // Bounded on both sides
+    EXPECT_EQ(18, tally.Get(11, 20));
+    EXPECT_EQ(0, tally.Get(21, 29));
+    EXPECT_EQ(0, tally.Get(20, 19));
+
+    EXPECT_EQ(12, tally.Get("a", 0, 30));
+    EXPECT_EQ(5, tally.Get("a", 0, 19));
+    EXPECT_EQ(13, tally.Get("b", 16, 30));
+    EXPECT_EQ(0, tally.Get("c", 0, 30));
+    EXPECT_EQ(2, tally.AddressCount());
+}
+
+TEST(BalanceTallyTest, RemoveRestoresState) {
+    CBalanceTally<std::string> tally;
+    tally.Add("a", 10, 5);
+    tally.Add("a", 10, 6);
+    tally.Add("b", 12, 1);
+    EXPECT_EQ(11, tally.Get("a", 10, 10));
+
+    tally.Remove("a", 10, 5);
+    EXPECT_EQ(6, tally.Get("a", 0, 100));
+    EXPECT_EQ(7, tally.Get(0, 100));
+
+    tally.Remove("a", 10, 6);
+    EXPECT_EQ(0, tally.Get("a", 0, 100));
+    EXPECT_EQ(1, tally.AddressCount());
+    EXPECT_EQ(1, tally.Get(0, 11) + tally.Get(12, 12));
+
+    tally.Clear();
+    EXPECT_EQ(0, tally.Get(0, 100));
+    EXPECT_EQ(0, tally.AddressCount());
+}
@@ -59,6 +59,9 @@ public:
     void SetBestChain(MockWalletDB& walletdb, const CBlockLocator& loc) {
         CWallet::SetBestChainINTERNAL(walletdb, loc);
     }
+    void MarkWalletTxDirty(const uint256& hash) {
+        CWallet::MarkWalletTxDirty(hash);
+    }
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx) {
         return CWallet::UpdatedNoteData(wtxIn, wtx);
     }
@@ -1553,6 +1556,7 @@ TEST(WalletTests, WriteWitnessCache) {
     noteData[jsoutpt] = nd;
     wtx.SetSproutNoteData(noteData);
     wallet.AddToWallet(wtx, true, NULL);
+    wallet.MarkWalletTxDirty(wtx.GetHash());
 
     // TxnBegin fails
     EXPECT_CALL(walletdb, TxnBegin())
@@ -1620,7 +1624,7 @@ TEST(WalletTests, WriteWitnessCache) {
     wallet.SetBestChain(walletdb, loc);
 }
 
-TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
+TEST(WalletTests, SetBestChainWritesOnlyDirtyTxs) {
     SelectParams(CBaseChainParams::REGTEST);
 
     TestWallet wallet;
@@ -1681,6 +1685,10 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     CWalletTx wtxSaplingTransparent {nullptr, mtxSaplingTransparent};
     wallet.AddToWallet(wtxSaplingTransparent, true, nullptr);
 
+    // Only the transactions whose note data changed are written
+    wallet.MarkWalletTxDirty(wtxSprout.GetHash());
+    wallet.MarkWalletTxDirty(wtxSapling.GetHash());
+
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(true));
     EXPECT_CALL(walletdb, WriteTx(wtxTransparent.GetHash(), wtxTransparent))
@@ -1700,6 +1708,85 @@ TEST(WalletTests, SetBestChainIgnoresTxsWithoutShieldedData) {
     EXPECT_CALL(walletdb, TxnCommit())
         .WillOnce(Return(true));
     wallet.SetBestChain(walletdb, loc);
+
+    // Nothing changed since the last write
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(WalletTests, ChainTipWritesOnlyChangedTxs) {
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(::testing::_, ::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+
+    // A transaction mined in the first block, whose witnesses move with
+    // every block
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto outpts = CreateValidBlock(wallet, sk, index1, block1, sproutTree, saplingTree);
+    uint256 hashMined = outpts.first.hash;
+
+    // A transaction not mined yet, whose notes have no witnesses
+    auto wtx = GetValidSproutReceive(sk, 10, true);
+    auto note = GetSproutNote(sk, wtx, 0, 1);
+    mapSproutNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+    SproutNoteData nd {sk.address(), note.nullifier(sk)};
+    noteData[jsoutpt] = nd;
+    wtx.SetSproutNoteData(noteData);
+    SetSaplingNoteData(wtx);
+    wallet.AddToWallet(wtx, true, NULL);
+    wallet.MarkWalletTxDirty(wtx.GetHash());
+    wallet.SetBestChain(walletdb, loc);
+
+    // Connecting a block only rewrites the transaction whose witnesses moved
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, sproutTree, saplingTree);
+    EXPECT_EQ(-1, wallet.mapWallet[wtx.GetHash()].mapSproutNoteData[jsoutpt].witnessHeight);
+    EXPECT_CALL(walletdb, WriteTx(hashMined, ::testing::_))
+        .Times(1).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+
+    // So does disconnecting it
+    wallet.DecrementNoteWitnesses(&index2);
+    EXPECT_EQ(-1, wallet.mapWallet[wtx.GetHash()].mapSproutNoteData[jsoutpt].witnessHeight);
+    EXPECT_CALL(walletdb, WriteTx(hashMined, ::testing::_))
+        .Times(1).WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
 }
 
 TEST(WalletTests, UpdateSproutNullifierNoteMap) {
@@ -0,0 +1,585 @@
+#include <gtest/gtest.h>
+
+#include "consensus/upgrades.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "utiltest.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+
+#include <boost/optional.hpp>
+
+/**
+ * A chain of fake blocks, connected to and disconnected from the wallet the
+ * way ConnectTip and DisconnectTip notify it.
+ */
+class FakeChain {
+    struct FakeBlock {
+        CBlock block;
+        uint256 hash;
+        std::unique_ptr<CBlockIndex> pindex;
+        SproutMerkleTree sproutTree;
+        SaplingMerkleTree saplingTree;
+    };
+    std::vector<std::unique_ptr<FakeBlock>> vBlocks;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+public:
+    ~FakeChain() {
+        chainActive.SetTip(NULL);
+        for (const auto& b : vBlocks) {
+            mapBlockIndex.erase(b->hash);
+        }
+    }
+
+    // Mine the transactions in a new tip block and hand them to the wallet
+    void Mine(CWallet& wallet, const std::vector<CWalletTx*>& vtx) {
+        std::unique_ptr<FakeBlock> b(new FakeBlock());
+        for (const CWalletTx* wtx : vtx) {
+            b->block.vtx.push_back(*wtx);
+        }
+        if (!vBlocks.empty()) {
+            b->block.hashPrevBlock = vBlocks.back()->hash;
+        }
+        b->block.hashMerkleRoot = b->block.BuildMerkleTree();
+        b->hash = b->block.GetHash();
+        b->pindex.reset(new CBlockIndex(b->block));
+        b->pindex->phashBlock = &b->hash;
+        b->pindex->pprev = vBlocks.empty() ? NULL : vBlocks.back()->pindex.get();
+        b->pindex->nHeight = vBlocks.size();
+        b->sproutTree = sproutTree;
+        b->saplingTree = saplingTree;
+        mapBlockIndex.insert(std::make_pair(b->hash, b->pindex.get()));
+        chainActive.SetTip(b->pindex.get());
+
+        for (CWalletTx* wtx : vtx) {
+            wtx->SetMerkleBranch(b->block);
+            wallet.AddToWallet(*wtx, true, NULL);
+            for (const JSDescription& jsdesc : wtx->vJoinSplit) {
+                for (const uint256& commitment : jsdesc.commitments) {
+                    sproutTree.append(commitment);
+                }
+            }
+            for (const OutputDescription& output : wtx->vShieldedOutput) {
+                saplingTree.append(output.cmu);
+            }
+        }
+        wallet.ChainTip(b->pindex.get(), &b->block, std::make_pair(b->sproutTree, b->saplingTree));
+        vBlocks.push_back(std::move(b));
+    }
+
+    // Disconnect the tip block; its transactions are left unconfirmed
+    void Disconnect(CWallet& wallet) {
+        std::unique_ptr<FakeBlock> b(std::move(vBlocks.back()));
+        vBlocks.pop_back();
+        chainActive.SetTip(b->pindex->pprev);
+        wallet.ChainTip(b->pindex.get(), &b->block, boost::none);
+        sproutTree = b->sproutTree;
+        saplingTree = b->saplingTree;
+        mapBlockIndex.erase(b->hash);
+    }
+};
+
+static CWalletTx GetTransparentReceive(const CWallet& wallet, const std::vector<CTxOut>& vout) {
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout = vout;
+    return CWalletTx(&wallet, mtx);
+}
+
+static CWalletTx GetTransparentSpend(const CWallet& wallet, const COutPoint& prevout, const std::vector<CTxOut>& vout) {
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = prevout;
+    mtx.vout = vout;
+    return CWalletTx(&wallet, mtx);
+}
+
+static CWalletTx GetSproutReceiveWithNoteData(const libzcash::SproutSpendingKey& sk, CAmount value,
+                                              libzcash::SproutNote& note) {
+    auto wtx = GetValidSproutReceive(sk, value, true);
+    note = GetSproutNote(sk, wtx, 0, 1);
+    mapSproutNoteData_t noteData;
+    noteData[JSOutPoint {wtx.GetHash(), 0, 1}] = SproutNoteData {sk.address(), note.nullifier(sk)};
+    wtx.SetSproutNoteData(noteData);
+    return wtx;
+}
+
+// AvailableCoins as it was before the unspent index: every wallet
+// transaction is visited.
+static void ScanAvailableCoins(const CWallet& wallet, std::vector<COutput>& vCoins,
+                               bool fOnlyConfirmed, bool fIncludeCoinBase) {
+    vCoins.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet) {
+        const CWalletTx* pcoin = &item.second;
+        if (!CheckFinalTx(*pcoin) || (fOnlyConfirmed && !pcoin->IsTrusted()))
+            continue;
+        if (pcoin->IsCoinBase() && (!fIncludeCoinBase || pcoin->GetBlocksToMaturity() > 0))
+            continue;
+        int nDepth = pcoin->GetDepthInMainChain();
+        if (nDepth < 0)
+            continue;
+        for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            isminetype mine = wallet.IsMine(pcoin->vout[i]);
+            if (!wallet.IsSpent(item.first, i) && mine != ISMINE_NO &&
+                !wallet.IsLockedCoin(item.first, i) && pcoin->vout[i].nValue > 0)
+                vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+        }
+    }
+}
+
+// Unspent notes, as GetFilteredNotes returns them when it also returns
+// spent ones and so visits every wallet transaction.
+static void ScanUnspentNotes(CWallet& wallet,
+                             std::vector<SproutNoteEntry>& sproutEntries,
+                             std::vector<SaplingNoteEntry>& saplingEntries,
+                             std::set<libzcash::PaymentAddress>& filterAddresses,
+                             int minDepth, int maxDepth, bool requireSpendingKey) {
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, false, requireSpendingKey);
+    sproutEntries.erase(std::remove_if(sproutEntries.begin(), sproutEntries.end(),
+        [&wallet](const SproutNoteEntry& entry) {
+            auto nullifier = wallet.mapWallet.at(entry.jsop.hash).mapSproutNoteData.at(entry.jsop).nullifier;
+            return nullifier && wallet.IsSproutSpent(*nullifier);
+        }), sproutEntries.end());
+    saplingEntries.erase(std::remove_if(saplingEntries.begin(), saplingEntries.end(),
+        [&wallet](const SaplingNoteEntry& entry) {
+            auto nullifier = wallet.mapWallet.at(entry.op.hash).mapSaplingNoteData.at(entry.op).nullifier;
+            return nullifier && wallet.IsSaplingSpent(*nullifier);
+        }), saplingEntries.end());
+}
+
+static std::vector<std::string> DescribeCoins(const std::vector<COutput>& vCoins) {
+    std::vector<std::string> result;
+    for (const COutput& out : vCoins) {
+        result.push_back(out.ToString() + (out.fSpendable ? " spendable" : ""));
+    }
+    return result;
+}
+
+static std::vector<std::string> DescribeNotes(const std::vector<SproutNoteEntry>& sproutEntries,
+                                              const std::vector<SaplingNoteEntry>& saplingEntries) {
+    std::vector<std::string> result;
+    for (const SproutNoteEntry& entry : sproutEntries) {
+        result.push_back(strprintf("%s %d", entry.jsop.ToString(), entry.confirmations));
+    }
+    for (const SaplingNoteEntry& entry : saplingEntries) {
+        result.push_back(strprintf("%s %d", entry.op.ToString(), entry.confirmations));
+    }
+    return result;
+}
+
+// Check coin and note selection, which are served from the unspent index,
+// against a scan of every wallet transaction.
+static void ExpectIndexMatchesScan(CWallet& wallet, const std::vector<CTxDestination>& vDest,
+                                   const libzcash::SproutPaymentAddress& zaddr) {
+    std::vector<COutput> vCoins, vExpected;
+    for (bool fOnlyConfirmed : {true, false}) {
+        for (bool fIncludeCoinBase : {true, false}) {
+            SCOPED_TRACE(strprintf("fOnlyConfirmed=%d fIncludeCoinBase=%d", fOnlyConfirmed, fIncludeCoinBase));
+            wallet.AvailableCoins(vCoins, fOnlyConfirmed, NULL, false, fIncludeCoinBase);
+            ScanAvailableCoins(wallet, vExpected, fOnlyConfirmed, fIncludeCoinBase);
+            EXPECT_EQ(DescribeCoins(vExpected), DescribeCoins(vCoins));
+
+            for (const CTxDestination& dest : vDest) {
+                wallet.AvailableCoinsForDestination(vCoins, dest, fOnlyConfirmed, false, fIncludeCoinBase);
+                std::vector<COutput> vExpectedDest;
+                for (const COutput& out : vExpected) {
+                    CTxDestination address;
+                    if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address) && address == dest)
+                        vExpectedDest.push_back(out);
+                }
+                std::stable_sort(vExpectedDest.begin(), vExpectedDest.end(), [](const COutput& a, const COutput& b) {
+                    return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+                });
+                EXPECT_EQ(DescribeCoins(vExpectedDest), DescribeCoins(vCoins));
+            }
+        }
+    }
+
+    // Deterministic selections (exact matches, or every coin) are unchanged
+    wallet.AvailableCoins(vCoins);
+    ScanAvailableCoins(wallet, vExpected, true, true);
+    std::vector<CAmount> vTargets;
+    CAmount nTotal = 0;
+    for (const COutput& out : vExpected) {
+        vTargets.push_back(out.tx->vout[out.i].nValue);
+        nTotal += out.tx->vout[out.i].nValue;
+    }
+    vTargets.push_back(nTotal);
+    for (CAmount nTarget : vTargets) {
+        std::set<std::pair<const CWalletTx*, unsigned int>> setCoins, setExpected;
+        CAmount nValue = 0, nExpectedValue = 0;
+        bool fExpected = wallet.SelectCoinsMinConf(nTarget, 1, 1, vExpected, setExpected, nExpectedValue);
+        EXPECT_EQ(fExpected, wallet.SelectCoinsMinConf(nTarget, 1, 1, vCoins, setCoins, nValue));
+        EXPECT_EQ(setExpected, setCoins);
+        EXPECT_EQ(nExpectedValue, nValue);
+    }
+
+    std::set<libzcash::PaymentAddress> noFilter, zaddrFilter {zaddr};
+    for (std::set<libzcash::PaymentAddress>* filter : {&noFilter, &zaddrFilter}) {
+        for (int minDepth : {0, 1, 2}) {
+            SCOPED_TRACE(strprintf("minDepth=%d filtered=%d", minDepth, !filter->empty()));
+            std::vector<SproutNoteEntry> sproutEntries, sproutExpected;
+            std::vector<SaplingNoteEntry> saplingEntries, saplingExpected;
+            wallet.GetFilteredNotes(sproutEntries, saplingEntries, *filter, minDepth, INT_MAX, true);
+            ScanUnspentNotes(wallet, sproutExpected, saplingExpected, *filter, minDepth, INT_MAX, true);
+            EXPECT_EQ(DescribeNotes(sproutExpected, saplingExpected), DescribeNotes(sproutEntries, saplingEntries));
+        }
+    }
+}
+
+// Check the balances, which are served from the balance tallies, against
+// the sums over every wallet transaction they replaced.
+static void ExpectBalancesMatchScan(CWallet& wallet, const std::vector<CTxDestination>& vDest,
+                                    const std::vector<libzcash::PaymentAddress>& vZaddr) {
+    CAmount nBalance = 0, nUnconfirmed = 0, nImmature = 0;
+    CAmount nWatchOnly = 0, nUnconfirmedWatchOnly = 0, nImmatureWatchOnly = 0;
+    for (const std::pair<const uint256, CWalletTx>& item : wallet.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (wtx.IsTrusted()) {
+            nBalance += wtx.GetAvailableCredit(false);
+            nWatchOnly += wtx.GetAvailableWatchOnlyCredit(false);
+        }
+        if (!CheckFinalTx(wtx) || (!wtx.IsTrusted() && wtx.GetDepthInMainChain() == 0)) {
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+            nUnconfirmedWatchOnly += wtx.GetAvailableWatchOnlyCredit(false);
+        }
+        nImmature += wtx.GetImmatureCredit(false);
+        nImmatureWatchOnly += wtx.GetImmatureWatchOnlyCredit(false);
+    }
+    EXPECT_EQ(nBalance, wallet.GetBalance());
+    EXPECT_EQ(nUnconfirmed, wallet.GetUnconfirmedBalance());
+    EXPECT_EQ(nImmature, wallet.GetImmatureBalance());
+    EXPECT_EQ(nWatchOnly, wallet.GetWatchOnlyBalance());
+    EXPECT_EQ(nUnconfirmedWatchOnly, wallet.GetUnconfirmedWatchOnlyBalance());
+    EXPECT_EQ(nImmatureWatchOnly, wallet.GetImmatureWatchOnlyBalance());
+
+    // getbalance and z_getbalance for a taddr summed AvailableCoins
+    std::vector<COutput> vCoins;
+    ScanAvailableCoins(wallet, vCoins, false, true);
+    for (int minDepth : {0, 1, 2, 6}) {
+        for (bool ignoreUnspendable : {true, false}) {
+            SCOPED_TRACE(strprintf("minDepth=%d ignoreUnspendable=%d", minDepth, ignoreUnspendable));
+            CAmount nTotal = 0;
+            std::map<CTxDestination, CAmount> mapTotals;
+            for (const COutput& out : vCoins) {
+                if (out.nDepth < minDepth || (ignoreUnspendable && !out.fSpendable))
+                    continue;
+                nTotal += out.tx->vout[out.i].nValue;
+                CTxDestination address;
+                if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+                    mapTotals[address] += out.tx->vout[out.i].nValue;
+            }
+            EXPECT_EQ(nTotal, wallet.GetTransparentBalance(NULL, minDepth, ignoreUnspendable));
+            for (const CTxDestination& dest : vDest) {
+                EXPECT_EQ(mapTotals[dest], wallet.GetTransparentBalance(&dest, minDepth, ignoreUnspendable));
+            }
+        }
+    }
+
+    // z_getbalance for a zaddr and z_gettotalbalance summed GetFilteredNotes
+    std::vector<std::pair<int, int>> vDepths {{0, INT_MAX}, {1, INT_MAX}, {2, INT_MAX}, {1, 1}, {0, 0}};
+    for (const std::pair<int, int>& depths : vDepths) {
+        for (bool ignoreUnspendable : {true, false}) {
+            SCOPED_TRACE(strprintf("minDepth=%d maxDepth=%d ignoreUnspendable=%d", depths.first, depths.second, ignoreUnspendable));
+            std::set<libzcash::PaymentAddress> noFilter;
+            std::vector<SproutNoteEntry> sproutEntries;
+            std::vector<SaplingNoteEntry> saplingEntries;
+            ScanUnspentNotes(wallet, sproutEntries, saplingEntries, noFilter, depths.first, depths.second, ignoreUnspendable);
+            CAmount nTotal = 0;
+            std::map<libzcash::PaymentAddress, CAmount> mapTotals;
+            for (const SproutNoteEntry& entry : sproutEntries) {
+                nTotal += entry.note.value();
+                mapTotals[libzcash::PaymentAddress(entry.address)] += entry.note.value();
+            }
+            for (const SaplingNoteEntry& entry : saplingEntries) {
+                nTotal += entry.note.value();
+                mapTotals[libzcash::PaymentAddress(entry.address)] += entry.note.value();
+            }
+            EXPECT_EQ(nTotal, wallet.GetShieldedBalance(NULL, depths.first, depths.second, ignoreUnspendable));
+            for (const libzcash::PaymentAddress& zaddr : vZaddr) {
+                EXPECT_EQ(mapTotals[zaddr], wallet.GetShieldedBalance(&zaddr, depths.first, depths.second, ignoreUnspendable));
+            }
+        }
+    }
+}
+
+TEST(WalletBalanceTests, UnspentIndexMatchesWalletScan) {
+    RegtestActivateSapling();
+
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    CKey key1 = AddTestCKeyToKeyStore(wallet);
+    CKey key2;
+    key2.MakeNewKey(true);
+    wallet.AddKey(key2);
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CTxDestination dest1 = key1.GetPubKey().GetID();
+    CTxDestination dest2 = key2.GetPubKey().GetID();
+    CScript script1 = GetScriptForDestination(dest1);
+    CScript script2 = GetScriptForDestination(dest2);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    std::vector<CTxDestination> vDest {dest1, dest2};
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    FakeChain chain;
+
+    // An immature coinbase, transparent coins and notes
+    CMutableTransaction mtxCoinBase;
+    mtxCoinBase.vin.resize(1);
+    mtxCoinBase.vin[0].prevout.SetNull();
+    mtxCoinBase.vout.push_back(CTxOut(40 * COIN, script2));
+    CWalletTx wtxCoinBase(&wallet, mtxCoinBase);
+    CWalletTx wtx1 = GetTransparentReceive(wallet, {
+        CTxOut(10 * COIN, script1), CTxOut(30 * COIN, script1), CTxOut(20 * COIN, script2), CTxOut(7 * COIN, scriptOther)});
+    libzcash::SproutNote note1, note2;
+    CWalletTx wtxNote1 = GetSproutReceiveWithNoteData(sk, 10, note1);
+    chain.Mine(wallet, {&wtxCoinBase, &wtx1, &wtxNote1});
+
+    CWalletTx wtx2 = GetTransparentReceive(wallet, {CTxOut(50 * COIN, script1)});
+    CWalletTx wtxNote2 = GetSproutReceiveWithNoteData(sk, 20, note2);
+    chain.Mine(wallet, {&wtx2, &wtxNote2});
+    {
+        SCOPED_TRACE("received");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // A spend that is neither mined nor in the mempool (as when abandoned)
+    // leaves its inputs unspent
+    CWalletTx wtxSpend = GetTransparentSpend(wallet, COutPoint(wtx1.GetHash(), 0), {
+        CTxOut(4 * COIN, scriptOther), CTxOut(5 * COIN, script2)});
+    wallet.AddToWallet(wtxSpend, true, NULL);
+    EXPECT_FALSE(wallet.IsSpent(wtx1.GetHash(), 0));
+    {
+        SCOPED_TRACE("unconfirmed spend outside the mempool");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // In the mempool it spends them, and its change can be selected
+    mempool.addUnchecked(wtxSpend.GetHash(), CTxMemPoolEntry(wtxSpend, 0, 0, 0.0, 1, true, false, SPROUT_BRANCH_ID));
+    wallet.AddToWallet(wtxSpend, true, NULL);
+    EXPECT_TRUE(wallet.IsSpent(wtx1.GetHash(), 0));
+    {
+        SCOPED_TRACE("spend in the mempool");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Leaving the mempool doesn't notify the wallet
+    std::list<CTransaction> removed;
+    mempool.remove(wtxSpend, removed);
+    EXPECT_FALSE(wallet.IsSpent(wtx1.GetHash(), 0));
+    {
+        SCOPED_TRACE("spend evicted from the mempool");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Mined spends of a coin and a note
+    CWalletTx wtxNoteSpend = GetValidSproutSpend(sk, note1, 5);
+    chain.Mine(wallet, {&wtxSpend, &wtxNoteSpend});
+    EXPECT_TRUE(wallet.IsSpent(wtx1.GetHash(), 0));
+    EXPECT_TRUE(wallet.IsSproutSpent(note1.nullifier(sk)));
+    {
+        SCOPED_TRACE("mined spends");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Locked coins and notes are not selected until unlocked
+    COutPoint lockedCoin(wtx2.GetHash(), 0);
+    JSOutPoint lockedNote {wtxNote2.GetHash(), 0, 1};
+    wallet.LockCoin(lockedCoin);
+    wallet.LockNote(lockedNote);
+    {
+        SCOPED_TRACE("locked");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+    wallet.UnlockCoin(lockedCoin);
+    wallet.UnlockNote(lockedNote);
+    {
+        SCOPED_TRACE("unlocked");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Disconnecting the spends makes their inputs unspent again
+    chain.Disconnect(wallet);
+    EXPECT_FALSE(wallet.IsSpent(wtx1.GetHash(), 0));
+    EXPECT_FALSE(wallet.IsSproutSpent(note1.nullifier(sk)));
+    {
+        SCOPED_TRACE("spends disconnected");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Disconnecting a block of receives removes its coins and notes
+    chain.Disconnect(wallet);
+    {
+        SCOPED_TRACE("receives disconnected");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // The other branch mines them again, with the spends in a later block
+    chain.Mine(wallet, {&wtx2, &wtxNote2});
+    chain.Mine(wallet, {});
+    chain.Mine(wallet, {&wtxSpend, &wtxNoteSpend});
+    {
+        SCOPED_TRACE("reorganized");
+        ExpectIndexMatchesScan(wallet, vDest, sk.address());
+    }
+
+    // Tear down
+    mempool.clear();
+    RegtestDeactivateSapling();
+}
+
+TEST(WalletBalanceTests, BalancesMatchWalletScan) {
+    RegtestActivateSapling();
+
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    CKey key = AddTestCKeyToKeyStore(wallet);
+    CKey keyWatched;
+    keyWatched.MakeNewKey(true);
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CTxDestination dest = key.GetPubKey().GetID();
+    CTxDestination destWatched = keyWatched.GetPubKey().GetID();
+    CScript script = GetScriptForDestination(dest);
+    CScript scriptWatched = GetScriptForDestination(destWatched);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    wallet.AddWatchOnly(scriptWatched);
+    std::vector<CTxDestination> vDest {dest, destWatched};
+
+    // Notes to a spending key and to a viewing key
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+    auto skViewed = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutViewingKey(skViewed.viewing_key());
+    std::vector<libzcash::PaymentAddress> vZaddr {sk.address(), skViewed.address()};
+
+    FakeChain chain;
+
+    CMutableTransaction mtxCoinBase;
+    mtxCoinBase.vin.resize(1);
+    mtxCoinBase.vin[0].prevout.SetNull();
+    mtxCoinBase.vout.push_back(CTxOut(40 * COIN, script));
+    mtxCoinBase.vout.push_back(CTxOut(3 * COIN, scriptWatched));
+    CWalletTx wtxCoinBase(&wallet, mtxCoinBase);
+    CWalletTx wtx1 = GetTransparentReceive(wallet, {
+        CTxOut(10 * COIN, script), CTxOut(20 * COIN, scriptWatched), CTxOut(7 * COIN, scriptOther)});
+    libzcash::SproutNote note1, note2, noteViewed;
+    CWalletTx wtxNote1 = GetSproutReceiveWithNoteData(sk, 10, note1);
+    CWalletTx wtxNoteViewed = GetSproutReceiveWithNoteData(skViewed, 15, noteViewed);
+    chain.Mine(wallet, {&wtxCoinBase, &wtx1, &wtxNote1, &wtxNoteViewed});
+
+    CWalletTx wtx2 = GetTransparentReceive(wallet, {CTxOut(50 * COIN, script)});
+    CWalletTx wtxNote2 = GetSproutReceiveWithNoteData(sk, 20, note2);
+    chain.Mine(wallet, {&wtx2, &wtxNote2});
+    {
+        SCOPED_TRACE("received");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+
+    // A spend with change, in the mempool, evicted from it, and mined
+    CWalletTx wtxSpend = GetTransparentSpend(wallet, COutPoint(wtx1.GetHash(), 0), {
+        CTxOut(4 * COIN, scriptOther), CTxOut(5 * COIN, script)});
+    mempool.addUnchecked(wtxSpend.GetHash(), CTxMemPoolEntry(wtxSpend, 0, 0, 0.0, 1, true, false, SPROUT_BRANCH_ID));
+    wallet.AddToWallet(wtxSpend, true, NULL);
+    {
+        SCOPED_TRACE("spend in the mempool");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    std::list<CTransaction> removed;
+    mempool.remove(wtxSpend, removed);
+    {
+        SCOPED_TRACE("spend evicted from the mempool");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    CWalletTx wtxNoteSpend = GetValidSproutSpend(sk, note1, 5);
+    chain.Mine(wallet, {&wtxSpend, &wtxNoteSpend});
+    {
+        SCOPED_TRACE("mined spends");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+
+    // Locked coins and notes
+    COutPoint lockedChange(wtxSpend.GetHash(), 1);
+    COutPoint lockedWatched(wtx1.GetHash(), 1);
+    JSOutPoint lockedNote {wtxNote2.GetHash(), 0, 1};
+    wallet.LockCoin(lockedChange);
+    wallet.LockCoin(lockedWatched);
+    wallet.LockNote(lockedNote);
+    {
+        SCOPED_TRACE("locked");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    wallet.UnlockCoin(lockedChange);
+    wallet.UnlockCoin(lockedWatched);
+    wallet.UnlockNote(lockedNote);
+    {
+        SCOPED_TRACE("unlocked");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+
+    // A reorganization that mines the spends a block later
+    chain.Disconnect(wallet);
+    {
+        SCOPED_TRACE("spends disconnected");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    chain.Disconnect(wallet);
+    {
+        SCOPED_TRACE("receives disconnected");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    chain.Mine(wallet, {&wtx2, &wtxNote2});
+    chain.Mine(wallet, {});
+    chain.Mine(wallet, {&wtxSpend, &wtxNoteSpend});
+    {
+        SCOPED_TRACE("reorganized");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+
+    // The coinbase matures, and is immature again once the block that
+    // matured it is disconnected
+    EXPECT_GT(wallet.GetImmatureBalance(), 0);
+    while (wtxCoinBase.GetBlocksToMaturity() > 1) {
+        chain.Mine(wallet, {});
+    }
+    {
+        SCOPED_TRACE("coinbase one block from maturity");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    chain.Mine(wallet, {});
+    EXPECT_EQ(0, wallet.GetImmatureBalance());
+    {
+        SCOPED_TRACE("coinbase mature");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    chain.Disconnect(wallet);
+    EXPECT_GT(wallet.GetImmatureBalance(), 0);
+    {
+        SCOPED_TRACE("coinbase immature again");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+    chain.Mine(wallet, {});
+    chain.Mine(wallet, {});
+    {
+        SCOPED_TRACE("coinbase mature again");
+        ExpectBalancesMatchScan(wallet, vDest, vZaddr);
+    }
+
+    // Tear down
+    mempool.clear();
+    RegtestDeactivateSapling();
+}
@@ -106,7 +106,9 @@ void WalletTxToJSON(const CWalletTx& wtx, UniValue& entry)
     {
         entry.pushKV("blockhash", wtx.hashBlock.GetHex());
         entry.pushKV("blockindex", wtx.nIndex);
-        entry.pushKV("blocktime", mapBlockIndex[wtx.hashBlock]->GetBlockTime());
+        CBlockIndex* pindex = LookupBlockIndex(wtx.hashBlock);
+        if (pindex)
+            entry.pushKV("blocktime", pindex->GetBlockTime());
         entry.pushKV("expiryheight", (int64_t)wtx.nExpiryHeight);
         status = "mined";
     }
@@ -3345,69 +3347,26 @@ UniValue z_listaddresses(const UniValue& params, bool fHelp)
 }
 
 CAmount getBalanceTaddr(std::string transparentAddress, int minDepth=1, bool ignoreUnspendable=true) {
-    std::set<CTxDestination> destinations;
-    vector<COutput> vecOutputs;
-    CAmount balance = 0;
-
-    KeyIO keyIO(Params());
     if (transparentAddress.length() > 0) {
+        KeyIO keyIO(Params());
         CTxDestination taddr = keyIO.DecodeDestination(transparentAddress);
         if (!IsValidDestination(taddr)) {
             throw std::runtime_error("invalid transparent address");
         }
-        destinations.insert(taddr);
+        return pwalletMain->GetTransparentBalance(&taddr, minDepth, ignoreUnspendable);
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true);
-
-    BOOST_FOREACH(const COutput& out, vecOutputs) {
-        if (out.nDepth < minDepth) {
-            continue;
-        }
-
-        if (ignoreUnspendable && !out.fSpendable) {
-            continue;
-        }
-
-        if (destinations.size()) {
-            CTxDestination address;
-            if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-                continue;
-            }
-
-            if (!destinations.count(address)) {
-                continue;
-            }
-        }
-
-        CAmount nValue = out.tx->vout[out.i].nValue;
-        balance += nValue;
-    }
-    return balance;
+    return pwalletMain->GetTransparentBalance(NULL, minDepth, ignoreUnspendable);
 }
 
 CAmount getBalanceZaddr(std::string address, int minDepth, int maxDepth, bool ignoreUnspendable) {
-    CAmount balance = 0;
-    std::vector<SproutNoteEntry> sproutEntries;
-    std::vector<SaplingNoteEntry> saplingEntries;
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    std::set<PaymentAddress> filterAddresses;
     if (address.length() > 0) {
         KeyIO keyIO(Params());
-        filterAddresses.insert(keyIO.DecodePaymentAddress(address));
+        PaymentAddress zaddr = keyIO.DecodePaymentAddress(address);
+        return pwalletMain->GetShieldedBalance(&zaddr, minDepth, maxDepth, ignoreUnspendable);
     }
 
-    pwalletMain->GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, maxDepth, true, ignoreUnspendable);
-    for (auto & entry : sproutEntries) {
-        balance += CAmount(entry.note.value());
-    }
-    for (auto & entry : saplingEntries) {
-        balance += CAmount(entry.note.value());
-    }
-    return balance;
+    return pwalletMain->GetShieldedBalance(NULL, minDepth, maxDepth, ignoreUnspendable);
 }
 
 struct txblock
@@ -3420,8 +3379,9 @@ struct txblock
     {
         if (pwalletMain->mapWallet.count(hash)) {
             const CWalletTx& wtx = pwalletMain->mapWallet[hash];
-            if (!wtx.hashBlock.IsNull())
-                height = mapBlockIndex[wtx.hashBlock]->nHeight;
+            CBlockIndex* pindex = wtx.hashBlock.IsNull() ? NULL : LookupBlockIndex(wtx.hashBlock);
+            if (pindex)
+                height = pindex->nHeight;
             index = wtx.nIndex;
             time = wtx.GetTxTime();
         }
@@ -3947,8 +3907,8 @@ UniValue z_getoperationstatus(const UniValue& params, bool fHelp)
 
 UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedOperations=false)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
+    // The queue has its own lock; operation status doesn't need cs_main or
+    // cs_wallet, so polling never waits on block processing.
     std::set<AsyncRPCOperationId> filter;
     if (params.size()==1) {
         UniValue ids = params[0].get_array();
@@ -3960,29 +3920,28 @@ UniValue z_getoperationstatus_IMPL(const UniValue& params, bool fRemoveFinishedO
 
     UniValue ret(UniValue::VARR);
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::vector<AsyncRPCOperationId> ids = q->getAllOperationIds();
-
-    for (auto id : ids) {
-        if (useFilter && !filter.count(id))
-            continue;
-
-        std::shared_ptr<AsyncRPCOperation> operation = q->getOperationForId(id);
-        if (!operation) {
-            continue;
-            // It's possible that the operation was removed from the internal queue and map during this loop
-            // throw JSONRPCError(RPC_INVALID_PARAMETER, "No operation exists for that id.");
+    std::vector<std::shared_ptr<AsyncRPCOperation>> operations;
+    if (useFilter) {
+        // Look up only the requested ids instead of walking every operation
+        for (const AsyncRPCOperationId& id : filter) {
+            std::shared_ptr<AsyncRPCOperation> operation = q->getOperationForId(id);
+            if (operation) {
+                operations.push_back(operation);
+            }
         }
+    } else {
+        operations = q->getAllOperations();
+    }
 
-        UniValue obj = operation->getStatus();
-        std::string s = obj["status"].get_str();
+    for (const std::shared_ptr<AsyncRPCOperation>& operation : operations) {
         if (fRemoveFinishedOperations) {
             // Caller is only interested in retrieving finished results
-            if ("success"==s || "failed"==s || "cancelled"==s) {
-                ret.push_back(obj);
-                q->popOperationForId(id);
+            if (operation->isFinished()) {
+                ret.push_back(operation->getStatus());
+                q->popOperationForId(operation->getId());
             }
         } else {
-            ret.push_back(obj);
+            ret.push_back(operation->getStatus());
         }
     }
 
@@ -4665,10 +4624,11 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
                 unfinalizedMigratedAmount -= tx.valueBalance;
             }
             // If the transaction is in the mempool it will not be associated with a block yet
-            if (tx.hashBlock.IsNull() || mapBlockIndex[tx.hashBlock] == nullptr) {
+            BlockMap::const_iterator mi = tx.hashBlock.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(tx.hashBlock);
+            if (mi == mapBlockIndex.end() || mi->second == nullptr) {
                 continue;
             }
-            CBlockIndex* blockIndex = mapBlockIndex[tx.hashBlock];
+            CBlockIndex* blockIndex = mi->second;
             //  The value of "time_started" is the earliest Unix timestamp of any known
             // migration transaction involving this wallet; if there is no such transaction,
             // then the field is absent.
@@ -5368,8 +5328,6 @@ UniValue z_listoperationids(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_listoperationids", "")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
     std::string filter;
     bool useFilter = false;
     if (params.size()==1) {
@@ -5379,16 +5337,11 @@ UniValue z_listoperationids(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VARR);
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::vector<AsyncRPCOperationId> ids = q->getAllOperationIds();
-    for (auto id : ids) {
-        std::shared_ptr<AsyncRPCOperation> operation = q->getOperationForId(id);
-        if (!operation) {
-            continue;
-        }
+    for (const std::shared_ptr<AsyncRPCOperation>& operation : q->getAllOperations()) {
         std::string state = operation->getStateAsString();
         if (useFilter && filter.compare(state)!=0)
             continue;
-        ret.push_back(id);
+        ret.push_back(operation->getId());
     }
 
     return ret;
@@ -5454,81 +5407,81 @@ extern UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp); // i
 extern UniValue z_validatepaymentdisclosure(const UniValue &params, bool fHelp);
 
 static const CRPCCommand commands[] =
-{ //  category              name                        actor (function)           okSafeMode
-    //  --------------------- ------------------------    -----------------------    ----------
-    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false },
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true  },
-    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true  },
-    { "wallet",             "backupwallet",             &backupwallet,             true  },
-    { "wallet",             "dumpprivkey",              &dumpprivkey,              true  },
-    { "wallet",             "dumpwallet",               &dumpwallet,               true  },
-    { "wallet",             "encryptwallet",            &encryptwallet,            true  },
-    { "wallet",             "getaccountaddress",        &getaccountaddress,        true  },
-    { "wallet",             "getaccount",               &getaccount,               true  },
-    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true  },
-    { "wallet",             "getbalance",               &getbalance,               false },
-    { "wallet",             "getnewaddress",            &getnewaddress,            true  },
-    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true  },
-    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false },
-    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false },
-    { "wallet",             "gettransaction",           &gettransaction,           false },
-    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false },
-    { "wallet",             "getwalletinfo",            &getwalletinfo,            false },
-    { "wallet",             "importprivkey",            &importprivkey,            true  },
-    { "wallet",             "importwallet",             &importwallet,             true  },
-    { "wallet",             "importaddress",            &importaddress,            true  },
-    { "wallet",             "importpubkey",             &importpubkey,             true  },
-    { "wallet",             "keypoolrefill",            &keypoolrefill,            true  },
-    { "wallet",             "listaccounts",             &listaccounts,             false },
-    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false },
-    { "wallet",             "listlockunspent",          &listlockunspent,          false },
-    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false },
-    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false },
-    { "wallet",             "listsinceblock",           &listsinceblock,           false },
-    { "wallet",             "listtransactions",         &listtransactions,         false },
-    { "wallet",             "listunspent",              &listunspent,              false },
-    { "wallet",             "lockunspent",              &lockunspent,              true  },
-    { "wallet",             "move",                     &movecmd,                  false },
-    { "wallet",             "sendfrom",                 &sendfrom,                 false },
-    { "wallet",             "sendmany",                 &sendmany,                 false },
-    { "wallet",             "sendtoaddress",            &sendtoaddress,            false },
-    { "wallet",             "setaccount",               &setaccount,               true  },
-    { "wallet",             "settxfee",                 &settxfee,                 true  },
-    { "wallet",             "signmessage",              &signmessage,              true  },
-    { "wallet",             "walletlock",               &walletlock,               true  },
-    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true  },
-    { "wallet",             "walletpassphrase",         &walletpassphrase,         true  },
-    { "wallet",             "zcbenchmark",              &zc_benchmark,             true  },
-    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true  },
-    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true  },
-    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true  },
-    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true  },
-    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false },
-    { "wallet",             "z_listunspent",            &z_listunspent,            false },
-    { "wallet",             "z_getbalance",             &z_getbalance,             false },
-    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false },
-    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false },
-    { "wallet",             "z_sendmany",               &z_sendmany,               false },
-    { "wallet",             "z_setmigration",           &z_setmigration,           false },
-    { "wallet",             "z_getmigrationstatus",     &z_getmigrationstatus,     false },
-    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false },
-    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true  },
-    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
-    { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
-    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
-    { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
-    { "wallet",             "z_exportkey",              &z_exportkey,              true  },
-    { "wallet",             "z_importkey",              &z_importkey,              true  },
-    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
-    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true  },
-    { "wallet",             "z_exportwallet",           &z_exportwallet,           true  },
-    { "wallet",             "z_importwallet",           &z_importwallet,           true  },
-    { "wallet",             "z_viewtransaction",        &z_viewtransaction,        false },
-    { "wallet",             "z_getnotescount",          &z_getnotescount,          false },
-    { "key-value",          "kv_set",                   &kv_set,                   false },
+{ //  category              name                        actor (function)           okSafeMode readOnly
+    //  --------------------- ------------------------    -----------------------    ---------- --------
+    { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false,     false },
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,      false },
+    { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true,      false },
+    { "wallet",             "backupwallet",             &backupwallet,             true,      false },
+    { "wallet",             "dumpprivkey",              &dumpprivkey,              true,      false },
+    { "wallet",             "dumpwallet",               &dumpwallet,               true,      false },
+    { "wallet",             "encryptwallet",            &encryptwallet,            true,      false },
+    { "wallet",             "getaccountaddress",        &getaccountaddress,        true,      false },
+    { "wallet",             "getaccount",               &getaccount,               true,      false },
+    { "wallet",             "getaddressesbyaccount",    &getaddressesbyaccount,    true,      false },
+    { "wallet",             "getbalance",               &getbalance,               false,     false },
+    { "wallet",             "getnewaddress",            &getnewaddress,            true,      false },
+    { "wallet",             "getrawchangeaddress",      &getrawchangeaddress,      true,      false },
+    { "wallet",             "getreceivedbyaccount",     &getreceivedbyaccount,     false,     false },
+    { "wallet",             "getreceivedbyaddress",     &getreceivedbyaddress,     false,     false },
+    { "wallet",             "gettransaction",           &gettransaction,           false,     false },
+    { "wallet",             "getunconfirmedbalance",    &getunconfirmedbalance,    false,     false },
+    { "wallet",             "getwalletinfo",            &getwalletinfo,            false,     false },
+    { "wallet",             "importprivkey",            &importprivkey,            true,      false },
+    { "wallet",             "importwallet",             &importwallet,             true,      false },
+    { "wallet",             "importaddress",            &importaddress,            true,      false },
+    { "wallet",             "importpubkey",             &importpubkey,             true,      false },
+    { "wallet",             "keypoolrefill",            &keypoolrefill,            true,      false },
+    { "wallet",             "listaccounts",             &listaccounts,             false,     false },
+    { "wallet",             "listaddressgroupings",     &listaddressgroupings,     false,     false },
+    { "wallet",             "listlockunspent",          &listlockunspent,          false,     false },
+    { "wallet",             "listreceivedbyaccount",    &listreceivedbyaccount,    false,     false },
+    { "wallet",             "listreceivedbyaddress",    &listreceivedbyaddress,    false,     false },
+    { "wallet",             "listsinceblock",           &listsinceblock,           false,     false },
+    { "wallet",             "listtransactions",         &listtransactions,         false,     false },
+    { "wallet",             "listunspent",              &listunspent,              false,     false },
+    { "wallet",             "lockunspent",              &lockunspent,              true,      false },
+    { "wallet",             "move",                     &movecmd,                  false,     false },
+    { "wallet",             "sendfrom",                 &sendfrom,                 false,     false },
+    { "wallet",             "sendmany",                 &sendmany,                 false,     false },
+    { "wallet",             "sendtoaddress",            &sendtoaddress,            false,     false },
+    { "wallet",             "setaccount",               &setaccount,               true,      false },
+    { "wallet",             "settxfee",                 &settxfee,                 true,      false },
+    { "wallet",             "signmessage",              &signmessage,              true,      false },
+    { "wallet",             "walletlock",               &walletlock,               true,      false },
+    { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   true,      false },
+    { "wallet",             "walletpassphrase",         &walletpassphrase,         true,      false },
+    { "wallet",             "zcbenchmark",              &zc_benchmark,             true,      false },
+    { "wallet",             "zcrawkeygen",              &zc_raw_keygen,            true,      false },
+    { "wallet",             "zcrawjoinsplit",           &zc_raw_joinsplit,         true,      false },
+    { "wallet",             "zcrawreceive",             &zc_raw_receive,           true,      false },
+    { "wallet",             "zcsamplejoinsplit",        &zc_sample_joinsplit,      true,      false },
+    { "wallet",             "z_listreceivedbyaddress",  &z_listreceivedbyaddress,  false,     false },
+    { "wallet",             "z_listunspent",            &z_listunspent,            false,     false },
+    { "wallet",             "z_getbalance",             &z_getbalance,             false,     false },
+    { "wallet",             "z_gettotalbalance",        &z_gettotalbalance,        false,     false },
+    { "wallet",             "z_mergetoaddress",         &z_mergetoaddress,         false,     false },
+    { "wallet",             "z_sendmany",               &z_sendmany,               false,     false },
+    { "wallet",             "z_setmigration",           &z_setmigration,           false,     false },
+    { "wallet",             "z_getmigrationstatus",     &z_getmigrationstatus,     false,     false },
+    { "wallet",             "z_shieldcoinbase",         &z_shieldcoinbase,         false,     false },
+    { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true,      false },
+    { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true,      false },
+    { "wallet",             "z_listoperationids",       &z_listoperationids,       true,      false },
+    { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true,      false },
+    { "wallet",             "z_listaddresses",          &z_listaddresses,          true,      false },
+    { "wallet",             "z_exportkey",              &z_exportkey,              true,      false },
+    { "wallet",             "z_importkey",              &z_importkey,              true,      false },
+    { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true,      false },
+    { "wallet",             "z_importviewingkey",       &z_importviewingkey,       true,      false },
+    { "wallet",             "z_exportwallet",           &z_exportwallet,           true,      false },
+    { "wallet",             "z_importwallet",           &z_importwallet,           true,      false },
+    { "wallet",             "z_viewtransaction",        &z_viewtransaction,        false,     false },
+    { "wallet",             "z_getnotescount",          &z_getnotescount,          false,     false },
+    { "key-value",          "kv_set",                   &kv_set,                   false,     false },
     // TODO: rearrange into another category
-    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true  },
-    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true }
+    { "disclosure",         "z_getpaymentdisclosure",   &z_getpaymentdisclosure,   true,      false },
+    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true, false }
 };
 
 void RegisterWalletRPCCommands(CRPCTable &tableRPC)
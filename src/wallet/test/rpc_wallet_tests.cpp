@@ -966,6 +966,87 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+// Records the order in which operations were executed
+std::vector<AsyncRPCOperationId> gExecutionOrder;
+
+class PriorityOperation : public AsyncRPCOperation {
+public:
+    PriorityOperation(OperationPriority priority) {
+        set_priority(priority);
+    }
+    virtual ~PriorityOperation() {}
+    virtual void main() {
+        set_state(OperationStatus::EXECUTING);
+        start_execution_clock();
+        gExecutionOrder.push_back(getId());
+        stop_execution_clock();
+        set_result(UniValue(UniValue::VSTR, "done"));
+        set_state(OperationStatus::SUCCESS);
+    }
+};
+
+// This tests that higher priority operations are executed first
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priority)
+{
+    gExecutionOrder.clear();
+
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    std::shared_ptr<AsyncRPCOperation> low1(new PriorityOperation(OperationPriority::LOW));
+    std::shared_ptr<AsyncRPCOperation> normal(new PriorityOperation(OperationPriority::NORMAL));
+    std::shared_ptr<AsyncRPCOperation> low2(new PriorityOperation(OperationPriority::LOW));
+    std::shared_ptr<AsyncRPCOperation> high(new PriorityOperation(OperationPriority::HIGH));
+    q->addOperation(low1);
+    q->addOperation(normal);
+    q->addOperation(low2);
+    q->addOperation(high);
+    BOOST_CHECK(q->getOperationCount() == 4);
+
+    q->addWorker();
+    q->finishAndWait();
+
+    BOOST_CHECK(q->getOperationCount() == 0);
+    BOOST_REQUIRE(gExecutionOrder.size() == 4);
+    BOOST_CHECK_EQUAL(gExecutionOrder[0], high->getId());
+    BOOST_CHECK_EQUAL(gExecutionOrder[1], normal->getId());
+    BOOST_CHECK_EQUAL(gExecutionOrder[2], low1->getId());
+    BOOST_CHECK_EQUAL(gExecutionOrder[3], low2->getId());
+
+    UniValue status = high->getStatus();
+    BOOST_CHECK_EQUAL(find_value(status.get_obj(), "priority").get_str(), "high");
+    BOOST_CHECK(find_value(status.get_obj(), "execution_secs").isNum());
+    BOOST_CHECK(find_value(status.get_obj(), "cpu_secs").isNum());
+}
+
+// This tests that only the most recently finished operations are kept
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_retention)
+{
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    BOOST_CHECK(q->getRetention() == 0);
+    q->setRetention(2);
+
+    std::vector<std::shared_ptr<AsyncRPCOperation>> ops;
+    for (int i = 0; i < 5; i++) {
+        std::shared_ptr<AsyncRPCOperation> op(new PriorityOperation(OperationPriority::NORMAL));
+        ops.push_back(op);
+        q->addOperation(op);
+    }
+    q->addWorker();
+    q->finishAndWait();
+
+    std::vector<AsyncRPCOperationId> v = q->getAllOperationIds();
+    std::set<AsyncRPCOperationId> opids(v.begin(), v.end());
+    BOOST_CHECK(opids.size() == 2);
+    BOOST_CHECK(opids.count(ops[3]->getId()) == 1);
+    BOOST_CHECK(opids.count(ops[4]->getId()) == 1);
+    BOOST_CHECK(q->getAllOperations().size() == 2);
+
+    // Popped operations no longer count towards the limit
+    BOOST_CHECK(q->popOperationForId(ops[4]->getId()));
+    q->setRetention(1);
+    BOOST_CHECK(q->getAllOperations().size() == 1);
+    BOOST_CHECK(q->getOperationForId(ops[3]->getId()));
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
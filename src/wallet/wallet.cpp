@@ -610,14 +610,18 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
         ChainTipAdded(pindex, pblock, added->first, added->second);
         // Prevent migration transactions from being created when node is syncing after launch,
         // and also when node wakes up from suspension/hibernation and incoming blocks are old.
-        if (!IsInitialBlockDownload(Params()) &&
-            pblock->GetBlockTime() > GetTime() - 3 * 60 * 60)
+        // The block time is checked first: IsInitialBlockDownload() takes cs_main until it
+        // latches, which would be once per block while catching up.
+        if (pblock->GetBlockTime() > GetTime() - 3 * 60 * 60 &&
+            !IsInitialBlockDownload(Params()))
         {
             RunSaplingMigration(pindex->nHeight);
         }
     } else {
         DecrementNoteWitnesses(pindex);
         UpdateSaplingNullifierNoteMapForBlock(pblock);
+        LOCK(cs_wallet);
+        MarkBalanceDirtyFromHeight(pindex->nHeight);
     }
 }
 
@@ -668,6 +672,7 @@ void CWallet::AddPendingSaplingMigrationTx(const CTransaction& tx) {
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    LOCK(cs_wallet);
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
@@ -1031,6 +1036,8 @@ void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& w
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
     SyncMetaData<COutPoint>(range);
+
+    MarkBalanceDirty(outpoint.hash);
 }
 
 void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
@@ -1040,6 +1047,10 @@ void CWallet::AddToSproutSpends(const uint256& nullifier, const uint256& wtxid)
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSproutNullifiers.equal_range(nullifier);
     SyncMetaData<uint256>(range);
+
+    std::map<uint256, JSOutPoint>::const_iterator it = mapSproutNullifiersToNotes.find(nullifier);
+    if (it != mapSproutNullifiersToNotes.end())
+        MarkBalanceDirty(it->second.hash);
 }
 
 void CWallet::AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid)
@@ -1049,6 +1060,10 @@ void CWallet::AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid)
     pair<TxNullifiers::iterator, TxNullifiers::iterator> range;
     range = mapTxSaplingNullifiers.equal_range(nullifier);
     SyncMetaData<uint256>(range);
+
+    std::map<uint256, SaplingOutPoint>::const_iterator it = mapSaplingNullifiersToNotes.find(nullifier);
+    if (it != mapSaplingNullifiersToNotes.end())
+        MarkBalanceDirty(it->second.hash);
 }
 
 void CWallet::AddToSpends(const uint256& wtxid)
@@ -1075,14 +1090,20 @@ void CWallet::ClearNoteWitnessCache()
 {
     LOCK(cs_wallet);
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        bool fCleared = false;
         for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+            fCleared |= !item.second.witnesses.empty() || item.second.witnessHeight != -1;
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
         for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+            fCleared |= !item.second.witnesses.empty() || item.second.witnessHeight != -1;
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
         }
+        if (fCleared) {
+            MarkWalletTxDirty(wtxItem.first);
+        }
     }
     nWitnessCacheSize = 0;
 }
@@ -1159,18 +1180,31 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
 }
 
 
+/**
+ * Returns true if any note was updated. Every note which CopyPreviousWitnesses,
+ * AppendNoteCommitment or WitnessNoteIfMine touched for this height is among
+ * them, so this alone tells whether the note data changed. Notes without
+ * witnesses (not mined yet) have nothing to keep up with the chain; they
+ * stay at height -1 and their transaction is not rewritten.
+ */
 template<typename NoteDataMap>
-void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+bool UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
 {
+    bool fUpdated = false;
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
         if (nd->witnessHeight < indexHeight) {
-            nd->witnessHeight = indexHeight;
+            int witnessHeight = nd->witnesses.empty() ? -1 : indexHeight;
+            if (nd->witnessHeight != witnessHeight) {
+                nd->witnessHeight = witnessHeight;
+                fUpdated = true;
+            }
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
             assert(nWitnessCacheSize >= nd->witnesses.size());
         }
     }
+    return fUpdated;
 }
 
 void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
@@ -1237,8 +1271,11 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 
     // Update witness heights
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        bool fSproutUpdated = ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+        bool fSaplingUpdated = ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        if (fSproutUpdated || fSaplingUpdated) {
+            MarkWalletTxDirty(wtxItem.first);
+        }
     }
 
     // For performance reasons, we write out the witness cache in
@@ -1247,8 +1284,9 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 }
 
 template<typename NoteDataMap>
-void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+bool DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
 {
+    bool fUpdated = false;
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
         // Only decrement witnesses that are not above the current height
@@ -1263,10 +1301,16 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             assert((nd->witnessHeight == -1) || (nd->witnessHeight == indexHeight));
             if (nd->witnesses.size() > 0) {
                 nd->witnesses.pop_front();
+                fUpdated = true;
             }
             // indexHeight is the height of the block being removed, so 
-            // the new witness cache height is one below it.
-            nd->witnessHeight = indexHeight - 1;
+            // the new witness cache height is one below it. Notes left
+            // without witnesses go back to -1, like in UpdateWitnessHeights.
+            int witnessHeight = nd->witnesses.empty() ? -1 : indexHeight - 1;
+            if (nd->witnessHeight != witnessHeight) {
+                nd->witnessHeight = witnessHeight;
+                fUpdated = true;
+            }
         }
         // Check the validity of the cache
         // Technically if there are notes witnessed above the current
@@ -1284,14 +1328,18 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
             assert((nWitnessCacheSize - 1) >= nd->witnesses.size());
         }
     }
+    return fUpdated;
 }
 
 void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        bool fSproutUpdated = ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+        bool fSaplingUpdated = ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        if (fSproutUpdated || fSaplingUpdated) {
+            MarkWalletTxDirty(wtxItem.first);
+        }
     }
     nWitnessCacheSize -= 1;
     // TODO: If nWitnessCache is zero, we need to regenerate the caches (#1302)
@@ -1436,6 +1484,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        ClearBalanceCache();
     }
 }
 
@@ -1464,6 +1513,9 @@ bool CWallet::UpdateNullifierNoteMap()
                             dec,
                             hSig,
                             item.first.n);
+                        if (item.second.nullifier) {
+                            MarkWalletTxDirty(wtxItem.first);
+                        }
                     }
                 }
             }
@@ -1473,6 +1525,9 @@ bool CWallet::UpdateNullifierNoteMap()
 
             UpdateNullifierNoteMapWithTx(wtxItem.second);
         }
+
+        // Newly cached nullifiers can reveal spends of our notes.
+        ClearBalanceCache();
     }
     return true;
 }
@@ -1504,6 +1559,7 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
  */
 void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
     LOCK(cs_wallet);
+    MarkBalanceDirty(wtx.GetHash());
 
     for (mapSaplingNoteData_t::value_type &item : wtx.mapSaplingNoteData) {
         SaplingOutPoint op = item.first;
@@ -1513,6 +1569,7 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             // If there are no witnesses, erase the nullifier and associated mapping.
             if (item.second.nullifier) {
                 mapSaplingNullifiersToNotes.erase(item.second.nullifier.get());
+                MarkWalletTxDirty(wtx.GetHash());
             }
             item.second.nullifier = boost::none;
         }
@@ -1541,7 +1598,10 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
             assert(optNullifier != boost::none);
             uint256 nullifier = optNullifier.get();
             mapSaplingNullifiersToNotes[nullifier] = op;
-            item.second.nullifier = nullifier;
+            if (item.second.nullifier != nullifier) {
+                item.second.nullifier = nullifier;
+                MarkWalletTxDirty(wtx.GetHash());
+            }
         }
     }
 }
@@ -1562,7 +1622,7 @@ void CWallet::UpdateSaplingNullifierNoteMapForBlock(const CBlock *pblock) {
     }
 }
 
-bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
+bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fDeferWrite)
 {
     uint256 hash = wtxIn.GetHash();
 
@@ -1572,6 +1632,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        MarkBalanceDirty(hash, true);
     }
     else
     {
@@ -1590,7 +1651,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (!wtxIn.hashBlock.IsNull())
             {
-                if (mapBlockIndex.count(wtxIn.hashBlock))
+                CBlockIndex* pindexBlock = LookupBlockIndex(wtxIn.hashBlock);
+                if (pindexBlock)
                 {
                     int64_t latestNow = wtx.nTimeReceived;
                     int64_t latestEntry = 0;
@@ -1624,7 +1686,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                         }
                     }
 
-                    int64_t blocktime = mapBlockIndex[wtxIn.hashBlock]->GetBlockTime();
+                    int64_t blocktime = pindexBlock->GetBlockTime();
                     wtx.nTimeSmart = std::max(latestEntry, std::min(blocktime, latestNow));
                 }
                 else
@@ -1664,12 +1726,19 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
         // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk(pwalletdb))
-                return false;
+        if (fInsertedNew || fUpdated) {
+            if (fDeferWrite) {
+                MarkWalletTxDirty(hash);
+            } else {
+                if (!wtx.WriteToDisk(pwalletdb))
+                    return false;
+                setDirtyWalletTx.erase(hash);
+            }
+        }
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        MarkBalanceDirty(hash, true);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1736,7 +1805,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * updated; instead, the transaction being in the mempool or conflicted is determined on
  * the fly in CMerkleTx::GetDepthInMainChain().
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate, bool fDeferWrite)
 {
     {
         AssertLockHeld(cs_wallet);
@@ -1771,7 +1840,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
 
-            return AddToWallet(wtx, false, &walletdb);
+            // For the same reason, records of transactions found in a newly
+            // connected block are batched and written by the next SetBestChain().
+            return AddToWallet(wtx, false, &walletdb, fDeferWrite);
         }
     }
     return false;
@@ -1780,7 +1851,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight)
 {
     LOCK(cs_wallet);
-    if (!AddToWalletIfInvolvingMe(tx, pblock, nHeight, true))
+    if (!AddToWalletIfInvolvingMe(tx, pblock, nHeight, true, pblock != NULL))
         return; // Not one of ours
 
     MarkAffectedTransactionsDirty(tx);
@@ -1793,14 +1864,17 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
     // recomputed, also:
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        if (mapWallet.count(txin.prevout.hash))
+        if (mapWallet.count(txin.prevout.hash)) {
             mapWallet[txin.prevout.hash].MarkDirty();
+            MarkBalanceDirty(txin.prevout.hash);
+        }
     }
     for (const JSDescription& jsdesc : tx.vJoinSplit) {
         for (const uint256& nullifier : jsdesc.nullifiers) {
             if (mapSproutNullifiersToNotes.count(nullifier) &&
                 mapWallet.count(mapSproutNullifiersToNotes[nullifier].hash)) {
                 mapWallet[mapSproutNullifiersToNotes[nullifier].hash].MarkDirty();
+                MarkBalanceDirty(mapSproutNullifiersToNotes[nullifier].hash);
             }
         }
     }
@@ -1810,6 +1884,7 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
         if (mapSaplingNullifiersToNotes.count(nullifier) &&
             mapWallet.count(mapSaplingNullifiersToNotes[nullifier].hash)) {
             mapWallet[mapSaplingNullifiersToNotes[nullifier].hash].MarkDirty();
+            MarkBalanceDirty(mapSaplingNullifiersToNotes[nullifier].hash);
         }
     }
 }
@@ -1820,8 +1895,11 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        if (mapWallet.erase(hash)) {
             CWalletDB(strWalletFile).EraseTx(hash);
+            MarkBalanceDirty(hash);
+            setDirtyWalletTx.erase(hash);
+        }
     }
     return;
 }
@@ -3109,32 +3187,308 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+/**
+ * Returns the greatest depth of any wallet transaction spending the given
+ * outpoint or nullifier, or -1 if no non-conflicted transaction spends it.
+ */
+template <class T>
+int CWallet::GetSpendDepth(const TxSpendMap<T>& spends, const T& key) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+    int nDepth = -1;
+    auto range = spends.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end())
+            nDepth = std::max(nDepth, mit->second.GetDepthInMainChain());
+    }
+    return nDepth;
+}
+
+/**
+ * Find the outputs and notes of a wallet transaction that pay to us. These
+ * only change when the transaction's note data or the wallet's keys change.
+ */
+void CWallet::ComputeBalanceCredits(const CWalletTx& wtx, WalletTxCredits& credits) const
+{
+    AssertLockHeld(cs_wallet);
+
+    credits.vTransparent.clear();
+    credits.vSprout.clear();
+    credits.vSapling.clear();
+    credits.fCoinBase = wtx.IsCoinBase();
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        isminetype mine = IsMine(wtx.vout[i]);
+        if (mine == ISMINE_NO)
+            continue;
+        CTxDestination dest;
+        if (!ExtractDestination(wtx.vout[i].scriptPubKey, dest))
+            dest = CNoDestination();
+        credits.vTransparent.push_back(TransparentCredit {
+            i, dest, wtx.vout[i].nValue, (mine & ISMINE_SPENDABLE) != ISMINE_NO, false });
+    }
+
+    // Coinbase transactions without Sapling outputs are never selected by
+    // GetFilteredNotes, so they don't count towards the shielded balance.
+    if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty())
+        return;
+
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        const SproutPaymentAddress& pa = item.second.address;
+        try {
+            auto decrypted = wtx.DecryptSproutNote(item.first);
+            credits.vSprout.push_back(SproutCredit {
+                item.first, pa, CAmount(decrypted.first.value()), HaveSproutSpendingKey(pa), false });
+        } catch (const std::exception& e) {
+            LogPrintf("%s: could not decrypt note %s: %s\n", __func__, item.first.ToString(), e.what());
         }
     }
 
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        const SaplingOutPoint& op = item.first;
+        const SaplingNoteData& nd = item.second;
+        auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(
+            wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+
+        // The transaction would not have entered the wallet unless
+        // its plaintext had been successfully decrypted previously.
+        assert(optDeserialized != boost::none);
+
+        auto notePt = optDeserialized.get();
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        assert(static_cast<bool>(maybe_pa));
+        auto pa = maybe_pa.get();
+
+        libzcash::SaplingExtendedFullViewingKey extfvk;
+        bool fSpendable = GetSaplingFullViewingKey(nd.ivk, extfvk) && HaveSaplingSpendingKey(extfvk);
+
+        credits.vSapling.push_back(SaplingCredit {
+            op, pa, CAmount(notePt.value()), fSpendable, false });
+    }
+}
+
+/**
+ * Refresh the confirmation and spent state of a transaction's credits.
+ * Returns true if that state depends on unconfirmed transactions, and so may
+ * change without the wallet being notified.
+ */
+bool CWallet::EvaluateBalanceCredits(const CWalletTx& wtx, WalletTxCredits& credits) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const CBlockIndex* pindex = NULL;
+    credits.fFinal = CheckFinalTx(wtx);
+    credits.nDepth = wtx.GetDepthInMainChain(pindex);
+    credits.nHeight = pindex ? pindex->nHeight : -1;
+    credits.fTrusted = credits.nDepth >= 1 || (credits.nDepth == 0 && wtx.IsTrusted());
+
+    bool fVolatile = !credits.fFinal || credits.nDepth == 0;
+    const uint256& hash = wtx.GetHash();
+
+    for (TransparentCredit& credit : credits.vTransparent) {
+        int nSpendDepth = GetSpendDepth(mapTxSpends, COutPoint(hash, credit.n));
+        credit.unspent = nSpendDepth < 0;
+        fVolatile |= nSpendDepth == 0;
+    }
+    for (SproutCredit& credit : credits.vSprout) {
+        const SproutNoteData& nd = wtx.mapSproutNoteData.at(credit.jsop);
+        int nSpendDepth = nd.nullifier ? GetSpendDepth(mapTxSproutNullifiers, *nd.nullifier) : -1;
+        credit.unspent = nSpendDepth < 0;
+        fVolatile |= nSpendDepth == 0;
+    }
+    for (SaplingCredit& credit : credits.vSapling) {
+        const SaplingNoteData& nd = wtx.mapSaplingNoteData.at(credit.op);
+        int nSpendDepth = nd.nullifier ? GetSpendDepth(mapTxSaplingNullifiers, *nd.nullifier) : -1;
+        credit.unspent = nSpendDepth < 0;
+        fVolatile |= nSpendDepth == 0;
+    }
+    return fVolatile;
+}
+
+template <typename Address, typename Set>
+static void UpdateUnspentIndex(std::map<Address, Set>& index, const Address& address,
+                               const typename Set::value_type& value, int nSign)
+{
+    if (nSign > 0) {
+        index[address].insert(value);
+        return;
+    }
+    typename std::map<Address, Set>::iterator it = index.find(address);
+    if (it == index.end())
+        return;
+    typename Set::iterator vit = it->second.find(value);
+    if (vit != it->second.end())
+        it->second.erase(vit);
+    if (it->second.empty())
+        index.erase(it);
+}
+
+void CWallet::TallyBalanceCredits(const uint256& hash, const WalletTxCredits& credits, int nSign) const
+{
+    for (const TransparentCredit& credit : credits.vTransparent) {
+        if (!credit.unspent)
+            continue;
+        CBalanceTally<CTxDestination>& tally = credits.fCoinBase ?
+            tallyCoinBase[credit.spendable] : tallyTransparent[credit.spendable];
+        tally.Add(credit.dest, credits.nHeight, nSign * credit.value);
+        UpdateUnspentIndex(mapUnspentCoins, credit.dest,
+                           std::make_pair(credit.value, COutPoint(hash, credit.n)), nSign);
+    }
+    for (const SproutCredit& credit : credits.vSprout) {
+        if (!credit.unspent)
+            continue;
+        libzcash::PaymentAddress address(credit.address);
+        tallyShielded[credit.spendable].Add(address, credits.nHeight, nSign * credit.value);
+        UpdateUnspentIndex(mapUnspentNotes, address, std::make_pair(credit.value, hash), nSign);
+    }
+    for (const SaplingCredit& credit : credits.vSapling) {
+        if (!credit.unspent)
+            continue;
+        libzcash::PaymentAddress address(credit.address);
+        tallyShielded[credit.spendable].Add(address, credits.nHeight, nSign * credit.value);
+        UpdateUnspentIndex(mapUnspentNotes, address, std::make_pair(credit.value, hash), nSign);
+    }
+}
+
+/**
+ * Bring the balance tallies up to date with every transaction marked dirty
+ * since the last query, and re-evaluate the volatile transactions.
+ */
+void CWallet::RefreshBalanceCache() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (!fBalanceCacheValid) {
+        mapBalanceCredits.clear();
+        setBalanceVolatile.clear();
+        mapBalanceHeights.clear();
+        for (int i = 0; i < 2; i++) {
+            tallyTransparent[i].Clear();
+            tallyCoinBase[i].Clear();
+            tallyShielded[i].Clear();
+        }
+        mapUnspentCoins.clear();
+        mapUnspentNotes.clear();
+        setBalanceDirty.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet)
+            setBalanceDirty.insert(item.first);
+        fBalanceCacheValid = true;
+    }
+
+    for (const uint256& hash : setBalanceDirty) {
+        std::map<uint256, WalletTxCredits>::iterator it = mapBalanceCredits.find(hash);
+        if (it != mapBalanceCredits.end() && it->second.fTallied) {
+            TallyBalanceCredits(hash, it->second, -1);
+            std::map<int, std::set<uint256>>::iterator hit = mapBalanceHeights.find(it->second.nHeight);
+            if (hit != mapBalanceHeights.end()) {
+                hit->second.erase(hash);
+                if (hit->second.empty())
+                    mapBalanceHeights.erase(hit);
+            }
+            it->second.fTallied = false;
+        }
+
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(hash);
+        if (mit == mapWallet.end()) {
+            if (it != mapBalanceCredits.end())
+                mapBalanceCredits.erase(it);
+            setBalanceVolatile.erase(hash);
+            continue;
+        }
+
+        WalletTxCredits& credits = mapBalanceCredits[hash];
+        if (!credits.fCreditsValid) {
+            ComputeBalanceCredits(mit->second, credits);
+            credits.fCreditsValid = true;
+        }
+        if (EvaluateBalanceCredits(mit->second, credits)) {
+            setBalanceVolatile.insert(hash);
+        } else {
+            setBalanceVolatile.erase(hash);
+            if (credits.nDepth > 0) {
+                TallyBalanceCredits(hash, credits, 1);
+                credits.fTallied = true;
+                mapBalanceHeights[credits.nHeight].insert(hash);
+            }
+        }
+    }
+    setBalanceDirty.clear();
+
+    for (std::set<uint256>::iterator it = setBalanceVolatile.begin(); it != setBalanceVolatile.end(); ) {
+        WalletTxCredits& credits = mapBalanceCredits[*it];
+        if (!EvaluateBalanceCredits(mapWallet.at(*it), credits) && credits.nDepth > 0) {
+            // Its spends and confirmation have settled; tally it from now on.
+            TallyBalanceCredits(*it, credits, 1);
+            credits.fTallied = true;
+            mapBalanceHeights[credits.nHeight].insert(*it);
+            it = setBalanceVolatile.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CWallet::MarkBalanceDirty(const uint256& hash, bool fCredits)
+{
+    AssertLockHeld(cs_wallet);
+    setBalanceDirty.insert(hash);
+    if (fCredits) {
+        std::map<uint256, WalletTxCredits>::iterator it = mapBalanceCredits.find(hash);
+        if (it != mapBalanceCredits.end())
+            it->second.fCreditsValid = false;
+    }
+}
+
+/** Mark every tallied transaction confirmed at or above nHeight as dirty. */
+void CWallet::MarkBalanceDirtyFromHeight(int nHeight)
+{
+    AssertLockHeld(cs_wallet);
+    for (auto it = mapBalanceHeights.lower_bound(nHeight); it != mapBalanceHeights.end(); ++it)
+        setBalanceDirty.insert(it->second.begin(), it->second.end());
+}
+
+void CWallet::ClearBalanceCache()
+{
+    AssertLockHeld(cs_wallet);
+    fBalanceCacheValid = false;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    CAmount nTotal = tallyTransparent[1].Get(0, nTip) +
+                     tallyCoinBase[1].Get(0, nTip - COINBASE_MATURITY);
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fTrusted || (credits.fCoinBase && credits.nDepth <= COINBASE_MATURITY))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (credit.spendable && credit.unspent)
+                nTotal += credit.value;
+        }
+    }
     return nTotal;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    // Unconfirmed transactions are always volatile.
     CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (credits.fFinal && (credits.fTrusted || credits.nDepth != 0))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (credit.spendable && credit.unspent)
+                nTotal += credit.value;
         }
     }
     return nTotal;
@@ -3142,13 +3496,18 @@ CAmount CWallet::GetUnconfirmedBalance() const
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    CAmount nTotal = tallyCoinBase[1].Get(nTip - COINBASE_MATURITY + 1, nTip);
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fCoinBase || credits.nDepth < 1 || credits.nDepth > COINBASE_MATURITY)
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (credit.spendable)
+                nTotal += credit.value;
         }
     }
     return nTotal;
@@ -3156,30 +3515,37 @@ CAmount CWallet::GetImmatureBalance() const
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    CAmount nTotal = tallyTransparent[0].Get(0, nTip) +
+                     tallyCoinBase[0].Get(0, nTip - COINBASE_MATURITY);
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fTrusted || (credits.fCoinBase && credits.nDepth <= COINBASE_MATURITY))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (!credit.spendable && credit.unspent)
+                nTotal += credit.value;
         }
     }
-
     return nTotal;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
     CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (credits.fFinal && (credits.fTrusted || credits.nDepth != 0))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (!credit.spendable && credit.unspent)
+                nTotal += credit.value;
         }
     }
     return nTotal;
@@ -3187,13 +3553,138 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    CAmount nTotal = tallyCoinBase[0].Get(nTip - COINBASE_MATURITY + 1, nTip);
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fCoinBase || credits.nDepth < 1 || credits.nDepth > COINBASE_MATURITY)
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (!credit.spendable)
+                nTotal += credit.value;
+        }
+    }
+    return nTotal;
+}
+
+/**
+ * Equivalent to summing the outputs returned by AvailableCoins(vCoins, false,
+ * NULL, true) with at least minDepth confirmations, but served from the
+ * balance tallies.
+ */
+CAmount CWallet::GetTransparentBalance(const CTxDestination* dest, int minDepth, bool ignoreUnspendable) const
+{
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    int nMaxHeight = nTip - minDepth + 1;
+    int nMaxCoinBaseHeight = std::min(nMaxHeight, nTip - COINBASE_MATURITY);
+
     CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
+    for (int i = ignoreUnspendable ? 1 : 0; i < 2; i++) {
+        if (dest) {
+            nTotal += tallyTransparent[i].Get(*dest, 0, nMaxHeight);
+            nTotal += tallyCoinBase[i].Get(*dest, 0, nMaxCoinBaseHeight);
+        } else {
+            nTotal += tallyTransparent[i].Get(0, nMaxHeight);
+            nTotal += tallyCoinBase[i].Get(0, nMaxCoinBaseHeight);
+        }
+    }
+
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fFinal || credits.nDepth < 0 || credits.nDepth < minDepth ||
+            (credits.fCoinBase && credits.nDepth <= COINBASE_MATURITY))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (!credit.unspent || (ignoreUnspendable && !credit.spendable) ||
+                (dest && credit.dest != *dest) || IsLockedCoin(hash, credit.n))
+                continue;
+            nTotal += credit.value;
+        }
+    }
+
+    // Locked coins are rare, so they are subtracted here rather than tracked.
+    for (const COutPoint& outpoint : setLockedCoins) {
+        std::map<uint256, WalletTxCredits>::const_iterator it = mapBalanceCredits.find(outpoint.hash);
+        if (it == mapBalanceCredits.end() || !it->second.fTallied)
+            continue;
+        const WalletTxCredits& credits = it->second;
+        if (credits.nHeight > (credits.fCoinBase ? nMaxCoinBaseHeight : nMaxHeight))
+            continue;
+        for (const TransparentCredit& credit : credits.vTransparent) {
+            if (credit.n == outpoint.n && credit.unspent &&
+                (credit.spendable || !ignoreUnspendable) &&
+                (!dest || credit.dest == *dest))
+                nTotal -= credit.value;
+        }
+    }
+    return nTotal;
+}
+
+/**
+ * Equivalent to summing the notes returned by GetFilteredNotes for the given
+ * address and depth range, ignoring spent and locked notes, but served from
+ * the balance tallies.
+ */
+CAmount CWallet::GetShieldedBalance(const libzcash::PaymentAddress* address, int minDepth, int maxDepth, bool ignoreUnspendable) const
+{
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    int nTip = chainActive.Height();
+    int nMinHeight = maxDepth > nTip ? 0 : nTip - maxDepth + 1;
+    int nMaxHeight = nTip - minDepth + 1;
+
+    CAmount nTotal = 0;
+    for (int i = ignoreUnspendable ? 1 : 0; i < 2; i++) {
+        nTotal += address ? tallyShielded[i].Get(*address, nMinHeight, nMaxHeight)
+                          : tallyShielded[i].Get(nMinHeight, nMaxHeight);
+    }
+
+    for (const uint256& hash : setBalanceVolatile) {
+        const WalletTxCredits& credits = mapBalanceCredits.at(hash);
+        if (!credits.fFinal || credits.nDepth < minDepth || credits.nDepth > maxDepth)
+            continue;
+        for (const SproutCredit& credit : credits.vSprout) {
+            if (!credit.unspent || (ignoreUnspendable && !credit.spendable) ||
+                (address && libzcash::PaymentAddress(credit.address) != *address) || IsLockedNote(credit.jsop))
+                continue;
+            nTotal += credit.value;
+        }
+        for (const SaplingCredit& credit : credits.vSapling) {
+            if (!credit.unspent || (ignoreUnspendable && !credit.spendable) ||
+                (address && libzcash::PaymentAddress(credit.address) != *address) || IsLockedNote(credit.op))
+                continue;
+            nTotal += credit.value;
+        }
+    }
+
+    // Locked notes are rare, so they are subtracted here rather than tracked.
+    for (const JSOutPoint& jsop : setLockedSproutNotes) {
+        std::map<uint256, WalletTxCredits>::const_iterator it = mapBalanceCredits.find(jsop.hash);
+        if (it == mapBalanceCredits.end() || !it->second.fTallied ||
+            it->second.nHeight < nMinHeight || it->second.nHeight > nMaxHeight)
+            continue;
+        for (const SproutCredit& credit : it->second.vSprout) {
+            if (credit.jsop == jsop && credit.unspent && (credit.spendable || !ignoreUnspendable) &&
+                (!address || libzcash::PaymentAddress(credit.address) == *address))
+                nTotal -= credit.value;
+        }
+    }
+    for (const SaplingOutPoint& op : setLockedSaplingNotes) {
+        std::map<uint256, WalletTxCredits>::const_iterator it = mapBalanceCredits.find(op.hash);
+        if (it == mapBalanceCredits.end() || !it->second.fTallied ||
+            it->second.nHeight < nMinHeight || it->second.nHeight > nMaxHeight)
+            continue;
+        for (const SaplingCredit& credit : it->second.vSapling) {
+            if (credit.op == op && credit.unspent && (credit.spendable || !ignoreUnspendable) &&
+                (!address || libzcash::PaymentAddress(credit.address) == *address))
+                nTotal -= credit.value;
         }
     }
     return nTotal;
@@ -3205,10 +3696,19 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        RefreshBalanceCache();
+
+        // Only transactions with unspent outputs can provide coins. Visiting
+        // them in txid order keeps the result in mapWallet order.
+        std::set<uint256> setCandidates(setBalanceVolatile);
+        for (const auto& item : mapUnspentCoins) {
+            for (const std::pair<CAmount, COutPoint>& coin : item.second)
+                setCandidates.insert(coin.second.hash);
+        }
+
+        for (const uint256& wtxid : setCandidates)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.at(wtxid);
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -3229,8 +3729,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO)));
@@ -3239,6 +3739,61 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
+void CWallet::AvailableCoinsForDestination(vector<COutput>& vCoins, const CTxDestination& dest, bool fOnlyConfirmed, bool fIncludeZeroValue, bool fIncludeCoinBase) const
+{
+    vCoins.clear();
+
+    LOCK2(cs_main, cs_wallet);
+    RefreshBalanceCache();
+
+    // Indexed coins come out in ascending order of value; coins from
+    // volatile transactions are sorted separately and merged in.
+    std::vector<COutPoint> vCandidates;
+    std::map<CTxDestination, std::set<std::pair<CAmount, COutPoint>>>::const_iterator it = mapUnspentCoins.find(dest);
+    if (it != mapUnspentCoins.end()) {
+        for (const std::pair<CAmount, COutPoint>& coin : it->second)
+            vCandidates.push_back(coin.second);
+    }
+    size_t nIndexed = vCandidates.size();
+    for (const uint256& hash : setBalanceVolatile) {
+        for (const TransparentCredit& credit : mapBalanceCredits.at(hash).vTransparent) {
+            if (credit.dest == dest)
+                vCandidates.push_back(COutPoint(hash, credit.n));
+        }
+    }
+
+    size_t nMerge = 0;
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        if (i == nIndexed)
+            nMerge = vCoins.size();
+
+        const COutPoint& outpoint = vCandidates[i];
+        const CWalletTx* pcoin = &mapWallet.at(outpoint.hash);
+
+        if (!CheckFinalTx(*pcoin) || (fOnlyConfirmed && !pcoin->IsTrusted()))
+            continue;
+        if (pcoin->IsCoinBase() && (!fIncludeCoinBase || pcoin->GetBlocksToMaturity() > 0))
+            continue;
+        int nDepth = pcoin->GetDepthInMainChain();
+        if (nDepth < 0)
+            continue;
+
+        isminetype mine = IsMine(pcoin->vout[outpoint.n]);
+        if (!IsSpent(outpoint.hash, outpoint.n) && mine != ISMINE_NO &&
+            !IsLockedCoin(outpoint.hash, outpoint.n) &&
+            (pcoin->vout[outpoint.n].nValue > 0 || fIncludeZeroValue))
+            vCoins.push_back(COutput(pcoin, outpoint.n, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+    }
+    if (nIndexed == vCandidates.size())
+        nMerge = vCoins.size();
+
+    auto byValue = [](const COutput& a, const COutput& b) -> bool {
+        return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+    };
+    std::sort(vCoins.begin() + nMerge, vCoins.end(), byValue);
+    std::inplace_merge(vCoins.begin(), vCoins.begin() + nMerge, vCoins.end(), byValue);
+}
+
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
@@ -4999,7 +5554,8 @@ void CWallet::GetFilteredNotes(
  * if the note is spent, if a spending key is required, and if the notes are locked.
  * These notes are decrypted and added to the output parameter vector, outEntries.
  */
-void CWallet::GetFilteredNotes(
+void CWallet::AddFilteredNotesFromTx(
+    const CWalletTx& wtx,
     std::vector<SproutNoteEntry>& sproutEntries,
     std::vector<SaplingNoteEntry>& saplingEntries,
     std::set<PaymentAddress>& filterAddresses,
@@ -5009,119 +5565,151 @@ void CWallet::GetFilteredNotes(
     bool requireSpendingKey,
     bool ignoreLocked)
 {
-    LOCK2(cs_main, cs_wallet);
-
     KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
+    // Filter the transactions before checking for notes
+    if (!CheckFinalTx(wtx) ||
+        wtx.GetDepthInMainChain() < minDepth ||
+        wtx.GetDepthInMainChain() > maxDepth) {
+        return;
+    }
+
+    // Filter coinbase transactions that don't have Sapling outputs
+    if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
+        return;
+    }
+
+    for (auto & pair : wtx.mapSproutNoteData) {
+        JSOutPoint jsop = pair.first;
+        SproutNoteData nd = pair.second;
+        SproutPaymentAddress pa = nd.address;
+
+        // skip notes which belong to a different payment address in the wallet
+        if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
             continue;
         }
 
-        // Filter coinbase transactions that don't have Sapling outputs
-        if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
             continue;
         }
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
-
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
+            continue;
+        }
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
+        int i = jsop.js; // Index into CTransaction.vJoinSplit
+        int j = jsop.n; // Index into JSDescription.ciphertexts
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
+        // Get cached decryptor
+        ZCNoteDecryption decryptor;
+        if (!GetNoteDecryptor(pa, decryptor)) {
+            // Note decryptors are created when the wallet is loaded, so it should always exist
+            throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
+        }
 
-            int i = jsop.js; // Index into CTransaction.vJoinSplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
+        // determine amount of funds in the note
+        auto hSig = wtx.vJoinSplit[i].h_sig(wtx.joinSplitPubKey);
+        try {
+            SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                    decryptor,
+                    wtx.vJoinSplit[i].ciphertexts[j],
+                    wtx.vJoinSplit[i].ephemeralKey,
+                    hSig,
+                    (unsigned char) j);
 
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            }
+            sproutEntries.push_back(SproutNoteEntry {
+                jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
 
-            // determine amount of funds in the note
-            auto hSig = wtx.vJoinSplit[i].h_sig(wtx.joinSplitPubKey);
-            try {
-                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vJoinSplit[i].ciphertexts[j],
-                        wtx.vJoinSplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-
-                sproutEntries.push_back(SproutNoteEntry {
-                    jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
-
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
-            }
+        } catch (const note_decryption_failed &err) {
+            // Couldn't decrypt with this spending key
+            throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
+        } catch (const std::exception &exc) {
+            // Unexpected failure
+            throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
         }
+    }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
+    for (auto & pair : wtx.mapSaplingNoteData) {
+        SaplingOutPoint op = pair.first;
+        SaplingNoteData nd = pair.second;
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+        auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != boost::none);
+        // The transaction would not have entered the wallet unless
+        // its plaintext had been successfully decrypted previously.
+        assert(optDeserialized != boost::none);
 
-            auto notePt = optDeserialized.get();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.get();
+        auto notePt = optDeserialized.get();
+        auto maybe_pa = nd.ivk.address(notePt.d);
+        assert(static_cast<bool>(maybe_pa));
+        auto pa = maybe_pa.get();
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        // skip notes which belong to a different payment address in the wallet
+        if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
+            continue;
+        }
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
-                continue;
-            }
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            continue;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
+            continue;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(op)) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            continue;
+        }
+
+        auto note = notePt.note(nd.ivk).get();
+        saplingEntries.push_back(SaplingNoteEntry {
+            op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+    }
+}
 
-            auto note = notePt.note(nd.ivk).get();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+void CWallet::GetFilteredNotes(
+    std::vector<SproutNoteEntry>& sproutEntries,
+    std::vector<SaplingNoteEntry>& saplingEntries,
+    std::set<PaymentAddress>& filterAddresses,
+    int minDepth,
+    int maxDepth,
+    bool ignoreSpent,
+    bool requireSpendingKey,
+    bool ignoreLocked)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    if (!ignoreSpent || minDepth < 0) {
+        for (auto & p : mapWallet) {
+            AddFilteredNotesFromTx(p.second, sproutEntries, saplingEntries, filterAddresses,
+                                   minDepth, maxDepth, ignoreSpent, requireSpendingKey, ignoreLocked);
         }
+        return;
+    }
+
+    // Unspent notes can only be in transactions indexed by the balance
+    // cache, or in volatile ones, so only those need to be decrypted.
+    RefreshBalanceCache();
+    std::set<uint256> setCandidates(setBalanceVolatile);
+    for (const auto& item : mapUnspentNotes) {
+        if (filterAddresses.empty() || filterAddresses.count(item.first)) {
+            for (const std::pair<CAmount, uint256>& note : item.second)
+                setCandidates.insert(note.second);
+        }
+    }
+
+    for (const uint256& hash : setCandidates) {
+        AddFilteredNotesFromTx(mapWallet.at(hash), sproutEntries, saplingEntries, filterAddresses,
+                               minDepth, maxDepth, ignoreSpent, requireSpendingKey, ignoreLocked);
     }
 }
 
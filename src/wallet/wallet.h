@@ -20,6 +20,7 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "script/ismine.h"
+#include "wallet/balancetally.h"
 #include "wallet/crypter.h"
 #include "wallet/walletdb.h"
 #include "wallet/rpcwallet.h"
@@ -338,6 +339,58 @@ struct SaplingNoteEntry
     int confirmations;
 };
 
+/** A transparent output of a wallet transaction that pays to one of our keys or scripts. */
+struct TransparentCredit
+{
+    uint32_t n;
+    CTxDestination dest;
+    CAmount value;
+    bool spendable;
+    bool unspent;
+};
+
+/** A Sprout note received by the wallet, with its decrypted value. */
+struct SproutCredit
+{
+    JSOutPoint jsop;
+    libzcash::SproutPaymentAddress address;
+    CAmount value;
+    bool spendable;
+    bool unspent;
+};
+
+/** A Sapling note received by the wallet, with its decrypted value. */
+struct SaplingCredit
+{
+    SaplingOutPoint op;
+    libzcash::SaplingPaymentAddress address;
+    CAmount value;
+    bool spendable;
+    bool unspent;
+};
+
+/**
+ * Balance cache state for one wallet transaction: the outputs it pays to us
+ * (computed once, as notes have to be decrypted) and the confirmation and
+ * spent state last used to add it to the wallet's balance tallies.
+ */
+struct WalletTxCredits
+{
+    bool fCreditsValid;
+    bool fTallied;
+    bool fCoinBase;
+    bool fFinal;
+    bool fTrusted;
+    int nDepth;
+    int nHeight;
+    std::vector<TransparentCredit> vTransparent;
+    std::vector<SproutCredit> vSprout;
+    std::vector<SaplingCredit> vSapling;
+
+    WalletTxCredits() : fCreditsValid(false), fTallied(false), fCoinBase(false),
+        fFinal(false), fTrusted(false), nDepth(-1), nHeight(-1) {}
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -794,6 +847,50 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Incrementally maintained balance accumulators. Confirmed credit is
+     * added to the tallies (indexed by whether it is spendable) when a
+     * transaction is marked dirty by AddToWallet, by a spend, or by a block
+     * disconnect. Transactions whose contribution can change without a
+     * wallet notification (unconfirmed, or spent only by unconfirmed
+     * transactions) are kept in setBalanceVolatile and evaluated on demand.
+     */
+    mutable bool fBalanceCacheValid;
+    mutable std::map<uint256, WalletTxCredits> mapBalanceCredits;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalanceVolatile;
+    mutable std::map<int, std::set<uint256>> mapBalanceHeights;
+    mutable CBalanceTally<CTxDestination> tallyTransparent[2];
+    mutable CBalanceTally<CTxDestination> tallyCoinBase[2];
+    mutable CBalanceTally<libzcash::PaymentAddress> tallyShielded[2];
+
+    /**
+     * The unspent outputs and notes of tallied transactions, per address and
+     * ordered by value, so that coin and note selection only visits
+     * candidates. Volatile transactions are checked separately.
+     */
+    mutable std::map<CTxDestination, std::set<std::pair<CAmount, COutPoint>>> mapUnspentCoins;
+    mutable std::map<libzcash::PaymentAddress, std::multiset<std::pair<CAmount, uint256>>> mapUnspentNotes;
+
+    template <class T>
+    int GetSpendDepth(const TxSpendMap<T>& spends, const T& key) const;
+    void ComputeBalanceCredits(const CWalletTx& wtx, WalletTxCredits& credits) const;
+    bool EvaluateBalanceCredits(const CWalletTx& wtx, WalletTxCredits& credits) const;
+    void TallyBalanceCredits(const uint256& hash, const WalletTxCredits& credits, int nSign) const;
+    void RefreshBalanceCache() const;
+    void MarkBalanceDirty(const uint256& hash, bool fCredits = false);
+    void MarkBalanceDirtyFromHeight(int nHeight);
+    void ClearBalanceCache();
+    void AddFilteredNotesFromTx(const CWalletTx& wtx,
+                                std::vector<SproutNoteEntry>& sproutEntries,
+                                std::vector<SaplingNoteEntry>& saplingEntries,
+                                std::set<libzcash::PaymentAddress>& filterAddresses,
+                                int minDepth,
+                                int maxDepth,
+                                bool ignoreSpent,
+                                bool requireSpendingKey,
+                                bool ignoreLocked);
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -806,6 +903,20 @@ public:
     void ClearNoteWitnessCache();
 
 protected:
+    /**
+     * Transactions whose wallet.dat record is older than the in-memory copy:
+     * witness caches and nullifiers updated while connecting blocks, and
+     * block-confirmed transactions added with fDeferWrite. They are written
+     * together with the best block in one database transaction by
+     * SetBestChain(), so on-disk state stays consistent with the locator
+     * used for rescanning after a crash.
+     */
+    std::set<uint256> setDirtyWalletTx;
+
+    void MarkWalletTxDirty(const uint256& hash) {
+        setDirtyWalletTx.insert(hash);
+    }
+
     /**
      * pindex is the new tip being connected.
      */
@@ -826,18 +937,17 @@ protected:
             return;
         }
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
-                // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
-                // are empty. This covers transactions that have no Sprout or Sapling data
-                // (i.e. are purely transparent), as well as shielding and unshielding
-                // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
-                        LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
-                        walletdb.TxnAbort();
-                        return;
-                    }
+            // Only transactions which changed since the last write are
+            // rewritten; their witness caches are written along with them.
+            for (const uint256& hash : setDirtyWalletTx) {
+                auto it = mapWallet.find(hash);
+                if (it == mapWallet.end()) {
+                    continue;
+                }
+                if (!walletdb.WriteTx(hash, it->second)) {
+                    LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
+                    walletdb.TxnAbort();
+                    return;
                 }
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
@@ -862,6 +972,7 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        setDirtyWalletTx.clear();
     }
 
 private:
@@ -931,6 +1042,7 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fBalanceCacheValid = false;
     }
 
     /**
@@ -1009,6 +1121,11 @@ public:
      * populate vCoins with vector of available COutputs.
      */
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true) const;
+    /**
+     * populate vCoins with the available COutputs paying to dest, in
+     * ascending order of value.
+     */
+    void AvailableCoinsForDestination(std::vector<COutput>& vCoins, const CTxDestination& dest, bool fOnlyConfirmed=true, bool fIncludeZeroValue=false, bool fIncludeCoinBase=true) const;
 
     /**
      * Shuffle and select coins until nTargetValue is reached while avoiding
@@ -1163,9 +1280,19 @@ public:
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapForBlock(const CBlock* pblock);
-    bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
+    /**
+     * With fDeferWrite, a new or updated transaction is only marked dirty and
+     * written by the next SetBestChain(). Only use this for transactions
+     * which a rescan from the best block locator would find again.
+     */
+    bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb, bool fDeferWrite = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate);
+    /**
+     * fDeferWrite is passed on to AddToWallet. Only the tip connection path
+     * may set it: a rescan starts after the locator, so what it finds must
+     * be written straight away.
+     */
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, const int nHeight, bool fUpdate, bool fDeferWrite = false);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
@@ -1181,6 +1308,16 @@ public:
     CAmount GetWatchOnlyBalance() const;
     CAmount GetUnconfirmedWatchOnlyBalance() const;
     CAmount GetImmatureWatchOnlyBalance() const;
+    /**
+     * Balance of unspent, unlocked transparent outputs with at least minDepth
+     * confirmations, optionally restricted to one destination.
+     */
+    CAmount GetTransparentBalance(const CTxDestination* dest, int minDepth, bool ignoreUnspendable) const;
+    /**
+     * Balance of unspent, unlocked notes with between minDepth and maxDepth
+     * confirmations, optionally restricted to one payment address.
+     */
+    CAmount GetShieldedBalance(const libzcash::PaymentAddress* address, int minDepth, int maxDepth, bool ignoreUnspendable) const;
 
     /**
      * Insert additional inputs into the transaction by
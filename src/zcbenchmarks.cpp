@@ -535,7 +535,10 @@ double benchmark_connectblock_slow()
     indexPrev.phashBlock = &hashPrev;
     indexPrev.nHeight = index.nHeight - 1;
     index.pprev = &indexPrev;
-    mapBlockIndex.insert(std::make_pair(hashPrev, &indexPrev));
+    {
+        LOCK(cs_mapBlockIndex);
+        mapBlockIndex.insert(std::make_pair(hashPrev, &indexPrev));
+    }
 
     CValidationState state;
     struct timeval tv_start;
@@ -544,7 +547,10 @@ double benchmark_connectblock_slow()
     auto duration = timer_stop(tv_start);
 
     // Undo alterations to global state
-    mapBlockIndex.erase(hashPrev);
+    {
+        LOCK(cs_mapBlockIndex);
+        mapBlockIndex.erase(hashPrev);
+    }
     SelectParams(ChainNameFromCommandLine());
 
     return duration;
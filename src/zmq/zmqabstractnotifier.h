@@ -7,15 +7,28 @@
 
 #include "zmqconfig.h"
 
+#include <memory>
+
 class CBlockIndex;
+class CDataStream;
 class CZMQAbstractNotifier;
+enum class MemPoolRemovalReason;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
+/**
+ * A serialized block or transaction. It is made by the first notifier that
+ * needs it and shared by the others and the sender thread.
+ */
+typedef std::shared_ptr<const CDataStream> CZMQPayloadRef;
+
+/** Default for -zmqpub<topic>hwm: messages a topic may have waiting to be sent */
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+
 class CZMQAbstractNotifier
 {
 public:
-    CZMQAbstractNotifier() : psocket(0) { }
+    CZMQAbstractNotifier() : psocket(0), nHighWaterMark(DEFAULT_ZMQ_SNDHWM) { }
     virtual ~CZMQAbstractNotifier();
 
     template <typename T>
@@ -28,18 +41,30 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    int GetHighWaterMark() const { return nHighWaterMark; }
+    void SetHighWaterMark(int n) { nHighWaterMark = n; }
 
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
+    /** A new tip, published after the block was connected. */
     virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyBlock(const CBlock& pblock);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
+    /** A block that passed validation, with its serialized form if a notifier made it. */
+    virtual bool NotifyBlock(const CBlock& pblock, CZMQPayloadRef& payload);
+    virtual bool NotifyTransaction(const CTransaction &transaction, CZMQPayloadRef& payload);
+
+    /** A block connected to or disconnected from the active chain, in the order wallets see them. */
+    virtual bool NotifyBlockConnect(const CBlockIndex *pindex);
+    virtual bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+    /** A mempool addition or removal, with its mempool sequence number. */
+    virtual bool NotifyTransactionAcceptance(const uint256 &txid, uint64_t nMempoolSequence);
+    virtual bool NotifyTransactionRemoval(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
 
 protected:
     void *psocket;
     std::string type;
     std::string address;
+    int nHighWaterMark;
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
@@ -10,6 +10,10 @@
 #include "streams.h"
 #include "util.h"
 
+#include <algorithm>
+
+CZMQNotificationInterface* pzmqNotificationInterface = NULL;
+
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
@@ -40,6 +44,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+    factories["pubsequence"] = CZMQAbstractNotifier::Create<CZMQPublishSequenceNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -51,6 +56,9 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
             CZMQAbstractNotifier *notifier = factory();
             notifier->SetType(i->first);
             notifier->SetAddress(address);
+            std::map<std::string, std::string>::const_iterator hwm = args.find("-zmq" + i->first + "hwm");
+            if (hwm != args.end())
+                notifier->SetHighWaterMark(std::max(1, atoi(hwm->second)));
             notifiers.push_back(notifier);
         }
     }
@@ -104,6 +112,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    StartZMQSender();
     return true;
 }
 
@@ -113,6 +122,8 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        // Send what is still queued while the sockets are open
+        StopZMQSender();
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -125,12 +136,13 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+template <typename Function>
+void CZMQNotificationInterface::ForEachNotifier(Function func)
 {
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
+        if (func(notifier))
         {
             i++;
         }
@@ -142,40 +154,54 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
     }
 }
 
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    ForEachNotifier([pindex](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyBlock(pindex);
+    });
+}
+
 void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidationState& state)
 {
     if (state.IsInvalid()) {
         return;
     }
 
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(block))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    // Serialized at most once, by the first notifier that needs it
+    CZMQPayloadRef payload;
+    ForEachNotifier([&block, &payload](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyBlock(block, payload);
+    });
 }
 
 void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    CZMQPayloadRef payload;
+    ForEachNotifier([&tx, &payload](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransaction(tx, payload);
+    });
+}
+
+void CZMQNotificationInterface::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added)
+{
+    // ThreadNotifyWallets passes the old commitment trees for connected
+    // blocks only
+    bool fConnected = (bool)added;
+    ForEachNotifier([pindex, fConnected](CZMQAbstractNotifier *notifier) {
+        return fConnected ? notifier->NotifyBlockConnect(pindex) : notifier->NotifyBlockDisconnect(pindex);
+    });
+}
+
+void CZMQNotificationInterface::TransactionAddedToMempool(const uint256 &txid, uint64_t nMempoolSequence)
+{
+    ForEachNotifier([&txid, nMempoolSequence](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransactionAcceptance(txid, nMempoolSequence);
+    });
+}
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    ForEachNotifier([&txid, reason, nMempoolSequence](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransactionRemoval(txid, reason, nMempoolSequence);
+    });
 }
@@ -7,6 +7,7 @@
 
 #include "validationinterface.h"
 #include "consensus/validation.h"
+#include <list>
 #include <string>
 #include <map>
 
@@ -20,6 +21,8 @@ public:
 
     static CZMQNotificationInterface* CreateWithArguments(const std::map<std::string, std::string> &args);
 
+    const std::list<CZMQAbstractNotifier*>& GetNotifiers() const { return notifiers; }
+
 protected:
     bool Initialize();
     void Shutdown();
@@ -28,12 +31,21 @@ protected:
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight);
     void UpdatedBlockTip(const CBlockIndex *pindex);
     void BlockChecked(const CBlock& block, const CValidationState& state);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, boost::optional<std::pair<SproutMerkleTree, SaplingMerkleTree>> added);
+    void TransactionAddedToMempool(const uint256 &txid, uint64_t nMempoolSequence);
+    void TransactionRemovedFromMempool(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
 
 private:
     CZMQNotificationInterface();
 
+    /** Call func on every notifier, shutting down and dropping those for which it fails. */
+    template <typename Function>
+    void ForEachNotifier(Function func);
+
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
 };
 
+extern CZMQNotificationInterface* pzmqNotificationInterface;
+
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
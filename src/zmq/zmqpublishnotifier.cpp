@@ -5,15 +5,46 @@
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "streams.h"
+#include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
+#include <boost/thread.hpp>
+
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
+/** Blocks the raw block notifier keeps serialized until one becomes the tip */
+static const size_t MAX_ZMQ_RECENT_BLOCKS = 8;
+
+namespace {
+
+struct CZMQQueuedMessage
+{
+    CZMQAbstractPublishNotifier *notifier;
+    const char *command;
+    CZMQPayloadRef payload;
+    const CBlockIndex *pindex;
+    uint32_t nSequence;
+};
+
+// Messages of all publish notifiers, sent in order by ThreadZMQSender.
+// The lock also guards the notifiers' stats.
+boost::mutex cs_zmqQueue;
+boost::condition_variable zmqQueueCondition;
+std::deque<CZMQQueuedMessage> zmqQueue;
+bool fStopZMQSender = false;
+boost::thread zmqSenderThread;
+
+} // namespace
+
 static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_SEQUENCE  = "sequence";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -71,7 +102,17 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        LogPrint("zmq", "zmq: Outbound message high water mark for %s at %s is %d\n", type, address, nHighWaterMark);
+
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &nHighWaterMark, sizeof(nHighWaterMark));
+        if (rc != 0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -124,82 +165,245 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size, uint32_t nMsgSequence)
 {
     assert(psocket);
 
     /* send three parts, command & data & a LE 4byte sequence number */
     unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
+    WriteLE32(&msgseq[0], nMsgSequence);
     int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
     if (rc == -1)
         return false;
 
-    /* increment memory only sequence number after sending */
-    nSequence++;
-
     return true;
 }
 
+void CZMQAbstractPublishNotifier::QueueMessage(const char *command, const CZMQPayloadRef& payload, const CBlockIndex *pindex)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_zmqQueue);
+        uint32_t nMsgSequence = nSequence++;
+        if (stats.nQueued >= (size_t)nHighWaterMark) {
+            stats.nDropped++;
+            LogPrint("zmq", "zmq: Dropped %s message %u, %u already queued\n", command, nMsgSequence, stats.nQueued);
+            return;
+        }
+        CZMQQueuedMessage msg = {this, command, payload, pindex, nMsgSequence};
+        zmqQueue.push_back(msg);
+        stats.nQueued++;
+        stats.nPeakQueued = std::max(stats.nPeakQueued, stats.nQueued);
+    }
+    zmqQueueCondition.notify_one();
+}
+
+CZMQPublishStats CZMQAbstractPublishNotifier::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(cs_zmqQueue);
+    return stats;
+}
+
+static CZMQPayloadRef ReadRawBlock(const CBlockIndex *pindex)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = pindex->GetBlockPos();
+    }
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pos, Params().GetConsensus())) {
+        zmqError("Can't read block from disk");
+        return CZMQPayloadRef();
+    }
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    *ss << block;
+    return ss;
+}
+
+void ThreadZMQSender()
+{
+    RenameThread("vect-zmqsend");
+    while (true)
+    {
+        CZMQQueuedMessage msg;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_zmqQueue);
+            while (zmqQueue.empty() && !fStopZMQSender)
+                zmqQueueCondition.wait(lock);
+            if (zmqQueue.empty())
+                return;
+            msg = zmqQueue.front();
+            zmqQueue.pop_front();
+        }
+
+        CZMQPayloadRef payload = msg.payload;
+        if (!payload && msg.pindex)
+            payload = ReadRawBlock(msg.pindex);
+        bool fSent = payload && msg.notifier->SendMessage(msg.command, &(*payload->begin()), payload->size(), msg.nSequence);
+
+        boost::unique_lock<boost::mutex> lock(cs_zmqQueue);
+        msg.notifier->stats.nQueued--;
+        if (fSent)
+            msg.notifier->stats.nSent++;
+        else
+            msg.notifier->stats.nFailed++;
+    }
+}
+
+void StartZMQSender()
+{
+    fStopZMQSender = false;
+    zmqSenderThread = boost::thread(&ThreadZMQSender);
+}
+
+void StopZMQSender()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_zmqQueue);
+        fStopZMQSender = true;
+    }
+    zmqQueueCondition.notify_all();
+    if (zmqSenderThread.joinable())
+        zmqSenderThread.join();
+}
+
+static CZMQPayloadRef SerializeOnce(CZMQPayloadRef& payload, const CBlock& block)
+{
+    if (!payload) {
+        std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+        *ss << block;
+        payload = ss;
+    }
+    return payload;
+}
+
+static CZMQPayloadRef SerializeOnce(CZMQPayloadRef& payload, const CTransaction& tx)
+{
+    if (!payload) {
+        std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+        *ss << tx;
+        payload = ss;
+    }
+    return payload;
+}
+
+static CZMQPayloadRef HashPayload(const uint256& hash)
+{
+    // Hashes are published in the usual display byte order
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    ss->write((const char*)hash.begin(), hash.size());
+    std::reverse(ss->begin(), ss->end());
+    return ss;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
-    char data[32];
-    for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHBLOCK, data, 32);
+    QueueMessage(MSG_HASHBLOCK, HashPayload(hash));
+    return true;
 }
 
-bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction, CZMQPayloadRef& payload)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
-    char data[32];
-    for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHTX, data, 32);
+    QueueMessage(MSG_HASHTX, HashPayload(hash));
+    return true;
+}
+
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlock &block, CZMQPayloadRef& payload)
+{
+    // Only the tip is published, and none at all during initial block
+    // download, so there is no point serializing the block then.
+    if (IsInitialBlockDownload(Params()))
+        return true;
+
+    LOCK(cs_recentBlocks);
+    recentBlocks.push_back(std::make_pair(block.GetHash(), SerializeOnce(payload, block)));
+    if (recentBlocks.size() > MAX_ZMQ_RECENT_BLOCKS)
+        recentBlocks.pop_front();
+    return true;
 }
 
 bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
-    LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish rawblock %s\n", hash.GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    // Use the block serialized when it was connected, if we still have it;
+    // otherwise the sender thread reads it from disk.
+    CZMQPayloadRef payload;
     {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
+        LOCK(cs_recentBlocks);
+        for (size_t i = 0; i < recentBlocks.size(); i++) {
+            if (recentBlocks[i].first == hash) {
+                payload = recentBlocks[i].second;
+                recentBlocks.erase(recentBlocks.begin(), recentBlocks.begin() + i + 1);
+                break;
+            }
         }
-
-        ss << block;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    QueueMessage(MSG_RAWBLOCK, payload, pindex);
+    return true;
 }
 
-bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
+bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block, CZMQPayloadRef& payload)
 {
     LogPrint("zmq", "zmq: Publish checkedblock %s\n", block.GetHash().GetHex());
-
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        ss << block;
-    }
-
-    return SendMessage(MSG_CHECKEDBLOCK, &(*ss.begin()), ss.size());
+    QueueMessage(MSG_CHECKEDBLOCK, SerializeOnce(payload, block));
+    return true;
 }
 
-bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction, CZMQPayloadRef& payload)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    QueueMessage(MSG_RAWTX, SerializeOnce(payload, transaction));
+    return true;
+}
+
+// <32-byte hash> <label> [<8-byte LE mempool sequence> [<1-byte removal reason>]]
+static CZMQPayloadRef SequencePayload(const uint256& hash, char label, const uint64_t *pnMempoolSequence = NULL, const MemPoolRemovalReason *preason = NULL)
+{
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    ss->write((const char*)hash.begin(), hash.size());
+    std::reverse(ss->begin(), ss->end());
+    *ss << label;
+    if (pnMempoolSequence)
+        *ss << *pnMempoolSequence;
+    if (preason)
+        *ss << (uint8_t)*preason;
+    return ss;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish sequence block connect %s\n", hash.GetHex());
+    QueueMessage(MSG_SEQUENCE, SequencePayload(hash, 'C'));
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockDisconnect(const CBlockIndex *pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish sequence block disconnect %s\n", hash.GetHex());
+    QueueMessage(MSG_SEQUENCE, SequencePayload(hash, 'D'));
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionAcceptance(const uint256 &txid, uint64_t nMempoolSequence)
+{
+    LogPrint("zmq", "zmq: Publish sequence mempool acceptance %s, mempool sequence %d\n", txid.GetHex(), nMempoolSequence);
+    QueueMessage(MSG_SEQUENCE, SequencePayload(txid, 'A', &nMempoolSequence));
+    return true;
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence)
+{
+    LogPrint("zmq", "zmq: Publish sequence mempool removal %s, mempool sequence %d\n", txid.GetHex(), nMempoolSequence);
+    QueueMessage(MSG_SEQUENCE, SequencePayload(txid, 'R', &nMempoolSequence, &reason));
+    return true;
 }
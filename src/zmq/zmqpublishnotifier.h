@@ -6,15 +6,36 @@
 #define BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
 
 #include "zmqabstractnotifier.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <utility>
 
 class CBlockIndex;
 
+/** Counters of one publish notifier, as reported by getzmqnotifications */
+struct CZMQPublishStats
+{
+    size_t nQueued;     //!< messages waiting for the sender thread
+    size_t nPeakQueued; //!< most messages ever waiting at once
+    uint64_t nSent;
+    uint64_t nDropped;  //!< messages not queued because nQueued was at the high-water mark
+    uint64_t nFailed;   //!< messages zmq failed to send, or blocks that could not be read
+
+    CZMQPublishStats() : nQueued(0), nPeakQueued(0), nSent(0), nDropped(0), nFailed(0) {}
+};
+
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; //! upcounting per message sequence number
+    CZMQPublishStats stats;
+
+    friend void ThreadZMQSender();
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0) {}
 
     /* send zmq multipart message
        parts:
@@ -22,12 +43,28 @@ public:
           * data
           * message sequence number
     */
-    bool SendMessage(const char *command, const void* data, size_t size);
+    bool SendMessage(const char *command, const void* data, size_t size, uint32_t nMsgSequence);
+
+    /**
+     * Queue a message for the sender thread. Without a payload, pindex is
+     * read from disk there. The sequence number is taken even if the
+     * message is dropped, so subscribers see the gap.
+     */
+    void QueueMessage(const char *command, const CZMQPayloadRef& payload, const CBlockIndex *pindex = NULL);
+
+    CZMQPublishStats GetStats() const;
 
     bool Initialize(void *pcontext);
     void Shutdown();
 };
 
+/**
+ * Start and stop the thread that sends the queued messages of all publish
+ * notifiers. Stopping sends what is still queued first.
+ */
+void StartZMQSender();
+void StopZMQSender();
+
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
@@ -37,25 +74,45 @@ public:
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, CZMQPayloadRef& payload);
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
+private:
+    //! Blocks serialized as they were connected, until they are published as the tip
+    std::deque<std::pair<uint256, CZMQPayloadRef> > recentBlocks;
+    CCriticalSection cs_recentBlocks;
+
 public:
     bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlock &block, CZMQPayloadRef& payload);
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, CZMQPayloadRef& payload);
 };
 
 class CZMQPublishCheckedBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlock &block);
+    bool NotifyBlock(const CBlock &block, CZMQPayloadRef& payload);
+};
+
+/**
+ * Block connects and disconnects and mempool additions and removals on a
+ * single topic, so that a subscriber can mirror the mempool: the mempool
+ * sequence number of each mempool event lines it up with getrawmempool.
+ */
+class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const CBlockIndex *pindex);
+    bool NotifyBlockDisconnect(const CBlockIndex *pindex);
+    bool NotifyTransactionAcceptance(const uint256 &txid, uint64_t nMempoolSequence);
+    bool NotifyTransactionRemoval(const uint256 &txid, MemPoolRemovalReason reason, uint64_t nMempoolSequence);
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
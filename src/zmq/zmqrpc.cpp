@@ -0,0 +1,73 @@
+// Copyright (c) 2020 The Vectorium developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "zmq/zmqrpc.h"
+
+#include "rpc/server.h"
+#include "utilstrencodings.h"
+#include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqpublishnotifier.h"
+
+#include <univalue.h>
+
+UniValue getzmqnotifications(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getzmqnotifications\n"
+            "\nReturns information about the active ZeroMQ notifications.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"type\": \"pubhashtx\",   (string) Type of notification\n"
+            "    \"address\": \"...\",      (string) Address of the publisher\n"
+            "    \"hwm\": n,                (numeric) Most messages that may wait to be sent, in the queue and in the socket\n"
+            "    \"queued\": n,             (numeric) Messages waiting for the sender thread\n"
+            "    \"peakqueued\": n,         (numeric) Most messages that were ever waiting at once\n"
+            "    \"sent\": n,               (numeric) Messages sent\n"
+            "    \"dropped\": n,            (numeric) Messages dropped because the queue was at the high-water mark\n"
+            "    \"failed\": n              (numeric) Messages that could not be sent\n"
+            "  },\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getzmqnotifications", "")
+            + HelpExampleRpc("getzmqnotifications", "")
+        );
+
+    UniValue result(UniValue::VARR);
+    if (pzmqNotificationInterface != NULL) {
+        const std::list<CZMQAbstractNotifier*>& notifiers = pzmqNotificationInterface->GetNotifiers();
+        for (std::list<CZMQAbstractNotifier*>::const_iterator it = notifiers.begin(); it != notifiers.end(); ++it) {
+            const CZMQAbstractNotifier* notifier = *it;
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("type", notifier->GetType());
+            obj.pushKV("address", notifier->GetAddress());
+            obj.pushKV("hwm", notifier->GetHighWaterMark());
+            const CZMQAbstractPublishNotifier* publisher = dynamic_cast<const CZMQAbstractPublishNotifier*>(notifier);
+            if (publisher != NULL) {
+                CZMQPublishStats stats = publisher->GetStats();
+                obj.pushKV("queued", (uint64_t)stats.nQueued);
+                obj.pushKV("peakqueued", (uint64_t)stats.nPeakQueued);
+                obj.pushKV("sent", stats.nSent);
+                obj.pushKV("dropped", stats.nDropped);
+                obj.pushKV("failed", stats.nFailed);
+            }
+            result.push_back(obj);
+        }
+    }
+    return result;
+}
+
+static const CRPCCommand commands[] =
+{ //  category              name                      actor (function)         okSafeMode readOnly
+  //  --------------------- ------------------------  -----------------------  ---------- --------
+    { "zmq",                "getzmqnotifications",    &getzmqnotifications,    true,      true  },
+};
+
+void RegisterZMQRPCCommands(CRPCTable &tableRPC)
+{
+    for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
+        tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+}